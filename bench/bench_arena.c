@@ -0,0 +1,179 @@
+/*
+ * AST arena benchmark.
+ * Parses a source file with every node taken from malloc and freed with
+ * ast_destroy, then with every node taken from an arena and released
+ * with one reset, and reports the best time of each and how many
+ * allocator calls the tree cost.
+ *
+ * Usage: bench_arena <source_file> [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parser.h"
+#include "arena.h"
+
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t count_list(const NodeList *list);
+
+/*
+ * Blocks a malloc-built tree holds: one per node, plus each list with a
+ * heap array of its own. Reallocs while the lists grew are not counted.
+ */
+static size_t count_blocks(const ASTNode *node) {
+    if (!node) {
+        return 0;
+    }
+    size_t blocks = 1;
+    switch (node->type) {
+        case NODE_PROGRAM:
+            blocks += count_list(&node->data.program.statements);
+            break;
+        case NODE_BINARY_OP:
+            blocks += count_blocks(node->data.binary_op.left) + count_blocks(node->data.binary_op.right);
+            break;
+        case NODE_UNARY_OP:
+            blocks += count_blocks(node->data.unary_op.operand);
+            break;
+        case NODE_CALL:
+            blocks += count_blocks(node->data.call.function) + count_list(&node->data.call.arguments);
+            break;
+        case NODE_IF:
+            blocks += count_blocks(node->data.if_stmt.condition) + count_list(&node->data.if_stmt.then_branch) +
+                      count_list(&node->data.if_stmt.else_branch);
+            break;
+        case NODE_WHILE:
+            blocks += count_blocks(node->data.while_stmt.condition) + count_list(&node->data.while_stmt.body);
+            break;
+        case NODE_FUNCTION_DEF:
+            blocks += (node->data.function_def.parameters.capacity > 0) +
+                      count_list(&node->data.function_def.body);
+            break;
+        case NODE_RETURN:
+            blocks += count_blocks(node->data.return_stmt.value);
+            break;
+        case NODE_VAR_DECL:
+            blocks += count_blocks(node->data.var_decl.initializer);
+            break;
+        case NODE_BLOCK:
+            blocks += count_list(&node->data.block.statements);
+            break;
+        case NODE_EXPRESSION_STMT:
+            blocks += count_blocks(node->data.expr_stmt.expression);
+            break;
+        default:
+            break;
+    }
+    return blocks;
+}
+
+static size_t count_list(const NodeList *list) {
+    size_t blocks = list->capacity > 0;
+    for (uint32_t i = 0; i < list->count; i++) {
+        blocks += count_blocks(list->items[i]);
+    }
+    return blocks;
+}
+
+/* Best lex, parse and free time of `iterations` runs, in seconds; *mallocs gets what the tree cost */
+static double time_parse(const char *source, int iterations, Arena *arena, size_t *mallocs) {
+    double best = 0.0;
+    for (int it = 0; it < iterations; it++) {
+        size_t chunks = arena ? arena->chunk_count : 0;
+        double start = now_seconds();
+        ast_use_arena(arena);
+        Lexer *lexer = lexer_create(source);
+        Parser *parser = parser_create(lexer);
+        ASTNode *ast = parser_parse(parser);
+        if (!ast) {
+            fprintf(stderr, "Error: Parse failed\n");
+            exit(1);
+        }
+        parser_destroy(parser);
+        lexer_destroy(lexer);
+        double elapsed = now_seconds() - start;
+
+        /* Counted outside the timed part */
+        *mallocs = arena ? arena->chunk_count - chunks : count_blocks(ast);
+
+        start = now_seconds();
+        if (arena) {
+            arena_reset(arena);
+            ast_use_arena(NULL);
+        } else {
+            ast_destroy(ast);
+        }
+        elapsed += now_seconds() - start;
+
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    char *source = read_file(argv[1]);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+    int iterations = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 5;
+
+    size_t malloc_blocks = 0;
+    double malloc_time = time_parse(source, iterations, NULL, &malloc_blocks);
+
+    Arena *arena = arena_create(0);
+    if (!arena) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    size_t arena_chunks = 0;
+    double arena_time = time_parse(source, iterations, arena, &arena_chunks);
+    size_t arena_blocks = arena->allocations / (size_t)iterations;
+
+    printf("arena: malloc tree  best %8.3f ms (parse + ast_destroy), %zu mallocs\n",
+           malloc_time * 1e3, malloc_blocks);
+    printf("arena: arena tree   best %8.3f ms (parse + arena_reset), %zu mallocs for %zu blocks\n",
+           arena_time * 1e3, arena_chunks, arena_blocks);
+    printf("arena: %.2fx faster, %.0fx fewer allocator calls\n",
+           malloc_time / arena_time, (double)malloc_blocks / (arena_chunks > 0 ? arena_chunks : 1));
+
+    arena_destroy(arena);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * AST cache benchmark.
+ * Compiles the front end of a source file the two ways `miru --cache`
+ * can: cold, lexing and parsing the file into an arena tree, and warm,
+ * hashing the file, mapping its cache entry and rebuilding the arena
+ * tree from it. Reports the best time of each, how long the warm path
+ * spends before the mapped tree is usable, and what a miss costs on top
+ * of the parse to write the entry. The atom table is cleared before every
+ * run, as in a fresh compiler process; the cache file is in the page
+ * cache after the first run.
+ *
+ * Usage: bench_ast_cache <source_file> [cache_dir] [iterations]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "parser.h"
+#include "arena.h"
+#include "ast_cache.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ASTNode *parse_fd(int fd) {
+    lseek(fd, 0, SEEK_SET);
+    Lexer *lexer = lexer_create_fd(fd, LEXER_DEFAULT_CHUNK_SIZE);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    if (!ast) {
+        fprintf(stderr, "Error: Parse failed\n");
+        exit(1);
+    }
+    return ast;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [cache_dir] [iterations]\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argc > 2 ? argv[2] : "bench/bin/ast_cache";
+    int iterations = argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 5;
+
+    int fd = open(argv[1], O_RDONLY);
+    Arena *arena = arena_create(0);
+    if (fd < 0 || !arena) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+
+    double cold = 0.0, store = 0.0, mapped = 0.0, warm = 0.0;
+    AstCacheKey key;
+    for (int it = 0; it < iterations; it++) {
+        /* Cold: parse, then what a miss adds to write the entry */
+        atom_table_clear();
+        ast_use_arena(arena);
+        double start = now_seconds();
+        ASTNode *ast = parse_fd(fd);
+        double elapsed = now_seconds() - start;
+        cold = it == 0 || elapsed < cold ? elapsed : cold;
+
+        start = now_seconds();
+        CompactAst *compact = compact_ast_build(ast);
+        if (!ast_cache_key(fd, &key) || !ast_cache_store(dir, &key, compact)) {
+            fprintf(stderr, "Error: Cannot write AST cache in %s\n", dir);
+            return 1;
+        }
+        elapsed = now_seconds() - start;
+        store = it == 0 || elapsed < store ? elapsed : store;
+        compact_ast_destroy(compact);
+        arena_reset(arena);
+
+        /* Warm: hash, map, rebuild */
+        atom_table_clear();
+        start = now_seconds();
+        MappedAst *hit = ast_cache_key(fd, &key) ? ast_cache_load(dir, &key) : NULL;
+        if (!hit) {
+            fprintf(stderr, "Error: Cache miss\n");
+            return 1;
+        }
+        double usable = now_seconds() - start;
+        ast = compact_ast_expand(&hit->ast);
+        ast_cache_unmap(hit);
+        elapsed = now_seconds() - start;
+        if (!ast) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        mapped = it == 0 || usable < mapped ? usable : mapped;
+        warm = it == 0 || elapsed < warm ? elapsed : warm;
+        arena_reset(arena);
+        ast_use_arena(NULL);
+    }
+
+    printf("ast cache: cold parse            best %8.3f ms\n", cold * 1e3);
+    printf("ast cache: miss, lower + write   best %8.3f ms (on top of the parse)\n", store * 1e3);
+    printf("ast cache: warm, hash + map      best %8.3f ms (compact tree usable)\n", mapped * 1e3);
+    printf("ast cache: warm, + pointer tree  best %8.3f ms\n", warm * 1e3);
+    printf("ast cache: warm is %.2fx faster than cold\n", cold / warm);
+
+    arena_destroy(arena);
+    atom_table_clear();
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Compact AST benchmark.
+ * Parses a source file into the pointer AST (once with malloc, once in an
+ * arena), lowers it into a CompactAst, and reports the bytes each form
+ * takes per node and the best time of a full traversal of each: a
+ * pre-order walk with an explicit stack over both forms, and a linear
+ * pass over the compact arrays, which is what a pass that looks at every
+ * node in any order can do instead.
+ *
+ * Every traversal computes the same checksum over node kinds and integer
+ * values, so they are known to visit the same nodes.
+ *
+ * Usage: bench_compact_ast <source_file> [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parser.h"
+#include "arena.h"
+#include "ast_compact.h"
+
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ASTNode *parse(const char *source) {
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    if (!ast) {
+        fprintf(stderr, "Error: Parse failed\n");
+        exit(1);
+    }
+    return ast;
+}
+
+/* Work stack shared by the walks; sized for the deepest tree seen so far */
+static void **stack;
+static size_t stack_capacity;
+
+static void push(size_t *count, void *item) {
+    if (*count == stack_capacity) {
+        stack_capacity = stack_capacity ? stack_capacity * 2 : 1024;
+        stack = realloc(stack, stack_capacity * sizeof(void *));
+        if (!stack) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    stack[(*count)++] = item;
+}
+
+static void push_list(size_t *count, const NodeList *list) {
+    for (size_t i = list->count; i > 0; i--) {
+        push(count, list->items[i - 1]);
+    }
+}
+
+static unsigned long visit(unsigned long sum, NodeType kind, long value) {
+    return sum * 31 + (unsigned long)kind + (unsigned long)value;
+}
+
+static unsigned long walk_pointer(const ASTNode *root, size_t *nodes) {
+    unsigned long sum = 0;
+    size_t count = 0;
+    *nodes = 0;
+    push(&count, (void *)root);
+    while (count > 0) {
+        const ASTNode *node = stack[--count];
+        if (!node) {
+            continue;
+        }
+        (*nodes)++;
+        sum = visit(sum, node->type, node->type == NODE_INT_LITERAL ? node->data.int_literal.value : 0);
+        switch (node->type) {
+            case NODE_PROGRAM:
+                push_list(&count, &node->data.program.statements);
+                break;
+            case NODE_BINARY_OP:
+                push(&count, node->data.binary_op.right);
+                push(&count, node->data.binary_op.left);
+                break;
+            case NODE_UNARY_OP:
+                push(&count, node->data.unary_op.operand);
+                break;
+            case NODE_CALL:
+                push_list(&count, &node->data.call.arguments);
+                push(&count, node->data.call.function);
+                break;
+            case NODE_IF:
+                push_list(&count, &node->data.if_stmt.else_branch);
+                push_list(&count, &node->data.if_stmt.then_branch);
+                push(&count, node->data.if_stmt.condition);
+                break;
+            case NODE_WHILE:
+                push_list(&count, &node->data.while_stmt.body);
+                push(&count, node->data.while_stmt.condition);
+                break;
+            case NODE_FUNCTION_DEF:
+                push_list(&count, &node->data.function_def.body);
+                break;
+            case NODE_RETURN:
+                push(&count, node->data.return_stmt.value);
+                break;
+            case NODE_VAR_DECL:
+                push(&count, node->data.var_decl.initializer);
+                break;
+            case NODE_BLOCK:
+                push_list(&count, &node->data.block.statements);
+                break;
+            case NODE_EXPRESSION_STMT:
+                push(&count, node->data.expr_stmt.expression);
+                break;
+            default:
+                break;
+        }
+    }
+    return sum;
+}
+
+static void push_refs(size_t *count, CompactList list) {
+    for (size_t i = list.count; i > 0; i--) {
+        push(count, (void *)(uintptr_t)list.items[i - 1]);
+    }
+}
+
+static unsigned long walk_compact(const CompactAst *ast) {
+    unsigned long sum = 0;
+    size_t count = 0;
+    push(&count, (void *)(uintptr_t)ast->root);
+    while (count > 0) {
+        NodeRef node = (NodeRef)(uintptr_t)stack[--count];
+        if (node == NODE_REF_NONE) {
+            continue;
+        }
+        NodeType kind = (NodeType)ast->kinds[node];
+        const CompactData *data = &ast->data[node];
+        sum = visit(sum, kind, kind == NODE_INT_LITERAL ? compact_ast_int(ast, node) : 0);
+        switch (kind) {
+            case NODE_PROGRAM:
+            case NODE_BLOCK:
+                push_refs(&count, compact_ast_list(ast, data->a));
+                break;
+            case NODE_BINARY_OP:
+                push(&count, (void *)(uintptr_t)data->b);
+                push(&count, (void *)(uintptr_t)data->a);
+                break;
+            case NODE_UNARY_OP:
+            case NODE_RETURN:
+            case NODE_EXPRESSION_STMT:
+                push(&count, (void *)(uintptr_t)data->a);
+                break;
+            case NODE_CALL:
+            case NODE_WHILE:
+                push_refs(&count, compact_ast_list(ast, data->b));
+                push(&count, (void *)(uintptr_t)data->a);
+                break;
+            case NODE_IF: {
+                CompactList then_branch = compact_ast_list(ast, data->b);
+                push_refs(&count, compact_ast_list(ast, then_branch.end));
+                push_refs(&count, then_branch);
+                push(&count, (void *)(uintptr_t)data->a);
+                break;
+            }
+            case NODE_FUNCTION_DEF:
+                push_refs(&count, compact_ast_list(ast, compact_ast_list(ast, data->b).end));
+                break;
+            case NODE_VAR_DECL:
+                push(&count, (void *)(uintptr_t)data->b);
+                break;
+            default:
+                break;
+        }
+    }
+    return sum;
+}
+
+/* Nodes are numbered in pre-order, so visiting them in index order is the same walk */
+static unsigned long scan_compact(const CompactAst *ast) {
+    unsigned long sum = 0;
+    for (size_t node = 1; node < ast->count; node++) {
+        NodeType kind = (NodeType)ast->kinds[node];
+        sum = visit(sum, kind, kind == NODE_INT_LITERAL ? compact_ast_int(ast, (NodeRef)node) : 0);
+    }
+    return sum;
+}
+
+typedef enum { WALK_POINTER, WALK_COMPACT, SCAN_COMPACT } Traversal;
+
+static double time_traversal(Traversal traversal, const ASTNode *root, const CompactAst *ast,
+                             int iterations, unsigned long *sum) {
+    double best = 0.0;
+    size_t nodes;
+    for (int it = 0; it < iterations; it++) {
+        double start = now_seconds();
+        switch (traversal) {
+            case WALK_POINTER: *sum = walk_pointer(root, &nodes); break;
+            case WALK_COMPACT: *sum = walk_compact(ast); break;
+            case SCAN_COMPACT: *sum = scan_compact(ast); break;
+        }
+        double elapsed = now_seconds() - start;
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    char *source = read_file(argv[1]);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+    int iterations = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 5;
+
+    ASTNode *heap_tree = parse(source);
+    Arena *arena = arena_create(0);
+    ast_use_arena(arena);
+    ASTNode *arena_tree = parse(source);
+    ast_use_arena(NULL);
+
+    double start = now_seconds();
+    CompactAst *ast = compact_ast_build(heap_tree);
+    double build = now_seconds() - start;
+    if (!ast) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    size_t nodes = 0;
+    walk_pointer(heap_tree, &nodes);
+    size_t compact_bytes = ast->count * (sizeof(uint8_t) * 2 + sizeof(uint32_t) + sizeof(CompactData)) +
+                           ast->extra_count * sizeof(uint32_t) + ast->string_length;
+    printf("compact ast: %zu nodes, lowered in %.3f ms\n", nodes, build * 1e3);
+    printf("compact ast: pointer %.1f bytes/node (%zu-byte node + lists, in an arena; malloc adds its headers),"
+           " compact %.1f bytes/node\n",
+           (double)arena->bytes_used / nodes, sizeof(ASTNode), (double)compact_bytes / nodes);
+
+    unsigned long sums[4];
+    double heap_walk = time_traversal(WALK_POINTER, heap_tree, ast, iterations, &sums[0]);
+    double arena_walk = time_traversal(WALK_POINTER, arena_tree, ast, iterations, &sums[1]);
+    double compact_walk = time_traversal(WALK_COMPACT, NULL, ast, iterations, &sums[2]);
+    double compact_scan = time_traversal(SCAN_COMPACT, NULL, ast, iterations, &sums[3]);
+    if (sums[0] != sums[1] || sums[0] != sums[2] || sums[0] != sums[3]) {
+        fprintf(stderr, "Error: Traversals disagree\n");
+        return 1;
+    }
+    printf("compact ast: walk pointer (malloc)  best %8.3f ms  %5.2f ns/node\n",
+           heap_walk * 1e3, heap_walk / nodes * 1e9);
+    printf("compact ast: walk pointer (arena)   best %8.3f ms  %5.2f ns/node\n",
+           arena_walk * 1e3, arena_walk / nodes * 1e9);
+    printf("compact ast: walk compact           best %8.3f ms  %5.2f ns/node\n",
+           compact_walk * 1e3, compact_walk / nodes * 1e9);
+    printf("compact ast: scan compact           best %8.3f ms  %5.2f ns/node\n",
+           compact_scan * 1e3, compact_scan / nodes * 1e9);
+
+    compact_ast_destroy(ast);
+    ast_destroy(heap_tree);
+    arena_destroy(arena);
+    free(stack);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Incremental re-parse benchmark.
+ * Parses a source file once, then edits integer literals inside function
+ * bodies spread over the file (inserting a digit and removing it again)
+ * and compares the time per edit with a full lex and parse.
+ *
+ * Usage: bench_incremental <source_file> [edits]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "incremental.h"
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+        *size = (size_t)file_size;
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Offset of the first digit after `from` that follows a space, or size if none */
+static size_t find_literal(const char *text, size_t size, size_t from) {
+    for (size_t i = from; i + 1 < size; i++) {
+        if (text[i] == ' ' && text[i + 1] >= '1' && text[i + 1] <= '9') {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [edits]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = 0;
+    char *text = read_file(argv[1], &size);
+    if (!text) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+
+    int edits = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 200;
+
+    double start = now_seconds();
+    ParsedSource *source = parsed_source_create(text, size);
+    double full = now_seconds() - start;
+    if (!source || !source->program) {
+        fprintf(stderr, "Error: Parse failed\n");
+        return 1;
+    }
+
+    double total = 0.0;
+    double worst = 0.0;
+    size_t relexed = 0;
+    size_t reparsed = 0;
+    int done = 0;
+    for (int i = 0; i < edits; i++) {
+        size_t at = find_literal(source->text, source->length, (size_t)((double)source->length * i / edits));
+        if (at >= source->length) {
+            continue;
+        }
+
+        for (int pass = 0; pass < 2; pass++) {
+            start = now_seconds();
+            ASTNode *program = pass == 0 ? parsed_source_edit(source, at, 0, "1", 1)
+                                         : parsed_source_edit(source, at, 1, NULL, 0);
+            double elapsed = now_seconds() - start;
+            if (!program) {
+                fprintf(stderr, "Error: Edit at %zu did not parse\n", at);
+                return 1;
+            }
+            total += elapsed;
+            worst = elapsed > worst ? elapsed : worst;
+            relexed += source->relexed_tokens;
+            reparsed += source->reparsed_statements;
+            done++;
+        }
+    }
+
+    printf("incremental: %zu bytes, %zu tokens, full parse %.3f ms\n",
+           size, source->tokens->count, full * 1e3);
+    printf("incremental: %d edits, mean %.3f ms, worst %.3f ms, %.1f tokens relexed, "
+           "%.1f statements reparsed per edit\n",
+           done, total / done * 1e3, worst * 1e3, (double)relexed / done, (double)reparsed / done);
+
+    parsed_source_destroy(source);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Parallel lexer scaling benchmark.
+ * Tokenizes a source file with lexer_tokenize_all() and then with
+ * lexer_tokenize_parallel() on 1 to N threads, reporting the best time
+ * and the speedup over the sequential lexer for each thread count.
+ *
+ * Usage: bench_lex_scaling <source_file> [max_threads] [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lexer.h"
+#include "lexer_parallel.h"
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+        *size = (size_t)file_size;
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best time of `iterations` runs; threads == 0 means the sequential lexer */
+static double time_tokenize(const char *source, size_t size, unsigned threads, int iterations,
+                            size_t *tokens) {
+    double best = 0.0;
+    for (int it = 0; it < iterations; it++) {
+        double start = now_seconds();
+        TokenBuffer *buffer;
+        if (threads == 0) {
+            Lexer *lexer = lexer_create_slice(source, 0, size);
+            buffer = lexer_tokenize_all(lexer);
+            lexer_destroy(lexer);
+        } else {
+            buffer = lexer_tokenize_parallel(source, size, threads);
+        }
+        double elapsed = now_seconds() - start;
+
+        if (!buffer) {
+            fprintf(stderr, "Error: Tokenizing failed\n");
+            exit(1);
+        }
+        *tokens = buffer->count;
+        token_buffer_destroy(buffer);
+
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [max_threads] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = 0;
+    char *source = read_file(argv[1], &size);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+
+    int max_threads = argc > 2 ? atoi(argv[2]) : 4;
+    int iterations = argc > 3 ? atoi(argv[3]) : 3;
+    size_t tokens = 0;
+
+    double sequential = time_tokenize(source, size, 0, iterations, &tokens);
+    printf("lex scaling: %zu bytes, %zu tokens\n", size, tokens);
+    printf("  sequential  best %9.3f ms  %7.1f MB/s\n", sequential * 1e3, size / sequential / 1e6);
+
+    for (int threads = 1; threads <= max_threads; threads++) {
+        double best = time_tokenize(source, size, (unsigned)threads, iterations, &tokens);
+        printf("  %2d threads  best %9.3f ms  %7.1f MB/s  %.2fx\n",
+               threads, best * 1e3, size / best / 1e6, sequential / best);
+    }
+
+    free(source);
+    return 0;
+}
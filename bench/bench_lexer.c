@@ -0,0 +1,100 @@
+/*
+ * Lexer throughput benchmark.
+ * Tokenizes a source file several times and reports tokens per second.
+ * Lexer creation, which validates the input as UTF-8, is timed with it;
+ * the validator's own throughput is reported separately.
+ *
+ * Usage: bench_lexer <source_file> [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lexer.h"
+#include "scan.h"
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+        *size = (size_t)file_size;
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = 0;
+    char *source = read_file(argv[1], &size);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    double best = 0.0;
+    size_t tokens = 0;
+
+    double best_validate = 0.0;
+    size_t valid = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        double start = now_seconds();
+        valid = scan_utf8(source, 0, size);
+        double elapsed = now_seconds() - start;
+        if (it == 0 || elapsed < best_validate) {
+            best_validate = elapsed;
+        }
+    }
+
+    for (int it = 0; it < iterations; it++) {
+        size_t count = 0;
+        double start = now_seconds();
+        Lexer *lexer = lexer_create(source);
+        Token token;
+        do {
+            token = lexer_next_token(lexer);
+            count++;
+        } while (token.kind != TOKEN_EOF);
+        double elapsed = now_seconds() - start;
+        lexer_destroy(lexer);
+
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        tokens = count;
+    }
+
+    printf("lexer: %zu bytes, %zu tokens, best %.3f ms, %.1f Mtokens/s, %.1f MB/s\n",
+           size, tokens, best * 1e3, tokens / best / 1e6, size / best / 1e6);
+    printf("utf8: %zu of %zu bytes valid, best %.3f ms, %.1f MB/s\n",
+           valid, size, best_validate * 1e3, size / best_validate / 1e6);
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Child list scaling benchmark.
+ * Generates programs of growing size in memory, each in two shapes: that
+ * many top-level statements, and a single function whose body holds that
+ * many statements. Parse time per statement should stay flat as the size
+ * doubles; a list that grew by one slot at a time would show it rising.
+ *
+ * Usage: bench_list_scaling [max_statements] [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parser.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* `count` short statements, optionally wrapped in one function */
+static char *generate(long count, int in_function) {
+    size_t capacity = (size_t)count * 40 + 64;
+    char *source = malloc(capacity);
+    if (!source) {
+        return NULL;
+    }
+    size_t length = 0;
+    if (in_function) {
+        length += (size_t)sprintf(source + length, "func body(a) {\n");
+    }
+    for (long i = 0; i < count; i++) {
+        length += (size_t)sprintf(source + length, "    x = f(a, %ld, x + %ld);\n", i, i % 7);
+    }
+    if (in_function) {
+        length += (size_t)sprintf(source + length, "}\n");
+    }
+    return source;
+}
+
+/* Best lex-and-parse time of `iterations` runs, in seconds */
+static double time_parse(const char *source, int iterations) {
+    double best = 0.0;
+    for (int it = 0; it < iterations; it++) {
+        double start = now_seconds();
+        Lexer *lexer = lexer_create(source);
+        Parser *parser = parser_create(lexer);
+        ASTNode *ast = parser_parse(parser);
+        double elapsed = now_seconds() - start;
+
+        if (!ast) {
+            fprintf(stderr, "Error: Parse failed\n");
+            exit(1);
+        }
+        ast_destroy(ast);
+        parser_destroy(parser);
+        lexer_destroy(lexer);
+
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    long max_statements = argc > 1 && atol(argv[1]) > 0 ? atol(argv[1]) : 1000000;
+    int iterations = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 3;
+
+    static const char *shapes[] = { "top level", "one body" };
+    for (int shape = 0; shape < 2; shape++) {
+        long count = max_statements / 8 > 0 ? max_statements / 8 : 1;
+        for (; count <= max_statements; count *= 2) {
+            char *source = generate(count, shape);
+            if (!source) {
+                fprintf(stderr, "Error: Out of memory\n");
+                return 1;
+            }
+            double best = time_parse(source, iterations);
+            printf("list scaling: %-9s %8ld statements  %9.3f ms  %6.1f ns/statement\n",
+                   shapes[shape], count, best * 1e3, best / count * 1e9);
+            free(source);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Parallel parser scaling benchmark.
+ * Lexes a source file once, then parses the tokens with parser_parse()
+ * and with parser_parse_parallel() on 1 to N threads, reporting the best
+ * time and the speedup over the sequential parser for each thread count.
+ *
+ * Usage: bench_parse_scaling <source_file> [max_threads] [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parser_parallel.h"
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+        *size = (size_t)file_size;
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best time of `iterations` runs; threads == 0 means the sequential parser */
+static double time_parse(Lexer *lexer, TokenBuffer *tokens, unsigned threads, int iterations,
+                         size_t *statements) {
+    double best = 0.0;
+    for (int it = 0; it < iterations; it++) {
+        double start = now_seconds();
+        ASTNode *program;
+        if (threads == 0) {
+            Parser *parser = parser_create_from_tokens(lexer, tokens, 0);
+            program = parser_parse(parser);
+            parser_destroy(parser);
+        } else {
+            program = parser_parse_parallel(lexer, tokens, threads);
+        }
+        double elapsed = now_seconds() - start;
+
+        if (!program) {
+            fprintf(stderr, "Error: Parse failed\n");
+            exit(1);
+        }
+        *statements = program->data.program.statements.count;
+        ast_destroy(program);
+
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [max_threads] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = 0;
+    char *source = read_file(argv[1], &size);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+
+    Lexer *lexer = lexer_create_slice(source, 0, size);
+    TokenBuffer *tokens = lexer ? lexer_tokenize_all(lexer) : NULL;
+    if (!tokens) {
+        fprintf(stderr, "Error: Tokenizing failed\n");
+        return 1;
+    }
+
+    int max_threads = argc > 2 ? atoi(argv[2]) : 4;
+    int iterations = argc > 3 ? atoi(argv[3]) : 3;
+    size_t statements = 0;
+
+    double sequential = time_parse(lexer, tokens, 0, iterations, &statements);
+    printf("parse scaling: %zu bytes, %zu tokens, %zu top-level statements\n", size, tokens->count, statements);
+    printf("  sequential  best %9.3f ms  %7.1f MB/s\n", sequential * 1e3, size / sequential / 1e6);
+
+    for (int threads = 1; threads <= max_threads; threads++) {
+        double best = time_parse(lexer, tokens, (unsigned)threads, iterations, &statements);
+        printf("  %2d threads  best %9.3f ms  %7.1f MB/s  %.2fx\n",
+               threads, best * 1e3, size / best / 1e6, sequential / best);
+    }
+
+    token_buffer_destroy(tokens);
+    lexer_destroy(lexer);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Parser throughput benchmark.
+ * Lexes and parses a source file several times and reports the best time,
+ * plus the token storage cost of the pre-tokenized buffer.
+ *
+ * Usage: bench_parser <source_file> [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parser.h"
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    if (source && fread(source, 1, file_size, file) != (size_t)file_size) {
+        free(source);
+        source = NULL;
+    }
+    if (source) {
+        source[file_size] = '\0';
+        *size = (size_t)file_size;
+    }
+    fclose(file);
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <source_file> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = 0;
+    char *source = read_file(argv[1], &size);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot read file %s\n", argv[1]);
+        return 1;
+    }
+
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    double best = 0.0;
+    size_t tokens = 0;
+    size_t literals = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        double start = now_seconds();
+        Lexer *lexer = lexer_create(source);
+        Parser *parser = parser_create(lexer);
+        ASTNode *ast = parser_parse(parser);
+        double elapsed = now_seconds() - start;
+
+        if (!ast) {
+            fprintf(stderr, "Error: Parse failed\n");
+            return 1;
+        }
+        tokens = parser->tokens->count;
+        literals = parser->tokens->literal_count;
+
+        ast_destroy(ast);
+        parser_destroy(parser);
+        lexer_destroy(lexer);
+
+        if (it == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    size_t buffer_bytes = tokens * (sizeof(uint8_t) + 2 * sizeof(uint32_t)) +
+                          literals * sizeof(TokenLiteral);
+    printf("parser: %zu bytes, %zu tokens, best %.3f ms (lex + parse), %.1f MB/s\n",
+           size, tokens, best * 1e3, size / best / 1e6);
+    printf("tokens: %.1f bytes/token buffered vs %zu bytes/Token (%zu literal side entries)\n",
+           (double)buffer_bytes / tokens, sizeof(Token), literals);
+
+    free(source);
+    return 0;
+}
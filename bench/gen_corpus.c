@@ -0,0 +1,56 @@
+/*
+ * Synthetic corpus generator for the Miru benchmarks.
+ * Writes a large, valid Miru program that mimics machine-generated
+ * sources: many small functions, comments, indentation and long names.
+ *
+ * Usage: gen_corpus <function_count> [output_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void emit_function(FILE *out, long i) {
+    fprintf(out, "// Generated helper number %ld: accumulates a bounded series\n", i);
+    fprintf(out, "func generated_helper_function_%ld(first_argument, second_argument) {\n", i);
+    fprintf(out, "    let accumulator_value = first_argument * %ld + second_argument;\n", i % 97 + 1);
+    fprintf(out, "    let loop_counter = 0;\n");
+    fprintf(out, "    while (loop_counter < %ld) {\n", i % 13 + 2);
+    fprintf(out, "        if (accumulator_value %% 2 == 0) {\n");
+    fprintf(out, "            accumulator_value = accumulator_value / 2 + loop_counter;\n");
+    fprintf(out, "        } else {\n");
+    fprintf(out, "            accumulator_value = (accumulator_value * 3 + 1) - second_argument;\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "        loop_counter = loop_counter + 1;  // step\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    if (accumulator_value >= %ld && first_argument != 0) {\n", i * 7 % 1000);
+    fprintf(out, "        return accumulator_value - %ld.%ld;\n", i % 10, i % 7);
+    fprintf(out, "    }\n");
+    fprintf(out, "    return accumulator_value;\n");
+    fprintf(out, "}\n\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <function_count> [output_file]\n", argv[0]);
+        return 1;
+    }
+
+    long count = strtol(argv[1], NULL, 10);
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: Cannot open file %s\n", argv[2]);
+        return 1;
+    }
+
+    for (long i = 0; i < count; i++) {
+        emit_function(out, i);
+    }
+    for (long i = 0; i < count; i += 64) {
+        fprintf(out, "print(generated_helper_function_%ld(%ld, \"unused\" == \"unused\"));\n", i, i);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Every block is aligned for pointers, integers and doubles */
+typedef union {
+    void *pointer;
+    long integer;
+    double real;
+} ArenaAlign;
+
+#define ARENA_ALIGNMENT sizeof(ArenaAlign)
+
+struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t size;
+    ArenaAlign data[];
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+/* `chunk_size` of 0 picks ARENA_DEFAULT_CHUNK_SIZE */
+Arena *arena_create(size_t chunk_size) {
+    Arena *arena = calloc(1, sizeof(Arena));
+    if (arena) {
+        arena->chunk_size = chunk_size > 0 ? align_up(chunk_size) : ARENA_DEFAULT_CHUNK_SIZE;
+    }
+    return arena;
+}
+
+static ArenaChunk *chunk_create(size_t size) {
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->used = 0;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+/* A block of `size` bytes that lives until the arena is reset; NULL if out of memory */
+void *arena_alloc(Arena *arena, size_t size) {
+    if (!arena || size > SIZE_MAX - ARENA_ALIGNMENT - sizeof(ArenaChunk)) {
+        return NULL;
+    }
+    size = align_up(size > 0 ? size : 1);
+
+    ArenaChunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        if (size > arena->chunk_size / 4) {
+            /* A big block gets a chunk to itself, behind the one being filled */
+            ArenaChunk *own = chunk_create(size);
+            if (!own) {
+                return NULL;
+            }
+            own->used = size;
+            if (chunk) {
+                own->next = chunk->next;
+                chunk->next = own;
+            } else {
+                arena->chunks = own;
+            }
+            arena->chunk_count++;
+            arena->allocations++;
+            arena->bytes_used += size;
+            return own->data;
+        }
+        chunk = chunk_create(arena->chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->chunk_count++;
+    }
+
+    void *block = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocations++;
+    arena->bytes_used += size;
+    return block;
+}
+
+/*
+ * Take over every block of `other`, which is left empty. Used to gather
+ * the arenas of worker threads into one that outlives them; the adopted
+ * chunks go behind the one being filled.
+ */
+void arena_adopt(Arena *arena, Arena *other) {
+    if (!arena || !other || !other->chunks) {
+        return;
+    }
+    ArenaChunk *last = other->chunks;
+    while (last->next) {
+        last = last->next;
+    }
+    if (arena->chunks) {
+        last->next = arena->chunks->next;
+        arena->chunks->next = other->chunks;
+    } else {
+        arena->chunks = other->chunks;
+    }
+    arena->allocations += other->allocations;
+    arena->chunk_count += other->chunk_count;
+    arena->bytes_used += other->bytes_used;
+    other->chunks = NULL;
+    other->allocations = 0;
+    other->chunk_count = 0;
+    other->bytes_used = 0;
+}
+
+/*
+ * Release every block at once. One chunk of the regular size is kept for
+ * reuse, so an arena reset between small units of work does not go back
+ * to malloc each time. The counters keep running.
+ */
+void arena_reset(Arena *arena) {
+    if (!arena) {
+        return;
+    }
+    ArenaChunk *kept = NULL;
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        if (!kept && chunk->size == arena->chunk_size) {
+            kept = chunk;
+            kept->next = NULL;
+            kept->used = 0;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    arena->chunks = kept;
+}
+
+void arena_destroy(Arena *arena) {
+    if (arena) {
+        arena_reset(arena);
+        free(arena->chunks);
+        free(arena);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator over a list of chunks. Allocation moves a pointer
+ * through the current chunk and takes a new chunk from malloc when it is
+ * full; nothing is freed on its own, and arena_reset() releases
+ * everything at once. Requests larger than a chunk get a chunk of their
+ * own, so the space left in the current one is not lost.
+ *
+ * The counters say how much the arena saved: `allocations` is how many
+ * blocks were handed out, `chunk_count` how many times malloc was called
+ * for them.
+ */
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+    ArenaChunk *chunks;     /* newest first; the first one is being filled */
+    size_t chunk_size;
+    size_t allocations;
+    size_t chunk_count;
+    size_t bytes_used;
+} Arena;
+
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+Arena *arena_create(size_t chunk_size);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_adopt(Arena *arena, Arena *other);
+void arena_reset(Arena *arena);
+void arena_destroy(Arena *arena);
+
+#endif
@@ -3,245 +3,767 @@
 #include <string.h>
 #include <stdio.h>
 
+/* The arena nodes of this thread are allocated from, if any; see ast_use_arena() */
+static _Thread_local Arena *current_arena;
+
+/*
+ * Allocate the nodes, child lists and strings that ast_create_* makes on
+ * this thread from `arena`, or from malloc again when it is NULL. A tree
+ * built in an arena is released by resetting the arena: ast_destroy does
+ * nothing while an arena is in use, so a tree must be destroyed under the
+ * same setting it was built under. Without an arena (the default, and
+ * what tests building trees by hand get) every node is freed with
+ * ast_destroy as before.
+ */
+void ast_use_arena(Arena *arena) {
+    current_arena = arena;
+}
+
+Arena *ast_arena(void) {
+    return current_arena;
+}
+
+static void *allocate(size_t size) {
+    return current_arena ? arena_alloc(current_arena, size) : malloc(size);
+}
+
+/* A node with `extra` bytes after it for its child lists or text */
+static ASTNode *node_alloc(NodeType type, size_t extra) {
+    ASTNode *node = (ASTNode *)allocate(sizeof(ASTNode) + extra);
+    if (node) {
+        node->type = type;
+    }
+    return node;
+}
+
 ASTNode *ast_create_program(void) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_PROGRAM;
-    node->data.program.statements = NULL;
-    node->data.program.statement_count = 0;
+    ASTNode *node = node_alloc(NODE_PROGRAM, 0);
+    if (!node) {
+        return NULL;
+    }
+    node->data.program.statements.items = NULL;
+    node->data.program.statements.count = 0;
+    node->data.program.statements.capacity = 0;
+    node->data.program.locals = 0;
     return node;
 }
 
 ASTNode *ast_create_int_literal(long value) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_INT_LITERAL;
+    ASTNode *node = node_alloc(NODE_INT_LITERAL, 0);
     node->data.int_literal.value = value;
     return node;
 }
 
 ASTNode *ast_create_float_literal(double value) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_FLOAT_LITERAL;
+    ASTNode *node = node_alloc(NODE_FLOAT_LITERAL, 0);
     node->data.float_literal.value = value;
     return node;
 }
 
 ASTNode *ast_create_string_literal(const char *value) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_STRING_LITERAL;
-    node->data.string_literal.value = (char *)malloc(strlen(value) + 1);
-    strcpy(node->data.string_literal.value, value);
+    return ast_create_string_literal_len(value, strlen(value));
+}
+
+/* A string literal of `length` bytes of text; the copy is kept right after the node */
+ASTNode *ast_create_string_literal_len(const char *value, size_t length) {
+    ASTNode *node = node_alloc(NODE_STRING_LITERAL, length + 1);
+    node->data.string_literal.value = (char *)(node + 1);
+    memcpy(node->data.string_literal.value, value, length);
+    node->data.string_literal.value[length] = '\0';
     return node;
 }
 
 ASTNode *ast_create_bool_literal(int value) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_BOOL_LITERAL;
+    ASTNode *node = node_alloc(NODE_BOOL_LITERAL, 0);
     node->data.bool_literal.value = value ? 1 : 0;
     return node;
 }
 
-ASTNode *ast_create_identifier(const char *name) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_IDENTIFIER;
-    node->data.identifier.name = (char *)malloc(strlen(name) + 1);
-    strcpy(node->data.identifier.name, name);
+ASTNode *ast_create_identifier(Atom name) {
+    ASTNode *node = node_alloc(NODE_IDENTIFIER, 0);
+    node->data.identifier.name = name;
+    node->data.identifier.depth = SCOPE_UNRESOLVED;
+    node->data.identifier.slot = 0;
+    node->data.identifier.type = TYPE_UNKNOWN;
     return node;
 }
 
 ASTNode *ast_create_binary_op(ASTNode *left, ASTNode *right, OperatorType op) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_BINARY_OP;
+    ASTNode *node = node_alloc(NODE_BINARY_OP, 0);
     node->data.binary_op.left = left;
     node->data.binary_op.right = right;
     node->data.binary_op.op = op;
+    node->data.binary_op.type = TYPE_UNKNOWN;
     return node;
 }
 
 ASTNode *ast_create_unary_op(ASTNode *operand, OperatorType op) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_UNARY_OP;
+    ASTNode *node = node_alloc(NODE_UNARY_OP, 0);
     node->data.unary_op.operand = operand;
     node->data.unary_op.op = op;
+    node->data.unary_op.type = TYPE_UNKNOWN;
     return node;
 }
 
-ASTNode *ast_create_call(ASTNode *function, ASTNode **arguments, size_t arg_count) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_CALL;
+/*
+ * Bytes a buffer's children will take after the node rather than in a
+ * heap array of their own: short lists always, and every list while an
+ * arena is in use, since the arena holds no separately freed arrays.
+ */
+static size_t inline_nodes(const NodeBuffer *buffer) {
+    return buffer && (buffer->capacity == 0 || current_arena) ? buffer->count * sizeof(ASTNode *) : 0;
+}
+
+static size_t inline_atoms(const AtomBuffer *buffer) {
+    return buffer && (buffer->capacity == 0 || current_arena) ? buffer->count * sizeof(Atom) : 0;
+}
+
+/*
+ * Move a buffer's children into a node's list, leaving the buffer empty: a
+ * heap array is taken over as it is, other children are copied to *tail
+ * in the node's allocation. A NULL buffer gives an empty list.
+ */
+static void take_nodes(NodeList *list, NodeBuffer *buffer, char **tail) {
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    if (!buffer) {
+        return;
+    }
+    list->count = buffer->count;
+    if (buffer->capacity > 0 && !current_arena) {
+        list->items = buffer->heap;
+        list->capacity = buffer->capacity;
+        memset(buffer, 0, sizeof(NodeBuffer));
+    } else if (buffer->count > 0) {
+        list->items = (ASTNode **)(void *)*tail;
+        memcpy(list->items, node_buffer_items(buffer), buffer->count * sizeof(ASTNode *));
+        *tail += buffer->count * sizeof(ASTNode *);
+        node_buffer_free(buffer);
+    }
+}
+
+static void take_atoms(AtomList *list, AtomBuffer *buffer, char **tail) {
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    if (!buffer) {
+        return;
+    }
+    list->count = buffer->count;
+    if (buffer->capacity > 0 && !current_arena) {
+        list->items = buffer->heap;
+        list->capacity = buffer->capacity;
+        memset(buffer, 0, sizeof(AtomBuffer));
+    } else if (buffer->count > 0) {
+        list->items = (Atom *)(void *)*tail;
+        memcpy(list->items, buffer->capacity > 0 ? buffer->heap : buffer->inline_items,
+               buffer->count * sizeof(Atom));
+        *tail += buffer->count * sizeof(Atom);
+        atom_buffer_free(buffer);
+    }
+}
+
+ASTNode *ast_create_call(ASTNode *function, NodeBuffer *arguments) {
+    ASTNode *node = node_alloc(NODE_CALL, inline_nodes(arguments));
+    char *tail = (char *)(node + 1);
     node->data.call.function = function;
-    node->data.call.arguments = arguments;
-    node->data.call.argument_count = arg_count;
+    take_nodes(&node->data.call.arguments, arguments, &tail);
     return node;
 }
 
-ASTNode *ast_create_if(ASTNode *condition, ASTNode **then_branch, size_t then_count,
-                       ASTNode **else_branch, size_t else_count) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_IF;
+ASTNode *ast_create_if(ASTNode *condition, NodeBuffer *then_branch, NodeBuffer *else_branch) {
+    ASTNode *node = node_alloc(NODE_IF, inline_nodes(then_branch) + inline_nodes(else_branch));
+    char *tail = (char *)(node + 1);
     node->data.if_stmt.condition = condition;
-    node->data.if_stmt.then_branch = then_branch;
-    node->data.if_stmt.then_count = then_count;
-    node->data.if_stmt.else_branch = else_branch;
-    node->data.if_stmt.else_count = else_count;
+    take_nodes(&node->data.if_stmt.then_branch, then_branch, &tail);
+    take_nodes(&node->data.if_stmt.else_branch, else_branch, &tail);
     return node;
 }
 
-ASTNode *ast_create_while(ASTNode *condition, ASTNode **body, size_t body_count) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_WHILE;
+ASTNode *ast_create_while(ASTNode *condition, NodeBuffer *body) {
+    ASTNode *node = node_alloc(NODE_WHILE, inline_nodes(body));
+    char *tail = (char *)(node + 1);
     node->data.while_stmt.condition = condition;
-    node->data.while_stmt.body = body;
-    node->data.while_stmt.body_count = body_count;
+    take_nodes(&node->data.while_stmt.body, body, &tail);
     return node;
 }
 
-ASTNode *ast_create_function_def(const char *name, char **parameters, size_t param_count,
-                                 ASTNode **body, size_t body_count) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_FUNCTION_DEF;
-    node->data.function_def.name = (char *)malloc(strlen(name) + 1);
-    strcpy(node->data.function_def.name, name);
-    node->data.function_def.parameters = parameters;
-    node->data.function_def.param_count = param_count;
-    node->data.function_def.body = body;
-    node->data.function_def.body_count = body_count;
+ASTNode *ast_create_function_def(Atom name, AtomBuffer *parameters, NodeBuffer *body) {
+    ASTNode *node = node_alloc(NODE_FUNCTION_DEF, inline_nodes(body) + inline_atoms(parameters));
+    char *tail = (char *)(node + 1);
+    node->data.function_def.name = name;
+    node->data.function_def.locals = 0;
+    /* Pointers first, so the atoms after them stay aligned */
+    take_nodes(&node->data.function_def.body, body, &tail);
+    take_atoms(&node->data.function_def.parameters, parameters, &tail);
     return node;
 }
 
 ASTNode *ast_create_return(ASTNode *value) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_RETURN;
+    ASTNode *node = node_alloc(NODE_RETURN, 0);
     node->data.return_stmt.value = value;
     return node;
 }
 
-ASTNode *ast_create_var_decl(const char *name, ASTNode *initializer, int is_const) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_VAR_DECL;
-    node->data.var_decl.name = (char *)malloc(strlen(name) + 1);
-    strcpy(node->data.var_decl.name, name);
+ASTNode *ast_create_var_decl(Atom name, ASTNode *initializer, int is_const) {
+    ASTNode *node = node_alloc(NODE_VAR_DECL, 0);
+    node->data.var_decl.name = name;
     node->data.var_decl.initializer = initializer;
     node->data.var_decl.is_const = is_const;
+    node->data.var_decl.slot = 0;
+    node->data.var_decl.type = TYPE_UNKNOWN;
     return node;
 }
 
-ASTNode *ast_create_block(ASTNode **statements, size_t statement_count) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_BLOCK;
-    node->data.block.statements = statements;
-    node->data.block.statement_count = statement_count;
+ASTNode *ast_create_block(NodeBuffer *statements) {
+    ASTNode *node = node_alloc(NODE_BLOCK, inline_nodes(statements));
+    char *tail = (char *)(node + 1);
+    take_nodes(&node->data.block.statements, statements, &tail);
     return node;
 }
 
 ASTNode *ast_create_expr_stmt(ASTNode *expression) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = NODE_EXPRESSION_STMT;
+    ASTNode *node = node_alloc(NODE_EXPRESSION_STMT, 0);
     node->data.expr_stmt.expression = expression;
     return node;
 }
 
-void ast_program_add_statement(ASTNode *program, ASTNode *statement) {
+ASTNode **node_buffer_items(NodeBuffer *buffer) {
+    return buffer->capacity > 0 ? buffer->heap : buffer->inline_items;
+}
+
+/* Append a node; returns false if out of memory, leaving the buffer as it was */
+bool node_buffer_push(NodeBuffer *buffer, ASTNode *node) {
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : NODE_LIST_INLINE;
+    if (buffer->count == capacity) {
+        if (capacity * 2 > UINT32_MAX) {
+            return false;
+        }
+        capacity *= 2;
+        ASTNode **heap = buffer->capacity > 0 ? realloc(buffer->heap, capacity * sizeof(ASTNode *))
+                                              : malloc(capacity * sizeof(ASTNode *));
+        if (!heap) {
+            return false;
+        }
+        if (buffer->capacity == 0) {
+            memcpy(heap, buffer->inline_items, sizeof(buffer->inline_items));
+        }
+        buffer->heap = heap;
+        buffer->capacity = (uint32_t)capacity;
+    }
+    node_buffer_items(buffer)[buffer->count++] = node;
+    return true;
+}
+
+/* Free the buffer's storage but not the nodes in it */
+void node_buffer_free(NodeBuffer *buffer) {
+    if (buffer->capacity > 0) {
+        free(buffer->heap);
+    }
+    memset(buffer, 0, sizeof(NodeBuffer));
+}
+
+/* Destroy the nodes in the buffer and free its storage */
+void node_buffer_destroy(NodeBuffer *buffer) {
+    ASTNode **items = node_buffer_items(buffer);
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        ast_destroy(items[i]);
+    }
+    node_buffer_free(buffer);
+}
+
+bool atom_buffer_push(AtomBuffer *buffer, Atom atom) {
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : NODE_LIST_INLINE;
+    if (buffer->count == capacity) {
+        if (capacity * 2 > UINT32_MAX) {
+            return false;
+        }
+        capacity *= 2;
+        Atom *heap = buffer->capacity > 0 ? realloc(buffer->heap, capacity * sizeof(Atom))
+                                          : malloc(capacity * sizeof(Atom));
+        if (!heap) {
+            return false;
+        }
+        if (buffer->capacity == 0) {
+            memcpy(heap, buffer->inline_items, sizeof(buffer->inline_items));
+        }
+        buffer->heap = heap;
+        buffer->capacity = (uint32_t)capacity;
+    }
+    (buffer->capacity > 0 ? buffer->heap : buffer->inline_items)[buffer->count++] = atom;
+    return true;
+}
+
+void atom_buffer_free(AtomBuffer *buffer) {
+    if (buffer->capacity > 0) {
+        free(buffer->heap);
+    }
+    memset(buffer, 0, sizeof(AtomBuffer));
+}
+
+/* Make room for `needed` top-level statements, doubling the array; returns false if out of memory */
+static bool reserve_statements(NodeList *list, size_t needed) {
+    if (needed <= list->capacity) {
+        return true;
+    }
+    if (needed > UINT32_MAX) {
+        return false;
+    }
+    size_t capacity = list->capacity > 0 ? list->capacity : 16;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    capacity = capacity > UINT32_MAX ? UINT32_MAX : capacity;
+    ASTNode **items;
+    if (current_arena) {
+        /* The old array stays in the arena until it is reset */
+        items = arena_alloc(current_arena, capacity * sizeof(ASTNode *));
+        if (items && list->count > 0) {
+            memcpy(items, list->items, list->count * sizeof(ASTNode *));
+        }
+    } else {
+        items = realloc(list->items, capacity * sizeof(ASTNode *));
+    }
+    if (!items) {
+        return false;
+    }
+    list->items = items;
+    list->capacity = (uint32_t)capacity;
+    return true;
+}
+
+/* Append a top-level statement; returns false if out of memory */
+bool ast_program_add_statement(ASTNode *program, ASTNode *statement) {
     if (!program || program->type != NODE_PROGRAM) {
-        return;
+        return false;
     }
+    NodeList *list = &program->data.program.statements;
+    if (!reserve_statements(list, (size_t)list->count + 1)) {
+        return false;
+    }
+    list->items[list->count++] = statement;
+    return true;
+}
 
-    size_t new_count = program->data.program.statement_count + 1;
-    ASTNode **new_statements = (ASTNode **)realloc(
-        program->data.program.statements,
-        sizeof(ASTNode *) * new_count
-    );
+/*
+ * Replace statements [start, end) of a program with `count` new ones; the
+ * replaced statements are destroyed. Returns 0 if out of memory, in which
+ * case nothing changes.
+ */
+int ast_program_replace(ASTNode *program, size_t start, size_t end, ASTNode **statements, size_t count) {
+    if (!program || program->type != NODE_PROGRAM || start > end ||
+        end > program->data.program.statements.count) {
+        return 0;
+    }
 
-    if (!new_statements) {
-        return;
+    NodeList *list = &program->data.program.statements;
+    size_t old_count = list->count;
+    size_t new_count = old_count - (end - start) + count;
+    if (!reserve_statements(list, new_count)) {
+        return 0;
     }
 
-    new_statements[new_count - 1] = statement;
-    program->data.program.statements = new_statements;
-    program->data.program.statement_count = new_count;
+    ASTNode **all = list->items;
+    for (size_t i = start; i < end; i++) {
+        ast_destroy(all[i]);
+    }
+    memmove(all + start + count, all + end, sizeof(ASTNode *) * (old_count - end));
+    if (count > 0) {
+        memcpy(all + start, statements, sizeof(ASTNode *) * count);
+    }
+    list->count = (uint32_t)new_count;
+    return 1;
 }
 
-void ast_destroy(ASTNode *node) {
-    if (!node) {
-        return;
+/*
+ * Children of a node in evaluation order, for passes that treat every
+ * kind alike: the operands, the function then the arguments, the
+ * condition then the statements of each branch or body. A return without
+ * a value or a declaration without an initializer still has its one
+ * child, which is NULL.
+ */
+size_t ast_child_count(const ASTNode *node) {
+    switch (node->type) {
+        case NODE_PROGRAM: return node->data.program.statements.count;
+        case NODE_BINARY_OP: return 2;
+        case NODE_UNARY_OP: return 1;
+        case NODE_CALL: return 1 + (size_t)node->data.call.arguments.count;
+        case NODE_IF:
+            return 1 + (size_t)node->data.if_stmt.then_branch.count + node->data.if_stmt.else_branch.count;
+        case NODE_WHILE: return 1 + (size_t)node->data.while_stmt.body.count;
+        case NODE_FUNCTION_DEF: return node->data.function_def.body.count;
+        case NODE_RETURN: return 1;
+        case NODE_VAR_DECL: return 1;
+        case NODE_BLOCK: return node->data.block.statements.count;
+        case NODE_EXPRESSION_STMT: return 1;
+        default: return 0;
     }
+}
 
+ASTNode *ast_child(const ASTNode *node, size_t index) {
     switch (node->type) {
-        case NODE_PROGRAM:
-            for (size_t i = 0; i < node->data.program.statement_count; i++) {
-                ast_destroy(node->data.program.statements[i]);
+        case NODE_PROGRAM: return node->data.program.statements.items[index];
+        case NODE_BINARY_OP: return index == 0 ? node->data.binary_op.left : node->data.binary_op.right;
+        case NODE_UNARY_OP: return node->data.unary_op.operand;
+        case NODE_CALL: return index == 0 ? node->data.call.function : node->data.call.arguments.items[index - 1];
+        case NODE_IF:
+            if (index == 0) {
+                return node->data.if_stmt.condition;
             }
-            free(node->data.program.statements);
-            break;
+            if (index <= node->data.if_stmt.then_branch.count) {
+                return node->data.if_stmt.then_branch.items[index - 1];
+            }
+            return node->data.if_stmt.else_branch.items[index - 1 - node->data.if_stmt.then_branch.count];
+        case NODE_WHILE: return index == 0 ? node->data.while_stmt.condition : node->data.while_stmt.body.items[index - 1];
+        case NODE_FUNCTION_DEF: return node->data.function_def.body.items[index];
+        case NODE_RETURN: return node->data.return_stmt.value;
+        case NODE_VAR_DECL: return node->data.var_decl.initializer;
+        case NODE_BLOCK: return node->data.block.statements.items[index];
+        case NODE_EXPRESSION_STMT: return node->data.expr_stmt.expression;
+        default: return NULL;
+    }
+}
+
+/*
+ * Replace the contents of a node's list with a buffer's, for passes that
+ * rewrite statement lists; the buffer is left empty and the nodes that
+ * were in the list are not destroyed. In an arena the items are copied
+ * into it; otherwise the list gets a heap array of its own, and the old
+ * one is freed if it had one. Returns false if out of memory, in which
+ * case nothing changes.
+ */
+bool ast_list_assign(NodeList *list, NodeBuffer *buffer) {
+    size_t count = buffer->count;
+    ASTNode **items;
+    if (current_arena) {
+        items = count > 0 ? arena_alloc(current_arena, count * sizeof(ASTNode *)) : NULL;
+    } else if (buffer->capacity > 0) {
+        items = buffer->heap;
+    } else {
+        items = count > 0 ? malloc(count * sizeof(ASTNode *)) : NULL;
+    }
+    if (count > 0 && !items) {
+        return false;
+    }
+    if (items != buffer->heap && count > 0) {
+        memcpy(items, node_buffer_items(buffer), count * sizeof(ASTNode *));
+    }
+
+    if (list->capacity > 0 && !current_arena) {
+        free(list->items);
+    }
+    list->items = items;
+    list->count = (uint32_t)count;
+    list->capacity = current_arena ? (uint32_t)count : buffer->capacity > 0 ? buffer->capacity : (uint32_t)count;
+    if (items == buffer->heap && buffer->capacity > 0) {
+        memset(buffer, 0, sizeof(NodeBuffer));
+    } else {
+        node_buffer_free(buffer);
+    }
+    return true;
+}
+
+/* Bytes of the lists a copy of `source` keeps after the node, child pointers before atoms */
+static size_t list_bytes(const ASTNode *source) {
+    switch (source->type) {
+        case NODE_CALL:
+            return source->data.call.arguments.count * sizeof(ASTNode *);
+        case NODE_IF:
+            return ((size_t)source->data.if_stmt.then_branch.count + source->data.if_stmt.else_branch.count) *
+                   sizeof(ASTNode *);
+        case NODE_WHILE:
+            return source->data.while_stmt.body.count * sizeof(ASTNode *);
+        case NODE_FUNCTION_DEF:
+            return source->data.function_def.body.count * sizeof(ASTNode *) +
+                   source->data.function_def.parameters.count * sizeof(Atom);
+        case NODE_BLOCK:
+            return source->data.block.statements.count * sizeof(ASTNode *);
         case NODE_STRING_LITERAL:
-            free(node->data.string_literal.value);
-            break;
-        case NODE_IDENTIFIER:
-            free(node->data.identifier.name);
-            break;
-        case NODE_BINARY_OP:
-            ast_destroy(node->data.binary_op.left);
-            ast_destroy(node->data.binary_op.right);
-            break;
-        case NODE_UNARY_OP:
-            ast_destroy(node->data.unary_op.operand);
+            return strlen(source->data.string_literal.value) + 1;
+        default:
+            return 0;
+    }
+}
+
+/* Give a copied list its own array at *tail, still holding the source's children */
+static void copy_list(NodeList *list, char **tail) {
+    if (list->count > 0) {
+        memcpy(*tail, list->items, list->count * sizeof(ASTNode *));
+        list->items = (ASTNode **)(void *)*tail;
+        *tail += list->count * sizeof(ASTNode *);
+    } else {
+        list->items = NULL;
+    }
+    list->capacity = 0;
+}
+
+/* A copy of one node, annotations included, whose child pointers are still the source's */
+static ASTNode *copy_node(const ASTNode *source) {
+    ASTNode *node = node_alloc(source->type, list_bytes(source));
+    if (!node) {
+        return NULL;
+    }
+    memcpy(node, source, sizeof(ASTNode));
+    char *tail = (char *)(node + 1);
+    switch (node->type) {
+        case NODE_STRING_LITERAL:
+            strcpy(tail, source->data.string_literal.value);
+            node->data.string_literal.value = tail;
             break;
         case NODE_CALL:
-            ast_destroy(node->data.call.function);
-            for (size_t i = 0; i < node->data.call.argument_count; i++) {
-                ast_destroy(node->data.call.arguments[i]);
-            }
-            free(node->data.call.arguments);
+            copy_list(&node->data.call.arguments, &tail);
             break;
         case NODE_IF:
-            ast_destroy(node->data.if_stmt.condition);
-            for (size_t i = 0; i < node->data.if_stmt.then_count; i++) {
-                ast_destroy(node->data.if_stmt.then_branch[i]);
-            }
-            free(node->data.if_stmt.then_branch);
-            for (size_t i = 0; i < node->data.if_stmt.else_count; i++) {
-                ast_destroy(node->data.if_stmt.else_branch[i]);
-            }
-            free(node->data.if_stmt.else_branch);
+            copy_list(&node->data.if_stmt.then_branch, &tail);
+            copy_list(&node->data.if_stmt.else_branch, &tail);
             break;
         case NODE_WHILE:
-            ast_destroy(node->data.while_stmt.condition);
-            for (size_t i = 0; i < node->data.while_stmt.body_count; i++) {
-                ast_destroy(node->data.while_stmt.body[i]);
-            }
-            free(node->data.while_stmt.body);
+            copy_list(&node->data.while_stmt.body, &tail);
             break;
-        case NODE_FUNCTION_DEF:
-            free(node->data.function_def.name);
-            for (size_t i = 0; i < node->data.function_def.param_count; i++) {
-                free(node->data.function_def.parameters[i]);
-            }
-            free(node->data.function_def.parameters);
-            for (size_t i = 0; i < node->data.function_def.body_count; i++) {
-                ast_destroy(node->data.function_def.body[i]);
+        case NODE_FUNCTION_DEF: {
+            AtomList *parameters = &node->data.function_def.parameters;
+            copy_list(&node->data.function_def.body, &tail);
+            if (parameters->count > 0) {
+                memcpy(tail, parameters->items, parameters->count * sizeof(Atom));
+                parameters->items = (Atom *)(void *)tail;
+            } else {
+                parameters->items = NULL;
             }
-            free(node->data.function_def.body);
+            parameters->capacity = 0;
             break;
-        case NODE_RETURN:
-            ast_destroy(node->data.return_stmt.value);
+        }
+        case NODE_BLOCK:
+            copy_list(&node->data.block.statements, &tail);
             break;
-        case NODE_VAR_DECL:
-            free(node->data.var_decl.name);
-            ast_destroy(node->data.var_decl.initializer);
+        default:
             break;
-        case NODE_BLOCK:
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                ast_destroy(node->data.block.statements[i]);
+    }
+    return node;
+}
+
+/*
+ * Deep copy of a subtree of any depth, offsets and annotations included;
+ * the copy is allocated like new nodes (see ast_use_arena). A program
+ * cannot be copied, since its statement list must be able to grow.
+ * Returns NULL if out of memory.
+ */
+ASTNode *ast_clone(const ASTNode *node) {
+    if (!node || node->type == NODE_PROGRAM) {
+        return NULL;
+    }
+    ASTNode *root = (ASTNode *)node;
+    /* Slots of copied nodes that still point at the source's children */
+    ASTNode ***pending = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    bool ok = true;
+
+    ASTNode **slot = &root;
+    for (;;) {
+        size_t children = ast_child_count(*slot);
+        if (count + children > capacity) {
+            size_t new_capacity = capacity ? capacity : 64;
+            while (new_capacity < count + children) {
+                new_capacity *= 2;
             }
-            free(node->data.block.statements);
-            break;
-        case NODE_EXPRESSION_STMT:
-            ast_destroy(node->data.expr_stmt.expression);
+            ASTNode ***grown = realloc(pending, new_capacity * sizeof(ASTNode **));
+            if (!grown) {
+                ok = false;
+                *slot = NULL;
+                break;
+            }
+            pending = grown;
+            capacity = new_capacity;
+        }
+        ASTNode *copy = copy_node(*slot);
+        if (!copy) {
+            ok = false;
+            *slot = NULL;
             break;
-        default:
+        }
+        *slot = copy;
+        /* ast_child order, so slots can be taken by address */
+        switch (copy->type) {
+            case NODE_BINARY_OP:
+                pending[count++] = &copy->data.binary_op.left;
+                pending[count++] = &copy->data.binary_op.right;
+                break;
+            case NODE_UNARY_OP:
+                pending[count++] = &copy->data.unary_op.operand;
+                break;
+            case NODE_RETURN:
+                pending[count++] = &copy->data.return_stmt.value;
+                break;
+            case NODE_VAR_DECL:
+                pending[count++] = &copy->data.var_decl.initializer;
+                break;
+            case NODE_EXPRESSION_STMT:
+                pending[count++] = &copy->data.expr_stmt.expression;
+                break;
+            case NODE_CALL:
+                pending[count++] = &copy->data.call.function;
+                for (uint32_t i = 0; i < copy->data.call.arguments.count; i++) {
+                    pending[count++] = &copy->data.call.arguments.items[i];
+                }
+                break;
+            case NODE_IF:
+                pending[count++] = &copy->data.if_stmt.condition;
+                for (uint32_t i = 0; i < copy->data.if_stmt.then_branch.count; i++) {
+                    pending[count++] = &copy->data.if_stmt.then_branch.items[i];
+                }
+                for (uint32_t i = 0; i < copy->data.if_stmt.else_branch.count; i++) {
+                    pending[count++] = &copy->data.if_stmt.else_branch.items[i];
+                }
+                break;
+            case NODE_WHILE:
+                pending[count++] = &copy->data.while_stmt.condition;
+                for (uint32_t i = 0; i < copy->data.while_stmt.body.count; i++) {
+                    pending[count++] = &copy->data.while_stmt.body.items[i];
+                }
+                break;
+            case NODE_FUNCTION_DEF:
+                for (uint32_t i = 0; i < copy->data.function_def.body.count; i++) {
+                    pending[count++] = &copy->data.function_def.body.items[i];
+                }
+                break;
+            case NODE_BLOCK:
+                for (uint32_t i = 0; i < copy->data.block.statements.count; i++) {
+                    pending[count++] = &copy->data.block.statements.items[i];
+                }
+                break;
+            default:
+                break;
+        }
+        do {
+            slot = count > 0 ? pending[--count] : NULL;
+        } while (slot && !*slot);
+        if (!slot) {
             break;
+        }
     }
 
-    free(node);
+    if (!ok) {
+        /* Cut the copy loose from the source's nodes before freeing what was copied */
+        while (count > 0) {
+            *pending[--count] = NULL;
+        }
+        ast_destroy(root);
+        root = NULL;
+    }
+    free(pending);
+    return root;
+}
+
+/* Nodes waiting to be freed; starts on the C stack and moves to the heap when deep */
+#define NODE_STACK_INLINE 64
+
+typedef struct {
+    ASTNode **items;
+    size_t count;
+    size_t capacity;
+    ASTNode *inline_items[NODE_STACK_INLINE];
+} NodeStack;
+
+static void node_stack_push(NodeStack *stack, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    if (stack->count == stack->capacity) {
+        size_t capacity = stack->capacity * 2;
+        ASTNode **items = stack->items == stack->inline_items ? malloc(capacity * sizeof(ASTNode *))
+                                                              : realloc(stack->items, capacity * sizeof(ASTNode *));
+        if (!items) {
+            /* Leak the subtree rather than fall back to recursion */
+            return;
+        }
+        if (stack->items == stack->inline_items) {
+            memcpy(items, stack->inline_items, sizeof(stack->inline_items));
+        }
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+    stack->items[stack->count++] = node;
+}
+
+/* Queue every node of a list and free the list's own array, if it has one */
+static void node_stack_push_all(NodeStack *stack, NodeList *list) {
+    for (uint32_t i = 0; i < list->count; i++) {
+        node_stack_push(stack, list->items[i]);
+    }
+    if (list->capacity > 0) {
+        free(list->items);
+    }
+}
+
+/*
+ * Free a tree of any depth: children go on a work stack instead of the C
+ * stack. Trees in an arena are left to arena_reset().
+ */
+void ast_destroy(ASTNode *node) {
+    if (current_arena) {
+        return;
+    }
+
+    NodeStack stack;
+    stack.items = stack.inline_items;
+    stack.count = 0;
+    stack.capacity = NODE_STACK_INLINE;
+    node_stack_push(&stack, node);
+
+    while (stack.count > 0) {
+        node = stack.items[--stack.count];
+        switch (node->type) {
+            case NODE_PROGRAM:
+                node_stack_push_all(&stack, &node->data.program.statements);
+                break;
+            case NODE_BINARY_OP:
+                node_stack_push(&stack, node->data.binary_op.left);
+                node_stack_push(&stack, node->data.binary_op.right);
+                break;
+            case NODE_UNARY_OP:
+                node_stack_push(&stack, node->data.unary_op.operand);
+                break;
+            case NODE_CALL:
+                node_stack_push(&stack, node->data.call.function);
+                node_stack_push_all(&stack, &node->data.call.arguments);
+                break;
+            case NODE_IF:
+                node_stack_push(&stack, node->data.if_stmt.condition);
+                node_stack_push_all(&stack, &node->data.if_stmt.then_branch);
+                node_stack_push_all(&stack, &node->data.if_stmt.else_branch);
+                break;
+            case NODE_WHILE:
+                node_stack_push(&stack, node->data.while_stmt.condition);
+                node_stack_push_all(&stack, &node->data.while_stmt.body);
+                break;
+            case NODE_FUNCTION_DEF:
+                if (node->data.function_def.parameters.capacity > 0) {
+                    free(node->data.function_def.parameters.items);
+                }
+                node_stack_push_all(&stack, &node->data.function_def.body);
+                break;
+            case NODE_RETURN:
+                node_stack_push(&stack, node->data.return_stmt.value);
+                break;
+            case NODE_VAR_DECL:
+                node_stack_push(&stack, node->data.var_decl.initializer);
+                break;
+            case NODE_BLOCK:
+                node_stack_push_all(&stack, &node->data.block.statements);
+                break;
+            case NODE_EXPRESSION_STMT:
+                node_stack_push(&stack, node->data.expr_stmt.expression);
+                break;
+            default:
+                break;
+        }
+        free(node);
+    }
+
+    if (stack.items != stack.inline_items) {
+        free(stack.items);
+    }
 }
 
 /* Helper to print indentation */
@@ -251,8 +773,8 @@ static void print_indent(int indent) {
     }
 }
 
-/* Helper to print operator */
-static const char *op_to_string(OperatorType op) {
+/* Source text of an operator */
+const char *ast_operator_text(OperatorType op) {
     switch (op) {
         case OP_ADD: return "+";
         case OP_SUB: return "-";
@@ -273,8 +795,60 @@ static const char *op_to_string(OperatorType op) {
     }
 }
 
-/* Print AST for debugging/visualization */
-void ast_print(ASTNode *node, int indent) {
+/* Line of a node for printing; 0 without a line index */
+static int node_line(LineIndex *lines, const ASTNode *statement, ASTNode *node) {
+    size_t offset = statement ? statement->offset + node->offset : node->offset;
+    return lines ? line_index_lookup(lines, offset).line : 0;
+}
+
+/*
+ * One line still to print: a node, or (when `label` is set) a section
+ * header such as "Arguments (2):" that takes `count` as its argument.
+ * `statement` is the top-level statement that offsets under the node are
+ * relative to.
+ */
+typedef struct {
+    ASTNode *node;
+    const ASTNode *statement;
+    int indent;
+    const char *label;
+    size_t count;
+} PrintItem;
+
+typedef struct {
+    PrintItem *items;
+    size_t count;
+    size_t capacity;
+} PrintStack;
+
+static void print_push(PrintStack *stack, ASTNode *node, const ASTNode *statement, int indent,
+                       const char *label, size_t count) {
+    if (stack->count == stack->capacity) {
+        size_t capacity = stack->capacity ? stack->capacity * 2 : 64;
+        PrintItem *items = realloc(stack->items, capacity * sizeof(PrintItem));
+        if (!items) {
+            return;
+        }
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+    PrintItem *item = &stack->items[stack->count++];
+    item->node = node;
+    item->statement = statement;
+    item->indent = indent;
+    item->label = label;
+    item->count = count;
+}
+
+/* The stack pops last-in first, so lists go on back to front */
+static void print_push_list(PrintStack *stack, const NodeList *list, const ASTNode *statement, int indent) {
+    for (size_t i = list->count; i > 0; i--) {
+        print_push(stack, list->items[i - 1], statement, indent, NULL, 0);
+    }
+}
+
+/* Print one node's own line and queue its children, which print before anything queued earlier */
+static void print_node(PrintStack *stack, ASTNode *node, LineIndex *lines, const ASTNode *statement, int indent) {
     if (!node) {
         print_indent(indent);
         printf("(null)\n");
@@ -282,139 +856,143 @@ void ast_print(ASTNode *node, int indent) {
     }
 
     print_indent(indent);
+    const ASTNode *inner = statement || node->type == NODE_PROGRAM ? statement : node;
 
     switch (node->type) {
         case NODE_PROGRAM:
-            printf("PROGRAM [line %d]\n", node->line);
-            for (size_t i = 0; i < node->data.program.statement_count; i++) {
-                ast_print(node->data.program.statements[i], indent + 1);
-            }
+            printf("PROGRAM [line %d]\n", node_line(lines, statement, node));
+            print_push_list(stack, &node->data.program.statements, inner, indent + 1);
             break;
 
         case NODE_INT_LITERAL:
-            printf("INT: %ld [line %d]\n", node->data.int_literal.value, node->line);
+            printf("INT: %ld [line %d]\n", node->data.int_literal.value, node_line(lines, statement, node));
             break;
 
         case NODE_FLOAT_LITERAL:
-            printf("FLOAT: %f [line %d]\n", node->data.float_literal.value, node->line);
+            printf("FLOAT: %f [line %d]\n", node->data.float_literal.value, node_line(lines, statement, node));
             break;
 
         case NODE_STRING_LITERAL:
-            printf("STRING: \"%s\" [line %d]\n", node->data.string_literal.value, node->line);
+            printf("STRING: \"%s\" [line %d]\n", node->data.string_literal.value, node_line(lines, statement, node));
             break;
 
         case NODE_BOOL_LITERAL:
             printf("BOOL: %s [line %d]\n",
-                   node->data.bool_literal.value ? "true" : "false", node->line);
+                   node->data.bool_literal.value ? "true" : "false", node_line(lines, statement, node));
             break;
 
         case NODE_IDENTIFIER:
-            printf("IDENTIFIER: %s [line %d]\n", node->data.identifier.name, node->line);
+            printf("IDENTIFIER: %s [line %d]\n", atom_name(node->data.identifier.name), node_line(lines, statement, node));
             break;
 
         case NODE_BINARY_OP:
             printf("BINARY_OP: %s [line %d]\n",
-                   op_to_string(node->data.binary_op.op), node->line);
-            ast_print(node->data.binary_op.left, indent + 1);
-            ast_print(node->data.binary_op.right, indent + 1);
+                   ast_operator_text(node->data.binary_op.op), node_line(lines, statement, node));
+            print_push(stack, node->data.binary_op.right, inner, indent + 1, NULL, 0);
+            print_push(stack, node->data.binary_op.left, inner, indent + 1, NULL, 0);
             break;
 
         case NODE_UNARY_OP:
             printf("UNARY_OP: %s [line %d]\n",
-                   op_to_string(node->data.unary_op.op), node->line);
-            ast_print(node->data.unary_op.operand, indent + 1);
+                   ast_operator_text(node->data.unary_op.op), node_line(lines, statement, node));
+            print_push(stack, node->data.unary_op.operand, inner, indent + 1, NULL, 0);
             break;
 
         case NODE_CALL:
-            printf("CALL [line %d]\n", node->line);
-            print_indent(indent + 1);
-            printf("Function:\n");
-            ast_print(node->data.call.function, indent + 2);
-            print_indent(indent + 1);
-            printf("Arguments (%zu):\n", node->data.call.argument_count);
-            for (size_t i = 0; i < node->data.call.argument_count; i++) {
-                ast_print(node->data.call.arguments[i], indent + 2);
-            }
+            printf("CALL [line %d]\n", node_line(lines, statement, node));
+            print_push_list(stack, &node->data.call.arguments, inner, indent + 2);
+            print_push(stack, NULL, NULL, indent + 1, "Arguments (%zu):\n", (size_t)node->data.call.arguments.count);
+            print_push(stack, node->data.call.function, inner, indent + 2, NULL, 0);
+            print_push(stack, NULL, NULL, indent + 1, "Function:\n", 0);
             break;
 
         case NODE_IF:
-            printf("IF [line %d]\n", node->line);
-            print_indent(indent + 1);
-            printf("Condition:\n");
-            ast_print(node->data.if_stmt.condition, indent + 2);
-            print_indent(indent + 1);
-            printf("Then (%zu statements):\n", node->data.if_stmt.then_count);
-            for (size_t i = 0; i < node->data.if_stmt.then_count; i++) {
-                ast_print(node->data.if_stmt.then_branch[i], indent + 2);
-            }
-            if (node->data.if_stmt.else_count > 0) {
-                print_indent(indent + 1);
-                printf("Else (%zu statements):\n", node->data.if_stmt.else_count);
-                for (size_t i = 0; i < node->data.if_stmt.else_count; i++) {
-                    ast_print(node->data.if_stmt.else_branch[i], indent + 2);
-                }
+            printf("IF [line %d]\n", node_line(lines, statement, node));
+            if (node->data.if_stmt.else_branch.count > 0) {
+                print_push_list(stack, &node->data.if_stmt.else_branch, inner, indent + 2);
+                print_push(stack, NULL, NULL, indent + 1, "Else (%zu statements):\n",
+                           (size_t)node->data.if_stmt.else_branch.count);
             }
+            print_push_list(stack, &node->data.if_stmt.then_branch, inner, indent + 2);
+            print_push(stack, NULL, NULL, indent + 1, "Then (%zu statements):\n",
+                       (size_t)node->data.if_stmt.then_branch.count);
+            print_push(stack, node->data.if_stmt.condition, inner, indent + 2, NULL, 0);
+            print_push(stack, NULL, NULL, indent + 1, "Condition:\n", 0);
             break;
 
         case NODE_WHILE:
-            printf("WHILE [line %d]\n", node->line);
-            print_indent(indent + 1);
-            printf("Condition:\n");
-            ast_print(node->data.while_stmt.condition, indent + 2);
-            print_indent(indent + 1);
-            printf("Body (%zu statements):\n", node->data.while_stmt.body_count);
-            for (size_t i = 0; i < node->data.while_stmt.body_count; i++) {
-                ast_print(node->data.while_stmt.body[i], indent + 2);
-            }
+            printf("WHILE [line %d]\n", node_line(lines, statement, node));
+            print_push_list(stack, &node->data.while_stmt.body, inner, indent + 2);
+            print_push(stack, NULL, NULL, indent + 1, "Body (%zu statements):\n",
+                       (size_t)node->data.while_stmt.body.count);
+            print_push(stack, node->data.while_stmt.condition, inner, indent + 2, NULL, 0);
+            print_push(stack, NULL, NULL, indent + 1, "Condition:\n", 0);
             break;
 
         case NODE_FUNCTION_DEF:
-            printf("FUNCTION: %s [line %d]\n", node->data.function_def.name, node->line);
+            printf("FUNCTION: %s [line %d]\n", atom_name(node->data.function_def.name), node_line(lines, statement, node));
             print_indent(indent + 1);
-            printf("Parameters (%zu): ", node->data.function_def.param_count);
-            for (size_t i = 0; i < node->data.function_def.param_count; i++) {
-                printf("%s%s", i > 0 ? ", " : "", node->data.function_def.parameters[i]);
+            printf("Parameters (%zu): ", (size_t)node->data.function_def.parameters.count);
+            for (size_t i = 0; i < node->data.function_def.parameters.count; i++) {
+                printf("%s%s", i > 0 ? ", " : "", atom_name(node->data.function_def.parameters.items[i]));
             }
             printf("\n");
             print_indent(indent + 1);
-            printf("Body (%zu statements):\n", node->data.function_def.body_count);
-            for (size_t i = 0; i < node->data.function_def.body_count; i++) {
-                ast_print(node->data.function_def.body[i], indent + 2);
-            }
+            printf("Body (%zu statements):\n", (size_t)node->data.function_def.body.count);
+            print_push_list(stack, &node->data.function_def.body, inner, indent + 2);
             break;
 
         case NODE_RETURN:
-            printf("RETURN [line %d]\n", node->line);
+            printf("RETURN [line %d]\n", node_line(lines, statement, node));
             if (node->data.return_stmt.value) {
-                ast_print(node->data.return_stmt.value, indent + 1);
+                print_push(stack, node->data.return_stmt.value, inner, indent + 1, NULL, 0);
             }
             break;
 
         case NODE_VAR_DECL:
             printf("VAR_DECL: %s (%s) [line %d]\n",
-                   node->data.var_decl.name,
+                   atom_name(node->data.var_decl.name),
                    node->data.var_decl.is_const ? "const" : "let",
-                   node->line);
+                   node_line(lines, statement, node));
             print_indent(indent + 1);
             printf("Initializer:\n");
-            ast_print(node->data.var_decl.initializer, indent + 2);
+            print_push(stack, node->data.var_decl.initializer, inner, indent + 2, NULL, 0);
             break;
 
         case NODE_BLOCK:
             printf("BLOCK (%zu statements) [line %d]\n",
-                   node->data.block.statement_count, node->line);
-            for (size_t i = 0; i < node->data.block.statement_count; i++) {
-                ast_print(node->data.block.statements[i], indent + 1);
-            }
+                   (size_t)node->data.block.statements.count, node_line(lines, statement, node));
+            print_push_list(stack, &node->data.block.statements, inner, indent + 1);
             break;
 
         case NODE_EXPRESSION_STMT:
-            printf("EXPR_STMT [line %d]\n", node->line);
-            ast_print(node->data.expr_stmt.expression, indent + 1);
+            printf("EXPR_STMT [line %d]\n", node_line(lines, statement, node));
+            print_push(stack, node->data.expr_stmt.expression, inner, indent + 1, NULL, 0);
             break;
 
         default:
-            printf("UNKNOWN NODE TYPE %d [line %d]\n", node->type, node->line);
+            printf("UNKNOWN NODE TYPE %d [line %d]\n", node->type, node_line(lines, statement, node));
             break;
     }
 }
+
+/*
+ * Print AST for debugging/visualization; `node` is a program or a
+ * top-level statement. Pending lines live on a heap stack, so any depth
+ * of nesting prints without deep recursion.
+ */
+void ast_print(ASTNode *node, LineIndex *lines, int indent) {
+    PrintStack stack = { NULL, 0, 0 };
+    print_node(&stack, node, lines, NULL, indent);
+
+    while (stack.count > 0) {
+        PrintItem item = stack.items[--stack.count];
+        if (item.label) {
+            print_indent(item.indent);
+            printf(item.label, item.count);
+        } else {
+            print_node(&stack, item.node, lines, item.statement, item.indent);
+        }
+    }
+    free(stack.items);
+}
@@ -2,6 +2,10 @@
 #define AST_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include "atom.h"
+#include "arena.h"
+#include "line_index.h"
 
 typedef enum {
     NODE_PROGRAM,
@@ -41,13 +45,75 @@ typedef enum {
     OP_ASSIGN,
 } OperatorType;
 
+/*
+ * The children of a program, block, call, function or branch. Lists of
+ * up to NODE_LIST_INLINE children are stored in the node's own
+ * allocation, right after the node, so the common short argument list or
+ * body costs no allocation of its own; longer lists are heap arrays.
+ */
+#define NODE_LIST_INLINE 4
+
+typedef struct {
+    struct ASTNode **items;
+    uint32_t count;
+    uint32_t capacity;      /* 0 unless `items` is a heap array of its own */
+} NodeList;
+
+/* Function parameter names, stored the same way */
+typedef struct {
+    Atom *items;
+    uint32_t count;
+    uint32_t capacity;
+} AtomList;
+
+/*
+ * Collects children while they are parsed: the first NODE_LIST_INLINE
+ * in the buffer itself, then a heap array that doubles as it grows. A
+ * zeroed buffer is empty; the ast_create functions take over its items.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;      /* 0 while the items are inline */
+    struct ASTNode **heap;
+    struct ASTNode *inline_items[NODE_LIST_INLINE];
+} NodeBuffer;
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    Atom *heap;
+    Atom inline_items[NODE_LIST_INLINE];
+} AtomBuffer;
+
+/*
+ * The type of a value, as inferred by the type pass (types.h). A type
+ * nothing has constrained stays TYPE_UNKNOWN and is emitted as a long.
+ */
+typedef enum {
+    TYPE_UNKNOWN,
+    TYPE_BOOL,
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_STRING,
+    TYPE_VOID,              /* what print returns */
+    TYPE_ERROR,             /* values of conflicting types met */
+} ValueType;
+
+/* Scope depth of a name the resolver (resolve.h) has not bound */
+#define SCOPE_UNRESOLVED UINT32_MAX
+
 typedef struct ASTNode {
     NodeType type;
-    int line;
+    /*
+     * Input offset of the node's first token. Only top-level statements
+     * hold an absolute offset; nodes inside one are relative to it, so an
+     * edit before a statement moves it without touching its subtree.
+     */
+    uint32_t offset;
     union {
         struct {
-            struct ASTNode **statements;
-            size_t statement_count;
+            NodeList statements;
+            uint32_t locals;        /* slots main needs; set by the resolver */
         } program;
         struct {
             long value;
@@ -62,52 +128,59 @@ typedef struct ASTNode {
             int value;
         } bool_literal;
         struct {
-            char *name;
+            Atom name;
+            /*
+             * Set by the resolver: the depth of the scope the name was
+             * declared in (0 for functions and builtins) and its slot,
+             * an index into the frame of the function it belongs to or,
+             * at depth 0, into the globals.
+             */
+            uint32_t depth;
+            uint32_t slot;
+            ValueType type;         /* of the variable, or what the called function returns */
         } identifier;
         struct {
             struct ASTNode *left;
             struct ASTNode *right;
             OperatorType op;
+            ValueType type;         /* of the result; set by the type pass */
         } binary_op;
         struct {
             struct ASTNode *operand;
             OperatorType op;
+            ValueType type;
         } unary_op;
         struct {
             struct ASTNode *function;
-            struct ASTNode **arguments;
-            size_t argument_count;
+            NodeList arguments;
         } call;
         struct {
             struct ASTNode *condition;
-            struct ASTNode **then_branch;
-            size_t then_count;
-            struct ASTNode **else_branch;
-            size_t else_count;
+            NodeList then_branch;
+            NodeList else_branch;
         } if_stmt;
         struct {
             struct ASTNode *condition;
-            struct ASTNode **body;
-            size_t body_count;
+            NodeList body;
         } while_stmt;
         struct {
-            char *name;
-            char **parameters;
-            size_t param_count;
-            struct ASTNode **body;
-            size_t body_count;
+            Atom name;
+            uint32_t locals;        /* frame slots, parameters first; set by the resolver */
+            AtomList parameters;
+            NodeList body;
         } function_def;
         struct {
             struct ASTNode *value;
         } return_stmt;
         struct {
-            char *name;
+            Atom name;
             struct ASTNode *initializer;
             int is_const;
+            uint32_t slot;          /* set by the resolver */
+            ValueType type;         /* set by the type pass */
         } var_decl;
         struct {
-            struct ASTNode **statements;
-            size_t statement_count;
+            NodeList statements;
         } block;
         struct {
             struct ASTNode *expression;
@@ -119,22 +192,37 @@ ASTNode *ast_create_program(void);
 ASTNode *ast_create_int_literal(long value);
 ASTNode *ast_create_float_literal(double value);
 ASTNode *ast_create_string_literal(const char *value);
+ASTNode *ast_create_string_literal_len(const char *value, size_t length);
 ASTNode *ast_create_bool_literal(int value);
-ASTNode *ast_create_identifier(const char *name);
+ASTNode *ast_create_identifier(Atom name);
 ASTNode *ast_create_binary_op(ASTNode *left, ASTNode *right, OperatorType op);
 ASTNode *ast_create_unary_op(ASTNode *operand, OperatorType op);
-ASTNode *ast_create_call(ASTNode *function, ASTNode **arguments, size_t arg_count);
-ASTNode *ast_create_if(ASTNode *condition, ASTNode **then_branch, size_t then_count,
-                       ASTNode **else_branch, size_t else_count);
-ASTNode *ast_create_while(ASTNode *condition, ASTNode **body, size_t body_count);
-ASTNode *ast_create_function_def(const char *name, char **parameters, size_t param_count,
-                                 ASTNode **body, size_t body_count);
+ASTNode *ast_create_call(ASTNode *function, NodeBuffer *arguments);
+ASTNode *ast_create_if(ASTNode *condition, NodeBuffer *then_branch, NodeBuffer *else_branch);
+ASTNode *ast_create_while(ASTNode *condition, NodeBuffer *body);
+ASTNode *ast_create_function_def(Atom name, AtomBuffer *parameters, NodeBuffer *body);
 ASTNode *ast_create_return(ASTNode *value);
-ASTNode *ast_create_var_decl(const char *name, ASTNode *initializer, int is_const);
-ASTNode *ast_create_block(ASTNode **statements, size_t statement_count);
+ASTNode *ast_create_var_decl(Atom name, ASTNode *initializer, int is_const);
+ASTNode *ast_create_block(NodeBuffer *statements);
 ASTNode *ast_create_expr_stmt(ASTNode *expression);
-void ast_program_add_statement(ASTNode *program, ASTNode *statement);
+bool ast_program_add_statement(ASTNode *program, ASTNode *statement);
+int ast_program_replace(ASTNode *program, size_t start, size_t end, ASTNode **statements, size_t count);
 void ast_destroy(ASTNode *node);
-void ast_print(ASTNode *node, int indent);
+ASTNode *ast_clone(const ASTNode *node);
+size_t ast_child_count(const ASTNode *node);
+ASTNode *ast_child(const ASTNode *node, size_t index);
+bool ast_list_assign(NodeList *list, NodeBuffer *buffer);
+
+ASTNode **node_buffer_items(NodeBuffer *buffer);
+bool node_buffer_push(NodeBuffer *buffer, ASTNode *node);
+void node_buffer_free(NodeBuffer *buffer);
+void node_buffer_destroy(NodeBuffer *buffer);
+bool atom_buffer_push(AtomBuffer *buffer, Atom atom);
+void atom_buffer_free(AtomBuffer *buffer);
+void ast_print(ASTNode *node, LineIndex *lines, int indent);
+const char *ast_operator_text(OperatorType op);
+
+void ast_use_arena(Arena *arena);
+Arena *ast_arena(void);
 
 #endif
@@ -0,0 +1,346 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ast_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "MIRUAST"
+#define CACHE_BYTE_ORDER 0x01020304u
+
+/* Sections of a cache file, in the order they are written */
+enum {
+    SECTION_KINDS,
+    SECTION_OPS,
+    SECTION_OFFSETS,
+    SECTION_DATA,
+    SECTION_EXTRA,
+    SECTION_STRINGS,
+    SECTION_ATOMS,          /* offset of each atom's name in SECTION_ATOM_TEXT, from atom 1 on */
+    SECTION_ATOM_TEXT,
+    SECTION_COUNT,
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    /* CACHE_BYTE_ORDER as the writer stored it */
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint64_t node_count;
+    uint64_t extra_count;
+    uint64_t string_length;
+    uint64_t atom_count;
+    uint64_t atom_text_length;
+    uint32_t root;
+    uint32_t reserved;
+    uint64_t sections[SECTION_COUNT];   /* file offset of each section */
+    uint64_t payload_hash;  /* ast_cache_hash of everything from the first section to the end of the file */
+} CacheHeader;
+
+/* Sections start on 8-byte boundaries so the mapped arrays are aligned */
+#define SECTION_ALIGNMENT 8
+
+static uint64_t align_section(uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) & ~(uint64_t)(SECTION_ALIGNMENT - 1);
+}
+
+static void section_sizes(const CacheHeader *header, uint64_t sizes[SECTION_COUNT]) {
+    sizes[SECTION_KINDS] = header->node_count * sizeof(uint8_t);
+    sizes[SECTION_OPS] = header->node_count * sizeof(uint8_t);
+    sizes[SECTION_OFFSETS] = header->node_count * sizeof(uint32_t);
+    sizes[SECTION_DATA] = header->node_count * sizeof(CompactData);
+    sizes[SECTION_EXTRA] = header->extra_count * sizeof(uint32_t);
+    sizes[SECTION_STRINGS] = header->string_length;
+    sizes[SECTION_ATOMS] = header->atom_count * sizeof(uint32_t);
+    sizes[SECTION_ATOM_TEXT] = header->atom_text_length;
+}
+
+/*
+ * 64-bit hash of a byte string, eight bytes per step. Only used to name
+ * and check cache files, so it is chosen for speed over large sources.
+ */
+uint64_t ast_cache_hash(const void *bytes, size_t length) {
+    const unsigned char *p = bytes;
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, length - i);
+    hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+/* Hash the whole of an open source file; the file position is left alone */
+bool ast_cache_key(int fd, AstCacheKey *key) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    key->length = (uint64_t)info.st_size;
+    if (info.st_size == 0) {
+        key->hash = ast_cache_hash("", 0);
+        return true;
+    }
+    void *bytes = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (bytes == MAP_FAILED) {
+        return false;
+    }
+    key->hash = ast_cache_hash(bytes, (size_t)info.st_size);
+    munmap(bytes, (size_t)info.st_size);
+    return true;
+}
+
+/* "<dir>/<hash>.ast"; the caller frees it */
+static char *cache_path(const char *dir, const AstCacheKey *key, const char *suffix) {
+    size_t size = strlen(dir) + 40 + strlen(suffix);
+    char *path = malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/%016llx.ast%s", dir, (unsigned long long)key->hash, suffix);
+    }
+    return path;
+}
+
+/* Check a mapped file's header against the key and the file size */
+static bool header_valid(const CacheHeader *header, size_t file_size, const AstCacheKey *key) {
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != AST_CACHE_VERSION || header->byte_order != CACHE_BYTE_ORDER ||
+        header->source_hash != key->hash || header->source_length != key->length ||
+        header->node_count < 2 || header->node_count > UINT32_MAX ||
+        header->root == NODE_REF_NONE || header->root >= header->node_count) {
+        return false;
+    }
+    uint64_t sizes[SECTION_COUNT];
+    section_sizes(header, sizes);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        uint64_t start = header->sections[i];
+        if (start % SECTION_ALIGNMENT != 0 || start < sizeof(CacheHeader) || start > file_size ||
+            sizes[i] > file_size - start) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The hash of what follows the header, padding included */
+static uint64_t payload_hash(const char *base, size_t file_size) {
+    size_t start = (size_t)align_section(sizeof(CacheHeader));
+    return ast_cache_hash(base + start, file_size > start ? file_size - start : 0);
+}
+
+/*
+ * Intern the file's atom names. They were written in the order the
+ * writer interned them, so in a process that has interned nothing else
+ * they get the same atoms and the mapped nodes can use them unchanged.
+ * Any difference makes the file a miss.
+ */
+static bool atoms_match(const CacheHeader *header, const char *base) {
+    const uint32_t *offsets = (const uint32_t *)(const void *)(base + header->sections[SECTION_ATOMS]);
+    const char *text = base + header->sections[SECTION_ATOM_TEXT];
+    if (header->atom_count > 0 && (header->atom_text_length == 0 || text[header->atom_text_length - 1] != '\0')) {
+        return false;
+    }
+    for (uint64_t i = 0; i < header->atom_count; i++) {
+        if (offsets[i] >= header->atom_text_length) {
+            return false;
+        }
+        const char *name = text + offsets[i];
+        if (atom_intern(name, strlen(name)) != (Atom)(i + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The cached tree for a source, or NULL on a miss */
+MappedAst *ast_cache_load(const char *dir, const AstCacheKey *key) {
+    char *path = cache_path(dir, key, "");
+    int fd = path ? open(path, O_RDONLY) : -1;
+    free(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(CacheHeader)) {
+        map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    size_t size = (size_t)info.st_size;
+    const CacheHeader *header = map;
+    const char *base = map;
+    MappedAst *mapped = NULL;
+    /* A file damaged after it was written fails the payload hash */
+    if (header_valid(header, size, key) && header->payload_hash == payload_hash(base, size) &&
+        atoms_match(header, base)) {
+        mapped = malloc(sizeof(MappedAst));
+    }
+    if (!mapped) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    /* The arrays are only read; the casts drop the const the mapping would need */
+    CompactAst *ast = &mapped->ast;
+    ast->kinds = (uint8_t *)(base + header->sections[SECTION_KINDS]);
+    ast->ops = (uint8_t *)(base + header->sections[SECTION_OPS]);
+    ast->offsets = (uint32_t *)(void *)(base + header->sections[SECTION_OFFSETS]);
+    ast->data = (CompactData *)(void *)(base + header->sections[SECTION_DATA]);
+    ast->count = (size_t)header->node_count;
+    ast->extra = (uint32_t *)(void *)(base + header->sections[SECTION_EXTRA]);
+    ast->extra_count = (size_t)header->extra_count;
+    ast->strings = (char *)(base + header->sections[SECTION_STRINGS]);
+    ast->string_length = (size_t)header->string_length;
+    ast->root = header->root;
+    mapped->map = map;
+    mapped->map_size = size;
+
+    /* A corrupted tree is a miss too, not a crash later */
+    if (!compact_ast_valid(ast, (size_t)header->atom_count)) {
+        ast_cache_unmap(mapped);
+        return NULL;
+    }
+    return mapped;
+}
+
+void ast_cache_unmap(MappedAst *mapped) {
+    if (mapped) {
+        munmap(mapped->map, mapped->map_size);
+        free(mapped);
+    }
+}
+
+/* Write `size` bytes at `offset`, padding with zeros from the current position */
+static bool write_section(FILE *file, uint64_t *position, uint64_t offset, const void *bytes, uint64_t size) {
+    static const char zeros[SECTION_ALIGNMENT];
+    if (offset - *position > 0 && fwrite(zeros, 1, (size_t)(offset - *position), file) != offset - *position) {
+        return false;
+    }
+    if (size > 0 && fwrite(bytes, 1, (size_t)size, file) != size) {
+        return false;
+    }
+    *position = offset + size;
+    return true;
+}
+
+/*
+ * Hash what has been written after the header and write the header with
+ * the hash; false if the file cannot be read back or written
+ */
+static bool write_header(FILE *file, CacheHeader *header, uint64_t size) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    header->payload_hash = payload_hash(map, (size_t)size);
+    munmap(map, (size_t)size);
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(header, sizeof(*header), 1, file) == 1;
+}
+
+/*
+ * Write a tree to the cache. The file is written under a temporary name
+ * of its own (mkstemp), so builds storing the same source at once do not
+ * write over each other, and renamed into place, so a reader never maps
+ * a half-written file. Atom names are the whole atom table, in order;
+ * see atoms_match().
+ */
+bool ast_cache_store(const char *dir, const AstCacheKey *key, const CompactAst *ast) {
+    if (!ast || ast->count < 2 || (mkdir(dir, 0777) != 0 && errno != EEXIST)) {
+        return false;
+    }
+
+    size_t atom_total = atom_count();
+    size_t atoms = atom_total > 0 ? atom_total - 1 : 0;
+    uint32_t *atom_offsets = malloc((atoms > 0 ? atoms : 1) * sizeof(uint32_t));
+    if (!atom_offsets) {
+        return false;
+    }
+    uint64_t atom_text_length = 0;
+    for (size_t i = 0; i < atoms; i++) {
+        atom_offsets[i] = (uint32_t)atom_text_length;
+        atom_text_length += atom_length((Atom)(i + 1)) + 1;
+    }
+    if (atom_text_length > UINT32_MAX) {
+        free(atom_offsets);
+        return false;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = AST_CACHE_VERSION;
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.source_hash = key->hash;
+    header.source_length = key->length;
+    header.node_count = ast->count;
+    header.extra_count = ast->extra_count;
+    header.string_length = ast->string_length;
+    header.atom_count = atoms;
+    header.atom_text_length = atom_text_length;
+    header.root = ast->root;
+
+    uint64_t sizes[SECTION_COUNT];
+    section_sizes(&header, sizes);
+    uint64_t offset = align_section(sizeof(CacheHeader));
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        header.sections[i] = offset;
+        offset = align_section(offset + sizes[i]);
+    }
+
+    char *temporary = cache_path(dir, key, ".XXXXXX");
+    char *path = cache_path(dir, key, "");
+    int fd = temporary && path ? mkstemp(temporary) : -1;
+    FILE *file = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+    if (fd >= 0 && !file) {
+        close(fd);
+        remove(temporary);
+    }
+    /* mkstemp makes the file private; a cache file is readable like any other */
+    bool ok = file != NULL && fchmod(fd, 0644) == 0;
+    uint64_t position = 0;
+    ok = ok && write_section(file, &position, 0, &header, sizeof(header));
+    ok = ok && write_section(file, &position, header.sections[SECTION_KINDS], ast->kinds, sizes[SECTION_KINDS]);
+    ok = ok && write_section(file, &position, header.sections[SECTION_OPS], ast->ops, sizes[SECTION_OPS]);
+    ok = ok && write_section(file, &position, header.sections[SECTION_OFFSETS], ast->offsets, sizes[SECTION_OFFSETS]);
+    ok = ok && write_section(file, &position, header.sections[SECTION_DATA], ast->data, sizes[SECTION_DATA]);
+    ok = ok && write_section(file, &position, header.sections[SECTION_EXTRA], ast->extra, sizes[SECTION_EXTRA]);
+    ok = ok && write_section(file, &position, header.sections[SECTION_STRINGS], ast->strings, sizes[SECTION_STRINGS]);
+    ok = ok && write_section(file, &position, header.sections[SECTION_ATOMS], atom_offsets, sizes[SECTION_ATOMS]);
+    for (size_t i = 0; ok && i < atoms; i++) {
+        /* Each name with its NUL */
+        ok = write_section(file, &position, i == 0 ? header.sections[SECTION_ATOM_TEXT] : position,
+                           atom_name((Atom)(i + 1)), atom_length((Atom)(i + 1)) + 1);
+    }
+    free(atom_offsets);
+    ok = ok && write_header(file, &header, position);
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    if (ok) {
+        ok = rename(temporary, path) == 0;
+    }
+    if (!ok && file) {
+        remove(temporary);
+    }
+    free(temporary);
+    free(path);
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef AST_CACHE_H
+#define AST_CACHE_H
+
+#include "ast_compact.h"
+
+/*
+ * On-disk cache of parsed programs. A file in the cache directory holds
+ * a CompactAst exactly as it is laid out in memory: a header, then the
+ * node arrays, the child lists, the string text and the names of the
+ * atoms, each at a file offset recorded in the header. Nothing in it is a
+ * pointer, so a hit is an mmap and the arrays are used where they lie.
+ *
+ * Files are named after a hash of the source bytes. The header repeats
+ * the hash and the source length, carries AST_CACHE_VERSION and a hash
+ * of the rest of the file; a file that does not match on any of them, or
+ * that cannot be read, is a miss and the source is parsed as usual. So
+ * is a file whose tree fails compact_ast_valid(), which makes a damaged
+ * file a miss rather than a crash; it cannot tell a changed encoding from a valid one, so the
+ * version must still change with NodeType, OperatorType or the compact
+ * encoding.
+ */
+#define AST_CACHE_VERSION 2
+
+/* What a cache file is looked up by */
+typedef struct {
+    uint64_t hash;
+    uint64_t length;
+} AstCacheKey;
+
+/* A cached tree; `ast` points into the mapping and lives until ast_cache_unmap */
+typedef struct {
+    CompactAst ast;
+    void *map;
+    size_t map_size;
+} MappedAst;
+
+uint64_t ast_cache_hash(const void *bytes, size_t length);
+bool ast_cache_key(int fd, AstCacheKey *key);
+MappedAst *ast_cache_load(const char *dir, const AstCacheKey *key);
+bool ast_cache_store(const char *dir, const AstCacheKey *key, const CompactAst *ast);
+void ast_cache_unmap(MappedAst *mapped);
+
+#endif
@@ -0,0 +1,849 @@
+#include "ast_compact.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Where a node's index goes: the root, a payload word of its parent, or an item of a list in `extra` */
+typedef enum {
+    SLOT_ROOT,
+    SLOT_A,
+    SLOT_B,
+    SLOT_EXTRA,
+} SlotKind;
+
+/*
+ * A node still to be lowered. `statement` is the top-level statement the
+ * node's offset is relative to; `slot` is the parent node or the `extra`
+ * index that gets the node's index once it has one.
+ */
+typedef struct {
+    const ASTNode *node;
+    const ASTNode *statement;
+    uint32_t slot;
+    SlotKind slot_kind;
+} BuildItem;
+
+/* Lowering state: the tree being filled, the room in its arrays and the nodes still to lower */
+typedef struct {
+    CompactAst *ast;
+    size_t node_capacity;
+    size_t extra_capacity;
+    size_t string_capacity;
+    BuildItem *items;
+    size_t count;
+    size_t capacity;
+} Builder;
+
+static bool build_push(Builder *builder, const ASTNode *node, const ASTNode *statement,
+                       uint32_t slot, SlotKind slot_kind) {
+    if (!node) {
+        return true;
+    }
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 64;
+        BuildItem *items = realloc(builder->items, capacity * sizeof(BuildItem));
+        if (!items) {
+            return false;
+        }
+        builder->items = items;
+        builder->capacity = capacity;
+    }
+    BuildItem *item = &builder->items[builder->count++];
+    item->node = node;
+    item->statement = statement;
+    item->slot = slot;
+    item->slot_kind = slot_kind;
+    return true;
+}
+
+/* The stack pops last-in first, so lists go on back to front; item i goes to extra[at + 1 + i] */
+static bool build_push_list(Builder *builder, const NodeList *list, const ASTNode *statement, uint32_t at) {
+    for (size_t i = list->count; i > 0; i--) {
+        if (!build_push(builder, list->items[i - 1], statement, at + (uint32_t)i, SLOT_EXTRA)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Grow an array to hold at least `needed` elements, doubling; false if out of memory or too big */
+static bool reserve(void **array, size_t *capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    if (needed > UINT32_MAX) {
+        return false;
+    }
+    size_t new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+/* Room for one more node in each of the per-node arrays, which grow together */
+static bool reserve_node(Builder *builder) {
+    CompactAst *ast = builder->ast;
+    if (ast->count < builder->node_capacity) {
+        return true;
+    }
+    size_t capacity = builder->node_capacity ? builder->node_capacity * 2 : 1024;
+    if (capacity - 1 > UINT32_MAX) {
+        return false;
+    }
+    uint8_t *kinds = realloc(ast->kinds, capacity * sizeof(uint8_t));
+    if (kinds) {
+        ast->kinds = kinds;
+    }
+    uint8_t *ops = realloc(ast->ops, capacity * sizeof(uint8_t));
+    if (ops) {
+        ast->ops = ops;
+    }
+    uint32_t *offsets = realloc(ast->offsets, capacity * sizeof(uint32_t));
+    if (offsets) {
+        ast->offsets = offsets;
+    }
+    CompactData *data = realloc(ast->data, capacity * sizeof(CompactData));
+    if (data) {
+        ast->data = data;
+    }
+    if (!kinds || !ops || !offsets || !data) {
+        return false;
+    }
+    builder->node_capacity = capacity;
+    return true;
+}
+
+/* Start a list of `count` items in `extra`; returns where it starts, or UINT32_MAX if out of memory */
+static uint32_t begin_list(Builder *builder, size_t count) {
+    CompactAst *ast = builder->ast;
+    if (!reserve((void **)&ast->extra, &builder->extra_capacity, ast->extra_count + 1 + count, sizeof(uint32_t))) {
+        return UINT32_MAX;
+    }
+    uint32_t at = (uint32_t)ast->extra_count;
+    ast->extra[at] = (uint32_t)count;
+    memset(&ast->extra[at + 1], 0, count * sizeof(uint32_t));
+    ast->extra_count += 1 + count;
+    return at;
+}
+
+/* Give a node the next index and fill in its arrays; its children are queued in pre-order */
+static bool lower(Builder *builder, const BuildItem *item) {
+    CompactAst *ast = builder->ast;
+    if (!reserve_node(builder)) {
+        return false;
+    }
+    const ASTNode *node = item->node;
+    NodeRef ref = (NodeRef)ast->count++;
+    switch (item->slot_kind) {
+        case SLOT_ROOT: ast->root = ref; break;
+        case SLOT_A: ast->data[item->slot].a = ref; break;
+        case SLOT_B: ast->data[item->slot].b = ref; break;
+        case SLOT_EXTRA: ast->extra[item->slot] = ref; break;
+    }
+
+    const ASTNode *statement = item->statement;
+    ast->kinds[ref] = (uint8_t)node->type;
+    ast->ops[ref] = 0;
+    ast->offsets[ref] = statement ? statement->offset + node->offset : node->offset;
+    CompactData *data = &ast->data[ref];
+    data->a = NODE_REF_NONE;
+    data->b = NODE_REF_NONE;
+
+    /* Offsets below a top-level statement are relative to it */
+    const ASTNode *inner = statement || node->type == NODE_PROGRAM ? statement : node;
+    uint32_t at;
+    uint64_t bits;
+
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK: {
+            const NodeList *statements = node->type == NODE_PROGRAM ? &node->data.program.statements
+                                                                    : &node->data.block.statements;
+            data->a = at = begin_list(builder, statements->count);
+            return at != UINT32_MAX && build_push_list(builder, statements, inner, at);
+        }
+
+        case NODE_EXPRESSION_STMT:
+            return build_push(builder, node->data.expr_stmt.expression, inner, ref, SLOT_A);
+
+        case NODE_INT_LITERAL:
+            bits = (uint64_t)(int64_t)node->data.int_literal.value;
+            data->a = (uint32_t)bits;
+            data->b = (uint32_t)(bits >> 32);
+            return true;
+
+        case NODE_FLOAT_LITERAL:
+            memcpy(&bits, &node->data.float_literal.value, sizeof(bits));
+            data->a = (uint32_t)bits;
+            data->b = (uint32_t)(bits >> 32);
+            return true;
+
+        case NODE_STRING_LITERAL: {
+            size_t length = strlen(node->data.string_literal.value);
+            if (!reserve((void **)&ast->strings, &builder->string_capacity, ast->string_length + length + 1, 1)) {
+                return false;
+            }
+            data->a = (uint32_t)ast->string_length;
+            data->b = (uint32_t)length;
+            memcpy(ast->strings + ast->string_length, node->data.string_literal.value, length + 1);
+            ast->string_length += length + 1;
+            return true;
+        }
+
+        case NODE_BOOL_LITERAL:
+            data->a = (uint32_t)node->data.bool_literal.value;
+            return true;
+
+        case NODE_IDENTIFIER:
+            data->a = node->data.identifier.name;
+            return true;
+
+        case NODE_BINARY_OP:
+            ast->ops[ref] = (uint8_t)node->data.binary_op.op;
+            return build_push(builder, node->data.binary_op.right, inner, ref, SLOT_B) &&
+                   build_push(builder, node->data.binary_op.left, inner, ref, SLOT_A);
+
+        case NODE_UNARY_OP:
+            ast->ops[ref] = (uint8_t)node->data.unary_op.op;
+            return build_push(builder, node->data.unary_op.operand, inner, ref, SLOT_A);
+
+        case NODE_CALL:
+            data->b = at = begin_list(builder, node->data.call.arguments.count);
+            return at != UINT32_MAX &&
+                   build_push_list(builder, &node->data.call.arguments, inner, at) &&
+                   build_push(builder, node->data.call.function, inner, ref, SLOT_A);
+
+        case NODE_IF: {
+            data->b = at = begin_list(builder, node->data.if_stmt.then_branch.count);
+            uint32_t else_at = at != UINT32_MAX ? begin_list(builder, node->data.if_stmt.else_branch.count)
+                                                : UINT32_MAX;
+            return else_at != UINT32_MAX &&
+                   build_push_list(builder, &node->data.if_stmt.else_branch, inner, else_at) &&
+                   build_push_list(builder, &node->data.if_stmt.then_branch, inner, at) &&
+                   build_push(builder, node->data.if_stmt.condition, inner, ref, SLOT_A);
+        }
+
+        case NODE_WHILE:
+            data->b = at = begin_list(builder, node->data.while_stmt.body.count);
+            return at != UINT32_MAX &&
+                   build_push_list(builder, &node->data.while_stmt.body, inner, at) &&
+                   build_push(builder, node->data.while_stmt.condition, inner, ref, SLOT_A);
+
+        case NODE_FUNCTION_DEF: {
+            const AtomList *parameters = &node->data.function_def.parameters;
+            data->a = node->data.function_def.name;
+            data->b = at = begin_list(builder, parameters->count);
+            if (at == UINT32_MAX) {
+                return false;
+            }
+            if (parameters->count > 0) {
+                memcpy(&ast->extra[at + 1], parameters->items, parameters->count * sizeof(Atom));
+            }
+            at = begin_list(builder, node->data.function_def.body.count);
+            return at != UINT32_MAX && build_push_list(builder, &node->data.function_def.body, inner, at);
+        }
+
+        case NODE_RETURN:
+            return build_push(builder, node->data.return_stmt.value, inner, ref, SLOT_A);
+
+        case NODE_VAR_DECL:
+            ast->ops[ref] = (uint8_t)(node->data.var_decl.is_const != 0);
+            data->a = node->data.var_decl.name;
+            return build_push(builder, node->data.var_decl.initializer, inner, ref, SLOT_B);
+
+        default:
+            return true;
+    }
+}
+
+/*
+ * Lower a pointer AST (a program or a single top-level statement) into
+ * compact form in one pre-order pass; the pointer AST is left as it is.
+ * Returns NULL if out of memory or the tree needs more than 2^32 nodes.
+ */
+CompactAst *compact_ast_build(const ASTNode *root) {
+    if (!root) {
+        return NULL;
+    }
+    CompactAst *ast = calloc(1, sizeof(CompactAst));
+    if (!ast) {
+        return NULL;
+    }
+    Builder builder = { ast, 0, 0, 0, NULL, 0, 0 };
+
+    /* Slot 0 stands for "no node" */
+    bool ok = reserve_node(&builder);
+    if (ok) {
+        ast->kinds[0] = (uint8_t)NODE_PROGRAM;
+        ast->ops[0] = 0;
+        ast->offsets[0] = 0;
+        ast->data[0].a = NODE_REF_NONE;
+        ast->data[0].b = NODE_REF_NONE;
+        ast->count = 1;
+        ok = build_push(&builder, root, NULL, 0, SLOT_ROOT);
+    }
+    while (ok && builder.count > 0) {
+        BuildItem item = builder.items[--builder.count];
+        ok = lower(&builder, &item);
+    }
+    free(builder.items);
+    if (!ok) {
+        compact_ast_destroy(ast);
+        return NULL;
+    }
+    return ast;
+}
+
+void compact_ast_destroy(CompactAst *ast) {
+    if (ast) {
+        free(ast->kinds);
+        free(ast->ops);
+        free(ast->offsets);
+        free(ast->data);
+        free(ast->extra);
+        free(ast->strings);
+        free(ast);
+    }
+}
+
+CompactList compact_ast_list(const CompactAst *ast, uint32_t at) {
+    CompactList list;
+    list.count = ast->extra[at];
+    list.items = &ast->extra[at + 1];
+    list.end = at + 1 + list.count;
+    return list;
+}
+
+long compact_ast_int(const CompactAst *ast, NodeRef node) {
+    uint64_t bits = (uint64_t)ast->data[node].b << 32 | ast->data[node].a;
+    return (long)(int64_t)bits;
+}
+
+double compact_ast_float(const CompactAst *ast, NodeRef node) {
+    uint64_t bits = (uint64_t)ast->data[node].b << 32 | ast->data[node].a;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* A node built by compact_ast_expand, handed to its parent; the slot is cleared so it is freed only once */
+static ASTNode *take(ASTNode **nodes, NodeRef ref) {
+    ASTNode *node = nodes[ref];
+    nodes[ref] = NULL;
+    return node;
+}
+
+/* Take the built nodes of a list into a buffer; on failure they are destroyed */
+static bool take_list(ASTNode **nodes, CompactList list, NodeBuffer *buffer) {
+    for (uint32_t i = 0; i < list.count; i++) {
+        if (!node_buffer_push(buffer, nodes[list.items[i]])) {
+            node_buffer_destroy(buffer);
+            return false;
+        }
+        nodes[list.items[i]] = NULL;
+    }
+    return true;
+}
+
+/* Build the pointer node for `ref`; its children are already in `nodes` */
+static ASTNode *expand_node(const CompactAst *ast, ASTNode **nodes, NodeRef ref) {
+    const CompactData *data = &ast->data[ref];
+    NodeBuffer first = {0};
+    NodeBuffer second = {0};
+    CompactList list;
+
+    switch ((NodeType)ast->kinds[ref]) {
+        case NODE_PROGRAM: {
+            ASTNode *program = ast_create_program();
+            list = compact_ast_list(ast, data->a);
+            for (uint32_t i = 0; program && i < list.count; i++) {
+                if (!ast_program_add_statement(program, nodes[list.items[i]])) {
+                    ast_destroy(program);
+                    return NULL;
+                }
+                nodes[list.items[i]] = NULL;
+            }
+            return program;
+        }
+
+        case NODE_EXPRESSION_STMT:
+            return ast_create_expr_stmt(take(nodes, data->a));
+
+        case NODE_INT_LITERAL:
+            return ast_create_int_literal(compact_ast_int(ast, ref));
+
+        case NODE_FLOAT_LITERAL:
+            return ast_create_float_literal(compact_ast_float(ast, ref));
+
+        case NODE_STRING_LITERAL:
+            return ast_create_string_literal_len(ast->strings + data->a, data->b);
+
+        case NODE_BOOL_LITERAL:
+            return ast_create_bool_literal((int)data->a);
+
+        case NODE_IDENTIFIER:
+            return ast_create_identifier(data->a);
+
+        case NODE_BINARY_OP: {
+            ASTNode *left = take(nodes, data->a);
+            return ast_create_binary_op(left, take(nodes, data->b), (OperatorType)ast->ops[ref]);
+        }
+
+        case NODE_UNARY_OP:
+            return ast_create_unary_op(take(nodes, data->a), (OperatorType)ast->ops[ref]);
+
+        case NODE_CALL:
+            if (!take_list(nodes, compact_ast_list(ast, data->b), &first)) {
+                return NULL;
+            }
+            return ast_create_call(take(nodes, data->a), &first);
+
+        case NODE_IF:
+            list = compact_ast_list(ast, data->b);
+            if (!take_list(nodes, list, &first)) {
+                return NULL;
+            }
+            if (!take_list(nodes, compact_ast_list(ast, list.end), &second)) {
+                node_buffer_destroy(&first);
+                return NULL;
+            }
+            return ast_create_if(take(nodes, data->a), &first, &second);
+
+        case NODE_WHILE:
+            if (!take_list(nodes, compact_ast_list(ast, data->b), &first)) {
+                return NULL;
+            }
+            return ast_create_while(take(nodes, data->a), &first);
+
+        case NODE_FUNCTION_DEF: {
+            AtomBuffer parameters = {0};
+            list = compact_ast_list(ast, data->b);
+            for (uint32_t i = 0; i < list.count; i++) {
+                if (!atom_buffer_push(&parameters, list.items[i])) {
+                    atom_buffer_free(&parameters);
+                    return NULL;
+                }
+            }
+            if (!take_list(nodes, compact_ast_list(ast, list.end), &first)) {
+                atom_buffer_free(&parameters);
+                return NULL;
+            }
+            return ast_create_function_def(data->a, &parameters, &first);
+        }
+
+        case NODE_RETURN:
+            return ast_create_return(take(nodes, data->a));
+
+        case NODE_VAR_DECL:
+            return ast_create_var_decl(data->a, take(nodes, data->b), ast->ops[ref]);
+
+        case NODE_BLOCK:
+            if (!take_list(nodes, compact_ast_list(ast, data->a), &first)) {
+                return NULL;
+            }
+            return ast_create_block(&first);
+
+        default:
+            return NULL;
+    }
+}
+
+/* Checks of one compact_ast_valid() pass; `parents` counts the references to each node */
+typedef struct {
+    const CompactAst *ast;
+    size_t atom_count;
+    uint8_t *parents;
+} Validator;
+
+static bool is_expression(NodeType kind) {
+    switch (kind) {
+        case NODE_INT_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_STRING_LITERAL:
+        case NODE_BOOL_LITERAL:
+        case NODE_IDENTIFIER:
+        case NODE_BINARY_OP:
+        case NODE_UNARY_OP:
+        case NODE_CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * A child: a node after its parent, which expansion then builds first,
+ * that no other node has as a child, and an expression where one is
+ * expected; `optional` allows none.
+ */
+static bool valid_child(Validator *validator, NodeRef parent, NodeRef child, bool expression, bool optional) {
+    const CompactAst *ast = validator->ast;
+    if (child == NODE_REF_NONE) {
+        return optional;
+    }
+    if (child <= parent || child >= ast->count || validator->parents[child]++ > 0) {
+        return false;
+    }
+    NodeType kind = (NodeType)ast->kinds[child];
+    return expression ? is_expression(kind) : kind != NODE_PROGRAM && !is_expression(kind);
+}
+
+static bool valid_atom(const Validator *validator, Atom atom) {
+    return atom != ATOM_NONE && atom <= validator->atom_count;
+}
+
+/* A list at `at` that fits in `extra`, of children or atoms; *end is where the list after it starts */
+static bool valid_list(Validator *validator, NodeRef parent, uint32_t at, bool expressions, bool atoms,
+                       uint32_t *end) {
+    const CompactAst *ast = validator->ast;
+    if (at >= ast->extra_count || ast->extra[at] > ast->extra_count - at - 1) {
+        return false;
+    }
+    CompactList list = compact_ast_list(ast, at);
+    for (uint32_t i = 0; i < list.count; i++) {
+        if (atoms ? !valid_atom(validator, list.items[i])
+                  : !valid_child(validator, parent, list.items[i], expressions, false)) {
+            return false;
+        }
+    }
+    if (end) {
+        *end = list.end;
+    }
+    return true;
+}
+
+static bool valid_node(Validator *validator, NodeRef ref) {
+    const CompactAst *ast = validator->ast;
+    const CompactData *data = &ast->data[ref];
+    uint32_t end;
+
+    switch ((NodeType)ast->kinds[ref]) {
+        case NODE_PROGRAM:
+            return ref == ast->root && valid_list(validator, ref, data->a, false, false, NULL);
+
+        case NODE_BLOCK:
+            return valid_list(validator, ref, data->a, false, false, NULL);
+
+        case NODE_EXPRESSION_STMT:
+            return valid_child(validator, ref, data->a, true, false);
+
+        case NODE_INT_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_BOOL_LITERAL:
+            return true;
+
+        case NODE_STRING_LITERAL:
+            return data->a < ast->string_length && data->b < ast->string_length - data->a &&
+                   ast->strings[data->a + data->b] == '\0';
+
+        case NODE_IDENTIFIER:
+            return valid_atom(validator, data->a);
+
+        case NODE_BINARY_OP:
+            return ast->ops[ref] <= OP_ASSIGN && valid_child(validator, ref, data->a, true, false) &&
+                   valid_child(validator, ref, data->b, true, false);
+
+        case NODE_UNARY_OP:
+            return ast->ops[ref] <= OP_ASSIGN && valid_child(validator, ref, data->a, true, false);
+
+        case NODE_CALL:
+            return valid_child(validator, ref, data->a, true, false) &&
+                   valid_list(validator, ref, data->b, true, false, NULL);
+
+        case NODE_IF:
+            return valid_child(validator, ref, data->a, true, false) &&
+                   valid_list(validator, ref, data->b, false, false, &end) &&
+                   valid_list(validator, ref, end, false, false, NULL);
+
+        case NODE_WHILE:
+            return valid_child(validator, ref, data->a, true, false) &&
+                   valid_list(validator, ref, data->b, false, false, NULL);
+
+        case NODE_FUNCTION_DEF:
+            return valid_atom(validator, data->a) && valid_list(validator, ref, data->b, false, true, &end) &&
+                   valid_list(validator, ref, end, false, false, NULL);
+
+        case NODE_RETURN:
+            return valid_child(validator, ref, data->a, true, true);
+
+        case NODE_VAR_DECL:
+            return valid_atom(validator, data->a) && valid_child(validator, ref, data->b, true, false);
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * Check, in one pass over the nodes, that a compact AST read from outside
+ * the process expands to a tree the passes can walk: every kind and
+ * operator is known, every child comes after its parent and has no other,
+ * every list fits in `extra`, every string in `strings`, and every atom
+ * is one of atoms 1 to `atom_count`. Returns false if out of memory.
+ */
+bool compact_ast_valid(const CompactAst *ast, size_t atom_count) {
+    if (!ast || ast->count < 2 || ast->root == NODE_REF_NONE || ast->root >= ast->count) {
+        return false;
+    }
+    Validator validator = { ast, atom_count, calloc(ast->count, 1) };
+    bool valid = validator.parents != NULL;
+    for (NodeRef ref = ast->root; valid && ref < ast->count; ref++) {
+        valid = valid_node(&validator, ref);
+    }
+    free(validator.parents);
+    return valid;
+}
+
+/*
+ * Build a pointer AST from a compact one, in the current AST arena if
+ * there is one. Nodes are numbered in pre-order, so going from the last
+ * index to the first meets every child before its parent and no stack is
+ * needed. Offsets are made relative to the top-level statement again.
+ * Returns NULL if out of memory.
+ */
+ASTNode *compact_ast_expand(const CompactAst *ast) {
+    if (!ast || ast->root == NODE_REF_NONE) {
+        return NULL;
+    }
+    ASTNode **nodes = calloc(ast->count, sizeof(ASTNode *));
+    if (!nodes) {
+        return NULL;
+    }
+
+    /* The top-level statements, walked backwards alongside the nodes to know what each is inside */
+    CompactList statements = { &ast->root, 1, 0 };
+    if ((NodeType)ast->kinds[ast->root] == NODE_PROGRAM) {
+        statements = compact_ast_list(ast, ast->data[ast->root].a);
+    }
+    size_t statement = statements.count;
+
+    bool ok = true;
+    size_t ref = ast->count;
+    while (ok && --ref >= ast->root) {
+        ASTNode *node = expand_node(ast, nodes, (NodeRef)ref);
+        ok = node != NULL;
+        if (!ok) {
+            break;
+        }
+        while (statement > 0 && statements.items[statement - 1] > ref) {
+            statement--;
+        }
+        uint32_t base = 0;
+        if (statement > 0 && statements.items[statement - 1] < ref) {
+            base = ast->offsets[statements.items[statement - 1]];
+        }
+        node->offset = ast->offsets[ref] - base;
+        nodes[ref] = node;
+    }
+
+    ASTNode *root = ok ? take(nodes, ast->root) : NULL;
+    for (size_t i = 0; i < ast->count; i++) {
+        ast_destroy(nodes[i]);
+    }
+    free(nodes);
+    return root;
+}
+
+/* One line still to print, as in ast_print: a node, or a section header when `label` is set */
+typedef struct {
+    NodeRef node;
+    int indent;
+    const char *label;
+    size_t count;
+} CompactPrintItem;
+
+typedef struct {
+    CompactPrintItem *items;
+    size_t count;
+    size_t capacity;
+} CompactPrintStack;
+
+static void print_push(CompactPrintStack *stack, NodeRef node, int indent, const char *label, size_t count) {
+    if (stack->count == stack->capacity) {
+        size_t capacity = stack->capacity ? stack->capacity * 2 : 64;
+        CompactPrintItem *items = realloc(stack->items, capacity * sizeof(CompactPrintItem));
+        if (!items) {
+            return;
+        }
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+    CompactPrintItem *item = &stack->items[stack->count++];
+    item->node = node;
+    item->indent = indent;
+    item->label = label;
+    item->count = count;
+}
+
+static void print_push_list(CompactPrintStack *stack, CompactList list, int indent) {
+    for (size_t i = list.count; i > 0; i--) {
+        print_push(stack, list.items[i - 1], indent, NULL, 0);
+    }
+}
+
+static void print_indent(int indent) {
+    for (int i = 0; i < indent; i++) {
+        printf("  ");
+    }
+}
+
+static const char *op_to_string(uint8_t op) {
+    static const char *names[] = {
+        [OP_ADD] = "+", [OP_SUB] = "-", [OP_MUL] = "*", [OP_DIV] = "/", [OP_MOD] = "%",
+        [OP_EQ] = "==", [OP_NE] = "!=", [OP_LT] = "<", [OP_LE] = "<=", [OP_GT] = ">",
+        [OP_GE] = ">=", [OP_AND] = "&&", [OP_OR] = "||", [OP_NOT] = "!", [OP_ASSIGN] = "=",
+    };
+    return op < sizeof(names) / sizeof(names[0]) && names[op] ? names[op] : "?";
+}
+
+/* Print one node's line and queue its children; same output as print_node in ast.c */
+static void print_node(const CompactAst *ast, CompactPrintStack *stack, NodeRef node, LineIndex *lines, int indent) {
+    print_indent(indent);
+    if (node == NODE_REF_NONE) {
+        printf("(null)\n");
+        return;
+    }
+
+    const CompactData *data = &ast->data[node];
+    int line = lines ? line_index_lookup(lines, ast->offsets[node]).line : 0;
+    CompactList list;
+
+    switch ((NodeType)ast->kinds[node]) {
+        case NODE_PROGRAM:
+            printf("PROGRAM [line %d]\n", line);
+            print_push_list(stack, compact_ast_list(ast, data->a), indent + 1);
+            break;
+
+        case NODE_INT_LITERAL:
+            printf("INT: %ld [line %d]\n", compact_ast_int(ast, node), line);
+            break;
+
+        case NODE_FLOAT_LITERAL:
+            printf("FLOAT: %f [line %d]\n", compact_ast_float(ast, node), line);
+            break;
+
+        case NODE_STRING_LITERAL:
+            printf("STRING: \"%s\" [line %d]\n", ast->strings + data->a, line);
+            break;
+
+        case NODE_BOOL_LITERAL:
+            printf("BOOL: %s [line %d]\n", data->a ? "true" : "false", line);
+            break;
+
+        case NODE_IDENTIFIER:
+            printf("IDENTIFIER: %s [line %d]\n", atom_name(data->a), line);
+            break;
+
+        case NODE_BINARY_OP:
+            printf("BINARY_OP: %s [line %d]\n", op_to_string(ast->ops[node]), line);
+            print_push(stack, data->b, indent + 1, NULL, 0);
+            print_push(stack, data->a, indent + 1, NULL, 0);
+            break;
+
+        case NODE_UNARY_OP:
+            printf("UNARY_OP: %s [line %d]\n", op_to_string(ast->ops[node]), line);
+            print_push(stack, data->a, indent + 1, NULL, 0);
+            break;
+
+        case NODE_CALL:
+            printf("CALL [line %d]\n", line);
+            list = compact_ast_list(ast, data->b);
+            print_push_list(stack, list, indent + 2);
+            print_push(stack, NODE_REF_NONE, indent + 1, "Arguments (%zu):\n", list.count);
+            print_push(stack, data->a, indent + 2, NULL, 0);
+            print_push(stack, NODE_REF_NONE, indent + 1, "Function:\n", 0);
+            break;
+
+        case NODE_IF: {
+            printf("IF [line %d]\n", line);
+            CompactList then_branch = compact_ast_list(ast, data->b);
+            list = compact_ast_list(ast, then_branch.end);
+            if (list.count > 0) {
+                print_push_list(stack, list, indent + 2);
+                print_push(stack, NODE_REF_NONE, indent + 1, "Else (%zu statements):\n", list.count);
+            }
+            print_push_list(stack, then_branch, indent + 2);
+            print_push(stack, NODE_REF_NONE, indent + 1, "Then (%zu statements):\n", then_branch.count);
+            print_push(stack, data->a, indent + 2, NULL, 0);
+            print_push(stack, NODE_REF_NONE, indent + 1, "Condition:\n", 0);
+            break;
+        }
+
+        case NODE_WHILE:
+            printf("WHILE [line %d]\n", line);
+            list = compact_ast_list(ast, data->b);
+            print_push_list(stack, list, indent + 2);
+            print_push(stack, NODE_REF_NONE, indent + 1, "Body (%zu statements):\n", list.count);
+            print_push(stack, data->a, indent + 2, NULL, 0);
+            print_push(stack, NODE_REF_NONE, indent + 1, "Condition:\n", 0);
+            break;
+
+        case NODE_FUNCTION_DEF:
+            printf("FUNCTION: %s [line %d]\n", atom_name(data->a), line);
+            list = compact_ast_list(ast, data->b);
+            print_indent(indent + 1);
+            printf("Parameters (%zu): ", (size_t)list.count);
+            for (size_t i = 0; i < list.count; i++) {
+                printf("%s%s", i > 0 ? ", " : "", atom_name(list.items[i]));
+            }
+            printf("\n");
+            list = compact_ast_list(ast, list.end);
+            print_indent(indent + 1);
+            printf("Body (%zu statements):\n", (size_t)list.count);
+            print_push_list(stack, list, indent + 2);
+            break;
+
+        case NODE_RETURN:
+            printf("RETURN [line %d]\n", line);
+            if (data->a != NODE_REF_NONE) {
+                print_push(stack, data->a, indent + 1, NULL, 0);
+            }
+            break;
+
+        case NODE_VAR_DECL:
+            printf("VAR_DECL: %s (%s) [line %d]\n", atom_name(data->a), ast->ops[node] ? "const" : "let", line);
+            print_indent(indent + 1);
+            printf("Initializer:\n");
+            print_push(stack, data->b, indent + 2, NULL, 0);
+            break;
+
+        case NODE_BLOCK:
+            list = compact_ast_list(ast, data->a);
+            printf("BLOCK (%zu statements) [line %d]\n", (size_t)list.count, line);
+            print_push_list(stack, list, indent + 1);
+            break;
+
+        case NODE_EXPRESSION_STMT:
+            printf("EXPR_STMT [line %d]\n", line);
+            print_push(stack, data->a, indent + 1, NULL, 0);
+            break;
+
+        default:
+            printf("UNKNOWN NODE TYPE %d [line %d]\n", ast->kinds[node], line);
+            break;
+    }
+}
+
+/* Print the tree in the same format as ast_print */
+void compact_ast_print(const CompactAst *ast, LineIndex *lines, int indent) {
+    CompactPrintStack stack = { NULL, 0, 0 };
+    print_node(ast, &stack, ast->root, lines, indent);
+
+    while (stack.count > 0) {
+        CompactPrintItem item = stack.items[--stack.count];
+        if (item.label) {
+            print_indent(item.indent);
+            printf(item.label, item.count);
+        } else {
+            print_node(ast, &stack, item.node, lines, item.indent);
+        }
+    }
+    free(stack.items);
+}
@@ -0,0 +1,73 @@
+#ifndef AST_COMPACT_H
+#define AST_COMPACT_H
+
+#include "ast.h"
+
+/* A node of a CompactAst: an index into its arrays; 0 is no node */
+typedef uint32_t NodeRef;
+
+#define NODE_REF_NONE 0
+
+/* The two 32-bit payload words of a node; what they hold depends on its kind */
+typedef struct {
+    uint32_t a;
+    uint32_t b;
+} CompactData;
+
+/*
+ * An immutable AST in struct-of-arrays form: 14 bytes per node (1-byte
+ * kind, 1-byte operator, 32-bit absolute offset, two 32-bit payload
+ * words) instead of a 48-byte ASTNode and the pointers to it. Nodes are
+ * numbered in pre-order from 1, so a node's subtree is the run of
+ * indices that follows it and a pass over every node is a loop over the
+ * arrays. Child lists live in `extra` as a count followed by the items.
+ *
+ *   kind                a                      b
+ *   PROGRAM, BLOCK      statements list        -
+ *   EXPRESSION_STMT     expression             -
+ *   INT_LITERAL         low 32 bits            high 32 bits
+ *   FLOAT_LITERAL       low 32 bits            high 32 bits (of the double)
+ *   STRING_LITERAL      offset in `strings`    length (text is NUL-terminated)
+ *   BOOL_LITERAL        value                  -
+ *   IDENTIFIER          atom                   -
+ *   BINARY_OP           left                   right       (op: operator)
+ *   UNARY_OP            operand                -           (op: operator)
+ *   CALL                function               arguments list
+ *   IF                  condition              then list, else list after it
+ *   WHILE               condition              body list
+ *   FUNCTION_DEF        name atom              parameter atoms, body list after it
+ *   RETURN              value or none          -
+ *   VAR_DECL            name atom              initializer (op: is_const)
+ *
+ * "list" is an index into `extra`; compact_ast_list reads one.
+ */
+typedef struct {
+    uint8_t *kinds;
+    uint8_t *ops;
+    uint32_t *offsets;
+    CompactData *data;
+    size_t count;           /* nodes, counting the unused slot 0 */
+    uint32_t *extra;
+    size_t extra_count;
+    char *strings;
+    size_t string_length;
+    NodeRef root;
+} CompactAst;
+
+/* A child list in `extra`; `end` is where the list after it starts */
+typedef struct {
+    const uint32_t *items;
+    uint32_t count;
+    uint32_t end;
+} CompactList;
+
+CompactAst *compact_ast_build(const ASTNode *root);
+void compact_ast_destroy(CompactAst *ast);
+CompactList compact_ast_list(const CompactAst *ast, uint32_t at);
+long compact_ast_int(const CompactAst *ast, NodeRef node);
+double compact_ast_float(const CompactAst *ast, NodeRef node);
+bool compact_ast_valid(const CompactAst *ast, size_t atom_count);
+ASTNode *compact_ast_expand(const CompactAst *ast);
+void compact_ast_print(const CompactAst *ast, LineIndex *lines, int indent);
+
+#endif
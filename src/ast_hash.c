@@ -0,0 +1,195 @@
+#include "ast_hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t mix(uint64_t hash, uint64_t value) {
+    hash = (hash ^ value) * 0xff51afd7ed558ccdull;
+    return hash ^ (hash >> 32);
+}
+
+/* 64-bit FNV-1a of a string literal's text */
+static uint64_t hash_text(const char *text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        hash = (hash ^ *p) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* Hash of a node's own fields: its kind and everything that is not a child */
+uint64_t ast_hash_begin(const ASTNode *node) {
+    uint64_t hash = mix(0x3c6ef372fe94f82bull, (uint64_t)node->type + 1);
+    uint64_t bits;
+    switch (node->type) {
+        case NODE_INT_LITERAL:
+            return mix(hash, (uint64_t)node->data.int_literal.value);
+        case NODE_FLOAT_LITERAL:
+            memcpy(&bits, &node->data.float_literal.value, sizeof(bits));
+            return mix(hash, bits);
+        case NODE_STRING_LITERAL:
+            return mix(hash, hash_text(node->data.string_literal.value));
+        case NODE_BOOL_LITERAL:
+            return mix(hash, (uint64_t)node->data.bool_literal.value);
+        case NODE_IDENTIFIER:
+            return mix(hash, atom_hash(node->data.identifier.name));
+        case NODE_BINARY_OP:
+            return mix(hash, (uint64_t)node->data.binary_op.op);
+        case NODE_UNARY_OP:
+            return mix(hash, (uint64_t)node->data.unary_op.op);
+        case NODE_IF:
+            /* The split between the branches is not in the child order */
+            return mix(hash, node->data.if_stmt.then_branch.count);
+        case NODE_FUNCTION_DEF:
+            hash = mix(hash, atom_hash(node->data.function_def.name));
+            for (uint32_t i = 0; i < node->data.function_def.parameters.count; i++) {
+                hash = mix(hash, atom_hash(node->data.function_def.parameters.items[i]));
+            }
+            return mix(hash, node->data.function_def.parameters.count);
+        case NODE_VAR_DECL:
+            hash = mix(hash, atom_hash(node->data.var_decl.name));
+            return mix(hash, (uint64_t)(node->data.var_decl.is_const != 0));
+        default:
+            return hash;
+    }
+}
+
+uint64_t ast_hash_add(uint64_t hash, uint64_t child) {
+    return mix(hash + 0x9e3779b97f4a7c15ull, child);
+}
+
+/* A node whose children are being hashed; `hash` has taken in the first `next` of them */
+typedef struct {
+    const ASTNode *node;
+    size_t next;
+    size_t count;
+    uint64_t hash;
+} HashFrame;
+
+/* Hash a subtree of any depth; children wait on a heap stack rather than the C stack */
+uint64_t ast_hash(const ASTNode *node) {
+    if (!node) {
+        return AST_HASH_NONE;
+    }
+    HashFrame *frames = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t result = AST_HASH_NONE;
+    const ASTNode *pending = node;
+
+    for (;;) {
+        if (pending) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                HashFrame *grown = realloc(frames, capacity * sizeof(HashFrame));
+                if (!grown) {
+                    free(frames);
+                    return 0;
+                }
+                frames = grown;
+            }
+            frames[count].node = pending;
+            frames[count].next = 0;
+            frames[count].count = ast_child_count(pending);
+            frames[count].hash = ast_hash_begin(pending);
+            count++;
+            pending = NULL;
+        }
+
+        HashFrame *top = &frames[count - 1];
+        if (top->next < top->count) {
+            const ASTNode *child = ast_child(top->node, top->next++);
+            if (child) {
+                pending = child;
+            } else {
+                top->hash = ast_hash_add(top->hash, AST_HASH_NONE);
+            }
+            continue;
+        }
+
+        /* All children in: hand the subtree's hash to the parent */
+        result = top->hash;
+        count--;
+        if (count == 0) {
+            break;
+        }
+        frames[count - 1].hash = ast_hash_add(frames[count - 1].hash, result);
+    }
+    free(frames);
+    return result;
+}
+
+/* Whether two nodes agree on everything but their children and offsets */
+static bool same_fields(const ASTNode *a, const ASTNode *b) {
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case NODE_INT_LITERAL:
+            return a->data.int_literal.value == b->data.int_literal.value;
+        case NODE_FLOAT_LITERAL:
+            return memcmp(&a->data.float_literal.value, &b->data.float_literal.value, sizeof(double)) == 0;
+        case NODE_STRING_LITERAL:
+            return strcmp(a->data.string_literal.value, b->data.string_literal.value) == 0;
+        case NODE_BOOL_LITERAL:
+            return a->data.bool_literal.value == b->data.bool_literal.value;
+        case NODE_IDENTIFIER:
+            return a->data.identifier.name == b->data.identifier.name;
+        case NODE_BINARY_OP:
+            return a->data.binary_op.op == b->data.binary_op.op;
+        case NODE_UNARY_OP:
+            return a->data.unary_op.op == b->data.unary_op.op;
+        case NODE_IF:
+            return a->data.if_stmt.then_branch.count == b->data.if_stmt.then_branch.count;
+        case NODE_FUNCTION_DEF:
+            return a->data.function_def.name == b->data.function_def.name &&
+                   a->data.function_def.parameters.count == b->data.function_def.parameters.count &&
+                   (a->data.function_def.parameters.count == 0 ||
+                    memcmp(a->data.function_def.parameters.items, b->data.function_def.parameters.items,
+                           a->data.function_def.parameters.count * sizeof(Atom)) == 0);
+        case NODE_VAR_DECL:
+            return a->data.var_decl.name == b->data.var_decl.name &&
+                   (a->data.var_decl.is_const != 0) == (b->data.var_decl.is_const != 0);
+        default:
+            return true;
+    }
+}
+
+/* Compare two subtrees of any depth, pair by pair from a heap stack */
+bool ast_equal(const ASTNode *a, const ASTNode *b) {
+    const ASTNode **pairs = NULL;
+    size_t count = 0, capacity = 0;
+    bool equal = true;
+
+    for (;;) {
+        if (a != b) {
+            if (!a || !b || !same_fields(a, b) || ast_child_count(a) != ast_child_count(b)) {
+                equal = false;
+                break;
+            }
+            size_t children = ast_child_count(a);
+            if (count + 2 * children > capacity) {
+                size_t grown_capacity = capacity ? capacity : 64;
+                while (grown_capacity < count + 2 * children) {
+                    grown_capacity *= 2;
+                }
+                const ASTNode **grown = realloc(pairs, grown_capacity * sizeof(ASTNode *));
+                if (!grown) {
+                    equal = false;
+                    break;
+                }
+                pairs = grown;
+                capacity = grown_capacity;
+            }
+            for (size_t i = 0; i < children; i++) {
+                pairs[count++] = ast_child(a, i);
+                pairs[count++] = ast_child(b, i);
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+        b = pairs[--count];
+        a = pairs[--count];
+    }
+    free(pairs);
+    return equal;
+}
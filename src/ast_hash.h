@@ -0,0 +1,25 @@
+#ifndef AST_HASH_H
+#define AST_HASH_H
+
+#include "ast.h"
+
+/*
+ * Structural hashing and comparison of AST subtrees. Two subtrees are
+ * equal when they have the same shape, node kinds, operators, literal
+ * values and names; offsets are ignored. Equal subtrees hash equal, and
+ * names are hashed by their text, so a hash means the same thing in
+ * every process and can be used as a cache key.
+ *
+ * ast_hash(node) is ast_hash_begin(node) folded with ast_hash_add over
+ * the hashes of its children in order (a missing child counts as
+ * AST_HASH_NONE), so a pass that visits every node bottom-up can hash
+ * all subtrees in one walk rather than calling ast_hash on each.
+ */
+#define AST_HASH_NONE 0x6a09e667f3bcc908ull
+
+uint64_t ast_hash_begin(const ASTNode *node);
+uint64_t ast_hash_add(uint64_t hash, uint64_t child);
+uint64_t ast_hash(const ASTNode *node);
+bool ast_equal(const ASTNode *a, const ASTNode *b);
+
+#endif
@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "atom.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Names interned before anything else; order matches the enum in atom.h */
+static const char *builtin_names[] = {
+    "print",
+};
+
+typedef struct {
+    const char *text;
+    uint32_t length;
+    uint32_t hash;
+} AtomEntry;
+
+/* Atom text is copied into fixed blocks so canonical pointers never move */
+typedef struct TextBlock {
+    struct TextBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} TextBlock;
+
+#define TEXT_BLOCK_SIZE (64 * 1024)
+#define INITIAL_SLOTS 1024
+
+static struct {
+    AtomEntry *entries;     /* indexed by atom; entry 0 is ATOM_NONE */
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;        /* open addressing over atoms, 0 = empty */
+    size_t slot_count;      /* power of two, kept at most half full */
+    TextBlock *blocks;
+} table;
+
+/* Taken by atom_intern only while the table is shared between threads */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool table_shared;
+
+/* 32-bit FNV-1a */
+static uint32_t hash_text(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Copy text into the current block, starting a new one when it is full */
+static const char *store_text(const char *text, size_t length) {
+    TextBlock *block = table.blocks;
+    if (!block || block->size - block->used < length + 1) {
+        size_t size = length + 1 > TEXT_BLOCK_SIZE ? length + 1 : TEXT_BLOCK_SIZE;
+        block = malloc(sizeof(TextBlock) + size);
+        if (!block) {
+            return NULL;
+        }
+        block->next = table.blocks;
+        block->used = 0;
+        block->size = size;
+        table.blocks = block;
+    }
+
+    char *copy = block->data + block->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+/* Double the slot array and reinsert every atom */
+static bool grow_slots(void) {
+    size_t slot_count = table.slot_count ? table.slot_count * 2 : INITIAL_SLOTS;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) {
+        return false;
+    }
+    for (size_t atom = 1; atom < table.count; atom++) {
+        size_t slot = table.entries[atom].hash & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (uint32_t)atom;
+    }
+    free(table.slots);
+    table.slots = slots;
+    table.slot_count = slot_count;
+    return true;
+}
+
+static Atom insert(const char *text, size_t length, uint32_t hash, size_t slot) {
+    if (table.count >= table.capacity) {
+        size_t capacity = table.capacity ? table.capacity * 2 : INITIAL_SLOTS / 2;
+        AtomEntry *entries = realloc(table.entries, capacity * sizeof(AtomEntry));
+        if (!entries) {
+            return ATOM_NONE;
+        }
+        table.entries = entries;
+        table.capacity = capacity;
+    }
+
+    const char *copy = store_text(text, length);
+    if (!copy) {
+        return ATOM_NONE;
+    }
+
+    Atom atom = (Atom)table.count++;
+    table.entries[atom].text = copy;
+    table.entries[atom].length = (uint32_t)length;
+    table.entries[atom].hash = hash;
+    table.slots[slot] = atom;
+    return atom;
+}
+
+static Atom lookup_or_insert(const char *text, size_t length) {
+    if ((table.count + 1) * 2 > table.slot_count && !grow_slots()) {
+        return ATOM_NONE;
+    }
+
+    uint32_t hash = hash_text(text, length);
+    size_t slot = hash & (table.slot_count - 1);
+    while (table.slots[slot]) {
+        const AtomEntry *entry = &table.entries[table.slots[slot]];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return table.slots[slot];
+        }
+        slot = (slot + 1) & (table.slot_count - 1);
+    }
+    return insert(text, length, hash, slot);
+}
+
+/* Set up ATOM_NONE and the builtin names on first use */
+static bool ensure_table(void) {
+    if (table.count > 0) {
+        return true;
+    }
+    table.count = 1;
+    if (!grow_slots()) {
+        table.count = 0;
+        return false;
+    }
+    table.capacity = INITIAL_SLOTS / 2;
+    table.entries = malloc(table.capacity * sizeof(AtomEntry));
+    if (!table.entries) {
+        atom_table_clear();
+        return false;
+    }
+    table.entries[ATOM_NONE].text = "";
+    table.entries[ATOM_NONE].length = 0;
+    table.entries[ATOM_NONE].hash = 0;
+
+    for (size_t i = 0; i < sizeof(builtin_names) / sizeof(builtin_names[0]); i++) {
+        if (lookup_or_insert(builtin_names[i], strlen(builtin_names[i])) == ATOM_NONE) {
+            atom_table_clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Intern a slice of text; returns ATOM_NONE only when out of memory */
+Atom atom_intern(const char *text, size_t length) {
+    if (!text || length > UINT32_MAX) {
+        return ATOM_NONE;
+    }
+    if (table_shared) {
+        pthread_mutex_lock(&table_lock);
+    }
+    Atom atom = ensure_table() ? lookup_or_insert(text, length) : ATOM_NONE;
+    if (table_shared) {
+        pthread_mutex_unlock(&table_lock);
+    }
+    return atom;
+}
+
+/*
+ * Make atom_intern safe to call from several threads at once (or stop
+ * paying for that). Switch it on before starting the threads and off
+ * after joining them; atom_name and atom_length must not be called while
+ * other threads may intern.
+ */
+void atom_table_set_shared(bool shared) {
+    table_shared = shared;
+}
+
+const char *atom_name(Atom atom) {
+    if (atom >= table.count) {
+        return "";
+    }
+    return table.entries[atom].text;
+}
+
+size_t atom_length(Atom atom) {
+    if (atom >= table.count) {
+        return 0;
+    }
+    return table.entries[atom].length;
+}
+
+/* Hash of an atom's text; unlike the atom itself, the same in every process */
+uint32_t atom_hash(Atom atom) {
+    if (atom >= table.count) {
+        return 0;
+    }
+    return table.entries[atom].hash;
+}
+
+/* One more than the last atom handed out; atoms are numbered from 1 in the order they were interned */
+size_t atom_count(void) {
+    return table.count;
+}
+
+/* Free every atom; names interned afterwards start from the builtins again */
+void atom_table_clear(void) {
+    while (table.blocks) {
+        TextBlock *next = table.blocks->next;
+        free(table.blocks);
+        table.blocks = next;
+    }
+    free(table.entries);
+    free(table.slots);
+    memset(&table, 0, sizeof(table));
+}
@@ -0,0 +1,33 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Compiler-wide table of interned names. Interning a slice of source
+ * text returns a 32-bit atom; equal names always get the same atom, so
+ * names are compared with == and the text is stored once. The canonical
+ * text of an atom is NUL-terminated and stays at the same address until
+ * atom_table_clear().
+ *
+ * Names the compiler itself looks for are interned first, in the order
+ * below, so their atoms are compile-time constants.
+ */
+typedef uint32_t Atom;
+
+enum {
+    ATOM_NONE = 0,
+    ATOM_PRINT,
+};
+
+Atom atom_intern(const char *text, size_t length);
+const char *atom_name(Atom atom);
+size_t atom_length(Atom atom);
+uint32_t atom_hash(Atom atom);
+size_t atom_count(void);
+void atom_table_clear(void);
+void atom_table_set_shared(bool shared);
+
+#endif
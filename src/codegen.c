@@ -1,4 +1,5 @@
 #include "codegen.h"
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -10,17 +11,38 @@ typedef struct CodeGen {
     ASTNode **functions;
     size_t function_count;
     size_t function_capacity;
+    const ProgramTypes *types;  /* of `functions`, in the same order; NULL emits longs */
+    /* Work stack of emit_expression, kept between expressions */
+    struct PendingOutput *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+    /* Streaming: functions and the body of main, held back until the end of the input */
+    FILE *function_bodies;
+    size_t function_definitions;
+    FILE *main_body;
+    size_t main_statements;
 } CodeGen;
 
+/* Output still owed by emit_expression: a node to emit, or fixed text when `text` is set */
+typedef struct PendingOutput {
+    ASTNode *node;
+    const char *text;
+} PendingOutput;
+
 /* Forward declarations of helper functions */
 static void emit_indent(CodeGen *gen);
 static void emit_includes(CodeGen *gen);
 static void emit_forward_declarations(CodeGen *gen);
 static void emit_expression(CodeGen *gen, ASTNode *node);
 static void emit_statement(CodeGen *gen, ASTNode *node);
-static void emit_statement_list(CodeGen *gen, ASTNode **statements, size_t count);
-static void emit_function_definition(CodeGen *gen, ASTNode *node);
-static void emit_binary_operator(CodeGen *gen, OperatorType op);
+static void emit_statement_list(CodeGen *gen, const NodeList *statements);
+static void emit_function_definition(CodeGen *gen, ASTNode *node, const FunctionType *type);
+static void emit_signature(CodeGen *gen, ASTNode *func, const FunctionType *type);
+static const FunctionType *function_type(CodeGen *gen, size_t index);
+static void emit_constant_declarator(CodeGen *gen, ASTNode *node);
+static void emit_float(CodeGen *gen, double value);
+static void emit_string(CodeGen *gen, const char *text);
+static const char *binary_operator_text(OperatorType op);
 static void emit_unary_operator(CodeGen *gen, OperatorType op);
 static void collect_functions(CodeGen *gen, ASTNode *ast);
 static void add_function(CodeGen *gen, ASTNode *func);
@@ -37,16 +59,43 @@ CodeGen *codegen_create(FILE *output) {
     gen->functions = NULL;
     gen->function_count = 0;
     gen->function_capacity = 0;
+    gen->types = NULL;
+    gen->pending = NULL;
+    gen->pending_count = 0;
+    gen->pending_capacity = 0;
+    gen->function_bodies = NULL;
+    gen->function_definitions = 0;
+    gen->main_body = NULL;
+    gen->main_statements = 0;
     return gen;
 }
 
 void codegen_destroy(CodeGen *gen) {
     if (gen) {
         free(gen->functions);
+        free(gen->pending);
+        if (gen->function_bodies) {
+            fclose(gen->function_bodies);
+        }
+        if (gen->main_body) {
+            fclose(gen->main_body);
+        }
         free(gen);
     }
 }
 
+/*
+ * Declare functions, variables and print calls with the types the type
+ * pass found (types.h) rather than as longs. The tree must have been
+ * annotated by the types_infer call that filled in `types`, which has to
+ * outlive the generator's use of it.
+ */
+void codegen_set_types(CodeGen *gen, const ProgramTypes *types) {
+    if (gen) {
+        gen->types = types;
+    }
+}
+
 /* Main code generation entry point */
 void codegen_generate(CodeGen *gen, ASTNode *ast) {
     if (!gen || !ast) {
@@ -72,7 +121,7 @@ void codegen_generate(CodeGen *gen, ASTNode *ast) {
 
     /* Emit all function definitions */
     for (size_t i = 0; i < gen->function_count; i++) {
-        emit_function_definition(gen, gen->functions[i]);
+        emit_function_definition(gen, gen->functions[i], function_type(gen, i));
         fprintf(gen->output, "\n");
     }
 
@@ -83,8 +132,8 @@ void codegen_generate(CodeGen *gen, ASTNode *ast) {
         gen->indent_level++;
         gen->in_function = true;
 
-        for (size_t i = 0; i < ast->data.program.statement_count; i++) {
-            ASTNode *stmt = ast->data.program.statements[i];
+        for (size_t i = 0; i < ast->data.program.statements.count; i++) {
+            ASTNode *stmt = ast->data.program.statements.items[i];
             /* Skip function definitions - they're already emitted */
             if (stmt->type != NODE_FUNCTION_DEF) {
                 emit_statement(gen, stmt);
@@ -99,14 +148,115 @@ void codegen_generate(CodeGen *gen, ASTNode *ast) {
     }
 }
 
+/*
+ * Streaming generation, for programs that are not held in memory whole:
+ * codegen_begin takes the function definitions the program will have
+ * (which need no bodies; only their signatures are read, and they must
+ * last until codegen_finish), codegen_add_statement emits each top-level
+ * statement as soon as it has been parsed, and codegen_finish closes the
+ * output. Statements are declared and printed with the types
+ * typer_type_statement annotated them with, and the n'th function
+ * definition with the n'th signature of the types set with
+ * codegen_set_types (typer_types), which are only all known at the end:
+ * definitions and the body of main are kept in temporary files until
+ * codegen_finish has written the prototypes ahead of them.
+ */
+bool codegen_begin(CodeGen *gen, ASTNode **functions, size_t count) {
+    if (!gen) {
+        return false;
+    }
+    gen->function_bodies = tmpfile();
+    gen->main_body = tmpfile();
+    if (!gen->function_bodies || !gen->main_body) {
+        return false;
+    }
+    gen->function_definitions = 0;
+    gen->main_statements = 0;
+
+    emit_includes(gen);
+    fprintf(gen->output, "\n");
+
+    gen->function_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        add_function(gen, functions[i]);
+    }
+    return true;
+}
+
+void codegen_add_statement(CodeGen *gen, ASTNode *statement) {
+    if (!gen || !gen->main_body || !statement) {
+        return;
+    }
+
+    FILE *output = gen->output;
+    if (statement->type == NODE_FUNCTION_DEF) {
+        gen->output = gen->function_bodies;
+        emit_function_definition(gen, statement, function_type(gen, gen->function_definitions++));
+        fprintf(gen->output, "\n");
+        gen->output = output;
+        return;
+    }
+
+    gen->output = gen->main_body;
+    gen->indent_level = 1;
+    gen->in_function = true;
+    emit_statement(gen, statement);
+    gen->indent_level = 0;
+    gen->in_function = false;
+    gen->output = output;
+    gen->main_statements++;
+}
+
+/* Copy a held-back temporary file to the output and close it; false if it could not be read */
+static bool emit_held_back(CodeGen *gen, FILE *held) {
+    char buffer[BUFSIZ];
+    size_t length;
+    rewind(held);
+    while ((length = fread(buffer, 1, sizeof(buffer), held)) > 0) {
+        fwrite(buffer, 1, length, gen->output);
+    }
+    bool ok = !ferror(held);
+    fclose(held);
+    return ok;
+}
+
+/*
+ * Write the prototypes, then the functions, then main if there were
+ * top-level statements; false if a held-back file could not be read
+ */
+bool codegen_finish(CodeGen *gen) {
+    if (!gen || !gen->main_body) {
+        return false;
+    }
+
+    emit_forward_declarations(gen);
+    if (gen->function_count > 0) {
+        fprintf(gen->output, "\n");
+    }
+    bool ok = emit_held_back(gen, gen->function_bodies);
+    gen->function_bodies = NULL;
+
+    if (gen->main_statements > 0) {
+        fprintf(gen->output, "int main(void) {\n");
+        ok = emit_held_back(gen, gen->main_body) && ok;
+        fprintf(gen->output, "    return 0;\n");
+        fprintf(gen->output, "}\n");
+    } else {
+        fclose(gen->main_body);
+    }
+    gen->main_body = NULL;
+    gen->function_count = 0;
+    return ok;
+}
+
 /* Collect all function definitions from the program */
 static void collect_functions(CodeGen *gen, ASTNode *ast) {
     if (ast->type != NODE_PROGRAM) {
         return;
     }
 
-    for (size_t i = 0; i < ast->data.program.statement_count; i++) {
-        ASTNode *stmt = ast->data.program.statements[i];
+    for (size_t i = 0; i < ast->data.program.statements.count; i++) {
+        ASTNode *stmt = ast->data.program.statements.items[i];
         if (stmt->type == NODE_FUNCTION_DEF) {
             add_function(gen, stmt);
         }
@@ -133,8 +283,8 @@ static bool has_top_level_statements(ASTNode *ast) {
         return false;
     }
 
-    for (size_t i = 0; i < ast->data.program.statement_count; i++) {
-        if (ast->data.program.statements[i]->type != NODE_FUNCTION_DEF) {
+    for (size_t i = 0; i < ast->data.program.statements.count; i++) {
+        if (ast->data.program.statements.items[i]->type != NODE_FUNCTION_DEF) {
             return true;
         }
     }
@@ -150,48 +300,55 @@ static void emit_indent(CodeGen *gen) {
 
 /* Emit #include statements */
 static void emit_includes(CodeGen *gen) {
+    fprintf(gen->output, "#include <stdbool.h>\n");
+    fprintf(gen->output, "#include <string.h>\n");
     fprintf(gen->output, "#include \"runtime/print.h\"\n");
 }
 
-/* Emit forward declarations for all functions */
-static void emit_forward_declarations(CodeGen *gen) {
-    for (size_t i = 0; i < gen->function_count; i++) {
-        ASTNode *func = gen->functions[i];
-        fprintf(gen->output, "int %s(", func->data.function_def.name);
+/* The inferred signature of the index'th collected function, if there are types */
+static const FunctionType *function_type(CodeGen *gen, size_t index) {
+    return gen->types && index < gen->types->function_count ? &gen->types->functions[index] : NULL;
+}
 
-        for (size_t j = 0; j < func->data.function_def.param_count; j++) {
-            if (j > 0) {
-                fprintf(gen->output, ", ");
-            }
-            fprintf(gen->output, "int %s", func->data.function_def.parameters[j]);
+/* Return type, name and parameters of a function */
+static void emit_signature(CodeGen *gen, ASTNode *func, const FunctionType *type) {
+    fprintf(gen->output, "%s%s(", type_declarator(type ? type->result : TYPE_UNKNOWN),
+            atom_name(func->data.function_def.name));
+
+    for (size_t i = 0; i < func->data.function_def.parameters.count; i++) {
+        if (i > 0) {
+            fprintf(gen->output, ", ");
         }
+        ValueType parameter = type && i < type->parameter_count ? type->parameters[i] : TYPE_UNKNOWN;
+        fprintf(gen->output, "%s%s", type_declarator(parameter),
+                atom_name(func->data.function_def.parameters.items[i]));
+    }
+
+    fprintf(gen->output, ")");
+}
 
-        fprintf(gen->output, ");\n");
+/* Emit forward declarations for all functions */
+static void emit_forward_declarations(CodeGen *gen) {
+    for (size_t i = 0; i < gen->function_count; i++) {
+        emit_signature(gen, gen->functions[i], function_type(gen, i));
+        fprintf(gen->output, ";\n");
     }
 }
 
 /* Emit a function definition */
-static void emit_function_definition(CodeGen *gen, ASTNode *node) {
+static void emit_function_definition(CodeGen *gen, ASTNode *node, const FunctionType *type) {
     if (node->type != NODE_FUNCTION_DEF) {
         return;
     }
 
     /* Function signature */
-    fprintf(gen->output, "int %s(", node->data.function_def.name);
-
-    for (size_t i = 0; i < node->data.function_def.param_count; i++) {
-        if (i > 0) {
-            fprintf(gen->output, ", ");
-        }
-        fprintf(gen->output, "int %s", node->data.function_def.parameters[i]);
-    }
-
-    fprintf(gen->output, ") {\n");
+    emit_signature(gen, node, type);
+    fprintf(gen->output, " {\n");
 
     /* Function body */
     gen->indent_level++;
     gen->in_function = true;
-    emit_statement_list(gen, node->data.function_def.body, node->data.function_def.body_count);
+    emit_statement_list(gen, &node->data.function_def.body);
     gen->in_function = false;
     gen->indent_level--;
 
@@ -199,9 +356,9 @@ static void emit_function_definition(CodeGen *gen, ASTNode *node) {
 }
 
 /* Emit a list of statements */
-static void emit_statement_list(CodeGen *gen, ASTNode **statements, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        emit_statement(gen, statements[i]);
+static void emit_statement_list(CodeGen *gen, const NodeList *statements) {
+    for (size_t i = 0; i < statements->count; i++) {
+        emit_statement(gen, statements->items[i]);
     }
 }
 
@@ -220,7 +377,12 @@ static void emit_statement(CodeGen *gen, ASTNode *node) {
 
         case NODE_VAR_DECL:
             emit_indent(gen);
-            fprintf(gen->output, "int %s", node->data.var_decl.name);
+            if (node->data.var_decl.is_const) {
+                emit_constant_declarator(gen, node);
+            } else {
+                fprintf(gen->output, "%s", type_declarator(node->data.var_decl.type));
+            }
+            fprintf(gen->output, "%s", atom_name(node->data.var_decl.name));
             if (node->data.var_decl.initializer) {
                 fprintf(gen->output, " = ");
                 emit_expression(gen, node->data.var_decl.initializer);
@@ -234,13 +396,13 @@ static void emit_statement(CodeGen *gen, ASTNode *node) {
             emit_expression(gen, node->data.if_stmt.condition);
             fprintf(gen->output, ") {\n");
             gen->indent_level++;
-            emit_statement_list(gen, node->data.if_stmt.then_branch, node->data.if_stmt.then_count);
+            emit_statement_list(gen, &node->data.if_stmt.then_branch);
             gen->indent_level--;
             emit_indent(gen);
-            if (node->data.if_stmt.else_count > 0) {
+            if (node->data.if_stmt.else_branch.count > 0) {
                 fprintf(gen->output, "} else {\n");
                 gen->indent_level++;
-                emit_statement_list(gen, node->data.if_stmt.else_branch, node->data.if_stmt.else_count);
+                emit_statement_list(gen, &node->data.if_stmt.else_branch);
                 gen->indent_level--;
                 emit_indent(gen);
             }
@@ -253,7 +415,7 @@ static void emit_statement(CodeGen *gen, ASTNode *node) {
             emit_expression(gen, node->data.while_stmt.condition);
             fprintf(gen->output, ") {\n");
             gen->indent_level++;
-            emit_statement_list(gen, node->data.while_stmt.body, node->data.while_stmt.body_count);
+            emit_statement_list(gen, &node->data.while_stmt.body);
             gen->indent_level--;
             emit_indent(gen);
             fprintf(gen->output, "}\n");
@@ -273,7 +435,7 @@ static void emit_statement(CodeGen *gen, ASTNode *node) {
             emit_indent(gen);
             fprintf(gen->output, "{\n");
             gen->indent_level++;
-            emit_statement_list(gen, node->data.block.statements, node->data.block.statement_count);
+            emit_statement_list(gen, &node->data.block.statements);
             gen->indent_level--;
             emit_indent(gen);
             fprintf(gen->output, "}\n");
@@ -288,23 +450,111 @@ static void emit_statement(CodeGen *gen, ASTNode *node) {
     }
 }
 
-/* Emit an expression */
-static void emit_expression(CodeGen *gen, ASTNode *node) {
-    if (!node) {
+/*
+ * The declarator of a constant. One holding a literal is static, so it
+ * is written once rather than on every entry to its scope.
+ */
+static void emit_constant_declarator(CodeGen *gen, ASTNode *node) {
+    NodeType value = node->data.var_decl.initializer->type;
+    if (value == NODE_INT_LITERAL || value == NODE_FLOAT_LITERAL || value == NODE_BOOL_LITERAL ||
+        value == NODE_STRING_LITERAL) {
+        fprintf(gen->output, "static ");
+    }
+    if (node->data.var_decl.type == TYPE_STRING) {
+        fprintf(gen->output, "const char *const ");
+    } else {
+        fprintf(gen->output, "const %s", type_declarator(node->data.var_decl.type));
+    }
+}
+
+/* The shortest literal that reads back as `value`, with a point so C takes it as a double */
+static void emit_float(CodeGen *gen, double value) {
+    char text[32];
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    fputs(text, gen->output);
+    if (isfinite(value) && !strpbrk(text, ".e")) {
+        fputs(".0", gen->output);
+    }
+}
+
+/*
+ * A string literal as C reads it. Parsed literals keep their quotes and
+ * have no escapes, so a backslash is itself and a string can span lines.
+ */
+static void emit_string(CodeGen *gen, const char *text) {
+    size_t length = strlen(text);
+    if (length >= 2 && text[0] == '"') {
+        text++;
+        length -= 2;
+    }
+    fputc('"', gen->output);
+    for (size_t i = 0; i < length; i++) {
+        switch (text[i]) {
+            case '\\':
+                fputs("\\\\", gen->output);
+                break;
+            case '\n':
+                fputs("\\n", gen->output);
+                break;
+            case '\r':
+                fputs("\\r", gen->output);
+                break;
+            default:
+                fputc(text[i], gen->output);
+                break;
+        }
+    }
+    fputc('"', gen->output);
+}
+
+/* Queue a node or text for emit_expression; both NULL queues nothing */
+static void push_pending(CodeGen *gen, ASTNode *node, const char *text) {
+    if (!node && !text) {
         return;
     }
+    if (gen->pending_count == gen->pending_capacity) {
+        size_t capacity = gen->pending_capacity ? gen->pending_capacity * 2 : 64;
+        PendingOutput *pending = realloc(gen->pending, capacity * sizeof(PendingOutput));
+        if (!pending) {
+            return;
+        }
+        gen->pending = pending;
+        gen->pending_capacity = capacity;
+    }
+    gen->pending[gen->pending_count].node = node;
+    gen->pending[gen->pending_count].text = text;
+    gen->pending_count++;
+}
+
+/* Queue call arguments, comma separated; the queue pops last-in first */
+static void push_arguments(CodeGen *gen, ASTNode *node) {
+    for (size_t i = node->data.call.arguments.count; i > 0; i--) {
+        push_pending(gen, node->data.call.arguments.items[i - 1], NULL);
+        if (i > 1) {
+            push_pending(gen, NULL, ", ");
+        }
+    }
+}
 
+/* Write what comes before a node's operands and queue the operands and what follows them */
+static void emit_expression_node(CodeGen *gen, ASTNode *node) {
     switch (node->type) {
         case NODE_INT_LITERAL:
-            fprintf(gen->output, "%ld", node->data.int_literal.value);
+            /* Suffixed, or C would compute arithmetic on small literals in int */
+            fprintf(gen->output, "%ldL", node->data.int_literal.value);
             break;
 
         case NODE_FLOAT_LITERAL:
-            fprintf(gen->output, "%f", node->data.float_literal.value);
+            emit_float(gen, node->data.float_literal.value);
             break;
 
         case NODE_STRING_LITERAL:
-            fprintf(gen->output, "\"%s\"", node->data.string_literal.value);
+            emit_string(gen, node->data.string_literal.value);
             break;
 
         case NODE_BOOL_LITERAL:
@@ -312,96 +562,74 @@ static void emit_expression(CodeGen *gen, ASTNode *node) {
             break;
 
         case NODE_IDENTIFIER:
-            fprintf(gen->output, "%s", node->data.identifier.name);
+            fprintf(gen->output, "%s", atom_name(node->data.identifier.name));
             break;
 
         case NODE_BINARY_OP:
+            /* Strings are equal by their text */
+            if (types_of(node->data.binary_op.left) == TYPE_STRING &&
+                (node->data.binary_op.op == OP_EQ || node->data.binary_op.op == OP_NE)) {
+                fprintf(gen->output, "(strcmp(");
+                push_pending(gen, NULL, node->data.binary_op.op == OP_EQ ? ") == 0)" : ") != 0)");
+                push_pending(gen, node->data.binary_op.right, NULL);
+                push_pending(gen, NULL, ", ");
+                push_pending(gen, node->data.binary_op.left, NULL);
+                break;
+            }
             fprintf(gen->output, "(");
-            emit_expression(gen, node->data.binary_op.left);
-            fprintf(gen->output, " ");
-            emit_binary_operator(gen, node->data.binary_op.op);
-            fprintf(gen->output, " ");
-            emit_expression(gen, node->data.binary_op.right);
-            fprintf(gen->output, ")");
+            push_pending(gen, NULL, ")");
+            push_pending(gen, node->data.binary_op.right, NULL);
+            push_pending(gen, NULL, " ");
+            push_pending(gen, NULL, binary_operator_text(node->data.binary_op.op));
+            push_pending(gen, NULL, " ");
+            push_pending(gen, node->data.binary_op.left, NULL);
             break;
 
         case NODE_UNARY_OP:
             emit_unary_operator(gen, node->data.unary_op.op);
             fprintf(gen->output, "(");
-            emit_expression(gen, node->data.unary_op.operand);
-            fprintf(gen->output, ")");
+            push_pending(gen, NULL, ")");
+            push_pending(gen, node->data.unary_op.operand, NULL);
             break;
 
         case NODE_CALL: {
             /* Special case for 'print' function */
             if (node->data.call.function->type == NODE_IDENTIFIER) {
-                const char *func_name = node->data.call.function->data.identifier.name;
-
-                if (strcmp(func_name, "print") == 0) {
-                    /* Determine which print function to use based on argument */
-                    if (node->data.call.argument_count > 0) {
-                        ASTNode *arg = node->data.call.arguments[0];
-
-                        /* Try to determine type from AST node type */
-                        switch (arg->type) {
-                            case NODE_INT_LITERAL:
-                            case NODE_IDENTIFIER:
-                            case NODE_BINARY_OP:
-                            case NODE_CALL:
-                                /* Default to int for now */
-                                fprintf(gen->output, "miru_print_int(");
-                                emit_expression(gen, arg);
-                                fprintf(gen->output, ")");
-                                break;
-
-                            case NODE_FLOAT_LITERAL:
+                Atom func_name = node->data.call.function->data.identifier.name;
+
+                if (func_name == ATOM_PRINT) {
+                    /* The printer for the argument's type; names in an untyped tree print as longs */
+                    if (node->data.call.arguments.count > 0) {
+                        ASTNode *arg = node->data.call.arguments.items[0];
+                        switch (types_of(arg)) {
+                            case TYPE_FLOAT:
                                 fprintf(gen->output, "miru_print_float(");
-                                emit_expression(gen, arg);
-                                fprintf(gen->output, ")");
                                 break;
-
-                            case NODE_STRING_LITERAL:
+                            case TYPE_STRING:
                                 fprintf(gen->output, "miru_print_string(");
-                                emit_expression(gen, arg);
-                                fprintf(gen->output, ")");
                                 break;
-
-                            case NODE_BOOL_LITERAL:
+                            case TYPE_BOOL:
                                 fprintf(gen->output, "miru_print_bool(");
-                                emit_expression(gen, arg);
-                                fprintf(gen->output, ")");
                                 break;
-
                             default:
-                                /* Default to int */
                                 fprintf(gen->output, "miru_print_int(");
-                                emit_expression(gen, arg);
-                                fprintf(gen->output, ")");
                                 break;
                         }
+                        push_pending(gen, NULL, ")");
+                        push_pending(gen, arg, NULL);
                     }
                 } else {
                     /* Regular function call */
-                    fprintf(gen->output, "%s(", func_name);
-                    for (size_t i = 0; i < node->data.call.argument_count; i++) {
-                        if (i > 0) {
-                            fprintf(gen->output, ", ");
-                        }
-                        emit_expression(gen, node->data.call.arguments[i]);
-                    }
-                    fprintf(gen->output, ")");
+                    fprintf(gen->output, "%s(", atom_name(func_name));
+                    push_pending(gen, NULL, ")");
+                    push_arguments(gen, node);
                 }
             } else {
                 /* Function expression (not just identifier) */
-                emit_expression(gen, node->data.call.function);
-                fprintf(gen->output, "(");
-                for (size_t i = 0; i < node->data.call.argument_count; i++) {
-                    if (i > 0) {
-                        fprintf(gen->output, ", ");
-                    }
-                    emit_expression(gen, node->data.call.arguments[i]);
-                }
-                fprintf(gen->output, ")");
+                push_pending(gen, NULL, ")");
+                push_arguments(gen, node);
+                push_pending(gen, NULL, "(");
+                push_pending(gen, node->data.call.function, NULL);
             }
             break;
         }
@@ -411,53 +639,54 @@ static void emit_expression(CodeGen *gen, ASTNode *node) {
     }
 }
 
-/* Emit a binary operator */
-static void emit_binary_operator(CodeGen *gen, OperatorType op) {
+/* Emit an expression; nested operands wait on gen->pending rather than the C stack */
+static void emit_expression(CodeGen *gen, ASTNode *node) {
+    size_t base = gen->pending_count;
+    push_pending(gen, node, NULL);
+
+    while (gen->pending_count > base) {
+        PendingOutput next = gen->pending[--gen->pending_count];
+        if (next.text) {
+            fputs(next.text, gen->output);
+        } else {
+            emit_expression_node(gen, next.node);
+        }
+    }
+}
+
+/* Text of a binary operator */
+static const char *binary_operator_text(OperatorType op) {
     switch (op) {
         case OP_ADD:
-            fprintf(gen->output, "+");
-            break;
+            return "+";
         case OP_SUB:
-            fprintf(gen->output, "-");
-            break;
+            return "-";
         case OP_MUL:
-            fprintf(gen->output, "*");
-            break;
+            return "*";
         case OP_DIV:
-            fprintf(gen->output, "/");
-            break;
+            return "/";
         case OP_MOD:
-            fprintf(gen->output, "%%");
-            break;
+            return "%";
         case OP_EQ:
-            fprintf(gen->output, "==");
-            break;
+            return "==";
         case OP_NE:
-            fprintf(gen->output, "!=");
-            break;
+            return "!=";
         case OP_LT:
-            fprintf(gen->output, "<");
-            break;
+            return "<";
         case OP_LE:
-            fprintf(gen->output, "<=");
-            break;
+            return "<=";
         case OP_GT:
-            fprintf(gen->output, ">");
-            break;
+            return ">";
         case OP_GE:
-            fprintf(gen->output, ">=");
-            break;
+            return ">=";
         case OP_AND:
-            fprintf(gen->output, "&&");
-            break;
+            return "&&";
         case OP_OR:
-            fprintf(gen->output, "||");
-            break;
+            return "||";
         case OP_ASSIGN:
-            fprintf(gen->output, "=");
-            break;
+            return "=";
         default:
-            break;
+            return "";
     }
 }
 
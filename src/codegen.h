@@ -2,12 +2,20 @@
 #define CODEGEN_H
 
 #include "ast.h"
+#include "types.h"
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef struct CodeGen CodeGen;
 
 CodeGen *codegen_create(FILE *output);
 void codegen_destroy(CodeGen *gen);
+void codegen_set_types(CodeGen *gen, const ProgramTypes *types);
 void codegen_generate(CodeGen *gen, ASTNode *ast);
 
+/* Streaming generation, one top-level statement at a time */
+bool codegen_begin(CodeGen *gen, ASTNode **functions, size_t count);
+void codegen_add_statement(CodeGen *gen, ASTNode *statement);
+bool codegen_finish(CodeGen *gen);
+
 #endif
@@ -0,0 +1,527 @@
+#include "cse.h"
+#include "ast_hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Variables an expression reads, or a statement assigns, as a 64-bit set
+ * of atom numbers modulo 64. Sets that share a bit may be killed together
+ * when only one of the variables changed; that costs a missed reuse,
+ * never a wrong one.
+ */
+#define VARIABLE_BIT(atom) (1ull << ((atom) & 63))
+
+/* An expression seen in the current block, and the first place it was computed */
+typedef struct {
+    ASTNode *node;
+    uint64_t hash;
+    uint64_t variables;
+    size_t statement;       /* index of the statement holding `node` in the block's list */
+    size_t size;            /* nodes in `node`'s subtree */
+    size_t born;            /* block clock when it was computed */
+    size_t uses;            /* occurrences, the first included */
+    Atom temporary;
+} Candidate;
+
+/* A later occurrence of a candidate, to be replaced by its temporary */
+typedef struct {
+    size_t candidate;
+    ASTNode *node;
+} Occurrence;
+
+/*
+ * One basic block: a statement list and what has been computed in it so
+ * far. `killed[b]` is the clock of the last statement that assigned a
+ * variable on bit b; a candidate reading such a variable and born no
+ * later is dead.
+ */
+typedef struct {
+    Candidate *candidates;
+    size_t count;
+    size_t capacity;
+    Occurrence *occurrences;
+    size_t occurrence_count;
+    size_t occurrence_capacity;
+    size_t *table;          /* open addressing, candidate index + 1; 0 is empty */
+    size_t table_size;
+    size_t clock;
+    size_t killed[64];
+} Block;
+
+/* A node of the expression being analysed, in pre-order */
+typedef struct {
+    ASTNode *node;
+    size_t parent;          /* SIZE_MAX at the root */
+    size_t size;            /* nodes in its subtree, itself included */
+    int position;           /* which operand of the parent it is */
+    bool conditional;       /* evaluated only on some paths through the expression */
+    bool pure;
+    uint64_t variables;
+    uint64_t hash;
+    uint64_t operand_hashes[2];
+} Visit;
+
+/* Work item for building the visits */
+typedef struct {
+    ASTNode *node;
+    size_t parent;
+    int position;
+    bool conditional;
+} VisitItem;
+
+/* Pass state; the visit buffers are reused by every statement */
+typedef struct {
+    Visit *visits;
+    size_t visit_count;
+    size_t visit_capacity;
+    VisitItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    unsigned next_temporary;
+    Atom first_new_atom;        /* names of temporaries must not be in use */
+    CseStats *stats;
+    bool failed;
+} Cse;
+
+static bool grow(void **array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void push_item(Cse *cse, ASTNode *node, size_t parent, int position, bool conditional) {
+    if (cse->item_count == cse->item_capacity &&
+        !grow((void **)&cse->items, &cse->item_capacity, sizeof(VisitItem))) {
+        cse->failed = true;
+        return;
+    }
+    VisitItem *item = &cse->items[cse->item_count++];
+    item->node = node;
+    item->parent = parent;
+    item->position = position;
+    item->conditional = conditional;
+}
+
+static bool is_operator(const ASTNode *node) {
+    return (node->type == NODE_BINARY_OP && node->data.binary_op.op != OP_ASSIGN) || node->type == NODE_UNARY_OP;
+}
+
+/* Lay an expression out in pre-order, left operands first */
+static bool collect_visits(Cse *cse, ASTNode *root) {
+    cse->visit_count = 0;
+    cse->item_count = 0;
+    push_item(cse, root, SIZE_MAX, 0, false);
+
+    while (cse->item_count > 0 && !cse->failed) {
+        VisitItem item = cse->items[--cse->item_count];
+        if (cse->visit_count == cse->visit_capacity &&
+            !grow((void **)&cse->visits, &cse->visit_capacity, sizeof(Visit))) {
+            return false;
+        }
+        size_t index = cse->visit_count++;
+        Visit *visit = &cse->visits[index];
+        ASTNode *node = item.node;
+        visit->node = node;
+        visit->parent = item.parent;
+        visit->size = 1;
+        visit->position = item.position;
+        visit->conditional = item.conditional;
+        visit->variables = node->type == NODE_IDENTIFIER ? VARIABLE_BIT(node->data.identifier.name) : 0;
+        visit->pure = is_operator(node) || node->type == NODE_INT_LITERAL || node->type == NODE_FLOAT_LITERAL ||
+                      node->type == NODE_STRING_LITERAL || node->type == NODE_BOOL_LITERAL ||
+                      node->type == NODE_IDENTIFIER;
+
+        switch (node->type) {
+            case NODE_BINARY_OP: {
+                OperatorType op = node->data.binary_op.op;
+                bool short_circuit = op == OP_AND || op == OP_OR;
+                push_item(cse, node->data.binary_op.right, index, 1, item.conditional || short_circuit);
+                push_item(cse, node->data.binary_op.left, index, 0, item.conditional);
+                break;
+            }
+            case NODE_UNARY_OP:
+                push_item(cse, node->data.unary_op.operand, index, 0, item.conditional);
+                break;
+            case NODE_CALL:
+                for (size_t i = node->data.call.arguments.count; i > 0; i--) {
+                    push_item(cse, node->data.call.arguments.items[i - 1], index, 0, item.conditional);
+                }
+                push_item(cse, node->data.call.function, index, 0, item.conditional);
+                break;
+            default:
+                break;
+        }
+    }
+    return !cse->failed;
+}
+
+static bool candidate_live(const Block *block, const Candidate *candidate) {
+    uint64_t variables = candidate->variables;
+    while (variables) {
+        int bit = __builtin_ctzll(variables);
+        if (block->killed[bit] >= candidate->born) {
+            return false;
+        }
+        variables &= variables - 1;
+    }
+    return true;
+}
+
+/* The slot holding a candidate equal to `node`, dead or alive, or the empty slot where it would go */
+static size_t find_slot(const Block *block, ASTNode *node, uint64_t hash) {
+    size_t mask = block->table_size - 1;
+    size_t slot = (size_t)hash & mask;
+    while (block->table[slot]) {
+        const Candidate *candidate = &block->candidates[block->table[slot] - 1];
+        if (candidate->hash == hash && ast_equal(candidate->node, node)) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Keep the table at most half full */
+static bool reserve_table(Block *block) {
+    if ((block->count + 1) * 2 <= block->table_size) {
+        return true;
+    }
+    size_t size = block->table_size ? block->table_size * 2 : 64;
+    size_t *table = calloc(size, sizeof(size_t));
+    if (!table) {
+        return false;
+    }
+    for (size_t slot = 0; slot < block->table_size; slot++) {
+        size_t entry = block->table[slot];
+        if (entry) {
+            size_t at = (size_t)block->candidates[entry - 1].hash & (size - 1);
+            while (table[at]) {
+                at = (at + 1) & (size - 1);
+            }
+            table[at] = entry;
+        }
+    }
+    free(block->table);
+    block->table = table;
+    block->table_size = size;
+    return true;
+}
+
+/*
+ * Find the pure operator expressions of one statement's expression and
+ * record each as a new candidate or an occurrence of a live one. A match
+ * covers its whole subtree, so only the largest repeated expression is
+ * taken. Expressions reading a variable in `excluded`, which the
+ * statement itself changes partway through, are left alone. Returns the
+ * variables the expression assigns.
+ */
+static uint64_t analyze_expression(Cse *cse, Block *block, ASTNode *root, size_t statement, uint64_t excluded) {
+    if (!root || !collect_visits(cse, root)) {
+        return 0;
+    }
+    Visit *visits = cse->visits;
+    size_t count = cse->visit_count;
+    uint64_t assigned = 0;
+
+    /* Children come after their parent in pre-order, so a backward sweep sees them first */
+    for (size_t i = count; i-- > 0;) {
+        Visit *visit = &visits[i];
+        ASTNode *node = visit->node;
+        if (node->type == NODE_BINARY_OP && node->data.binary_op.op == OP_ASSIGN &&
+            node->data.binary_op.left && node->data.binary_op.left->type == NODE_IDENTIFIER) {
+            uint64_t target = VARIABLE_BIT(node->data.binary_op.left->data.identifier.name);
+            assigned |= target;
+            /* The right-hand side of the outermost assignment is computed before the store */
+            if (i != 0) {
+                excluded |= target;
+            }
+        }
+        if (visit->pure) {
+            visit->hash = ast_hash_begin(node);
+            if (node->type == NODE_BINARY_OP) {
+                visit->hash = ast_hash_add(ast_hash_add(visit->hash, visit->operand_hashes[0]),
+                                           visit->operand_hashes[1]);
+            } else if (node->type == NODE_UNARY_OP) {
+                visit->hash = ast_hash_add(visit->hash, visit->operand_hashes[0]);
+            }
+        }
+        if (visit->parent != SIZE_MAX) {
+            Visit *parent = &visits[visit->parent];
+            parent->size += visit->size;
+            parent->pure = parent->pure && visit->pure;
+            parent->variables |= visit->variables;
+            parent->operand_hashes[visit->position] = visit->hash;
+        }
+    }
+
+    for (size_t i = 0; i < count;) {
+        Visit *visit = &visits[i];
+        if (!is_operator(visit->node) || !visit->pure || (visit->variables & excluded)) {
+            i++;
+            continue;
+        }
+        if (!reserve_table(block)) {
+            cse->failed = true;
+            return assigned;
+        }
+        size_t slot = find_slot(block, visit->node, visit->hash);
+        size_t entry = block->table[slot];
+        if (entry && candidate_live(block, &block->candidates[entry - 1])) {
+            if (block->occurrence_count == block->occurrence_capacity &&
+                !grow((void **)&block->occurrences, &block->occurrence_capacity, sizeof(Occurrence))) {
+                cse->failed = true;
+                return assigned;
+            }
+            block->occurrences[block->occurrence_count].candidate = entry - 1;
+            block->occurrences[block->occurrence_count].node = visit->node;
+            block->occurrence_count++;
+            block->candidates[entry - 1].uses++;
+            i += visit->size;
+            continue;
+        }
+        if (!visit->conditional) {
+            /* A new candidate, or one computed again after its variables changed */
+            if (block->count == block->capacity &&
+                !grow((void **)&block->candidates, &block->capacity, sizeof(Candidate))) {
+                cse->failed = true;
+                return assigned;
+            }
+            Candidate *candidate = &block->candidates[block->count++];
+            candidate->node = visit->node;
+            candidate->hash = visit->hash;
+            candidate->variables = visit->variables;
+            candidate->statement = statement;
+            candidate->size = visit->size;
+            candidate->born = block->clock;
+            candidate->uses = 1;
+            candidate->temporary = ATOM_NONE;
+            block->table[slot] = block->count;
+        }
+        i++;
+    }
+    return assigned;
+}
+
+/* Variables assigned anywhere in an expression, for expressions that take no part in the block */
+static uint64_t assigned_in(Cse *cse, ASTNode *root) {
+    uint64_t assigned = 0;
+    if (!root || !collect_visits(cse, root)) {
+        return 0;
+    }
+    for (size_t i = 0; i < cse->visit_count; i++) {
+        ASTNode *node = cse->visits[i].node;
+        if (node->type == NODE_BINARY_OP && node->data.binary_op.op == OP_ASSIGN &&
+            node->data.binary_op.left && node->data.binary_op.left->type == NODE_IDENTIFIER) {
+            assigned |= VARIABLE_BIT(node->data.binary_op.left->data.identifier.name);
+        }
+    }
+    return assigned;
+}
+
+/* Turn a node into a read of a temporary; it is resolved when the tree is resolved again */
+static void read_temporary(ASTNode *node, Atom temporary) {
+    node->type = NODE_IDENTIFIER;
+    node->data.identifier.name = temporary;
+    node->data.identifier.depth = SCOPE_UNRESOLVED;
+    node->data.identifier.slot = 0;
+    node->data.identifier.type = TYPE_UNKNOWN;
+}
+
+/* Turn a node into a read of a temporary, freeing what it computed */
+static void replace_with_temporary(ASTNode *node, Atom temporary) {
+    if (node->type == NODE_BINARY_OP) {
+        ast_destroy(node->data.binary_op.left);
+        ast_destroy(node->data.binary_op.right);
+    } else {
+        ast_destroy(node->data.unary_op.operand);
+    }
+    read_temporary(node, temporary);
+}
+
+/*
+ * Declarations go before the statement of their first occurrence and,
+ * within one statement, smallest first: a temporary's value can only
+ * read temporaries of its own proper subexpressions.
+ */
+static int compare_declarations(const void *a, const void *b) {
+    const Candidate *x = *(const Candidate *const *)a;
+    const Candidate *y = *(const Candidate *const *)b;
+    if (x->statement != y->statement) {
+        return x->statement < y->statement ? -1 : 1;
+    }
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Give every candidate used more than once a temporary: a declaration
+ * takes over the first occurrence's subtree, and every occurrence,
+ * the first included, becomes a read of it.
+ */
+static bool rewrite_block(Cse *cse, Block *block, NodeList *list) {
+    size_t repeated = 0;
+    for (size_t i = 0; i < block->count; i++) {
+        Candidate *candidate = &block->candidates[i];
+        if (candidate->uses < 2) {
+            continue;
+        }
+        /* Numbers whose name the program already had are skipped */
+        char name[32];
+        do {
+            snprintf(name, sizeof(name), "miru_cse_%u", cse->next_temporary++);
+            candidate->temporary = atom_intern(name, strlen(name));
+        } while (candidate->temporary != ATOM_NONE && candidate->temporary < cse->first_new_atom);
+        if (candidate->temporary == ATOM_NONE) {
+            return false;
+        }
+        repeated++;
+    }
+    if (repeated == 0) {
+        return true;
+    }
+
+    Candidate **order = malloc(repeated * sizeof(Candidate *));
+    if (!order) {
+        return false;
+    }
+    for (size_t i = 0, n = 0; i < block->count; i++) {
+        if (block->candidates[i].uses >= 2) {
+            order[n++] = &block->candidates[i];
+        }
+    }
+    qsort(order, repeated, sizeof(Candidate *), compare_declarations);
+
+    for (size_t i = 0; i < block->occurrence_count; i++) {
+        const Occurrence *occurrence = &block->occurrences[i];
+        replace_with_temporary(occurrence->node, block->candidates[occurrence->candidate].temporary);
+    }
+
+    /* A first occurrence is turned into a read in place, so a larger value built from it reads the temporary */
+    NodeBuffer statements = {0};
+    bool ok = true;
+    for (size_t s = 0, d = 0; ok && s < list->count; s++) {
+        for (; ok && d < repeated && order[d]->statement == s; d++) {
+            Candidate *candidate = order[d];
+            ASTNode *first = candidate->node;
+            ASTNode *value = first->type == NODE_BINARY_OP
+                                 ? ast_create_binary_op(first->data.binary_op.left, first->data.binary_op.right,
+                                                        first->data.binary_op.op)
+                                 : ast_create_unary_op(first->data.unary_op.operand, first->data.unary_op.op);
+            ASTNode *declaration = value ? ast_create_var_decl(candidate->temporary, value, 1) : NULL;
+            if (!declaration) {
+                ok = false;
+                break;
+            }
+            value->offset = first->offset;
+            declaration->offset = list->items[s]->offset;
+            read_temporary(first, candidate->temporary);
+            ok = node_buffer_push(&statements, declaration);
+            cse->stats->temporaries++;
+            cse->stats->eliminated += candidate->uses - 1;
+        }
+        ok = ok && node_buffer_push(&statements, list->items[s]);
+    }
+    ok = ok && ast_list_assign(list, &statements);
+    node_buffer_free(&statements);
+    free(order);
+    return ok;
+}
+
+static uint64_t process_list(Cse *cse, NodeList *list);
+
+/* Analyse one statement of a block; returns the variables it may assign */
+static uint64_t process_statement(Cse *cse, Block *block, ASTNode *statement, size_t index) {
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT:
+            return analyze_expression(cse, block, statement->data.expr_stmt.expression, index, 0);
+
+        case NODE_VAR_DECL: {
+            /* A new variable shadows any before it, so it ends what was computed from the old one */
+            uint64_t name = VARIABLE_BIT(statement->data.var_decl.name);
+            return name | analyze_expression(cse, block, statement->data.var_decl.initializer, index, name);
+        }
+
+        case NODE_RETURN:
+            return analyze_expression(cse, block, statement->data.return_stmt.value, index, 0);
+
+        case NODE_IF:
+            /* The condition belongs to this block; each branch is a block of its own */
+            return analyze_expression(cse, block, statement->data.if_stmt.condition, index, 0) |
+                   process_list(cse, &statement->data.if_stmt.then_branch) |
+                   process_list(cse, &statement->data.if_stmt.else_branch);
+
+        case NODE_WHILE:
+            /* The condition runs once per iteration, after the body; it is not part of this block */
+            return assigned_in(cse, statement->data.while_stmt.condition) |
+                   process_list(cse, &statement->data.while_stmt.body);
+
+        case NODE_BLOCK:
+            return process_list(cse, &statement->data.block.statements);
+
+        case NODE_FUNCTION_DEF:
+            /* Its variables are its own */
+            process_list(cse, &statement->data.function_def.body);
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+/* Eliminate common subexpressions in a statement list and the lists inside it; returns what it assigns */
+static uint64_t process_list(Cse *cse, NodeList *list) {
+    Block block;
+    memset(&block, 0, sizeof(block));
+    block.clock = 1;
+    uint64_t assigned = 0;
+
+    for (size_t i = 0; i < list->count && !cse->failed; i++) {
+        uint64_t changed = process_statement(cse, &block, list->items[i], i);
+        assigned |= changed;
+        while (changed) {
+            block.killed[__builtin_ctzll(changed)] = block.clock;
+            changed &= changed - 1;
+        }
+        block.clock++;
+    }
+    if (!cse->failed && !rewrite_block(cse, &block, list)) {
+        cse->failed = true;
+    }
+
+    free(block.candidates);
+    free(block.occurrences);
+    free(block.table);
+    return assigned;
+}
+
+/*
+ * Run the pass over a program, in the same allocation setting (arena or
+ * not) it was built under. Returns false if memory ran out, in which
+ * case the program may be left half rewritten and must not be used.
+ */
+bool cse_program(ASTNode *program, CseStats *stats) {
+    if (!program || program->type != NODE_PROGRAM) {
+        return false;
+    }
+    CseStats ignored;
+    Cse cse;
+    memset(&cse, 0, sizeof(cse));
+    cse.stats = stats ? stats : &ignored;
+    cse.first_new_atom = (Atom)atom_count();
+    cse.stats->temporaries = 0;
+    cse.stats->eliminated = 0;
+
+    process_list(&cse, &program->data.program.statements);
+
+    free(cse.visits);
+    free(cse.items);
+    return !cse.failed;
+}
@@ -0,0 +1,28 @@
+#ifndef CSE_H
+#define CSE_H
+
+#include "ast.h"
+
+/*
+ * Common-subexpression elimination within basic blocks. In each
+ * statement list, a pure expression (operators over literals and
+ * variables) that is computed more than once, with no assignment to its
+ * variables in between, is computed once into a temporary declared
+ * before the statement that first needs it, and every occurrence reads
+ * the temporary instead.
+ *
+ * Identical subtrees are found by structural hash (ast_hash.h), so the
+ * lookup is one probe per node. Expressions whose evaluation is
+ * conditional (the right operand of && and ||) reuse an earlier
+ * temporary but never start one, so nothing is evaluated that the
+ * program would not have evaluated. Temporaries are named miru_cse_<n>,
+ * with the numbers of names the program already has skipped.
+ */
+typedef struct {
+    size_t temporaries;     /* expressions given a temporary */
+    size_t eliminated;      /* occurrences replaced beyond the first */
+} CseStats;
+
+bool cse_program(ASTNode *program, CseStats *stats);
+
+#endif
@@ -0,0 +1,495 @@
+#include "dce.h"
+#include "resolve.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_DECLARATION UINT32_MAX
+
+/*
+ * Pass state. Declarations are numbered in the order a walk of the
+ * program meets them, which the counting and sweeping walks of a round
+ * share; the slots map each frame slot to the declaration that holds it
+ * at the point of the walk.
+ */
+typedef struct {
+    uint32_t *reads;            /* per declaration */
+    size_t declaration_count;
+    size_t declaration_capacity;
+    size_t next_declaration;    /* of the sweeping walk */
+    uint32_t *main_slots;
+    uint32_t *function_slots;
+    uint32_t *slots;
+    ASTNode **nodes;            /* subtree walks */
+    size_t node_count;
+    size_t node_capacity;
+    bool again;                 /* a read went, so a variable may have lost its last one */
+    DceStats *stats;
+    bool failed;
+} Dce;
+
+static bool grow(void **array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void push_node(Dce *dce, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    if (dce->node_count == dce->node_capacity &&
+        !grow((void **)&dce->nodes, &dce->node_capacity, sizeof(ASTNode *))) {
+        dce->failed = true;
+        return;
+    }
+    dce->nodes[dce->node_count++] = node;
+}
+
+/* Push a node's children so they come off in order */
+static void push_children(Dce *dce, ASTNode *node) {
+    for (size_t i = ast_child_count(node); i > 0; i--) {
+        push_node(dce, ast_child(node, i - 1));
+    }
+}
+
+static bool is_local(const ASTNode *node) {
+    return node->type == NODE_IDENTIFIER && node->data.identifier.depth != 0 &&
+           node->data.identifier.depth != SCOPE_UNRESOLVED;
+}
+
+/* The declaration a resolved variable refers to, or NO_DECLARATION for a parameter or function */
+static uint32_t declaration_of(const Dce *dce, const ASTNode *identifier) {
+    return is_local(identifier) ? dce->slots[identifier->data.identifier.slot] : NO_DECLARATION;
+}
+
+/* Whether evaluating an expression does anything beyond giving its value */
+static bool has_effect(Dce *dce, ASTNode *expression) {
+    bool effect = false;
+    size_t base = dce->node_count;
+    push_node(dce, expression);
+    while (dce->node_count > base && !effect && !dce->failed) {
+        ASTNode *node = dce->nodes[--dce->node_count];
+        effect = node->type == NODE_CALL || (node->type == NODE_BINARY_OP && node->data.binary_op.op == OP_ASSIGN);
+        push_children(dce, node);
+    }
+    dce->node_count = base;
+    return effect;
+}
+
+/* Free a subtree that is going, passing over its declarations */
+static void discard(Dce *dce, ASTNode *node) {
+    size_t base = dce->node_count;
+    push_node(dce, node);
+    while (dce->node_count > base && !dce->failed) {
+        ASTNode *next = dce->nodes[--dce->node_count];
+        dce->next_declaration += next->type == NODE_VAR_DECL;
+        dce->again |= is_local(next);
+        push_children(dce, next);
+    }
+    dce->node_count = base;
+    ast_destroy(node);
+}
+
+/*
+ * Count the reads of every variable an expression reads. The target of an
+ * assignment inside an expression counts too: only a whole assignment
+ * statement can go with its variable.
+ */
+static void count_reads(Dce *dce, ASTNode *expression) {
+    size_t base = dce->node_count;
+    push_node(dce, expression);
+    while (dce->node_count > base && !dce->failed) {
+        ASTNode *node = dce->nodes[--dce->node_count];
+        uint32_t declaration = declaration_of(dce, node);
+        if (declaration != NO_DECLARATION) {
+            dce->reads[declaration]++;
+        }
+        push_children(dce, node);
+    }
+    dce->node_count = base;
+}
+
+/* Point the slots of a function's parameters at no declaration */
+static void enter_function(Dce *dce, const ASTNode *function) {
+    dce->slots = dce->function_slots;
+    for (uint32_t i = 0; i < function->data.function_def.parameters.count; i++) {
+        dce->slots[i] = NO_DECLARATION;
+    }
+}
+
+static void count_statement(Dce *dce, ASTNode *statement);
+
+static void count_list(Dce *dce, const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count && !dce->failed; i++) {
+        count_statement(dce, statements->items[i]);
+    }
+}
+
+/* First walk of a round: number the declarations and count their reads */
+static void count_statement(Dce *dce, ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT: {
+            ASTNode *expression = statement->data.expr_stmt.expression;
+            if (expression->type == NODE_BINARY_OP && expression->data.binary_op.op == OP_ASSIGN &&
+                is_local(expression->data.binary_op.left)) {
+                expression = expression->data.binary_op.right;
+            }
+            count_reads(dce, expression);
+            break;
+        }
+
+        case NODE_VAR_DECL:
+            count_reads(dce, statement->data.var_decl.initializer);
+            if (dce->declaration_count == dce->declaration_capacity &&
+                !grow((void **)&dce->reads, &dce->declaration_capacity, sizeof(uint32_t))) {
+                dce->failed = true;
+                break;
+            }
+            dce->reads[dce->declaration_count] = 0;
+            dce->slots[statement->data.var_decl.slot] = (uint32_t)dce->declaration_count++;
+            break;
+
+        case NODE_IF:
+            count_reads(dce, statement->data.if_stmt.condition);
+            count_list(dce, &statement->data.if_stmt.then_branch);
+            count_list(dce, &statement->data.if_stmt.else_branch);
+            break;
+
+        case NODE_WHILE:
+            count_reads(dce, statement->data.while_stmt.condition);
+            count_list(dce, &statement->data.while_stmt.body);
+            break;
+
+        case NODE_RETURN:
+            count_reads(dce, statement->data.return_stmt.value);
+            break;
+
+        case NODE_BLOCK:
+            count_list(dce, &statement->data.block.statements);
+            break;
+
+        case NODE_FUNCTION_DEF:
+            enter_function(dce, statement);
+            count_list(dce, &statement->data.function_def.body);
+            dce->slots = dce->main_slots;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool list_returns(const NodeList *statements);
+
+/* Whether a statement returns on every path through it */
+static bool returns(const ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_RETURN:
+            return true;
+        case NODE_IF:
+            return list_returns(&statement->data.if_stmt.then_branch) &&
+                   list_returns(&statement->data.if_stmt.else_branch);
+        case NODE_BLOCK:
+            return list_returns(&statement->data.block.statements);
+        default:
+            return false;
+    }
+}
+
+static bool list_returns(const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (returns(statements->items[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * An expression statement in place of `statement`, for the part of it
+ * that still has an effect, or NULL if none has; what goes is freed.
+ */
+static ASTNode *keep_effect(Dce *dce, ASTNode *statement, ASTNode *value) {
+    dce->stats->stores++;
+    if (!value || !has_effect(dce, value)) {
+        discard(dce, value);
+        ast_destroy(statement);
+        return NULL;
+    }
+    /* An assignment kept as a statement of its own may now go in turn */
+    dce->again |= value->type == NODE_BINARY_OP && value->data.binary_op.op == OP_ASSIGN;
+    if (statement->type == NODE_EXPRESSION_STMT) {
+        statement->data.expr_stmt.expression = value;
+        return statement;
+    }
+    ASTNode *kept = ast_create_expr_stmt(value);
+    if (!kept) {
+        dce->failed = true;
+        return statement;
+    }
+    kept->offset = statement->offset;
+    ast_destroy(statement);
+    return kept;
+}
+
+static void sweep_list(Dce *dce, NodeList *statements);
+
+/* Second walk of a round: what is left of a statement, or NULL if it goes */
+static ASTNode *sweep_statement(Dce *dce, ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT: {
+            ASTNode *expression = statement->data.expr_stmt.expression;
+            if (expression->type == NODE_BINARY_OP && expression->data.binary_op.op == OP_ASSIGN) {
+                uint32_t declaration = declaration_of(dce, expression->data.binary_op.left);
+                if (declaration == NO_DECLARATION || dce->reads[declaration] > 0) {
+                    return statement;
+                }
+                /* A store nothing reads; the value may still have an effect */
+                ASTNode *value = expression->data.binary_op.right;
+                expression->data.binary_op.right = NULL;
+                ast_destroy(expression);
+                statement->data.expr_stmt.expression = NULL;
+                return keep_effect(dce, statement, value);
+            }
+            if (has_effect(dce, expression)) {
+                return statement;
+            }
+            statement->data.expr_stmt.expression = NULL;
+            return keep_effect(dce, statement, expression);
+        }
+
+        case NODE_VAR_DECL: {
+            size_t declaration = dce->next_declaration++;
+            dce->slots[statement->data.var_decl.slot] = (uint32_t)declaration;
+            if (dce->reads[declaration] > 0) {
+                return statement;
+            }
+            ASTNode *initializer = statement->data.var_decl.initializer;
+            statement->data.var_decl.initializer = NULL;
+            return keep_effect(dce, statement, initializer);
+        }
+
+        case NODE_IF:
+            sweep_list(dce, &statement->data.if_stmt.then_branch);
+            sweep_list(dce, &statement->data.if_stmt.else_branch);
+            if (statement->data.if_stmt.then_branch.count == 0 && statement->data.if_stmt.else_branch.count == 0) {
+                ASTNode *condition = statement->data.if_stmt.condition;
+                statement->data.if_stmt.condition = NULL;
+                return keep_effect(dce, statement, condition);
+            }
+            return statement;
+
+        case NODE_WHILE:
+            sweep_list(dce, &statement->data.while_stmt.body);
+            return statement;
+
+        case NODE_BLOCK:
+            sweep_list(dce, &statement->data.block.statements);
+            if (statement->data.block.statements.count == 0) {
+                return keep_effect(dce, statement, NULL);
+            }
+            return statement;
+
+        case NODE_FUNCTION_DEF:
+            enter_function(dce, statement);
+            sweep_list(dce, &statement->data.function_def.body);
+            dce->slots = dce->main_slots;
+            return statement;
+
+        default:
+            return statement;
+    }
+}
+
+/* Sweep a statement list, rebuilding it only if a statement goes or changes */
+static void sweep_list(Dce *dce, NodeList *statements) {
+    NodeBuffer kept = {0};
+    bool rebuilt = false;
+    bool returned = false;
+    for (uint32_t i = 0; i < statements->count && !dce->failed; i++) {
+        ASTNode *statement = statements->items[i];
+        ASTNode *left;
+        /* Functions are not run where they are defined, so a return in main does not end them */
+        if (returned && statement->type != NODE_FUNCTION_DEF) {
+            discard(dce, statement);
+            dce->stats->unreachable++;
+            left = NULL;
+        } else {
+            left = sweep_statement(dce, statement);
+            returned |= left && returns(left);
+        }
+        if (left == statement && !rebuilt) {
+            continue;
+        }
+        for (uint32_t j = 0; !rebuilt && j < i; j++) {
+            dce->failed |= !node_buffer_push(&kept, statements->items[j]);
+        }
+        rebuilt = true;
+        if (left) {
+            dce->failed |= !node_buffer_push(&kept, left);
+        }
+    }
+    if (rebuilt && !dce->failed) {
+        dce->failed = !ast_list_assign(statements, &kept);
+    }
+    node_buffer_free(&kept);
+}
+
+/* Mark the functions the calls in a subtree reach */
+static void mark_calls(Dce *dce, ASTNode *root, bool *reachable, uint32_t *queue, size_t *queued,
+                       size_t function_count) {
+    size_t base = dce->node_count;
+    push_node(dce, root);
+    while (dce->node_count > base && !dce->failed) {
+        ASTNode *node = dce->nodes[--dce->node_count];
+        if (node->type == NODE_CALL) {
+            const ASTNode *callee = node->data.call.function;
+            /* Global slot 0 is print; function k is slot k + 1 */
+            if (callee->type == NODE_IDENTIFIER && callee->data.identifier.depth == 0 &&
+                callee->data.identifier.slot > 0 && callee->data.identifier.slot <= function_count &&
+                !reachable[callee->data.identifier.slot - 1]) {
+                reachable[callee->data.identifier.slot - 1] = true;
+                queue[(*queued)++] = callee->data.identifier.slot - 1;
+            }
+        }
+        push_children(dce, node);
+    }
+    dce->node_count = base;
+}
+
+/* Drop the functions main cannot reach, and their signatures; returns false if out of memory */
+static bool shake(Dce *dce, ASTNode *program, ProgramTypes *types) {
+    NodeList *statements = &program->data.program.statements;
+    NodeBuffer functions = {0};
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_FUNCTION_DEF && !node_buffer_push(&functions, statements->items[i])) {
+            node_buffer_free(&functions);
+            return false;
+        }
+    }
+    size_t count = functions.count;
+    ASTNode **definitions = node_buffer_items(&functions);
+    bool *reachable = calloc(count ? count : 1, sizeof(bool));
+    uint32_t *queue = malloc((count ? count : 1) * sizeof(uint32_t));
+    bool ok = reachable && queue;
+    size_t queued = 0;
+
+    for (uint32_t i = 0; ok && i < statements->count; i++) {
+        if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+            mark_calls(dce, statements->items[i], reachable, queue, &queued, count);
+        }
+    }
+    for (size_t next = 0; ok && next < queued; next++) {
+        mark_calls(dce, definitions[queue[next]], reachable, queue, &queued, count);
+    }
+    ok = ok && !dce->failed;
+
+    if (ok && queued < count) {
+        NodeBuffer kept = {0};
+        size_t function = 0;
+        bool typed = types && types->function_count == count;
+        for (uint32_t i = 0; ok && i < statements->count; i++) {
+            ASTNode *statement = statements->items[i];
+            if (statement->type != NODE_FUNCTION_DEF) {
+                ok = node_buffer_push(&kept, statement);
+                continue;
+            }
+            if (reachable[function++]) {
+                ok = node_buffer_push(&kept, statement);
+            }
+        }
+        ok = ok && ast_list_assign(statements, &kept);
+        node_buffer_free(&kept);
+        if (ok && typed) {
+            size_t left = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (reachable[i]) {
+                    types->functions[left++] = types->functions[i];
+                } else {
+                    free(types->functions[i].parameters);
+                }
+            }
+            types->function_count = left;
+        }
+        for (size_t i = 0; ok && i < count; i++) {
+            if (!reachable[i]) {
+                ast_destroy(definitions[i]);
+            }
+        }
+        dce->stats->functions = count - queued;
+    }
+
+    free(reachable);
+    free(queue);
+    node_buffer_free(&functions);
+    return ok;
+}
+
+/* Whether a program has statements outside its functions, which make its main */
+static bool has_statements(const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool dce_program(ASTNode *program, ProgramTypes *types, DceStats *stats) {
+    if (!program || program->type != NODE_PROGRAM) {
+        return false;
+    }
+    DceStats ignored;
+    Dce dce;
+    memset(&dce, 0, sizeof(dce));
+    dce.stats = stats ? stats : &ignored;
+    memset(dce.stats, 0, sizeof(DceStats));
+
+    NodeList *statements = &program->data.program.statements;
+    uint32_t function_slots = 1;
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_FUNCTION_DEF &&
+            statements->items[i]->data.function_def.locals > function_slots) {
+            function_slots = statements->items[i]->data.function_def.locals;
+        }
+    }
+    dce.main_slots = malloc((program->data.program.locals + 1) * sizeof(uint32_t));
+    dce.function_slots = malloc(function_slots * sizeof(uint32_t));
+    dce.failed = !dce.main_slots || !dce.function_slots;
+
+    bool has_main = has_statements(statements);
+    do {
+        dce.again = false;
+        dce.declaration_count = 0;
+        dce.next_declaration = 0;
+        dce.slots = dce.main_slots;
+        count_list(&dce, statements);
+        dce.slots = dce.main_slots;
+        sweep_list(&dce, statements);
+    } while (dce.again && !dce.failed);
+
+    /* A library has no main to start from; all of its functions may be called */
+    if (!dce.failed && has_main) {
+        dce.failed = !shake(&dce, program, types);
+        /* A main that lost every statement is still a main */
+        if (!dce.failed && !has_statements(statements)) {
+            ASTNode *block = ast_create_block(NULL);
+            dce.failed = !block || !ast_program_add_statement(program, block);
+        }
+    }
+
+    free(dce.reads);
+    free(dce.main_slots);
+    free(dce.function_slots);
+    free(dce.nodes);
+    if (dce.failed) {
+        return false;
+    }
+    bool removed = dce.stats->functions + dce.stats->unreachable + dce.stats->stores > 0;
+    return !removed || resolve_program(program, NULL);
+}
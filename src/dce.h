@@ -0,0 +1,34 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "ast.h"
+#include "types.h"
+
+/*
+ * Dead-code elimination and tree shaking.
+ *
+ * Within main and every function, statements after one that always
+ * returns are removed, as are expression statements that compute
+ * nothing anyone sees, variables nothing reads and the assignments to
+ * them. A call in anything removed stays, as an expression statement of
+ * its own, so side effects are kept. Removing a variable can leave
+ * another unread, so this repeats until nothing more goes.
+ *
+ * Then only the functions main can reach through calls are kept. A
+ * program with no statements outside its functions is a library, and all
+ * of its functions are kept.
+ *
+ * Runs on a resolved program (resolve.h) and resolves it again if
+ * anything was removed. `types`, if given, holds the signatures of the
+ * program's functions in order (types.h); the entries of removed
+ * functions are removed with them.
+ */
+typedef struct {
+    size_t functions;       /* definitions nothing reachable calls */
+    size_t unreachable;     /* statements after a return */
+    size_t stores;          /* declarations and assignments nothing reads, and statements without effect */
+} DceStats;
+
+bool dce_program(ASTNode *program, ProgramTypes *types, DceStats *stats);
+
+#endif
@@ -0,0 +1,643 @@
+#include "fold.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_DECLARATION UINT32_MAX
+
+/* A declared variable: whether anything assigns it, and the literal it always holds if not */
+typedef struct {
+    bool assigned;
+    ASTNode *value;
+} Constant;
+
+/* The value of a literal; bools are 0 or 1 */
+typedef struct {
+    ValueType type;
+    long integer;
+    double real;
+    const char *text;
+} Value;
+
+/* The place of an expression node, before or after its operands have been folded */
+typedef struct {
+    ASTNode **slot;
+    bool operands_done;
+} FoldItem;
+
+/*
+ * Pass state. Declarations are numbered in the order a walk of the
+ * program meets them, which both walks share; the slots map each frame
+ * slot to the declaration that holds it at the point of the walk.
+ */
+typedef struct {
+    Constant *constants;
+    size_t constant_count;
+    size_t constant_capacity;
+    size_t next_constant;       /* of the folding walk */
+    uint32_t *main_slots;
+    uint32_t *function_slots;
+    uint32_t *slots;
+    FoldItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    ASTNode **nodes;            /* subtree walks */
+    size_t node_count;
+    size_t node_capacity;
+    FoldStats *stats;
+    bool failed;
+} Folder;
+
+static bool grow(void **array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void push_node(Folder *folder, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    if (folder->node_count == folder->node_capacity &&
+        !grow((void **)&folder->nodes, &folder->node_capacity, sizeof(ASTNode *))) {
+        folder->failed = true;
+        return;
+    }
+    folder->nodes[folder->node_count++] = node;
+}
+
+/* Nodes in a subtree of any depth, and how many of them are declarations */
+static size_t count_nodes(Folder *folder, ASTNode *root, size_t *declarations) {
+    size_t count = 0;
+    size_t base = folder->node_count;
+    push_node(folder, root);
+    while (folder->node_count > base && !folder->failed) {
+        ASTNode *node = folder->nodes[--folder->node_count];
+        count++;
+        *declarations += node->type == NODE_VAR_DECL;
+        for (size_t i = ast_child_count(node); i > 0; i--) {
+            push_node(folder, ast_child(node, i - 1));
+        }
+    }
+    folder->node_count = base;
+    return count;
+}
+
+/* Code that is being removed: its nodes are eliminated and its declarations passed over */
+static void drop(Folder *folder, ASTNode *node) {
+    size_t declarations = 0;
+    folder->stats->eliminated += count_nodes(folder, node, &declarations);
+    folder->next_constant += declarations;
+}
+
+static void drop_list(Folder *folder, const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        drop(folder, statements->items[i]);
+    }
+}
+
+/* The declaration a resolved variable refers to, or NO_DECLARATION for a parameter or function */
+static uint32_t declaration_of(const Folder *folder, const ASTNode *identifier) {
+    if (identifier->type != NODE_IDENTIFIER || identifier->data.identifier.depth == 0 ||
+        identifier->data.identifier.depth == SCOPE_UNRESOLVED) {
+        return NO_DECLARATION;
+    }
+    return folder->slots[identifier->data.identifier.slot];
+}
+
+/* Mark the variables an expression assigns */
+static void mark_assignments(Folder *folder, ASTNode *expression) {
+    size_t base = folder->node_count;
+    push_node(folder, expression);
+    while (folder->node_count > base && !folder->failed) {
+        ASTNode *node = folder->nodes[--folder->node_count];
+        if (node->type == NODE_BINARY_OP && node->data.binary_op.op == OP_ASSIGN) {
+            uint32_t declaration = declaration_of(folder, node->data.binary_op.left);
+            if (declaration != NO_DECLARATION) {
+                folder->constants[declaration].assigned = true;
+            }
+        }
+        for (size_t i = ast_child_count(node); i > 0; i--) {
+            push_node(folder, ast_child(node, i - 1));
+        }
+    }
+    folder->node_count = base;
+}
+
+static void mark_statement(Folder *folder, ASTNode *statement);
+
+static void mark_list(Folder *folder, const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count && !folder->failed; i++) {
+        mark_statement(folder, statements->items[i]);
+    }
+}
+
+/* First walk: number the declarations and find which of them are ever assigned */
+static void mark_statement(Folder *folder, ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT:
+            mark_assignments(folder, statement->data.expr_stmt.expression);
+            break;
+
+        case NODE_VAR_DECL:
+            mark_assignments(folder, statement->data.var_decl.initializer);
+            if (folder->constant_count == folder->constant_capacity &&
+                !grow((void **)&folder->constants, &folder->constant_capacity, sizeof(Constant))) {
+                folder->failed = true;
+                break;
+            }
+            folder->constants[folder->constant_count].assigned = false;
+            folder->constants[folder->constant_count].value = NULL;
+            folder->slots[statement->data.var_decl.slot] = (uint32_t)folder->constant_count++;
+            break;
+
+        case NODE_IF:
+            mark_assignments(folder, statement->data.if_stmt.condition);
+            mark_list(folder, &statement->data.if_stmt.then_branch);
+            mark_list(folder, &statement->data.if_stmt.else_branch);
+            break;
+
+        case NODE_WHILE:
+            mark_assignments(folder, statement->data.while_stmt.condition);
+            mark_list(folder, &statement->data.while_stmt.body);
+            break;
+
+        case NODE_RETURN:
+            mark_assignments(folder, statement->data.return_stmt.value);
+            break;
+
+        case NODE_BLOCK:
+            mark_list(folder, &statement->data.block.statements);
+            break;
+
+        case NODE_FUNCTION_DEF:
+            folder->slots = folder->function_slots;
+            for (uint32_t i = 0; i < statement->data.function_def.parameters.count; i++) {
+                folder->slots[i] = NO_DECLARATION;
+            }
+            mark_list(folder, &statement->data.function_def.body);
+            folder->slots = folder->main_slots;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool literal_value(const ASTNode *node, Value *value) {
+    switch (node->type) {
+        case NODE_INT_LITERAL:
+            value->type = TYPE_INT;
+            value->integer = node->data.int_literal.value;
+            return true;
+        case NODE_BOOL_LITERAL:
+            value->type = TYPE_BOOL;
+            value->integer = node->data.bool_literal.value != 0;
+            return true;
+        case NODE_FLOAT_LITERAL:
+            value->type = TYPE_FLOAT;
+            value->real = node->data.float_literal.value;
+            return true;
+        case NODE_STRING_LITERAL:
+            value->type = TYPE_STRING;
+            value->text = node->data.string_literal.value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static ASTNode *create_literal(const Value *value) {
+    switch (value->type) {
+        case TYPE_INT:
+            return ast_create_int_literal(value->integer);
+        case TYPE_BOOL:
+            return ast_create_bool_literal((int)value->integer);
+        case TYPE_FLOAT:
+            return ast_create_float_literal(value->real);
+        default:
+            return ast_create_string_literal(value->text);
+    }
+}
+
+static bool truth(const Value *value) {
+    return value->type == TYPE_FLOAT ? value->real != 0 : value->integer != 0;
+}
+
+static double real_of(const Value *value) {
+    return value->type == TYPE_FLOAT ? value->real : (double)value->integer;
+}
+
+static bool boolean(Value *result, bool truth) {
+    result->type = TYPE_BOOL;
+    result->integer = truth;
+    return true;
+}
+
+/* A double the emitted C can write as a literal */
+static bool real(Value *result, double value) {
+    result->type = TYPE_FLOAT;
+    result->real = value;
+    return isfinite(value);
+}
+
+/* A long the emitted C can write as a literal: LONG_MIN has none */
+static bool integer(Value *result, long value) {
+    result->type = TYPE_INT;
+    result->integer = value;
+    return value != LONG_MIN;
+}
+
+/* `left op right` as the emitted C computes it; false if it cannot be computed here */
+static bool compute_binary(OperatorType op, const Value *left, const Value *right, Value *result) {
+    if (left->type == TYPE_STRING || right->type == TYPE_STRING) {
+        if (left->type != right->type || (op != OP_EQ && op != OP_NE)) {
+            return false;
+        }
+        return boolean(result, (strcmp(left->text, right->text) == 0) == (op == OP_EQ));
+    }
+
+    if (left->type == TYPE_FLOAT || right->type == TYPE_FLOAT) {
+        double a = real_of(left), b = real_of(right);
+        switch (op) {
+            case OP_ADD:
+                return real(result, a + b);
+            case OP_SUB:
+                return real(result, a - b);
+            case OP_MUL:
+                return real(result, a * b);
+            case OP_DIV:
+                return real(result, a / b);
+            case OP_EQ:
+                return boolean(result, a == b);
+            case OP_NE:
+                return boolean(result, a != b);
+            case OP_LT:
+                return boolean(result, a < b);
+            case OP_LE:
+                return boolean(result, a <= b);
+            case OP_GT:
+                return boolean(result, a > b);
+            case OP_GE:
+                return boolean(result, a >= b);
+            default:
+                return false;
+        }
+    }
+
+    long a = left->integer, b = right->integer, value;
+    switch (op) {
+        case OP_ADD:
+            return !__builtin_add_overflow(a, b, &value) && integer(result, value);
+        case OP_SUB:
+            return !__builtin_sub_overflow(a, b, &value) && integer(result, value);
+        case OP_MUL:
+            return !__builtin_mul_overflow(a, b, &value) && integer(result, value);
+        case OP_DIV:
+            return b != 0 && !(a == LONG_MIN && b == -1) && integer(result, a / b);
+        case OP_MOD:
+            return b != 0 && !(a == LONG_MIN && b == -1) && integer(result, a % b);
+        case OP_EQ:
+            return boolean(result, a == b);
+        case OP_NE:
+            return boolean(result, a != b);
+        case OP_LT:
+            return boolean(result, a < b);
+        case OP_LE:
+            return boolean(result, a <= b);
+        case OP_GT:
+            return boolean(result, a > b);
+        case OP_GE:
+            return boolean(result, a >= b);
+        default:
+            return false;
+    }
+}
+
+/* Put a literal in place of the subtree at `slot` */
+static void replace(Folder *folder, ASTNode **slot, const Value *value) {
+    ASTNode *literal = create_literal(value);
+    if (!literal) {
+        folder->failed = true;
+        return;
+    }
+    size_t declarations = 0;
+    literal->offset = (*slot)->offset;
+    folder->stats->eliminated += count_nodes(folder, *slot, &declarations) - 1;
+    ast_destroy(*slot);
+    *slot = literal;
+}
+
+/* Fold one node whose operands have been folded */
+static void fold_node(Folder *folder, ASTNode **slot) {
+    ASTNode *node = *slot;
+    Value left, right, result;
+    switch (node->type) {
+        case NODE_IDENTIFIER: {
+            uint32_t declaration = declaration_of(folder, node);
+            const Constant *constant = declaration != NO_DECLARATION ? &folder->constants[declaration] : NULL;
+            if (constant && !constant->assigned && constant->value && literal_value(constant->value, &result)) {
+                replace(folder, slot, &result);
+                folder->stats->propagated++;
+            }
+            return;
+        }
+
+        case NODE_BINARY_OP: {
+            OperatorType op = node->data.binary_op.op;
+            bool left_known = literal_value(node->data.binary_op.left, &left);
+            bool right_known = literal_value(node->data.binary_op.right, &right);
+            if (op == OP_AND || op == OP_OR) {
+                /* Once the left operand decides, the right one is never evaluated */
+                if (!left_known || (truth(&left) != (op == OP_OR) && !right_known)) {
+                    return;
+                }
+                boolean(&result, truth(&left) == (op == OP_OR) ? op == OP_OR : truth(&right));
+            } else if (!left_known || !right_known || !compute_binary(op, &left, &right, &result)) {
+                return;
+            }
+            break;
+        }
+
+        case NODE_UNARY_OP:
+            if (!literal_value(node->data.unary_op.operand, &right) || right.type == TYPE_STRING) {
+                return;
+            }
+            if (node->data.unary_op.op == OP_NOT) {
+                boolean(&result, !truth(&right));
+            } else if (right.type == TYPE_FLOAT) {
+                real(&result, -right.real);
+            } else if (!integer(&result, -right.integer)) {
+                return;
+            }
+            break;
+
+        default:
+            return;
+    }
+    replace(folder, slot, &result);
+    folder->stats->folded++;
+}
+
+static void push_item(Folder *folder, ASTNode **slot, bool operands_done) {
+    if (folder->item_count == folder->item_capacity &&
+        !grow((void **)&folder->items, &folder->item_capacity, sizeof(FoldItem))) {
+        folder->failed = true;
+        return;
+    }
+    folder->items[folder->item_count].slot = slot;
+    folder->items[folder->item_count].operands_done = operands_done;
+    folder->item_count++;
+}
+
+/* Fold an expression of any depth, operands first */
+static void fold_expression(Folder *folder, ASTNode **root) {
+    if (!*root) {
+        return;
+    }
+    size_t base = folder->item_count;
+    push_item(folder, root, false);
+    while (folder->item_count > base && !folder->failed) {
+        FoldItem item = folder->items[--folder->item_count];
+        ASTNode *node = *item.slot;
+        if (item.operands_done) {
+            fold_node(folder, item.slot);
+            continue;
+        }
+        push_item(folder, item.slot, true);
+        switch (node->type) {
+            case NODE_BINARY_OP:
+                push_item(folder, &node->data.binary_op.right, false);
+                /* An assignment's target is written, not read */
+                if (node->data.binary_op.op != OP_ASSIGN) {
+                    push_item(folder, &node->data.binary_op.left, false);
+                }
+                break;
+            case NODE_UNARY_OP:
+                push_item(folder, &node->data.unary_op.operand, false);
+                break;
+            case NODE_CALL:
+                for (uint32_t i = node->data.call.arguments.count; i > 0; i--) {
+                    push_item(folder, &node->data.call.arguments.items[i - 1], false);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    folder->item_count = base;
+}
+
+static bool is_literal(const ASTNode *node) {
+    Value value;
+    return node && literal_value(node, &value);
+}
+
+static void fold_list(Folder *folder, NodeList *statements);
+
+/*
+ * Second walk: fold a statement. Returns false if it goes, leaving in
+ * *taken the statements of the branch a decided `if` takes, which go in
+ * its place.
+ */
+static bool fold_statement(Folder *folder, ASTNode *statement, NodeList **taken) {
+    Value condition;
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT:
+            fold_expression(folder, &statement->data.expr_stmt.expression);
+            return true;
+
+        case NODE_VAR_DECL: {
+            ASTNode **initializer = &statement->data.var_decl.initializer;
+            fold_expression(folder, initializer);
+            size_t declaration = folder->next_constant++;
+            folder->slots[statement->data.var_decl.slot] = (uint32_t)declaration;
+            if (!folder->constants[declaration].assigned && is_literal(*initializer)) {
+                folder->constants[declaration].value = *initializer;
+            }
+            return true;
+        }
+
+        case NODE_IF:
+            fold_expression(folder, &statement->data.if_stmt.condition);
+            if (!literal_value(statement->data.if_stmt.condition, &condition)) {
+                fold_list(folder, &statement->data.if_stmt.then_branch);
+                fold_list(folder, &statement->data.if_stmt.else_branch);
+                return true;
+            }
+            /* The if and its condition go, and the branch not taken with them */
+            if (truth(&condition)) {
+                fold_list(folder, &statement->data.if_stmt.then_branch);
+                drop_list(folder, &statement->data.if_stmt.else_branch);
+                *taken = &statement->data.if_stmt.then_branch;
+            } else {
+                drop_list(folder, &statement->data.if_stmt.then_branch);
+                fold_list(folder, &statement->data.if_stmt.else_branch);
+                *taken = &statement->data.if_stmt.else_branch;
+            }
+            folder->stats->eliminated += 2;
+            folder->stats->branches++;
+            return false;
+
+        case NODE_WHILE:
+            fold_expression(folder, &statement->data.while_stmt.condition);
+            if (literal_value(statement->data.while_stmt.condition, &condition) && !truth(&condition)) {
+                drop(folder, statement);
+                folder->stats->branches++;
+                return false;
+            }
+            fold_list(folder, &statement->data.while_stmt.body);
+            return true;
+
+        case NODE_RETURN:
+            fold_expression(folder, &statement->data.return_stmt.value);
+            return true;
+
+        case NODE_BLOCK:
+            fold_list(folder, &statement->data.block.statements);
+            return true;
+
+        case NODE_FUNCTION_DEF:
+            folder->slots = folder->function_slots;
+            for (uint32_t i = 0; i < statement->data.function_def.parameters.count; i++) {
+                folder->slots[i] = NO_DECLARATION;
+            }
+            fold_list(folder, &statement->data.function_def.body);
+            folder->slots = folder->main_slots;
+            return true;
+
+        default:
+            return true;
+    }
+}
+
+static bool declares(const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_VAR_DECL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * What a decided `if` leaves: its branch's statements, in a block of
+ * their own if they declare anything, so their scope stays the same.
+ */
+static bool push_taken(Folder *folder, NodeBuffer *buffer, ASTNode *statement, NodeList *branch) {
+    if (!declares(branch)) {
+        for (uint32_t i = 0; i < branch->count; i++) {
+            if (!node_buffer_push(buffer, branch->items[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    NodeBuffer statements = {0};
+    for (uint32_t i = 0; i < branch->count; i++) {
+        if (!node_buffer_push(&statements, branch->items[i])) {
+            node_buffer_free(&statements);
+            return false;
+        }
+    }
+    ASTNode *block = ast_create_block(&statements);
+    if (!block) {
+        node_buffer_free(&statements);
+        return false;
+    }
+    block->offset = statement->offset;
+    folder->stats->eliminated--;
+    return node_buffer_push(buffer, block);
+}
+
+/* Fold a statement list, rebuilding it only if a statement goes */
+static void fold_list(Folder *folder, NodeList *statements) {
+    NodeBuffer kept = {0};
+    bool rebuilt = false;
+    for (uint32_t i = 0; i < statements->count && !folder->failed; i++) {
+        ASTNode *statement = statements->items[i];
+        NodeList *taken = NULL;
+        bool keep = fold_statement(folder, statement, &taken);
+        if (keep && !rebuilt) {
+            continue;
+        }
+        for (uint32_t j = 0; !rebuilt && j < i; j++) {
+            folder->failed |= !node_buffer_push(&kept, statements->items[j]);
+        }
+        rebuilt = true;
+        if (keep) {
+            folder->failed |= !node_buffer_push(&kept, statement);
+            continue;
+        }
+        if (taken) {
+            folder->failed |= !push_taken(folder, &kept, statement, taken);
+            /* Its statements have moved out; the rest of the if is freed */
+            taken->count = 0;
+        }
+        ast_destroy(statement);
+    }
+    if (rebuilt && !folder->failed) {
+        folder->failed = !ast_list_assign(statements, &kept);
+    }
+    node_buffer_free(&kept);
+}
+
+/* Whether a program has statements outside its functions, which make its main */
+static bool has_statements(const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool fold_program(ASTNode *program, FoldStats *stats) {
+    if (!program || program->type != NODE_PROGRAM) {
+        return false;
+    }
+    FoldStats ignored;
+    Folder folder;
+    memset(&folder, 0, sizeof(folder));
+    folder.stats = stats ? stats : &ignored;
+    memset(folder.stats, 0, sizeof(FoldStats));
+
+    NodeList *statements = &program->data.program.statements;
+    uint32_t function_slots = 1;
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_FUNCTION_DEF &&
+            statements->items[i]->data.function_def.locals > function_slots) {
+            function_slots = statements->items[i]->data.function_def.locals;
+        }
+    }
+    folder.main_slots = malloc((program->data.program.locals + 1) * sizeof(uint32_t));
+    folder.function_slots = malloc(function_slots * sizeof(uint32_t));
+    folder.failed = !folder.main_slots || !folder.function_slots;
+
+    if (!folder.failed) {
+        bool has_main = has_statements(statements);
+        folder.slots = folder.main_slots;
+        mark_list(&folder, statements);
+        folder.slots = folder.main_slots;
+        fold_list(&folder, statements);
+        /* A program whose statements all folded away still has a main, if an empty one */
+        if (!folder.failed && has_main && !has_statements(statements)) {
+            ASTNode *block = ast_create_block(NULL);
+            folder.failed = !block || !ast_program_add_statement(program, block);
+            folder.stats->eliminated--;
+        }
+    }
+
+    free(folder.constants);
+    free(folder.main_slots);
+    free(folder.function_slots);
+    free(folder.items);
+    free(folder.nodes);
+    return !folder.failed;
+}
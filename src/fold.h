@@ -0,0 +1,34 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "ast.h"
+
+/*
+ * Constant folding and propagation. Operators whose operands are all
+ * literals are computed at compile time, as the emitted C would compute
+ * them: integer division truncates toward zero and % takes the sign of
+ * the dividend, and a bool in arithmetic counts as 0 or 1. What C leaves
+ * undefined or cannot write as a literal is left for run time: division
+ * or % by zero, a long that overflows, or a double that is not finite.
+ *
+ * A `const`, or a `let` that is never assigned, whose initializer folds
+ * to a literal is propagated: its reads become that literal, which may
+ * fold further. An `if` whose condition folds is replaced by the branch
+ * it takes, and a `while` whose condition folds to false is removed.
+ * The declarations themselves stay; the code generator emits those that
+ * are constants as `static const`.
+ *
+ * Runs on a resolved program (resolve.h), which is what ties each read
+ * to its declaration, after the type pass, so that the same type errors
+ * are reported whether or not the program is optimized. Slots stay valid.
+ */
+typedef struct {
+    size_t folded;          /* operators computed at compile time */
+    size_t propagated;      /* reads of constants replaced by their value */
+    size_t branches;        /* ifs and whiles whose condition was decided */
+    size_t eliminated;      /* nodes removed from the tree */
+} FoldStats;
+
+bool fold_program(ASTNode *program, FoldStats *stats);
+
+#endif
@@ -0,0 +1,330 @@
+#include "incremental.h"
+#include "parser.h"
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Lex and parse the whole text; the program stays NULL on a parse error */
+static void rebuild(ParsedSource *source) {
+    token_buffer_destroy(source->tokens);
+    ast_destroy(source->program);
+    source->tokens = NULL;
+    source->program = NULL;
+
+    Lexer *lexer = lexer_create_slice(source->text, 0, source->length);
+    if (!lexer) {
+        return;
+    }
+    source->valid_utf8 = !lexer->invalid_utf8;
+    source->tokens = lexer_tokenize_all(lexer);
+    if (source->tokens) {
+        Parser *parser = parser_create_from_tokens(lexer, source->tokens, 0);
+        if (parser) {
+            source->program = parser_parse(parser);
+            parser_destroy(parser);
+        }
+        source->relexed_tokens = source->tokens->count;
+        source->reparsed_statements = source->program ? source->program->data.program.statements.count : 0;
+    }
+    lexer_destroy(lexer);
+}
+
+ParsedSource *parsed_source_create(const char *text, size_t length) {
+    if (!text || length > UINT32_MAX) {
+        return NULL;
+    }
+    ParsedSource *source = calloc(1, sizeof(ParsedSource));
+    if (!source) {
+        return NULL;
+    }
+    source->text = malloc(length + 1);
+    if (!source->text) {
+        free(source);
+        return NULL;
+    }
+    memcpy(source->text, text, length);
+    source->text[length] = '\0';
+    source->length = length;
+    source->capacity = length + 1;
+    rebuild(source);
+    return source;
+}
+
+void parsed_source_destroy(ParsedSource *source) {
+    if (source) {
+        ast_destroy(source->program);
+        token_buffer_destroy(source->tokens);
+        free(source->text);
+        free(source);
+    }
+}
+
+/* Index of the last token that starts before `offset`, or 0 */
+static size_t last_token_before(const TokenBuffer *tokens, size_t offset) {
+    size_t lo = 0;
+    size_t hi = tokens->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tokens->offsets[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+/* End of the bytes the lexer looked at for token `index` */
+static size_t token_reach(const TokenBuffer *tokens, size_t index) {
+    /* Error tokens have no length; an unterminated string runs up to the next token */
+    size_t end = tokens->kinds[index] == TOKEN_ERROR ? tokens->offsets[index + 1]
+                                                     : tokens->offsets[index] + tokens->lengths[index];
+    return end + LEXER_LOOKAHEAD;
+}
+
+/* Index of the first statement at or after `first` that starts at or after `offset` */
+static size_t statement_from(const ASTNode *program, size_t first, size_t offset) {
+    ASTNode **statements = program->data.program.statements.items;
+    size_t lo = first;
+    size_t hi = program->data.program.statements.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (statements[mid]->offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Replace [offset, offset + removed) of the text with the inserted bytes */
+static bool edit_text(ParsedSource *source, size_t offset, size_t removed,
+                      const char *inserted, size_t inserted_length) {
+    size_t length = source->length - removed + inserted_length;
+    if (length + 1 > source->capacity) {
+        size_t capacity = source->capacity * 2 > length + 1 ? source->capacity * 2 : length + 1;
+        char *text = realloc(source->text, capacity);
+        if (!text) {
+            return false;
+        }
+        source->text = text;
+        source->capacity = capacity;
+    }
+
+    /* The tail moves together with its NUL terminator */
+    memmove(source->text + offset + inserted_length, source->text + offset + removed,
+            source->length - offset - removed + 1);
+    memcpy(source->text + offset, inserted, inserted_length);
+    source->length = length;
+    return true;
+}
+
+/*
+ * Whether well-formed text is still well-formed after bytes were written
+ * at [offset, end): only the sequences the edit touches, from the one
+ * holding the byte before it to the first sequence start after it, can
+ * have gone wrong.
+ */
+static bool edit_keeps_utf8(const ParsedSource *source, size_t offset, size_t end) {
+    const unsigned char *text = (const unsigned char *)source->text;
+    size_t start = offset;
+    for (size_t back = 1; back <= 3 && back <= offset; back++) {
+        if (text[offset - back] >= 0xC0) {
+            start = offset - back;
+            break;
+        }
+        if (text[offset - back] < 0x80) {
+            break;
+        }
+    }
+    for (size_t ahead = 0; ahead < 3 && end < source->length && (text[end] & 0xC0) == 0x80; ahead++) {
+        end++;
+    }
+    if (end < source->length && (text[end] & 0xC0) == 0x80) {
+        return false;
+    }
+    return scan_utf8(source->text, start, end) == end;
+}
+
+/*
+ * Lex the text again from token `restart` until a token starts where an
+ * old token past the edit started (shifted by `delta`), and splice the
+ * new tokens over the old ones in between. On success *fresh_end is the
+ * index of the first token that was kept.
+ */
+static bool relex(ParsedSource *source, Lexer *lexer, size_t restart, size_t edit_end,
+                  ptrdiff_t delta, size_t *fresh_end) {
+    TokenBuffer *tokens = source->tokens;
+    TokenBuffer *fresh = token_buffer_create(source->text, 64);
+    if (!fresh) {
+        return false;
+    }
+
+    size_t old = restart;
+    bool synced = false;
+    while (!synced && lexer_tokenize_into(lexer, fresh, 1) > 0) {
+        size_t start = fresh->offsets[fresh->count - 1];
+        if (start < edit_end) {
+            continue;
+        }
+        size_t old_start = (size_t)((ptrdiff_t)start - delta);
+        while (old < tokens->count && tokens->offsets[old] < old_start) {
+            old++;
+        }
+        if (old < tokens->count && tokens->offsets[old] == old_start) {
+            /* The old token is still right; drop the copy just lexed */
+            synced = true;
+            fresh->count--;
+            if (fresh->literal_count > 0 && fresh->literals[fresh->literal_count - 1].token == fresh->count) {
+                fresh->literal_count--;
+            }
+        }
+    }
+
+    bool ok = synced && token_buffer_splice(tokens, restart, old, fresh, delta);
+    if (ok) {
+        tokens->source = source->text;
+        *fresh_end = restart + fresh->count;
+        source->relexed_tokens = fresh->count;
+    }
+    token_buffer_destroy(fresh);
+    return ok;
+}
+
+/*
+ * Parse the top-level statements from the one before token `restart`
+ * until the parser stands on an old statement boundary past the changed
+ * tokens, and splice them over the old statements in between.
+ */
+static bool reparse(ParsedSource *source, Lexer *lexer, size_t restart, size_t fresh_end, ptrdiff_t delta) {
+    TokenBuffer *tokens = source->tokens;
+    ASTNode *program = source->program;
+    size_t count = program->data.program.statements.count;
+
+    /* Start at the statement holding the last unchanged token */
+    size_t first = 0;
+    size_t pos = 0;
+    if (restart > 0 && count > 0) {
+        first = statement_from(program, 0, (size_t)tokens->offsets[restart - 1] + 1) - 1;
+        pos = last_token_before(tokens, (size_t)program->data.program.statements.items[first]->offset + 1);
+    }
+
+    Parser *parser = parser_create_from_tokens(lexer, tokens, pos);
+    if (!parser) {
+        return false;
+    }
+
+    NodeBuffer statements = {0};
+    size_t end = count;
+    bool ok = true;
+    for (;;) {
+        if (parser->pos >= fresh_end) {
+            if (parser->current == TOKEN_EOF) {
+                break;
+            }
+            size_t old_offset = (size_t)((ptrdiff_t)tokens->offsets[parser->pos] - delta);
+            end = statement_from(program, first, old_offset);
+            if (end < count && program->data.program.statements.items[end]->offset == old_offset) {
+                break;
+            }
+            end = count;
+        }
+
+        ASTNode *stmt = parser_parse_statement(parser);
+        if (!stmt || !node_buffer_push(&statements, stmt)) {
+            ast_destroy(stmt);
+            ok = false;
+            break;
+        }
+    }
+    parser_destroy(parser);
+
+    size_t statement_count = statements.count;
+    if (ok) {
+        ok = ast_program_replace(program, first, end, node_buffer_items(&statements), statement_count);
+    }
+    if (!ok) {
+        node_buffer_destroy(&statements);
+        return false;
+    }
+    node_buffer_free(&statements);
+
+    size_t new_count = program->data.program.statements.count;
+    for (size_t i = first + statement_count; i < new_count; i++) {
+        program->data.program.statements.items[i]->offset += (uint32_t)delta;
+    }
+    source->reparsed_statements = statement_count;
+    return true;
+}
+
+/*
+ * Replace source bytes [offset, offset + removed) with `inserted`, which
+ * must not point into the source's own text, and bring the tokens and
+ * program up to date. Returns the program, or NULL if the new text does
+ * not parse, memory runs out, or the range is out of bounds (in which
+ * case nothing changes).
+ */
+ASTNode *parsed_source_edit(ParsedSource *source, size_t offset, size_t removed,
+                            const char *inserted, size_t inserted_length) {
+    if (!source || offset > source->length || removed > source->length - offset ||
+        (inserted_length > 0 && !inserted) ||
+        source->length - removed + inserted_length > UINT32_MAX) {
+        return NULL;
+    }
+
+    TokenBuffer *tokens = source->tokens;
+    size_t restart = 0;
+    if (tokens) {
+        restart = last_token_before(tokens, offset);
+        while (restart > 0 && token_reach(tokens, restart - 1) > offset) {
+            restart--;
+        }
+    }
+
+    if (!edit_text(source, offset, removed, inserted, inserted_length)) {
+        return NULL;
+    }
+    source->relexed_tokens = 0;
+    source->reparsed_statements = 0;
+    if (!tokens) {
+        rebuild(source);
+        return source->program;
+    }
+
+    /* Text that was valid UTF-8 only needs the edited sequences checked */
+    ptrdiff_t delta = (ptrdiff_t)inserted_length - (ptrdiff_t)removed;
+    size_t from = restart > 0 ? tokens->offsets[restart] : 0;
+    Lexer *lexer;
+    if (source->valid_utf8 && edit_keeps_utf8(source, offset, offset + inserted_length)) {
+        lexer = lexer_create_validated(source->text, from, source->length);
+    } else {
+        lexer = lexer_create_slice(source->text, from, source->length);
+    }
+    size_t fresh_end = 0;
+    if (!lexer || !relex(source, lexer, restart, offset + inserted_length, delta, &fresh_end)) {
+        lexer_destroy(lexer);
+        rebuild(source);
+        return source->program;
+    }
+
+    source->valid_utf8 = !lexer->invalid_utf8;
+
+    bool ok;
+    if (source->program) {
+        ok = reparse(source, lexer, restart, fresh_end, delta);
+    } else {
+        Parser *parser = parser_create_from_tokens(lexer, tokens, 0);
+        source->program = parser ? parser_parse(parser) : NULL;
+        parser_destroy(parser);
+        ok = source->program != NULL;
+        source->reparsed_statements = ok ? source->program->data.program.statements.count : 0;
+    }
+    if (!ok) {
+        ast_destroy(source->program);
+        source->program = NULL;
+    }
+    lexer_destroy(lexer);
+    return source->program;
+}
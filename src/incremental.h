@@ -0,0 +1,43 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "lexer.h"
+#include "ast.h"
+
+/*
+ * An in-memory source kept together with its tokens and program so that
+ * edits can be applied without lexing and parsing the whole text again.
+ *
+ * An edit re-lexes from the last token it can affect until the new token
+ * stream starts a token at the same place as the old one past the edit;
+ * the lexer carries no state between tokens, so from there on the old
+ * tokens are still right and are only moved. The top-level statements
+ * whose tokens changed are then parsed again, from the statement before
+ * the damage (which may have looked at the first changed token, as an
+ * `if` does for `else`) until the parser is back on an old statement
+ * boundary, and spliced into the program. Nested node offsets are
+ * relative to their statement, so later statements only get their own
+ * offset moved.
+ *
+ * `program` is NULL while the text does not parse; the next edit then
+ * parses the whole token stream again. While the text is valid UTF-8,
+ * an edit only validates the bytes around it.
+ */
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    TokenBuffer *tokens;
+    ASTNode *program;
+    bool valid_utf8;
+    /* Work done by the last edit */
+    size_t relexed_tokens;
+    size_t reparsed_statements;
+} ParsedSource;
+
+ParsedSource *parsed_source_create(const char *text, size_t length);
+void parsed_source_destroy(ParsedSource *source);
+ASTNode *parsed_source_edit(ParsedSource *source, size_t offset, size_t removed,
+                            const char *inserted, size_t inserted_length);
+
+#endif
@@ -0,0 +1,888 @@
+#include "inline.h"
+#include "atom.h"
+#include "resolve.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_FUNCTION UINT32_MAX
+#define UNVISITED UINT32_MAX
+
+/* A top-level function, as callee and as caller */
+typedef struct {
+    ASTNode *definition;
+    uint32_t first_callee;      /* into Inliner.callees */
+    uint32_t callee_count;
+    uint32_t calls;             /* call sites anywhere in the program */
+    size_t size;                /* nodes in the body, once what it calls is inlined into it */
+    bool recursive;
+    uint32_t index;             /* Tarjan's walk */
+    uint32_t low;
+    bool on_stack;
+} Function;
+
+/* Statements to lower: a run of a list, then whatever follows it */
+typedef struct Segment {
+    ASTNode **items;
+    size_t count;
+    const struct Segment *next;
+} Segment;
+
+/* How the body of one inlined call is lowered */
+typedef struct {
+    uint32_t site;
+    bool used;                  /* the value of the call is read, into `result` */
+    Atom result;
+    ValueType type;
+    Atom done;                  /* set once the body has returned, where a loop or later code must know */
+    bool has_done;
+} Lowering;
+
+typedef struct {
+    const ProgramTypes *types;
+    const InlineOptions *options;
+    InlineStats *stats;
+    Function *functions;
+    size_t function_count;
+    uint32_t *callees;
+    size_t callee_count;
+    size_t callee_capacity;
+    ASTNode **nodes;            /* subtree walks */
+    size_t node_count;
+    size_t node_capacity;
+    Atom *renames;              /* frame slot of the callee to the name in the copy */
+    size_t rename_capacity;
+    char *text;                 /* names of the copies */
+    size_t text_capacity;
+    Atom first_new_atom;        /* names of the copies must not be in use */
+    uint32_t next_site;
+    const char *caller;
+    size_t caller_size;
+    size_t inlined;             /* into the current caller */
+    bool failed;
+    bool unresolved;            /* failed in the resolver, which has said why */
+} Inliner;
+
+static bool grow(void **array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void push_node(Inliner *inliner, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    if (inliner->node_count == inliner->node_capacity &&
+        !grow((void **)&inliner->nodes, &inliner->node_capacity, sizeof(ASTNode *))) {
+        inliner->failed = true;
+        return;
+    }
+    inliner->nodes[inliner->node_count++] = node;
+}
+
+/* Push a node's children so they come off in order */
+static void push_children(Inliner *inliner, ASTNode *node) {
+    for (size_t i = ast_child_count(node); i > 0; i--) {
+        push_node(inliner, ast_child(node, i - 1));
+    }
+}
+
+static bool is_local(const ASTNode *node) {
+    return node->type == NODE_IDENTIFIER && node->data.identifier.depth != 0 &&
+           node->data.identifier.depth != SCOPE_UNRESOLVED;
+}
+
+/* The function a call calls, or NO_FUNCTION for print */
+static uint32_t callee_of(const Inliner *inliner, const ASTNode *call) {
+    const ASTNode *callee = call->data.call.function;
+    /* Global slot 0 is print; function k is slot k + 1 */
+    if (callee->type != NODE_IDENTIFIER || callee->data.identifier.depth != 0 || callee->data.identifier.slot == 0 ||
+        callee->data.identifier.slot > inliner->function_count) {
+        return NO_FUNCTION;
+    }
+    return callee->data.identifier.slot - 1;
+}
+
+static size_t count_nodes(Inliner *inliner, ASTNode *root) {
+    size_t count = 0;
+    size_t base = inliner->node_count;
+    push_node(inliner, root);
+    while (inliner->node_count > base && !inliner->failed) {
+        ASTNode *node = inliner->nodes[--inliner->node_count];
+        count++;
+        push_children(inliner, node);
+    }
+    inliner->node_count = base;
+    return count;
+}
+
+static size_t count_list(Inliner *inliner, const NodeList *statements) {
+    size_t count = 0;
+    for (uint32_t i = 0; i < statements->count; i++) {
+        count += count_nodes(inliner, statements->items[i]);
+    }
+    return count;
+}
+
+/* Whether evaluating an expression does anything beyond giving its value */
+static bool has_effect(Inliner *inliner, ASTNode *expression) {
+    bool effect = false;
+    size_t base = inliner->node_count;
+    push_node(inliner, expression);
+    while (inliner->node_count > base && !effect && !inliner->failed) {
+        ASTNode *node = inliner->nodes[--inliner->node_count];
+        effect = node->type == NODE_CALL || (node->type == NODE_BINARY_OP && node->data.binary_op.op == OP_ASSIGN);
+        push_children(inliner, node);
+    }
+    inliner->node_count = base;
+    return effect;
+}
+
+/*
+ * Count the calls in a subtree; with `caller`, also record each function
+ * called as one of its callees.
+ */
+static void collect_calls(Inliner *inliner, ASTNode *root, Function *caller) {
+    size_t base = inliner->node_count;
+    push_node(inliner, root);
+    while (inliner->node_count > base && !inliner->failed) {
+        ASTNode *node = inliner->nodes[--inliner->node_count];
+        uint32_t function = node->type == NODE_CALL ? callee_of(inliner, node) : NO_FUNCTION;
+        if (function != NO_FUNCTION) {
+            inliner->functions[function].calls++;
+            if (caller) {
+                if (inliner->callee_count == inliner->callee_capacity &&
+                    !grow((void **)&inliner->callees, &inliner->callee_capacity, sizeof(uint32_t))) {
+                    inliner->failed = true;
+                    break;
+                }
+                inliner->callees[inliner->callee_count++] = function;
+                caller->callee_count++;
+                caller->recursive |= &inliner->functions[function] == caller;
+            }
+        }
+        push_children(inliner, node);
+    }
+    inliner->node_count = base;
+}
+
+/*
+ * Order the functions so that each comes after those it calls, but for
+ * the ones that call each other, which are marked recursive: these are
+ * the strongly connected components of the call graph, which Tarjan's
+ * algorithm finds callees first. Returns NULL if out of memory.
+ */
+static uint32_t *order_functions(Inliner *inliner) {
+    size_t count = inliner->function_count;
+    uint32_t *order = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t *stack = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t *walk = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t *edge = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!order || !stack || !walk || !edge) {
+        free(order);
+        free(stack);
+        free(walk);
+        free(edge);
+        return NULL;
+    }
+    Function *functions = inliner->functions;
+    size_t ordered = 0, stacked = 0;
+    uint32_t next_index = 0;
+    for (size_t root = 0; root < count; root++) {
+        if (functions[root].index != UNVISITED) {
+            continue;
+        }
+        size_t depth = 0;
+        walk[depth] = (uint32_t)root;
+        edge[depth++] = 0;
+        functions[root].index = functions[root].low = next_index++;
+        functions[root].on_stack = true;
+        stack[stacked++] = (uint32_t)root;
+        while (depth > 0) {
+            Function *function = &functions[walk[depth - 1]];
+            if (edge[depth - 1] < function->callee_count) {
+                uint32_t callee = inliner->callees[function->first_callee + edge[depth - 1]++];
+                if (functions[callee].index == UNVISITED) {
+                    functions[callee].index = functions[callee].low = next_index++;
+                    functions[callee].on_stack = true;
+                    stack[stacked++] = callee;
+                    walk[depth] = callee;
+                    edge[depth++] = 0;
+                } else if (functions[callee].on_stack && functions[callee].index < function->low) {
+                    function->low = functions[callee].index;
+                }
+                continue;
+            }
+            if (function->low == function->index) {
+                /* A component of its own: pop it, callees first */
+                size_t first = ordered;
+                uint32_t member;
+                do {
+                    member = stack[--stacked];
+                    functions[member].on_stack = false;
+                    order[ordered++] = member;
+                } while (&functions[member] != function);
+                for (size_t i = first; ordered - first > 1 && i < ordered; i++) {
+                    functions[order[i]].recursive = true;
+                }
+            }
+            depth--;
+            if (depth > 0 && function->low < functions[walk[depth - 1]].low) {
+                functions[walk[depth - 1]].low = function->low;
+            }
+        }
+    }
+    free(stack);
+    free(walk);
+    free(edge);
+    return order;
+}
+
+/*
+ * `miru_inline_<site>` followed by `suffix`, or by nothing, with '_'
+ * added until no name the program had before the pass is the same
+ */
+static Atom copy_name(Inliner *inliner, const char *prefix, uint32_t site, const char *suffix) {
+    size_t length = strlen(prefix) + strlen(suffix) + 16;
+    while (inliner->text_capacity < length) {
+        if (!grow((void **)&inliner->text, &inliner->text_capacity, 1)) {
+            inliner->failed = true;
+            return 0;
+        }
+    }
+    size_t written = (size_t)snprintf(inliner->text, inliner->text_capacity, "%s%u%s%s", prefix, site,
+                                      *suffix ? "_" : "", suffix);
+    Atom atom = atom_intern(inliner->text, written);
+    while (atom != ATOM_NONE && atom < inliner->first_new_atom) {
+        if (written == inliner->text_capacity &&
+            !grow((void **)&inliner->text, &inliner->text_capacity, 1)) {
+            inliner->failed = true;
+            return 0;
+        }
+        inliner->text[written++] = '_';
+        atom = atom_intern(inliner->text, written);
+    }
+    inliner->failed |= atom == ATOM_NONE;
+    return atom;
+}
+
+/* Give the variables of a copied subtree the names of the copy */
+static void rename_copy(Inliner *inliner, ASTNode *root, uint32_t site) {
+    size_t base = inliner->node_count;
+    push_node(inliner, root);
+    while (inliner->node_count > base && !inliner->failed) {
+        ASTNode *node = inliner->nodes[--inliner->node_count];
+        if (node->type == NODE_VAR_DECL) {
+            node->data.var_decl.name = copy_name(inliner, "miru_inline_", site, atom_name(node->data.var_decl.name));
+            inliner->renames[node->data.var_decl.slot] = node->data.var_decl.name;
+        } else if (is_local(node)) {
+            node->data.identifier.name = inliner->renames[node->data.identifier.slot];
+        }
+        push_children(inliner, node);
+    }
+    inliner->node_count = base;
+}
+
+static bool list_returns(const NodeList *statements);
+
+/* Whether a statement returns on every path through it */
+static bool returns(const ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_RETURN:
+            return true;
+        case NODE_IF:
+            return list_returns(&statement->data.if_stmt.then_branch) &&
+                   list_returns(&statement->data.if_stmt.else_branch);
+        case NODE_BLOCK:
+            return list_returns(&statement->data.block.statements);
+        default:
+            return false;
+    }
+}
+
+static bool list_returns(const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (returns(statements->items[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool list_has_return(const NodeList *statements);
+
+/* Whether a statement returns on any path through it */
+static bool has_return(const ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_RETURN:
+            return true;
+        case NODE_IF:
+            return list_has_return(&statement->data.if_stmt.then_branch) ||
+                   list_has_return(&statement->data.if_stmt.else_branch);
+        case NODE_WHILE:
+            return list_has_return(&statement->data.while_stmt.body);
+        case NODE_BLOCK:
+            return list_has_return(&statement->data.block.statements);
+        default:
+            return false;
+    }
+}
+
+static bool list_has_return(const NodeList *statements) {
+    for (uint32_t i = 0; i < statements->count; i++) {
+        if (has_return(statements->items[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool segment_empty(const Segment *segment) {
+    for (; segment; segment = segment->next) {
+        if (segment->count > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Free what follows a return */
+static void drop_segment(const Segment *segment) {
+    for (; segment; segment = segment->next) {
+        for (size_t i = 0; i < segment->count; i++) {
+            ast_destroy(segment->items[i]);
+        }
+    }
+}
+
+static ASTNode *typed_identifier(Atom name, ValueType type) {
+    ASTNode *identifier = ast_create_identifier(name);
+    if (identifier) {
+        identifier->data.identifier.type = type;
+    }
+    return identifier;
+}
+
+/* `name = value;`, typed */
+static ASTNode *assignment(Atom name, ASTNode *value, ValueType type) {
+    ASTNode *target = typed_identifier(name, type);
+    ASTNode *assign = target && value ? ast_create_binary_op(target, value, OP_ASSIGN) : NULL;
+    if (!assign) {
+        ast_destroy(target);
+        ast_destroy(value);
+        return NULL;
+    }
+    assign->data.binary_op.type = type;
+    return ast_create_expr_stmt(assign);
+}
+
+/* A variable declaration of a given type */
+static ASTNode *declaration(Atom name, ASTNode *initializer, ValueType type) {
+    ASTNode *declaration = initializer ? ast_create_var_decl(name, initializer, 0) : NULL;
+    if (!declaration) {
+        ast_destroy(initializer);
+        return NULL;
+    }
+    declaration->data.var_decl.type = type;
+    return declaration;
+}
+
+/* What the result holds before anything is returned */
+static ASTNode *zero(ValueType type) {
+    switch (type) {
+        case TYPE_BOOL:
+            return ast_create_bool_literal(0);
+        case TYPE_FLOAT:
+            return ast_create_float_literal(0.0);
+        case TYPE_STRING:
+            return ast_create_string_literal("");
+        default:
+            return ast_create_int_literal(0);
+    }
+}
+
+static void push_statement(Inliner *inliner, NodeBuffer *out, ASTNode *statement) {
+    if (!statement || !node_buffer_push(out, statement)) {
+        ast_destroy(statement);
+        inliner->failed = true;
+    }
+}
+
+static Atom done_flag(Inliner *inliner, Lowering *lowering) {
+    if (!lowering->has_done) {
+        lowering->done = copy_name(inliner, "miru_inline_done_", lowering->site, "");
+        lowering->has_done = true;
+    }
+    return lowering->done;
+}
+
+/* `!done` */
+static ASTNode *not_done(Inliner *inliner, Lowering *lowering) {
+    ASTNode *flag = typed_identifier(done_flag(inliner, lowering), TYPE_BOOL);
+    ASTNode *not = flag ? ast_create_unary_op(flag, OP_NOT) : NULL;
+    if (!not) {
+        ast_destroy(flag);
+        inliner->failed = true;
+        return NULL;
+    }
+    not->data.unary_op.type = TYPE_BOOL;
+    return not;
+}
+
+static void lower(Inliner *inliner, Lowering *lowering, const Segment *sequence, bool flagged, NodeBuffer *out);
+
+static void lower_list(Inliner *inliner, Lowering *lowering, NodeList *statements, const Segment *rest,
+                       bool flagged) {
+    Segment sequence = { statements->items, statements->count, rest };
+    NodeBuffer lowered = {0};
+    lower(inliner, lowering, &sequence, flagged, &lowered);
+    if (!inliner->failed && !ast_list_assign(statements, &lowered)) {
+        inliner->failed = true;
+    }
+    node_buffer_free(&lowered);
+}
+
+/* Code that runs only if the body has not returned yet: `if (!done) { rest }` */
+static void guard(Inliner *inliner, Lowering *lowering, const Segment *rest, bool flagged, NodeBuffer *out) {
+    if (segment_empty(rest)) {
+        return;
+    }
+    NodeBuffer body = {0};
+    lower(inliner, lowering, rest, flagged, &body);
+    ASTNode *condition = not_done(inliner, lowering);
+    ASTNode *skip = condition && !inliner->failed ? ast_create_if(condition, &body, NULL) : NULL;
+    if (!skip) {
+        ast_destroy(condition);
+        node_buffer_destroy(&body);
+    }
+    push_statement(inliner, out, skip);
+}
+
+/* A return: the result is assigned, and if anything could run after it, the flag is set */
+static void lower_return(Inliner *inliner, Lowering *lowering, ASTNode *statement, bool flagged, NodeBuffer *out) {
+    ASTNode *value = statement->data.return_stmt.value;
+    statement->data.return_stmt.value = NULL;
+    ast_destroy(statement);
+    if (value && lowering->used) {
+        push_statement(inliner, out, assignment(lowering->result, value, lowering->type));
+    } else if (value && has_effect(inliner, value)) {
+        push_statement(inliner, out, ast_create_expr_stmt(value));
+    } else {
+        ast_destroy(value);
+    }
+    if (flagged) {
+        ASTNode *truth = ast_create_bool_literal(1);
+        push_statement(inliner, out, assignment(done_flag(inliner, lowering), truth, TYPE_BOOL));
+    }
+}
+
+/*
+ * Lower a body's statements into `out`, with no returns left. `flagged`
+ * is set where code may run after a return: in a loop, or in an if that
+ * does not always return with more code after it.
+ */
+static void lower(Inliner *inliner, Lowering *lowering, const Segment *sequence, bool flagged, NodeBuffer *out) {
+    for (const Segment *segment = sequence; segment && !inliner->failed; segment = segment->next) {
+        for (size_t i = 0; i < segment->count && !inliner->failed; i++) {
+            ASTNode *statement = segment->items[i];
+            const Segment rest = { segment->items + i + 1, segment->count - i - 1, segment->next };
+            if (statement->type == NODE_RETURN) {
+                lower_return(inliner, lowering, statement, flagged, out);
+                drop_segment(&rest);
+                return;
+            }
+            if (!has_return(statement)) {
+                push_statement(inliner, out, statement);
+                continue;
+            }
+            switch (statement->type) {
+                case NODE_BLOCK:
+                    /* Every name in the copy is its own, so what follows can move into the block */
+                    lower_list(inliner, lowering, &statement->data.block.statements, &rest, flagged);
+                    push_statement(inliner, out, statement);
+                    return;
+
+                case NODE_IF: {
+                    NodeList *then_branch = &statement->data.if_stmt.then_branch;
+                    NodeList *else_branch = &statement->data.if_stmt.else_branch;
+                    bool then_returns = list_returns(then_branch);
+                    bool else_returns = list_returns(else_branch);
+                    if (then_returns || else_returns) {
+                        /* What follows runs only in the branch that does not return */
+                        lower_list(inliner, lowering, then_branch, then_returns ? NULL : &rest, flagged);
+                        lower_list(inliner, lowering, else_branch, else_returns ? NULL : &rest, flagged);
+                        push_statement(inliner, out, statement);
+                        if (then_returns && else_returns) {
+                            drop_segment(&rest);
+                        }
+                        return;
+                    }
+                    bool last = segment_empty(&rest);
+                    lower_list(inliner, lowering, then_branch, NULL, flagged || !last);
+                    lower_list(inliner, lowering, else_branch, NULL, flagged || !last);
+                    push_statement(inliner, out, statement);
+                    guard(inliner, lowering, &rest, flagged, out);
+                    return;
+                }
+
+                case NODE_WHILE: {
+                    lower_list(inliner, lowering, &statement->data.while_stmt.body, NULL, true);
+                    ASTNode *running = not_done(inliner, lowering);
+                    ASTNode *condition = running ? ast_create_binary_op(running, statement->data.while_stmt.condition,
+                                                                        OP_AND)
+                                                 : NULL;
+                    if (!condition) {
+                        ast_destroy(running);
+                        inliner->failed = true;
+                        return;
+                    }
+                    condition->data.binary_op.type = TYPE_BOOL;
+                    statement->data.while_stmt.condition = condition;
+                    push_statement(inliner, out, statement);
+                    guard(inliner, lowering, &rest, flagged, out);
+                    return;
+                }
+
+                default:
+                    push_statement(inliner, out, statement);
+                    break;
+            }
+        }
+    }
+}
+
+/*
+ * Where a statement has a call to a function that could be inlined: the
+ * place of the call, and whether its value is read. NULL if none.
+ */
+static ASTNode **site_of(const Inliner *inliner, ASTNode *statement, bool *used) {
+    ASTNode **site = NULL;
+    *used = true;
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT: {
+            ASTNode *expression = statement->data.expr_stmt.expression;
+            if (expression->type == NODE_CALL && callee_of(inliner, expression) == NO_FUNCTION &&
+                expression->data.call.arguments.count == 1) {
+                site = &expression->data.call.arguments.items[0];
+            } else if (expression->type == NODE_BINARY_OP && expression->data.binary_op.op == OP_ASSIGN) {
+                site = &expression->data.binary_op.right;
+            } else {
+                site = &statement->data.expr_stmt.expression;
+                *used = false;
+            }
+            break;
+        }
+        case NODE_VAR_DECL:
+            site = &statement->data.var_decl.initializer;
+            break;
+        case NODE_RETURN:
+            site = statement->data.return_stmt.value ? &statement->data.return_stmt.value : NULL;
+            break;
+        case NODE_IF:
+            site = &statement->data.if_stmt.condition;
+            break;
+        default:
+            break;
+    }
+    return site && (*site)->type == NODE_CALL && callee_of(inliner, *site) != NO_FUNCTION ? site : NULL;
+}
+
+/* Whether a call is worth inlining, by the cost model; the decision is written out */
+static bool decide(Inliner *inliner, ASTNode *call, uint32_t function) {
+    const InlineOptions *options = inliner->options;
+    const Function *callee = &inliner->functions[function];
+    const char *name = atom_name(callee->definition->data.function_def.name);
+    FILE *decisions = options->decisions;
+    if (callee->recursive) {
+        inliner->stats->recursive++;
+        if (decisions) {
+            fprintf(decisions, "inline: %s not inlined into %s: recursive\n", name, inliner->caller);
+        }
+        return false;
+    }
+    size_t literals = 0, effects = 0;
+    for (uint32_t i = 0; i < call->data.call.arguments.count; i++) {
+        ASTNode *argument = call->data.call.arguments.items[i];
+        literals += argument->type == NODE_INT_LITERAL || argument->type == NODE_FLOAT_LITERAL ||
+                    argument->type == NODE_STRING_LITERAL || argument->type == NODE_BOOL_LITERAL;
+        effects += has_effect(inliner, argument);
+    }
+    if (effects > 1) {
+        inliner->stats->effects++;
+        if (decisions) {
+            fprintf(decisions, "inline: %s not inlined into %s: %zu arguments with side effects\n", name,
+                    inliner->caller, effects);
+        }
+        return false;
+    }
+    size_t bonus = literals * options->literal_bonus + (callee->calls == 1 ? options->once_bonus : 0);
+    size_t cost = callee->size > bonus ? callee->size - bonus : 0;
+    if (options->threshold == 0 || cost > options->threshold || inliner->caller_size > options->caller_limit) {
+        inliner->stats->too_large++;
+        if (decisions) {
+            if (inliner->caller_size > options->caller_limit) {
+                fprintf(decisions, "inline: %s not inlined into %s: caller has %zu nodes, over %zu\n", name,
+                        inliner->caller, inliner->caller_size, options->caller_limit);
+            } else {
+                fprintf(decisions, "inline: %s not inlined into %s: cost %zu over %zu\n", name, inliner->caller,
+                        cost, options->threshold);
+            }
+        }
+        return false;
+    }
+    inliner->stats->inlined++;
+    if (decisions) {
+        fprintf(decisions, "inline: %s inlined into %s: cost %zu\n", name, inliner->caller, cost);
+    }
+    return true;
+}
+
+static bool inline_statement(Inliner *inliner, ASTNode *statement, NodeBuffer *out);
+
+/*
+ * Replace the call at `site` in `statement` with a copy of the function's
+ * body, into `out`: the result's declaration, a block with the parameters
+ * and the lowered body, then the statement reading the result.
+ */
+static void expand(Inliner *inliner, ASTNode *statement, ASTNode **site, bool used, uint32_t function,
+                   NodeBuffer *out) {
+    ASTNode *call = *site;
+    const ASTNode *definition = inliner->functions[function].definition;
+    const AtomList *parameters = &definition->data.function_def.parameters;
+    const FunctionType *signature = inliner->types && inliner->types->function_count == inliner->function_count
+                                        ? &inliner->types->functions[function]
+                                        : NULL;
+    Lowering lowering = { inliner->next_site++, used, 0, types_of(call), 0, false };
+    inliner->caller_size += inliner->functions[function].size;
+
+    if (used) {
+        lowering.result = copy_name(inliner, "miru_inline_", lowering.site, "");
+        push_statement(inliner, out, declaration(lowering.result, zero(lowering.type), lowering.type));
+    }
+
+    /* Each argument into its parameter; those are the caller's code, so calls in them may be inlined too */
+    NodeBuffer declarations = {0};
+    for (uint32_t i = 0; i < parameters->count && !inliner->failed; i++) {
+        ASTNode *argument = call->data.call.arguments.items[i];
+        ValueType type = signature && i < signature->parameter_count ? signature->parameters[i] : types_of(argument);
+        Atom name = copy_name(inliner, "miru_inline_", lowering.site, atom_name(parameters->items[i]));
+        push_statement(inliner, &declarations, declaration(name, argument, type));
+    }
+    NodeBuffer none = {0};
+    inliner->failed |= !ast_list_assign(&call->data.call.arguments, &none);
+    NodeBuffer block = {0};
+    ASTNode **items = node_buffer_items(&declarations);
+    for (uint32_t i = 0; i < declarations.count && !inliner->failed; i++) {
+        if (!inline_statement(inliner, items[i], &block)) {
+            push_statement(inliner, &block, items[i]);
+        }
+    }
+    size_t slots = definition->data.function_def.locals > parameters->count ? definition->data.function_def.locals
+                                                                            : parameters->count;
+    while (inliner->rename_capacity < slots && !inliner->failed) {
+        inliner->failed = !grow((void **)&inliner->renames, &inliner->rename_capacity, sizeof(Atom));
+    }
+    for (uint32_t i = 0; i < declarations.count && !inliner->failed; i++) {
+        inliner->renames[i] = items[i]->data.var_decl.name;
+    }
+    node_buffer_free(&declarations);
+
+    /* The names of the parameters stay in `renames` for the copy of the body */
+    NodeBuffer copies = {0};
+    const NodeList *body = &definition->data.function_def.body;
+    for (uint32_t i = 0; i < body->count && !inliner->failed; i++) {
+        ASTNode *copy = ast_clone(body->items[i]);
+        if (copy) {
+            rename_copy(inliner, copy, lowering.site);
+        }
+        push_statement(inliner, &copies, copy);
+    }
+    NodeBuffer lowered = {0};
+    Segment sequence = { node_buffer_items(&copies), copies.count, NULL };
+    if (!inliner->failed) {
+        lower(inliner, &lowering, &sequence, false, &lowered);
+    }
+    node_buffer_free(&copies);
+    if (lowering.has_done) {
+        push_statement(inliner, &block, declaration(lowering.done, ast_create_bool_literal(0), TYPE_BOOL));
+    }
+    items = node_buffer_items(&lowered);
+    for (uint32_t i = 0; i < lowered.count; i++) {
+        push_statement(inliner, &block, items[i]);
+    }
+    node_buffer_free(&lowered);
+    ASTNode *copy = ast_create_block(&block);
+    if (copy) {
+        copy->offset = statement->offset;
+    } else {
+        node_buffer_destroy(&block);
+    }
+    push_statement(inliner, out, copy);
+
+    if (used) {
+        *site = typed_identifier(lowering.result, lowering.type);
+        inliner->failed |= *site == NULL;
+        push_statement(inliner, out, statement);
+        ast_destroy(call);
+    } else {
+        ast_destroy(statement);
+    }
+}
+
+/* Inline the call a statement makes, if it has one worth it; false leaves the statement as it was */
+static bool inline_statement(Inliner *inliner, ASTNode *statement, NodeBuffer *out) {
+    bool used;
+    ASTNode **site = site_of(inliner, statement, &used);
+    if (!site || !decide(inliner, *site, callee_of(inliner, *site))) {
+        return false;
+    }
+    expand(inliner, statement, site, used, callee_of(inliner, *site), out);
+    inliner->inlined++;
+    return true;
+}
+
+/* Inline into a list of statements, rebuilding it only if a call is inlined */
+static void inline_list(Inliner *inliner, NodeList *statements) {
+    NodeBuffer kept = {0};
+    bool rebuilt = false;
+    for (uint32_t i = 0; i < statements->count && !inliner->failed; i++) {
+        ASTNode *statement = statements->items[i];
+        NodeBuffer expansion = {0};
+        if (statement->type != NODE_FUNCTION_DEF && inline_statement(inliner, statement, &expansion)) {
+            for (uint32_t j = 0; !rebuilt && j < i; j++) {
+                inliner->failed |= !node_buffer_push(&kept, statements->items[j]);
+            }
+            rebuilt = true;
+            ASTNode **items = node_buffer_items(&expansion);
+            for (uint32_t j = 0; j < expansion.count; j++) {
+                inliner->failed |= !node_buffer_push(&kept, items[j]);
+            }
+            node_buffer_free(&expansion);
+            continue;
+        }
+        switch (statement->type) {
+            case NODE_IF:
+                inline_list(inliner, &statement->data.if_stmt.then_branch);
+                inline_list(inliner, &statement->data.if_stmt.else_branch);
+                break;
+            case NODE_WHILE:
+                inline_list(inliner, &statement->data.while_stmt.body);
+                break;
+            case NODE_BLOCK:
+                inline_list(inliner, &statement->data.block.statements);
+                break;
+            default:
+                break;
+        }
+        if (rebuilt) {
+            inliner->failed |= !node_buffer_push(&kept, statement);
+        }
+    }
+    if (rebuilt && !inliner->failed) {
+        inliner->failed = !ast_list_assign(statements, &kept);
+    }
+    node_buffer_free(&kept);
+}
+
+void inline_options_default(InlineOptions *options) {
+    options->threshold = INLINE_DEFAULT_THRESHOLD;
+    options->literal_bonus = INLINE_DEFAULT_LITERAL_BONUS;
+    options->once_bonus = INLINE_DEFAULT_ONCE_BONUS;
+    options->caller_limit = INLINE_DEFAULT_CALLER_LIMIT;
+    options->decisions = NULL;
+}
+
+bool inline_program(ASTNode *program, const ProgramTypes *types, const InlineOptions *options, InlineStats *stats) {
+    if (!program || program->type != NODE_PROGRAM) {
+        return false;
+    }
+    InlineOptions defaults;
+    if (!options) {
+        inline_options_default(&defaults);
+        options = &defaults;
+    }
+    InlineStats ignored;
+    Inliner inliner;
+    memset(&inliner, 0, sizeof(inliner));
+    inliner.types = types;
+    inliner.options = options;
+    inliner.stats = stats ? stats : &ignored;
+    inliner.first_new_atom = (Atom)atom_count();
+    memset(inliner.stats, 0, sizeof(InlineStats));
+    if (options->threshold == 0) {
+        return true;
+    }
+
+    NodeList *statements = &program->data.program.statements;
+    for (uint32_t i = 0; i < statements->count; i++) {
+        inliner.function_count += statements->items[i]->type == NODE_FUNCTION_DEF;
+    }
+    inliner.functions = calloc(inliner.function_count ? inliner.function_count : 1, sizeof(Function));
+    Resolver *resolver = resolver_create(NULL);
+    inliner.failed = !inliner.functions || !resolver;
+
+    /* The call graph */
+    size_t next = 0;
+    for (uint32_t i = 0; i < statements->count && !inliner.failed; i++) {
+        ASTNode *statement = statements->items[i];
+        if (statement->type != NODE_FUNCTION_DEF) {
+            collect_calls(&inliner, statement, NULL);
+            continue;
+        }
+        Function *function = &inliner.functions[next++];
+        function->definition = statement;
+        function->first_callee = (uint32_t)inliner.callee_count;
+        function->index = UNVISITED;
+        collect_calls(&inliner, statement, function);
+        inliner.unresolved |= !resolver_declare_functions(resolver, &statements->items[i], 1);
+        inliner.failed |= inliner.unresolved;
+    }
+    uint32_t *order = inliner.failed ? NULL : order_functions(&inliner);
+    inliner.failed |= !order;
+
+    /* Callees first, each resolved again so that its slots are right to copy from */
+    for (size_t i = 0; i < inliner.function_count && !inliner.failed; i++) {
+        Function *function = &inliner.functions[order[i]];
+        NodeList *body = &function->definition->data.function_def.body;
+        inliner.caller = atom_name(function->definition->data.function_def.name);
+        inliner.caller_size = count_list(&inliner, body);
+        inliner.inlined = 0;
+        inline_list(&inliner, body);
+        if (inliner.inlined > 0 && !inliner.failed) {
+            inliner.unresolved = !resolver_resolve_statement(resolver, function->definition);
+            inliner.failed = inliner.unresolved;
+            inliner.caller_size = count_list(&inliner, body);
+        }
+        function->size = inliner.caller_size;
+    }
+    if (!inliner.failed) {
+        inliner.caller = "main";
+        inliner.caller_size = 0;
+        for (uint32_t i = 0; i < statements->count; i++) {
+            if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+                inliner.caller_size += count_nodes(&inliner, statements->items[i]);
+            }
+        }
+        inline_list(&inliner, statements);
+    }
+
+    resolver_destroy(resolver);
+    free(order);
+    free(inliner.functions);
+    free(inliner.callees);
+    free(inliner.nodes);
+    free(inliner.renames);
+    free(inliner.text);
+    if (inliner.failed) {
+        if (!inliner.unresolved) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+        }
+        return false;
+    }
+    return inliner.stats->inlined == 0 || resolve_program(program, NULL);
+}
@@ -0,0 +1,78 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdio.h>
+#include "ast.h"
+#include "types.h"
+
+/*
+ * Function inlining. A call to a small function that cannot reach itself
+ * through calls is replaced by a copy of the function's body, where the
+ * call is all of a statement, the value of a declaration, assignment,
+ * return or if condition, or the argument of a print:
+ *
+ *   let m = max(x, 2);
+ *
+ * becomes, with every name of the copy made unique to it,
+ *
+ *   let miru_inline_0 = 0;
+ *   {
+ *       let miru_inline_0_a = x;
+ *       let miru_inline_0_b = 2;
+ *       if (miru_inline_0_a > miru_inline_0_b) {
+ *           miru_inline_0 = miru_inline_0_a;
+ *       } else {
+ *           miru_inline_0 = miru_inline_0_b;
+ *       }
+ *   }
+ *   let m = miru_inline_0;
+ *
+ * Each argument is evaluated once, in order, into its parameter. A return
+ * becomes an assignment of the result, and what follows it moves into the
+ * branch that does not return; a return inside a loop, or in an if that
+ * does not always return with more code after it, also sets a flag that
+ * ends the loop and skips the rest. Constant folding then specializes the
+ * copy to literal arguments, and dead-code elimination drops the
+ * functions no call is left to.
+ *
+ * Functions are inlined into their callers before the callers themselves
+ * are, so a copy brings along what was inlined into it. Whether a call is
+ * inlined is decided by the cost model in InlineOptions. A call whose
+ * arguments have more than one side effect is left alone: C leaves their
+ * order unspecified, and a copy would fix one.
+ *
+ * Runs on a resolved, typed program (resolve.h, types.h), whose
+ * signatures are in `types`, and resolves it again if anything was
+ * inlined. Each decision is written to `options->decisions` if that is
+ * not NULL. The names of the copies are made unlike any the program
+ * already has. A failure has been reported to stderr when this returns.
+ */
+#define INLINE_DEFAULT_THRESHOLD 30
+#define INLINE_DEFAULT_LITERAL_BONUS 5
+#define INLINE_DEFAULT_ONCE_BONUS 20
+#define INLINE_DEFAULT_CALLER_LIMIT 2000
+
+/*
+ * A call is inlined if the callee's body, in nodes, less the bonuses,
+ * is at most `threshold`, and the caller is not yet larger than
+ * `caller_limit`. A threshold of 0 inlines nothing.
+ */
+typedef struct {
+    size_t threshold;
+    size_t literal_bonus;   /* per literal argument, which folding can then propagate */
+    size_t once_bonus;      /* for a function called once, whose definition then goes */
+    size_t caller_limit;
+    FILE *decisions;
+} InlineOptions;
+
+typedef struct {
+    size_t inlined;         /* calls replaced by a copy of the body */
+    size_t recursive;       /* calls left to functions that can reach themselves */
+    size_t too_large;       /* calls left because of the cost model */
+    size_t effects;         /* calls left for the order of their arguments' side effects */
+} InlineStats;
+
+void inline_options_default(InlineOptions *options);
+bool inline_program(ASTNode *program, const ProgramTypes *types, const InlineOptions *options, InlineStats *stats);
+
+#endif
@@ -1,25 +1,70 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "lexer.h"
+#include "scan.h"
+#include "unicode.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include "lexer_tables.gen.h"
+
+/*
+ * Second-character transitions for punctuation and operators, indexed by
+ * the first character (CC_OPERATOR in char_class). A token is the two-char
+ * `pair` when the next character is `next`, otherwise the one-char `single`;
+ * characters that are only valid as a pair carry an `error` message instead.
+ */
+typedef struct {
+    TokenKind single;
+    char next;
+    TokenKind pair;
+    const char *error;
+} OperatorTransition;
+
+static const OperatorTransition operator_transitions[256] = {
+    ['('] = { TOKEN_LPAREN,    '\0', TOKEN_ERROR, NULL },
+    [')'] = { TOKEN_RPAREN,    '\0', TOKEN_ERROR, NULL },
+    ['{'] = { TOKEN_LBRACE,    '\0', TOKEN_ERROR, NULL },
+    ['}'] = { TOKEN_RBRACE,    '\0', TOKEN_ERROR, NULL },
+    ['['] = { TOKEN_LBRACKET,  '\0', TOKEN_ERROR, NULL },
+    [']'] = { TOKEN_RBRACKET,  '\0', TOKEN_ERROR, NULL },
+    [','] = { TOKEN_COMMA,     '\0', TOKEN_ERROR, NULL },
+    [';'] = { TOKEN_SEMICOLON, '\0', TOKEN_ERROR, NULL },
+    [':'] = { TOKEN_COLON,     '\0', TOKEN_ERROR, NULL },
+    ['.'] = { TOKEN_DOT,       '\0', TOKEN_ERROR, NULL },
+    ['+'] = { TOKEN_PLUS,      '\0', TOKEN_ERROR, NULL },
+    ['*'] = { TOKEN_STAR,      '\0', TOKEN_ERROR, NULL },
+    ['%'] = { TOKEN_PERCENT,   '\0', TOKEN_ERROR, NULL },
+    ['='] = { TOKEN_ASSIGN,    '=',  TOKEN_EQ,    NULL },
+    ['!'] = { TOKEN_NOT,       '=',  TOKEN_NE,    NULL },
+    ['<'] = { TOKEN_LT,        '=',  TOKEN_LE,    NULL },
+    ['>'] = { TOKEN_GT,        '=',  TOKEN_GE,    NULL },
+    ['&'] = { TOKEN_ERROR,     '&',  TOKEN_AND,   "Unexpected character '&'" },
+    ['|'] = { TOKEN_ERROR,     '|',  TOKEN_OR,    "Unexpected character '|'" },
+};
 
 /* Helper function prototypes */
-static void skip_whitespace(Lexer *lexer);
-static void skip_comment(Lexer *lexer);
-static bool is_alpha(char c);
+static CharClass class_of(char c);
 static bool is_digit(char c);
-static bool is_alnum(char c);
 static char peek(Lexer *lexer);
 static char peek_next(Lexer *lexer);
 static char advance(Lexer *lexer);
 static bool match(Lexer *lexer, char expected);
-static Token make_token(Lexer *lexer, TokenKind kind, const char *start, size_t length, int line, int column);
-static Token error_token(Lexer *lexer, const char *message, int line, int column);
-static Token parse_number(Lexer *lexer, int start_line, int start_column);
-static Token parse_string(Lexer *lexer, int start_line, int start_column);
-static Token parse_identifier(Lexer *lexer, int start_line, int start_column);
+static Token make_token(Lexer *lexer, TokenKind kind, const char *start, size_t length);
+static Token error_token(Lexer *lexer, const char *message);
+static Token parse_number(Lexer *lexer);
+static Token parse_string(Lexer *lexer);
+static Token parse_identifier(Lexer *lexer);
+static Token parse_unicode(Lexer *lexer);
 static TokenKind keyword_or_identifier(const char *text, size_t length);
+static void lexer_refill(Lexer *lexer);
+static void lexer_cut(Lexer *lexer, size_t start);
+static bool lexer_skip(Lexer *lexer, bool cut);
+static size_t lexer_scan_run(const Lexer *lexer, size_t from, bool *dot);
+static Token lex_token(Lexer *lexer);
 
 Lexer *lexer_create(const char *source) {
     Lexer *lexer = malloc(sizeof(Lexer));
@@ -28,63 +73,102 @@ Lexer *lexer_create(const char *source) {
     }
     lexer->source = source;
     lexer->length = source ? strlen(source) : 0;
+    lexer->invalid_utf8 = false;
+    lexer->reported_input = false;
+    if (source) {
+        size_t valid = scan_utf8(source, 0, lexer->length);
+        lexer->invalid_utf8 = valid < lexer->length;
+        lexer->length = valid;
+    }
     lexer->pos = 0;
-    lexer->line = 1;
-    lexer->column = 1;
+    lexer->token_start = 0;
+    line_index_init(&lexer->lines, source, 0, lexer->length, 1);
+    lexer->fd = -1;
+    lexer->window = NULL;
+    lexer->capacity = 0;
+    lexer->chunk_size = 0;
+    lexer->base = 0;
+    lexer->base_line = 1;
+    lexer->pin = (size_t)-1;
+    lexer->pending = 0;
+    lexer->in_comment = false;
+    lexer->at_eof = true;
+    lexer->read_error = false;
+    lexer->too_large = false;
     return lexer;
 }
 
-void lexer_destroy(Lexer *lexer) {
-    if (lexer) {
-        free(lexer);
+/*
+ * Create a lexer over source[start, end). Lexemes and token offsets stay
+ * relative to `source`; the slice end acts as end of input, so a string
+ * still open there is reported unterminated. `start` must be at the start
+ * of a UTF-8 sequence.
+ */
+Lexer *lexer_create_slice(const char *source, size_t start, size_t end) {
+    Lexer *lexer = lexer_create_validated(source, start, end);
+    if (lexer && source) {
+        size_t valid = scan_utf8(source, start, end);
+        lexer->invalid_utf8 = valid < end;
+        lexer->length = valid;
     }
+    return lexer;
 }
 
-/* Skip whitespace characters */
-static void skip_whitespace(Lexer *lexer) {
-    while (lexer->pos < lexer->length) {
-        char c = lexer->source[lexer->pos];
-        switch (c) {
-            case ' ':
-            case '\t':
-            case '\r':
-                lexer->pos++;
-                lexer->column++;
-                break;
-            case '\n':
-                lexer->pos++;
-                lexer->line++;
-                lexer->column = 1;
-                break;
-            default:
-                return;
-        }
+/* As lexer_create_slice, for a range the caller has already checked with scan_utf8 */
+Lexer *lexer_create_validated(const char *source, size_t start, size_t end) {
+    Lexer *lexer = lexer_create(NULL);
+    if (!lexer) {
+        return NULL;
     }
+    lexer->source = source;
+    lexer->length = end;
+    lexer->pos = start;
+    lexer->token_start = start;
+    line_index_init(&lexer->lines, source, 0, end, 1);
+    return lexer;
 }
 
-/* Skip single-line comments starting with // */
-static void skip_comment(Lexer *lexer) {
-    if (peek(lexer) == '/' && peek_next(lexer) == '/') {
-        /* Skip until end of line or end of file */
-        while (lexer->pos < lexer->length && lexer->source[lexer->pos] != '\n') {
-            lexer->pos++;
-        }
+/* Create a lexer that reads from fd in chunks; the caller keeps ownership of fd */
+Lexer *lexer_create_fd(int fd, size_t chunk_size) {
+    if (chunk_size == 0) {
+        chunk_size = LEXER_DEFAULT_CHUNK_SIZE;
     }
+
+    Lexer *lexer = lexer_create(NULL);
+    if (!lexer) {
+        return NULL;
+    }
+    lexer->window = malloc(2 * chunk_size + 1);
+    if (!lexer->window) {
+        free(lexer);
+        return NULL;
+    }
+    lexer->window[0] = '\0';
+    lexer->source = lexer->window;
+    line_index_init(&lexer->lines, lexer->window, 0, 0, 1);
+    lexer->fd = fd;
+    lexer->capacity = 2 * chunk_size;
+    lexer->chunk_size = chunk_size;
+    lexer->at_eof = false;
+    return lexer;
 }
 
-/* Check if character is alphabetic or underscore */
-static bool is_alpha(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+void lexer_destroy(Lexer *lexer) {
+    if (lexer) {
+        line_index_free(&lexer->lines);
+        free(lexer->window);
+        free(lexer);
+    }
 }
 
-/* Check if character is a digit */
-static bool is_digit(char c) {
-    return c >= '0' && c <= '9';
+/* Look up the character class of a byte */
+static CharClass class_of(char c) {
+    return (CharClass)char_class[(unsigned char)c];
 }
 
-/* Check if character is alphanumeric or underscore */
-static bool is_alnum(char c) {
-    return is_alpha(c) || is_digit(c);
+/* Check if character is a digit */
+static bool is_digit(char c) {
+    return class_of(c) == CC_DIGIT;
 }
 
 /* Peek at current character without advancing */
@@ -110,7 +194,6 @@ static char advance(Lexer *lexer) {
     }
     char c = lexer->source[lexer->pos];
     lexer->pos++;
-    lexer->column++;
     return c;
 }
 
@@ -123,61 +206,62 @@ static bool match(Lexer *lexer, char expected) {
         return false;
     }
     lexer->pos++;
-    lexer->column++;
     return true;
 }
 
-/* Create a token */
-static Token make_token(Lexer *lexer, TokenKind kind, const char *start, size_t length, int line, int column) {
+/* Create a token starting at the current token start */
+static Token make_token(Lexer *lexer, TokenKind kind, const char *start, size_t length) {
     Token token;
     token.kind = kind;
+    token.offset = (uint32_t)(lexer->base + lexer->token_start);
     token.lexeme = start;
     token.length = length;
-    token.line = line;
-    token.column = column;
     token.value.int_value = 0;
     return token;
 }
 
 /* Create an error token */
-static Token error_token(Lexer *lexer, const char *message, int line, int column) {
-    Token token;
-    token.kind = TOKEN_ERROR;
-    token.lexeme = message;
-    token.length = strlen(message);
-    token.line = line;
-    token.column = column;
-    token.value.int_value = 0;
-    return token;
+static Token error_token(Lexer *lexer, const char *message) {
+    return make_token(lexer, TOKEN_ERROR, message, strlen(message));
 }
 
 /* Parse a number (integer or float) */
-static Token parse_number(Lexer *lexer, int start_line, int start_column) {
+static Token parse_number(Lexer *lexer) {
     const char *start = &lexer->source[lexer->pos - 1];
     bool is_float = false;
 
     /* Handle negative numbers - already advanced past the '-' */
     /* Continue parsing digits */
-    while (is_digit(peek(lexer))) {
-        advance(lexer);
-    }
+    lexer->pos = scan_digits(lexer->source, lexer->pos, lexer->length);
 
     /* Check for decimal point */
     if (peek(lexer) == '.' && is_digit(peek_next(lexer))) {
         is_float = true;
         advance(lexer); /* Consume '.' */
 
-        while (is_digit(peek(lexer))) {
-            advance(lexer);
-        }
+        lexer->pos = scan_digits(lexer->source, lexer->pos, lexer->length);
     }
 
     size_t length = &lexer->source[lexer->pos] - start;
-    Token token = make_token(lexer, is_float ? TOKEN_FLOAT : TOKEN_INT, start, length, start_line, start_column);
+    Token token = make_token(lexer, is_float ? TOKEN_FLOAT : TOKEN_INT, start, length);
 
-    /* Parse the value */
+    /*
+     * Parse the value. strtod would also take an exponent or hex digits
+     * after the token, so floats are parsed from a copy of the token alone.
+     */
     if (is_float) {
-        token.value.float_value = strtod(start, NULL);
+        char digits[64];
+        char *copy = length < sizeof(digits) ? digits : malloc(length + 1);
+        if (copy) {
+            memcpy(copy, start, length);
+            copy[length] = '\0';
+            token.value.float_value = strtod(copy, NULL);
+            if (copy != digits) {
+                free(copy);
+            }
+        } else {
+            token.value.float_value = strtod(start, NULL);
+        }
     } else {
         token.value.int_value = strtol(start, NULL, 10);
     }
@@ -186,74 +270,291 @@ static Token parse_number(Lexer *lexer, int start_line, int start_column) {
 }
 
 /* Parse a string literal */
-static Token parse_string(Lexer *lexer, int start_line, int start_column) {
+static Token parse_string(Lexer *lexer) {
     const char *start = &lexer->source[lexer->pos - 1]; /* Include opening quote */
 
-    while (peek(lexer) != '"' && peek(lexer) != '\0') {
-        if (peek(lexer) == '\n') {
-            lexer->line++;
-            lexer->column = 0; /* Will be incremented by advance */
-        }
-        advance(lexer);
-    }
+    /* Strings may span lines; the body runs to the next quote or NUL */
+    lexer->pos = scan_string(lexer->source, lexer->pos, lexer->length);
 
     if (peek(lexer) == '\0') {
-        return error_token(lexer, "Unterminated string", start_line, start_column);
+        return error_token(lexer, "Unterminated string");
     }
 
     advance(lexer); /* Consume closing quote */
 
     size_t length = &lexer->source[lexer->pos] - start;
-    return make_token(lexer, TOKEN_STRING, start, length, start_line, start_column);
+    return make_token(lexer, TOKEN_STRING, start, length);
 }
 
 /* Parse an identifier or keyword */
-static Token parse_identifier(Lexer *lexer, int start_line, int start_column) {
-    const char *start = &lexer->source[lexer->pos - 1];
+static Token parse_identifier(Lexer *lexer) {
+    const char *start = &lexer->source[lexer->token_start];
+
+    lexer->pos = scan_ident(lexer->source, lexer->pos, lexer->length);
 
-    while (is_alnum(peek(lexer))) {
-        advance(lexer);
+    /* Non-ASCII characters continue the name if they are XID_Continue */
+    while (lexer->pos < lexer->length && class_of(lexer->source[lexer->pos]) == CC_UTF8) {
+        uint32_t cp;
+        size_t size = utf8_decode(lexer->source, lexer->pos, &cp);
+        if (!unicode_is_xid_continue(cp)) {
+            break;
+        }
+        lexer->pos = scan_ident(lexer->source, lexer->pos + size, lexer->length);
     }
 
     size_t length = &lexer->source[lexer->pos] - start;
     TokenKind kind = keyword_or_identifier(start, length);
 
-    return make_token(lexer, kind, start, length, start_line, start_column);
+    return make_token(lexer, kind, start, length);
 }
 
-/* Check if identifier is a keyword */
-static TokenKind keyword_or_identifier(const char *text, size_t length) {
-    /* Check keywords by length first for efficiency */
-    switch (length) {
-        case 2:
-            if (strncmp(text, "if", 2) == 0) return TOKEN_IF;
-            break;
-        case 3:
-            if (strncmp(text, "for", 3) == 0) return TOKEN_FOR;
-            if (strncmp(text, "let", 3) == 0) return TOKEN_LET;
-            break;
-        case 4:
-            if (strncmp(text, "else", 4) == 0) return TOKEN_ELSE;
-            if (strncmp(text, "func", 4) == 0) return TOKEN_FUNC;
-            if (strncmp(text, "true", 4) == 0) return TOKEN_TRUE;
-            if (strncmp(text, "null", 4) == 0) return TOKEN_NULL;
-            break;
-        case 5:
-            if (strncmp(text, "while", 5) == 0) return TOKEN_WHILE;
-            if (strncmp(text, "false", 5) == 0) return TOKEN_FALSE;
-            if (strncmp(text, "const", 5) == 0) return TOKEN_CONST;
-            if (strncmp(text, "print", 5) == 0) return TOKEN_PRINT;
-            break;
-        case 6:
-            if (strncmp(text, "return", 6) == 0) return TOKEN_RETURN;
-            break;
+/* A non-ASCII character starts an identifier if it is XID_Start */
+static Token parse_unicode(Lexer *lexer) {
+    uint32_t cp;
+    lexer->pos = lexer->token_start + utf8_decode(lexer->source, lexer->token_start, &cp);
+    if (!unicode_is_xid_start(cp)) {
+        return error_token(lexer, "Unexpected character");
     }
+    return parse_identifier(lexer);
+}
 
+/* Check if identifier is a keyword: one perfect-hash probe and one compare */
+static TokenKind keyword_or_identifier(const char *text, size_t length) {
+    const KeywordEntry *entry = &keyword_table[KEYWORD_HASH(text, length)];
+    if (entry->length == length && memcmp(entry->text, text, length) == 0) {
+        return entry->kind;
+    }
     return TOKEN_IDENTIFIER;
 }
 
-/* Main tokenization function */
+/*
+ * Read the next chunk into the window. When there is no room for a whole
+ * chunk, bytes before both the pin and the token being lexed are dropped
+ * first, and the window only grows if a single pinned region outgrows it.
+ * The new bytes are validated as UTF-8 together with the pending bytes
+ * before them; a sequence the chunk cuts off stays pending.
+ */
+static void lexer_refill(Lexer *lexer) {
+    size_t filled = lexer->length + lexer->pending;
+    if (lexer->capacity - filled < lexer->chunk_size) {
+        size_t keep = lexer->pin > lexer->base ? lexer->pin - lexer->base : 0;
+        if (keep > lexer->pos) {
+            keep = lexer->pos;
+        }
+        if (keep > 0) {
+            lexer->base_line += scan_count_newlines(lexer->window, 0, keep);
+            memmove(lexer->window, lexer->window + keep, filled - keep);
+            lexer->length -= keep;
+            lexer->pos -= keep;
+            lexer->base += keep;
+            filled -= keep;
+        }
+    }
+
+    if (lexer->capacity - filled < lexer->chunk_size) {
+        size_t new_capacity = lexer->capacity * 2;
+        while (new_capacity - filled < lexer->chunk_size) {
+            new_capacity *= 2;
+        }
+        char *window = realloc(lexer->window, new_capacity + 1);
+        if (!window) {
+            lexer->at_eof = true;
+            lexer->read_error = true;
+            return;
+        }
+        lexer->window = window;
+        lexer->capacity = new_capacity;
+    }
+
+    ssize_t got;
+    do {
+        got = read(lexer->fd, lexer->window + filled, lexer->chunk_size);
+    } while (got < 0 && errno == EINTR);
+
+    if (got <= 0) {
+        lexer->at_eof = true;
+        lexer->read_error = got < 0;
+        /* A sequence still pending at the end of input is truncated */
+        lexer->invalid_utf8 = lexer->pending > 0;
+    } else {
+        filled += (size_t)got;
+        /* Token offsets are 32-bit, so input past 4 GiB is cut off and reported */
+        if (lexer->base + filled > UINT32_MAX) {
+            filled = UINT32_MAX - lexer->base;
+            lexer->at_eof = true;
+            lexer->too_large = true;
+        }
+        size_t valid = scan_utf8(lexer->window, lexer->length, filled);
+        if (valid < filled && !utf8_is_partial(lexer->window, valid, filled)) {
+            lexer->at_eof = true;
+            lexer->invalid_utf8 = true;
+        }
+        lexer->length = valid;
+        lexer->pending = lexer->at_eof ? 0 : filled - valid;
+    }
+    lexer->window[lexer->length + lexer->pending] = '\0';
+    lexer->source = lexer->window;
+
+    /* Positions are resolved over the new window when next asked for */
+    line_index_free(&lexer->lines);
+    line_index_init(&lexer->lines, lexer->window, lexer->base, lexer->length, lexer->base_line);
+}
+
+/*
+ * Remove the comments and whitespace in [start, pos) from the window, so
+ * a long run of them after pinned tokens is not kept. The bytes before
+ * the cut keep their text, but their input offsets are now off by its
+ * length, and so is the pin.
+ */
+static void lexer_cut(Lexer *lexer, size_t start) {
+    size_t cut = lexer->pos - start;
+    size_t filled = lexer->length + lexer->pending;
+    lexer->base_line += scan_count_newlines(lexer->window, start, lexer->pos);
+    memmove(lexer->window + start, lexer->window + lexer->pos, filled - lexer->pos + 1);
+    lexer->length -= cut;
+    lexer->pos = start;
+    lexer->base += cut;
+    lexer->pin += cut;
+
+    line_index_free(&lexer->lines);
+    line_index_init(&lexer->lines, lexer->window, lexer->base, lexer->length, lexer->base_line);
+}
+
+/*
+ * Skip comments and whitespace in a streaming lexer, refilling when they
+ * run into the end of the window; whether a comment is still open is
+ * carried across refills. Skipped bytes are never kept: with nothing
+ * pinned the refill drops them, and after pinned tokens they are cut out
+ * of the window if `cut` is set. Otherwise a run longer than a chunk
+ * returns false, with the lexer inside it.
+ */
+static bool lexer_skip(Lexer *lexer, bool cut) {
+    size_t start = lexer->base + lexer->pos;    /* input offset where the run starts */
+    bool comment = lexer->in_comment;
+
+    for (;;) {
+        while (lexer->pos < lexer->length) {
+            if (comment) {
+                lexer->pos = scan_newline(lexer->source, lexer->pos, lexer->length);
+                comment = lexer->pos >= lexer->length;
+                continue;
+            }
+            CharClass cls = class_of(lexer->source[lexer->pos]);
+            if (cls == CC_BLANK) {
+                lexer->pos = scan_space(lexer->source, lexer->pos, lexer->length);
+            } else if (cls == CC_SLASH && peek_next(lexer) == '/') {
+                lexer->pos += 2;
+                comment = true;
+            } else {
+                break;
+            }
+        }
+
+        /* A '/' in the last byte may start a comment */
+        if (lexer->at_eof || (!comment && lexer->pos + 1 < lexer->length)) {
+            lexer->in_comment = false;
+            return true;
+        }
+        if (lexer->pin <= start) {
+            if (cut) {
+                lexer_cut(lexer, start - lexer->base);
+                start = lexer->base + lexer->pos;
+            } else if (lexer->base + lexer->pos - start >= lexer->chunk_size) {
+                lexer->in_comment = comment;
+                return false;
+            }
+        }
+        lexer_refill(lexer);
+        if (start < lexer->base) {
+            start = lexer->base;
+        }
+    }
+}
+
+/*
+ * Where the run of bytes the token at `pos` may cover ends, scanning on
+ * from `from`: the closing quote of a string, the end of a name, or the
+ * end of a number's digits and its one '.' (`*dot` once it is seen).
+ * Returns `length` if the run may go on into the next chunk.
+ */
+static size_t lexer_scan_run(const Lexer *lexer, size_t from, bool *dot) {
+    const char *source = lexer->source;
+    size_t start = lexer->pos;
+    size_t length = lexer->length;
+
+    switch (class_of(source[start])) {
+        case CC_QUOTE:
+            return scan_string(source, from > start ? from : start + 1, length);
+
+        case CC_ALPHA:
+        case CC_UTF8:
+            while (from < length) {
+                from = scan_ident(source, from, length);
+                if (from >= length || class_of(source[from]) != CC_UTF8) {
+                    break;
+                }
+                from++;
+            }
+            return from;
+
+        case CC_MINUS:
+        case CC_DIGIT:
+            from = scan_digits(source, from > start ? from : start + 1, length);
+            if (!*dot && from < length && source[from] == '.') {
+                *dot = true;
+                from = scan_digits(source, from + 1, length);
+            }
+            return from;
+
+        default:
+            return start + 1 < length ? start + 1 : length;
+    }
+}
+
+/*
+ * Lex the next token. A streaming lexer first skips comments and
+ * whitespace and reads on until the token's run of bytes, and the
+ * LEXER_LOOKAHEAD bytes after it, are in the window; the run is scanned
+ * once, resuming where it stopped after each refill. A token is final once
+ * the lexer has stopped more than one byte before the end of the window;
+ * otherwise it is lexed again after a refill, which the pre-scan leaves
+ * for input that ends mid-sequence.
+ */
 Token lexer_next_token(Lexer *lexer) {
+    if (!lexer || lexer->fd < 0) {
+        return lex_token(lexer);
+    }
+
+    lexer_skip(lexer, true);
+
+    size_t run = 0;     /* bytes of the run scanned, from pos */
+    bool dot = false;
+    bool complete = false;
+    while (!lexer->at_eof) {
+        if (!complete) {
+            size_t end = lexer_scan_run(lexer, lexer->pos + run, &dot);
+            run = end - lexer->pos;
+            complete = end < lexer->length;
+        }
+        if (complete && lexer->pos + run + LEXER_LOOKAHEAD < lexer->length) {
+            break;
+        }
+        lexer_refill(lexer);
+    }
+
+    for (;;) {
+        size_t pos = lexer->pos;
+        Token token = lex_token(lexer);
+        if (lexer->at_eof || lexer->pos + 1 < lexer->length) {
+            return token;
+        }
+
+        lexer->pos = pos;
+        lexer_refill(lexer);
+    }
+}
+
+static Token lex_token(Lexer *lexer) {
     Token token = {0};
 
     if (!lexer || !lexer->source) {
@@ -263,102 +564,365 @@ Token lexer_next_token(Lexer *lexer) {
 
     /* Skip whitespace and comments */
     while (lexer->pos < lexer->length) {
-        skip_whitespace(lexer);
-        if (peek(lexer) == '/' && peek_next(lexer) == '/') {
-            skip_comment(lexer);
+        char c = lexer->source[lexer->pos];
+        CharClass cls = class_of(c);
+
+        if (cls == CC_BLANK) {
+            lexer->pos = scan_space(lexer->source, lexer->pos, lexer->length);
+        } else if (cls == CC_SLASH && peek_next(lexer) == '/') {
+            /* Jump to end of line or end of file */
+            lexer->pos = scan_newline(lexer->source, lexer->pos, lexer->length);
         } else {
             break;
         }
     }
 
+    lexer->token_start = lexer->pos;
     if (lexer->pos >= lexer->length) {
+        if ((lexer->invalid_utf8 || lexer->too_large) && !lexer->reported_input) {
+            lexer->reported_input = true;
+            return error_token(lexer, lexer->too_large ? "Input larger than 4 GiB" : "Invalid UTF-8");
+        }
         token.kind = TOKEN_EOF;
-        token.line = lexer->line;
-        token.column = lexer->column;
+        token.offset = (uint32_t)(lexer->base + lexer->pos);
         return token;
     }
 
-    int start_line = lexer->line;
-    int start_column = lexer->column;
     char c = advance(lexer);
 
-    /* Identifiers and keywords */
-    if (is_alpha(c)) {
-        return parse_identifier(lexer, start_line, start_column);
-    }
-
-    /* Numbers */
-    if (is_digit(c)) {
-        return parse_number(lexer, start_line, start_column);
-    }
-
-    /* Handle operators and special characters */
-    switch (c) {
-        case '(': return make_token(lexer, TOKEN_LPAREN, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case ')': return make_token(lexer, TOKEN_RPAREN, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '{': return make_token(lexer, TOKEN_LBRACE, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '}': return make_token(lexer, TOKEN_RBRACE, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '[': return make_token(lexer, TOKEN_LBRACKET, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case ']': return make_token(lexer, TOKEN_RBRACKET, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case ',': return make_token(lexer, TOKEN_COMMA, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case ';': return make_token(lexer, TOKEN_SEMICOLON, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case ':': return make_token(lexer, TOKEN_COLON, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '.': return make_token(lexer, TOKEN_DOT, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '+': return make_token(lexer, TOKEN_PLUS, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '*': return make_token(lexer, TOKEN_STAR, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-        case '%': return make_token(lexer, TOKEN_PERCENT, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-
-        case '-':
+    switch (class_of(c)) {
+        case CC_ALPHA:
+            return parse_identifier(lexer);
+
+        case CC_DIGIT:
+            return parse_number(lexer);
+
+        case CC_QUOTE:
+            return parse_string(lexer);
+
+        case CC_SLASH:
+            /* Comments were skipped above, so this is division */
+            return make_token(lexer, TOKEN_SLASH, &lexer->source[lexer->pos - 1], 1);
+
+        case CC_MINUS:
             /* Check if this is a negative number or minus operator */
             if (is_digit(peek(lexer))) {
-                return parse_number(lexer, start_line, start_column);
+                return parse_number(lexer);
             }
-            return make_token(lexer, TOKEN_MINUS, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
+            return make_token(lexer, TOKEN_MINUS, &lexer->source[lexer->pos - 1], 1);
 
-        case '/':
-            /* Already handled comments in skip phase, so this is division */
-            return make_token(lexer, TOKEN_SLASH, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-
-        case '=':
-            if (match(lexer, '=')) {
-                return make_token(lexer, TOKEN_EQ, &lexer->source[lexer->pos - 2], 2, start_line, start_column);
+        case CC_OPERATOR: {
+            const OperatorTransition *transition = &operator_transitions[(unsigned char)c];
+            if (transition->next != '\0' && match(lexer, transition->next)) {
+                return make_token(lexer, transition->pair, &lexer->source[lexer->pos - 2], 2);
             }
-            return make_token(lexer, TOKEN_ASSIGN, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
-
-        case '!':
-            if (match(lexer, '=')) {
-                return make_token(lexer, TOKEN_NE, &lexer->source[lexer->pos - 2], 2, start_line, start_column);
+            if (transition->error) {
+                return error_token(lexer, transition->error);
             }
-            return make_token(lexer, TOKEN_NOT, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
+            return make_token(lexer, transition->single, &lexer->source[lexer->pos - 1], 1);
+        }
 
-        case '<':
-            if (match(lexer, '=')) {
-                return make_token(lexer, TOKEN_LE, &lexer->source[lexer->pos - 2], 2, start_line, start_column);
-            }
-            return make_token(lexer, TOKEN_LT, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
+        case CC_UTF8:
+            return parse_unicode(lexer);
 
-        case '>':
-            if (match(lexer, '=')) {
-                return make_token(lexer, TOKEN_GE, &lexer->source[lexer->pos - 2], 2, start_line, start_column);
-            }
-            return make_token(lexer, TOKEN_GT, &lexer->source[lexer->pos - 1], 1, start_line, start_column);
+        default:
+            return error_token(lexer, "Unexpected character");
+    }
+}
 
-        case '&':
-            if (match(lexer, '&')) {
-                return make_token(lexer, TOKEN_AND, &lexer->source[lexer->pos - 2], 2, start_line, start_column);
-            }
-            return error_token(lexer, "Unexpected character '&'", start_line, start_column);
+/* Grow the per-token arrays of a token buffer */
+static bool token_buffer_reserve(TokenBuffer *tokens, size_t needed) {
+    if (needed <= tokens->capacity) {
+        return true;
+    }
 
-        case '|':
-            if (match(lexer, '|')) {
-                return make_token(lexer, TOKEN_OR, &lexer->source[lexer->pos - 2], 2, start_line, start_column);
+    size_t new_capacity = tokens->capacity == 0 ? 1024 : tokens->capacity * 2;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    uint8_t *kinds = realloc(tokens->kinds, new_capacity * sizeof(uint8_t));
+    if (kinds) tokens->kinds = kinds;
+    uint32_t *offsets = realloc(tokens->offsets, new_capacity * sizeof(uint32_t));
+    if (offsets) tokens->offsets = offsets;
+    uint32_t *lengths = realloc(tokens->lengths, new_capacity * sizeof(uint32_t));
+    if (lengths) tokens->lengths = lengths;
+
+    if (!kinds || !offsets || !lengths) {
+        return false;
+    }
+    tokens->capacity = new_capacity;
+    return true;
+}
+
+/* Append a side-array entry for a literal or error token */
+static bool token_buffer_add_literal(TokenBuffer *tokens, TokenLiteral literal) {
+    if (tokens->literal_count >= tokens->literal_capacity) {
+        size_t new_capacity = tokens->literal_capacity == 0 ? 256 : tokens->literal_capacity * 2;
+        TokenLiteral *literals = realloc(tokens->literals, new_capacity * sizeof(TokenLiteral));
+        if (!literals) {
+            return false;
+        }
+        tokens->literals = literals;
+        tokens->literal_capacity = new_capacity;
+    }
+    tokens->literals[tokens->literal_count++] = literal;
+    return true;
+}
+
+/* Create an empty token buffer over a source text */
+TokenBuffer *token_buffer_create(const char *source, size_t expected_tokens) {
+    TokenBuffer *tokens = calloc(1, sizeof(TokenBuffer));
+    if (!tokens) {
+        return NULL;
+    }
+    tokens->source = source;
+    if (!token_buffer_reserve(tokens, expected_tokens)) {
+        token_buffer_destroy(tokens);
+        return NULL;
+    }
+    return tokens;
+}
+
+/*
+ * Append up to max_tokens tokens to a buffer. Returns the number appended;
+ * nothing is appended once EOF is in the buffer.
+ */
+size_t lexer_tokenize_into(Lexer *lexer, TokenBuffer *tokens, size_t max_tokens) {
+    if (!lexer || !tokens || lexer->length > UINT32_MAX) {
+        return 0;
+    }
+    if (tokens->count > 0 && tokens->kinds[tokens->count - 1] == TOKEN_EOF) {
+        return 0;
+    }
+
+    /* Keep the text of every buffered token in a streaming lexer's window */
+    lexer->pin = tokens->count > 0 ? tokens->base : (size_t)-1;
+
+    size_t appended = 0;
+    while (appended < max_tokens) {
+        /*
+         * A cut puts the offsets of the tokens before it off, so only runs
+         * ahead of tokens the caller has seen are cut; a long run after
+         * tokens of this batch ends the batch, and the next one cuts it.
+         */
+        if (lexer->fd >= 0 && !lexer_skip(lexer, appended == 0)) {
+            break;
+        }
+        Token token = lexer_next_token(lexer);
+        if (!token_buffer_reserve(tokens, tokens->count + 1)) {
+            break;
+        }
+
+        size_t index = tokens->count;
+        if (lexer->fd >= 0) {
+            /* The base follows the pin through cuts; an empty buffer starts at its first token */
+            tokens->base = index > 0 ? lexer->pin : lexer->base + lexer->token_start;
+            lexer->pin = tokens->base;
+        }
+        tokens->kinds[index] = (uint8_t)token.kind;
+        tokens->offsets[index] = (uint32_t)(lexer->base + lexer->token_start - tokens->base);
+        /* Error lexemes are messages, not source text */
+        tokens->lengths[index] = token.kind == TOKEN_ERROR ? 0 : (uint32_t)token.length;
+
+        if (token.kind == TOKEN_INT || token.kind == TOKEN_FLOAT || token.kind == TOKEN_ERROR) {
+            TokenLiteral literal;
+            literal.token = (uint32_t)index;
+            if (token.kind == TOKEN_ERROR) {
+                literal.value.message = token.lexeme;
+            } else if (token.kind == TOKEN_FLOAT) {
+                literal.value.float_value = token.value.float_value;
+            } else {
+                literal.value.int_value = token.value.int_value;
+            }
+            if (!token_buffer_add_literal(tokens, literal)) {
+                break;
             }
-            return error_token(lexer, "Unexpected character '|'", start_line, start_column);
+        }
 
-        case '"':
-            return parse_string(lexer, start_line, start_column);
+        tokens->count++;
+        appended++;
+        if (token.kind == TOKEN_EOF) {
+            break;
+        }
+    }
 
-        default:
-            return error_token(lexer, "Unexpected character", start_line, start_column);
+    /* Refills may have moved or compacted the window */
+    if (lexer->fd >= 0) {
+        tokens->source = lexer->source + (tokens->base - lexer->base);
     }
+    return appended;
+}
+
+/* Lex the rest of the source into a new token buffer, up to and including EOF */
+TokenBuffer *lexer_tokenize_all(Lexer *lexer) {
+    if (!lexer || lexer->length > UINT32_MAX) {
+        return NULL;
+    }
+
+    /* Generated sources average about eight bytes per token */
+    TokenBuffer *tokens = token_buffer_create(lexer->source, lexer->length / 8 + 1);
+    if (!tokens) {
+        return NULL;
+    }
+
+    lexer_tokenize_into(lexer, tokens, (size_t)-1);
+    if (tokens->count == 0 || tokens->kinds[tokens->count - 1] != TOKEN_EOF) {
+        token_buffer_destroy(tokens);
+        return NULL;
+    }
+    return tokens;
+}
+
+/*
+ * Drop the first `count` tokens (at least one token must remain). Offsets
+ * and literal indices are rebased onto the first remaining token, which
+ * also moves the pin of a streaming lexer forward on the next fill.
+ */
+void token_buffer_discard(TokenBuffer *tokens, size_t count) {
+    if (!tokens || count == 0 || count >= tokens->count) {
+        return;
+    }
+
+    uint32_t shift = tokens->offsets[count];
+    size_t remaining = tokens->count - count;
+    memmove(tokens->kinds, tokens->kinds + count, remaining * sizeof(uint8_t));
+    memmove(tokens->offsets, tokens->offsets + count, remaining * sizeof(uint32_t));
+    memmove(tokens->lengths, tokens->lengths + count, remaining * sizeof(uint32_t));
+    for (size_t i = 0; i < remaining; i++) {
+        tokens->offsets[i] -= shift;
+    }
+    tokens->count = remaining;
+    tokens->source += shift;
+    tokens->base += shift;
+
+    size_t first = 0;
+    while (first < tokens->literal_count && tokens->literals[first].token < count) {
+        first++;
+    }
+    tokens->literal_count -= first;
+    memmove(tokens->literals, tokens->literals + first, tokens->literal_count * sizeof(TokenLiteral));
+    for (size_t i = 0; i < tokens->literal_count; i++) {
+        tokens->literals[i].token -= (uint32_t)count;
+    }
+}
+
+/*
+ * Replace tokens [start, end) with every token of `replacement`, whose
+ * offsets must already be relative to the same base, and move the offsets
+ * of the tokens after them by `delta` bytes. Literal entries are spliced
+ * the same way. Returns false, with the buffer unchanged, if out of memory.
+ */
+bool token_buffer_splice(TokenBuffer *tokens, size_t start, size_t end,
+                         const TokenBuffer *replacement, ptrdiff_t delta) {
+    if (!tokens || !replacement || start > end || end > tokens->count) {
+        return false;
+    }
+
+    size_t tail = tokens->count - end;
+    size_t count = start + replacement->count + tail;
+    if (!token_buffer_reserve(tokens, count)) {
+        return false;
+    }
+
+    size_t literal_start = 0;
+    while (literal_start < tokens->literal_count && tokens->literals[literal_start].token < start) {
+        literal_start++;
+    }
+    size_t literal_end = literal_start;
+    while (literal_end < tokens->literal_count && tokens->literals[literal_end].token < end) {
+        literal_end++;
+    }
+    size_t literal_tail = tokens->literal_count - literal_end;
+    size_t literal_count = literal_start + replacement->literal_count + literal_tail;
+    if (literal_count > tokens->literal_capacity) {
+        TokenLiteral *literals = realloc(tokens->literals, literal_count * sizeof(TokenLiteral));
+        if (!literals) {
+            return false;
+        }
+        tokens->literals = literals;
+        tokens->literal_capacity = literal_count;
+    }
+
+    size_t to = start + replacement->count;
+    memmove(tokens->kinds + to, tokens->kinds + end, tail * sizeof(uint8_t));
+    memmove(tokens->offsets + to, tokens->offsets + end, tail * sizeof(uint32_t));
+    memmove(tokens->lengths + to, tokens->lengths + end, tail * sizeof(uint32_t));
+    memcpy(tokens->kinds + start, replacement->kinds, replacement->count * sizeof(uint8_t));
+    memcpy(tokens->offsets + start, replacement->offsets, replacement->count * sizeof(uint32_t));
+    memcpy(tokens->lengths + start, replacement->lengths, replacement->count * sizeof(uint32_t));
+    for (size_t i = to; i < count; i++) {
+        tokens->offsets[i] += (uint32_t)delta;
+    }
+    tokens->count = count;
+
+    size_t literal_to = literal_start + replacement->literal_count;
+    memmove(tokens->literals + literal_to, tokens->literals + literal_end, literal_tail * sizeof(TokenLiteral));
+    for (size_t i = 0; i < replacement->literal_count; i++) {
+        TokenLiteral literal = replacement->literals[i];
+        literal.token += (uint32_t)start;
+        tokens->literals[literal_start + i] = literal;
+    }
+    for (size_t i = literal_to; i < literal_count; i++) {
+        tokens->literals[i].token += (uint32_t)(to - end);
+    }
+    tokens->literal_count = literal_count;
+    return true;
+}
+
+void token_buffer_destroy(TokenBuffer *tokens) {
+    if (tokens) {
+        free(tokens->kinds);
+        free(tokens->offsets);
+        free(tokens->lengths);
+        free(tokens->literals);
+        free(tokens);
+    }
+}
+
+/* Line and column of an input offset; 0 if it is not in the (streaming) window */
+SourcePosition lexer_position(Lexer *lexer, size_t offset) {
+    SourcePosition position = {0, 0};
+    if (!lexer) {
+        return position;
+    }
+    return line_index_lookup(&lexer->lines, offset);
+}
+
+/* Find the side-array entry of a literal or error token (binary search) */
+const TokenLiteral *token_buffer_literal(const TokenBuffer *tokens, size_t index) {
+    size_t lo = 0;
+    size_t hi = tokens->literal_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tokens->literals[mid].token < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < tokens->literal_count && tokens->literals[lo].token == index) {
+        return &tokens->literals[lo];
+    }
+    return NULL;
+}
+
+/* Rebuild a full Token from the buffer */
+Token token_buffer_get(const TokenBuffer *tokens, size_t index) {
+    Token token = {0};
+    token.kind = (TokenKind)tokens->kinds[index];
+    token.lexeme = tokens->source + tokens->offsets[index];
+    token.length = tokens->lengths[index];
+    token.offset = (uint32_t)(tokens->base + tokens->offsets[index]);
+
+    const TokenLiteral *literal = token_buffer_literal(tokens, index);
+    if (literal && token.kind == TOKEN_ERROR) {
+        token.lexeme = literal->value.message;
+        token.length = strlen(literal->value.message);
+    } else if (literal && token.kind == TOKEN_FLOAT) {
+        token.value.float_value = literal->value.float_value;
+    } else if (literal) {
+        token.value.int_value = literal->value.int_value;
+    }
+    return token;
 }
@@ -2,6 +2,9 @@
 #define LEXER_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "line_index.h"
 
 typedef enum {
     TOKEN_EOF,
@@ -49,28 +52,126 @@ typedef enum {
     TOKEN_ERROR,
 } TokenKind;
 
+/* `offset` is the input offset of the token's first byte; see lexer_position() */
 typedef struct {
     TokenKind kind;
+    uint32_t offset;
     const char *lexeme;
     size_t length;
-    int line;
-    int column;
     union {
         long int_value;
         double float_value;
     } value;
 } Token;
 
+/*
+ * Bytes past its end that lexing a token may look at: an identifier
+ * decodes the whole (up to 4-byte) character after it to see whether it
+ * continues the name, and "1" reads two more to decide whether it starts
+ * "1.5". A token is unaffected by an edit that starts this far after it.
+ */
+#define LEXER_LOOKAHEAD 4
+
+/* Bytes read from a file descriptor per refill when no chunk size is given */
+#define LEXER_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+/*
+ * A lexer over either an in-memory string (lexer_create) or a file
+ * descriptor (lexer_create_fd). A streaming lexer keeps only a window of
+ * the input: `source[0]` is input byte `base`, and the window is refilled
+ * one chunk at a time, so tokens may straddle chunks; a token's bytes are
+ * scanned on from where a refill stopped them, not from its start.
+ * Bytes before `pin` are discarded when the window is compacted; with
+ * nothing pinned, a lexeme stays valid until the next call. Comments and
+ * whitespace are never pinned: a run of them after pinned tokens is cut
+ * out of the window.
+ *
+ * The lexer does no line or column bookkeeping; lexer_position() maps
+ * offsets back to lines through a LineIndex built on first use. For a
+ * streaming lexer that only covers the current window, whose first line
+ * is `base_line`.
+ *
+ * Input is UTF-8. It is validated up front (each chunk as it is read) so
+ * that lexing only decodes characters at non-ASCII bytes; input stops at
+ * the first invalid or truncated sequence, which is reported as a single
+ * error token before EOF. A streaming lexer holds back the `pending`
+ * bytes of a sequence split by a chunk boundary past `length`.
+ *
+ * Offsets are 32-bit. A streaming lexer stops reading at 4 GiB and sets
+ * `too_large`, which is reported the same way; an in-memory source that
+ * large is not lexed into a TokenBuffer at all.
+ */
 typedef struct {
     const char *source;
     size_t length;
     size_t pos;
-    size_t line;
-    size_t column;
+    size_t token_start;
+    LineIndex lines;
+    /* Streaming input; fd is -1 for in-memory sources */
+    int fd;
+    char *window;
+    size_t capacity;
+    size_t chunk_size;
+    size_t base;
+    size_t base_line;
+    size_t pin;
+    size_t pending;
+    bool in_comment;        /* a batch of tokens ended inside a comment */
+    bool at_eof;
+    bool read_error;
+    bool invalid_utf8;
+    bool too_large;
+    bool reported_input;
 } Lexer;
 
+/* Value of a literal or error token, kept out of line in a TokenBuffer */
+typedef struct {
+    uint32_t token;
+    union {
+        long int_value;
+        double float_value;
+        const char *message;
+    } value;
+} TokenLiteral;
+
+/*
+ * A file's tokens in struct-of-arrays form: 9 bytes per token (1-byte
+ * kind, 32-bit source offset and length) instead of a 32-byte Token.
+ * Values of INT/FLOAT tokens and messages of ERROR tokens live in the
+ * `literals` side array, sorted by token index. The last token is
+ * always TOKEN_EOF. Offsets are relative to `source`, which is
+ * input byte `base`; token_buffer_discard drops consumed tokens so a
+ * streaming lexer can release their text.
+ */
+typedef struct {
+    const char *source;
+    size_t base;
+    uint8_t *kinds;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    size_t count;
+    size_t capacity;
+    TokenLiteral *literals;
+    size_t literal_count;
+    size_t literal_capacity;
+} TokenBuffer;
+
 Lexer *lexer_create(const char *source);
+Lexer *lexer_create_fd(int fd, size_t chunk_size);
+Lexer *lexer_create_slice(const char *source, size_t start, size_t end);
+Lexer *lexer_create_validated(const char *source, size_t start, size_t end);
 void lexer_destroy(Lexer *lexer);
 Token lexer_next_token(Lexer *lexer);
+SourcePosition lexer_position(Lexer *lexer, size_t offset);
+
+TokenBuffer *token_buffer_create(const char *source, size_t expected_tokens);
+void token_buffer_destroy(TokenBuffer *tokens);
+size_t lexer_tokenize_into(Lexer *lexer, TokenBuffer *tokens, size_t max_tokens);
+TokenBuffer *lexer_tokenize_all(Lexer *lexer);
+void token_buffer_discard(TokenBuffer *tokens, size_t count);
+bool token_buffer_splice(TokenBuffer *tokens, size_t start, size_t end,
+                         const TokenBuffer *replacement, ptrdiff_t delta);
+const TokenLiteral *token_buffer_literal(const TokenBuffer *tokens, size_t index);
+Token token_buffer_get(const TokenBuffer *tokens, size_t index);
 
 #endif
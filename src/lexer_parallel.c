@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "lexer_parallel.h"
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* One newline-aligned piece of the input and the tokens lexed from it */
+typedef struct {
+    const char *source;
+    size_t length;
+    size_t start;
+    size_t end;
+    /* String state at the cuts, filled in by the lexing and prefix passes */
+    bool starts_in_string;
+    size_t open_quote;
+    bool ends_in_string;
+    size_t end_quote;
+    /* Tokens and where they go in the stitched buffer */
+    TokenBuffer *tokens;
+    size_t first_token;
+    size_t token_count;
+    size_t first_literal;
+    size_t literal_count;
+    TokenBuffer *result;
+    bool invalid_utf8;
+    bool failed;
+} Slice;
+
+/*
+ * Lex a slice from `from`: its start, or the opening quote of a string
+ * that is open at its start.
+ */
+static void lex_slice(Slice *slice, size_t from) {
+    token_buffer_destroy(slice->tokens);
+    slice->tokens = token_buffer_create(slice->source, (slice->end - from) / 8 + 1);
+    Lexer *lexer = lexer_create_slice(slice->source, from, slice->end);
+    if (!slice->tokens || !lexer) {
+        lexer_destroy(lexer);
+        slice->failed = true;
+        return;
+    }
+
+    lexer_tokenize_into(lexer, slice->tokens, (size_t)-1);
+    slice->invalid_utf8 = lexer->invalid_utf8;
+    lexer_destroy(lexer);
+
+    TokenBuffer *tokens = slice->tokens;
+    if (tokens->count == 0 || tokens->kinds[tokens->count - 1] != TOKEN_EOF) {
+        slice->failed = true;
+        return;
+    }
+
+    /*
+     * Every slice but the last ends just after a newline, so an error
+     * token starting at a quote just before EOF can only be a string cut
+     * off by the cut.
+     */
+    if (slice->end < slice->length && tokens->count >= 2 &&
+        tokens->kinds[tokens->count - 2] == TOKEN_ERROR) {
+        size_t quote = tokens->base + tokens->offsets[tokens->count - 2];
+        slice->ends_in_string = slice->source[quote] == '"';
+        slice->end_quote = quote;
+    }
+}
+
+/* Phase 1: lex a slice as if it started outside a string */
+static void *lex_speculative(void *arg) {
+    Slice *slice = arg;
+    lex_slice(slice, slice->start);
+    return NULL;
+}
+
+/* Phase 3: lex a slice again from the opening quote of the string open at its start */
+static void *lex_from_quote(void *arg) {
+    Slice *slice = arg;
+    lex_slice(slice, slice->open_quote);
+    return NULL;
+}
+
+/*
+ * String state at the end of a slice that starts inside a string. Mirrors
+ * the lexer: a string ends at '"' or NUL, and a quote inside a comment
+ * does not open one. Updates *quote when a new string is left open.
+ */
+static bool ends_in_string(const char *source, size_t start, size_t end, size_t *quote) {
+    bool in_string = true;
+    size_t pos = start;
+    while (pos < end) {
+        char c = source[pos];
+        if (in_string) {
+            /* A NUL ends the string but is then lexed as a character of its own */
+            if (c == '"') {
+                in_string = false;
+                pos++;
+            } else if (c == '\0') {
+                in_string = false;
+            } else {
+                pos++;
+            }
+        } else if (c == '"') {
+            in_string = true;
+            *quote = pos++;
+        } else if (c == '/' && pos + 1 < end && source[pos + 1] == '/') {
+            pos = scan_newline(source, pos, end);
+        } else {
+            pos++;
+        }
+    }
+    return in_string;
+}
+
+/* Phase 4: copy a slice's tokens into its place in the stitched buffer */
+static void *stitch_slice(void *arg) {
+    Slice *slice = arg;
+    const TokenBuffer *tokens = slice->tokens;
+    TokenBuffer *result = slice->result;
+    size_t first = slice->first_token;
+
+    memcpy(result->kinds + first, tokens->kinds, slice->token_count * sizeof(uint8_t));
+    memcpy(result->offsets + first, tokens->offsets, slice->token_count * sizeof(uint32_t));
+    memcpy(result->lengths + first, tokens->lengths, slice->token_count * sizeof(uint32_t));
+    for (size_t i = 0; i < slice->literal_count; i++) {
+        TokenLiteral literal = tokens->literals[i];
+        literal.token += (uint32_t)first;
+        result->literals[slice->first_literal + i] = literal;
+    }
+    return NULL;
+}
+
+/* Run a task over slices, one thread each; the calling thread takes the last one */
+static void run_parallel(Slice **work, size_t count, void *(*task)(void *)) {
+    if (count == 0) {
+        return;
+    }
+    pthread_t *threads = malloc(count * sizeof(pthread_t));
+    bool *started = calloc(count, sizeof(bool));
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (threads && started && pthread_create(&threads[i], NULL, task, work[i]) == 0) {
+            started[i] = true;
+        } else {
+            task(work[i]);
+        }
+    }
+    task(work[count - 1]);
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+/* Cut the input into up to `count` slices that each end just after a newline */
+static size_t split_slices(Slice *slices, const char *source, size_t length, size_t count) {
+    size_t used = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t end = length;
+        if (i + 1 < count) {
+            size_t target = (size_t)((double)length * (i + 1) / count);
+            size_t newline = scan_newline(source, target > start ? target : start, length);
+            end = newline < length ? newline + 1 : length;
+        }
+        if (end <= start && i + 1 < count) {
+            continue;
+        }
+
+        Slice *slice = &slices[used++];
+        memset(slice, 0, sizeof(Slice));
+        slice->source = source;
+        slice->length = length;
+        slice->start = start;
+        slice->end = end;
+        start = end;
+        if (start >= length) {
+            break;
+        }
+    }
+    return used;
+}
+
+TokenBuffer *lexer_tokenize_parallel(const char *source, size_t length, unsigned threads) {
+    if (!source || length > UINT32_MAX) {
+        return NULL;
+    }
+
+    size_t slice_count = threads > 0 ? threads : 1;
+    Slice *slices = malloc(slice_count * sizeof(Slice));
+    Slice **work = malloc(slice_count * sizeof(Slice *));
+    if (!slices || !work) {
+        free(slices);
+        free(work);
+        return NULL;
+    }
+    slice_count = split_slices(slices, source, length, slice_count);
+
+    /* Phase 1: speculative lexing, every slice assumed to start outside a string */
+    for (size_t i = 0; i < slice_count; i++) {
+        work[i] = &slices[i];
+    }
+    run_parallel(work, slice_count, lex_speculative);
+
+    /* Phase 2: carry the string state across the cuts */
+    bool in_string = false;
+    size_t quote = 0;
+    size_t relex_count = 0;
+    for (size_t i = 0; i < slice_count; i++) {
+        Slice *slice = &slices[i];
+        slice->starts_in_string = in_string;
+        slice->open_quote = quote;
+        if (in_string) {
+            work[relex_count++] = slice;
+            in_string = ends_in_string(source, slice->start, slice->end, &quote);
+        } else if (slice->ends_in_string) {
+            in_string = true;
+            quote = slice->end_quote;
+        }
+    }
+
+    /* Phase 3: lex the slices that start inside a string again */
+    run_parallel(work, relex_count, lex_from_quote);
+
+    /* A single slice is already the whole stream */
+    if (slice_count == 1 && !slices[0].failed) {
+        TokenBuffer *tokens = slices[0].tokens;
+        free(slices);
+        free(work);
+        return tokens;
+    }
+
+    /*
+     * Phase 4: stitch. Each slice drops its EOF, and a slice followed by
+     * one that starts inside a string also drops the cut-off string, which
+     * the next slice lexed again in full. Input ends at the first slice
+     * with invalid UTF-8, which keeps its error token and EOF.
+     */
+    size_t stitch_count = slice_count;
+    for (size_t i = 0; i < slice_count; i++) {
+        if (slices[i].invalid_utf8) {
+            stitch_count = i + 1;
+            break;
+        }
+    }
+
+    TokenBuffer *result = NULL;
+    size_t total_tokens = 0;
+    size_t total_literals = 0;
+    bool failed = false;
+    for (size_t i = 0; i < stitch_count; i++) {
+        Slice *slice = &slices[i];
+        if (slice->failed) {
+            failed = true;
+            break;
+        }
+        const TokenBuffer *tokens = slice->tokens;
+        slice->token_count = tokens->count;
+        slice->literal_count = tokens->literal_count;
+        if (i + 1 < stitch_count) {
+            slice->token_count--;
+            if (slices[i + 1].starts_in_string) {
+                slice->token_count--;
+            }
+            while (slice->literal_count > 0 &&
+                   tokens->literals[slice->literal_count - 1].token >= slice->token_count) {
+                slice->literal_count--;
+            }
+        }
+        slice->first_token = total_tokens;
+        slice->first_literal = total_literals;
+        total_tokens += slice->token_count;
+        total_literals += slice->literal_count;
+    }
+
+    if (!failed) {
+        result = token_buffer_create(source, total_tokens);
+        TokenLiteral *literals = malloc((total_literals > 0 ? total_literals : 1) * sizeof(TokenLiteral));
+        if (result && literals) {
+            result->count = total_tokens;
+            result->literals = literals;
+            result->literal_count = total_literals;
+            result->literal_capacity = total_literals;
+            for (size_t i = 0; i < stitch_count; i++) {
+                slices[i].result = result;
+                work[i] = &slices[i];
+            }
+            run_parallel(work, stitch_count, stitch_slice);
+        } else {
+            free(literals);
+            token_buffer_destroy(result);
+            result = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < slice_count; i++) {
+        token_buffer_destroy(slices[i].tokens);
+    }
+    free(slices);
+    free(work);
+    return result;
+}
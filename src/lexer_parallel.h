@@ -0,0 +1,22 @@
+#ifndef LEXER_PARALLEL_H
+#define LEXER_PARALLEL_H
+
+#include "lexer.h"
+
+/*
+ * Tokenize source[0, length) on up to `threads` threads.
+ *
+ * The input is cut into one slice per thread at newline boundaries and
+ * every slice is lexed speculatively as if it started outside a string.
+ * Comments end at a newline, so an open string literal is the only state
+ * that can cross a cut; a sequential pass over the slices finds the ones
+ * that really start inside a string, and those are lexed again from the
+ * string's opening quote. Token offsets are absolute, so the slices are
+ * stitched into one buffer identical to lexer_tokenize_all() by copying.
+ *
+ * Splitting only pays off for inputs of several megabytes. Returns NULL
+ * on allocation failure or if the input is larger than 4 GiB.
+ */
+TokenBuffer *lexer_tokenize_parallel(const char *source, size_t length, unsigned threads);
+
+#endif
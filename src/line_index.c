@@ -0,0 +1,69 @@
+#include "line_index.h"
+#include "scan.h"
+#include <stdlib.h>
+
+/* Set up an index over text without scanning it yet */
+void line_index_init(LineIndex *index, const char *text, size_t base, size_t length, size_t first_line) {
+    index->text = text;
+    index->base = base;
+    index->length = length;
+    index->first_line = first_line;
+    index->starts = NULL;
+    index->count = 0;
+    index->built = false;
+}
+
+void line_index_free(LineIndex *index) {
+    free(index->starts);
+    index->starts = NULL;
+    index->count = 0;
+    index->built = false;
+}
+
+/* Record the start of every line after the first */
+static bool build(LineIndex *index) {
+    size_t capacity = scan_count_newlines(index->text, 0, index->length);
+    index->starts = malloc((capacity > 0 ? capacity : 1) * sizeof(uint32_t));
+    if (!index->starts) {
+        return false;
+    }
+
+    size_t count = 0;
+    for (size_t pos = scan_newline(index->text, 0, index->length); pos < index->length;
+         pos = scan_newline(index->text, pos + 1, index->length)) {
+        index->starts[count++] = (uint32_t)(pos + 1);
+    }
+    index->count = count;
+    index->built = true;
+    return true;
+}
+
+/* Resolve an input offset to a line and column, building the index on first use */
+SourcePosition line_index_lookup(LineIndex *index, size_t offset) {
+    SourcePosition position = {0, 0};
+    if (!index->text || offset < index->base || offset - index->base > index->length ||
+        index->length > UINT32_MAX) {
+        return position;
+    }
+    if (!index->built && !build(index)) {
+        return position;
+    }
+
+    /* Number of line starts at or before the offset */
+    size_t relative = offset - index->base;
+    size_t lo = 0;
+    size_t hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->starts[mid] <= relative) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t line_start = lo > 0 ? index->starts[lo - 1] : 0;
+    position.line = (int)(index->first_line + lo);
+    position.column = (int)(relative - line_start + 1);
+    return position;
+}
@@ -0,0 +1,38 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* A 1-based line and column; line 0 means the offset could not be resolved */
+typedef struct {
+    int line;
+    int column;
+} SourcePosition;
+
+/*
+ * Line starts of a source text, for turning byte offsets back into lines
+ * and columns. Tokens and AST nodes only carry offsets, so nothing is
+ * counted while lexing; the table is built with one vectorized newline
+ * scan the first time a position is looked up, and each lookup is then a
+ * binary search.
+ *
+ * `text` is input byte `base`, which is on line `first_line`, so the
+ * index can also cover just the window of a streaming lexer.
+ */
+typedef struct {
+    const char *text;
+    size_t base;
+    size_t length;
+    size_t first_line;
+    uint32_t *starts;
+    size_t count;
+    bool built;
+} LineIndex;
+
+void line_index_init(LineIndex *index, const char *text, size_t base, size_t length, size_t first_line);
+void line_index_free(LineIndex *index);
+SourcePosition line_index_lookup(LineIndex *index, size_t offset);
+
+#endif
@@ -1,57 +1,422 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "lexer.h"
 #include "parser.h"
 #include "codegen.h"
+#include "atom.h"
+#include "arena.h"
+#include "ast_cache.h"
+#include "passes.h"
+#include "cse.h"
+#include "fold.h"
+#include "inline.h"
+#include "dce.h"
+#include "resolve.h"
+#include "types.h"
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <source_file>\n", argv[0]);
-        return 1;
+/* Signatures of the top-level functions, from a pass over the tokens only */
+static bool scan_functions(const char *path, NodeBuffer *functions) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return false;
     }
-
-    FILE *file = fopen(argv[1], "r");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file %s\n", argv[1]);
-        return 1;
+    Lexer *lexer = lexer_create_fd(fd, LEXER_DEFAULT_CHUNK_SIZE);
+    Parser *parser = lexer ? parser_create(lexer) : NULL;
+    bool ok = parser && parser_scan_functions(parser, functions);
+    if (!parser) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+    } else if (lexer->read_error) {
+        fprintf(stderr, "Error: Failed to read file\n");
+        ok = false;
+    } else if (lexer->too_large) {
+        fprintf(stderr, "Error: %s is larger than 4 GiB\n", path);
+        ok = false;
     }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    close(fd);
+    return ok;
+}
+
+/* Everything the passes of one compilation share */
+typedef struct {
+    const char *path;
+    const char *cache_dir;
+    int fd;
+    AstCacheKey key;
+    bool keyed;
+    bool cached;            /* `ast` was mapped from the cache */
+    bool optimize;          /* -O */
+    bool report;            /* --opt-report */
+    size_t inline_threshold;    /* --inline-threshold=<nodes> */
+    LineIndex *lines;       /* for the lines of resolution errors; NULL if the source could not be mapped */
+    ASTNode *ast;
+    ProgramTypes types;
+    NodeBuffer functions;   /* --stream: prototypes from the pre-scan */
+} Compilation;
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+/*
+ * --stream: emit each top-level statement as soon as it is parsed and
+ * free it, so memory is bounded by the largest function rather than the
+ * whole program. Functions come from a declaration pre-scan of the file;
+ * their parameters are longs, their results are typed from their bodies
+ * and variables from their initializers (types.h), and the prototypes are
+ * written once every body has been typed. A parse or type error fails the
+ * run as in the default mode, but the output written before it cannot be
+ * taken back.
+ */
+static PassStatus scan_pass(void *state) {
+    Compilation *compilation = state;
+    return scan_functions(compilation->path, &compilation->functions) ? PASS_DONE : PASS_FAILED;
+}
 
-    char *source = malloc(file_size + 1);
-    if (!source) {
+static PassStatus stream_pass(void *state) {
+    Compilation *compilation = state;
+    Lexer *lexer = lexer_create_fd(compilation->fd, LEXER_DEFAULT_CHUNK_SIZE);
+    Parser *parser = lexer ? parser_create(lexer) : NULL;
+    CodeGen *codegen = codegen_create(stdout);
+    Resolver *resolver = resolver_create(compilation->lines);
+    Typer *typer = typer_create(compilation->lines);
+    Arena *arena = ast_arena();
+    Arena *statements = arena_create(0);
+    bool ok = parser && codegen && resolver && typer && statements;
+    if (!ok) {
         fprintf(stderr, "Error: Memory allocation failed\n");
-        fclose(file);
-        return 1;
     }
-    size_t bytes_read = fread(source, 1, file_size, file);
-    if (bytes_read != (size_t)file_size) {
+    ok = ok && resolver_declare_functions(resolver, node_buffer_items(&compilation->functions),
+                                          compilation->functions.count);
+    if (ok && !codegen_begin(codegen, node_buffer_items(&compilation->functions), compilation->functions.count)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        ok = false;
+    }
+    codegen_set_types(codegen, typer ? typer_types(typer) : NULL);
+
+    /* Each statement is built in an arena of its own and dropped with one reset; the prototypes stay */
+    ast_use_arena(statements);
+    while (ok && parser->current != TOKEN_EOF) {
+        ASTNode *stmt = parser_parse_statement(parser);
+        if (!stmt || !resolver_resolve_statement(resolver, stmt) || !typer_type_statement(typer, stmt)) {
+            ok = false;
+            break;
+        }
+        codegen_add_statement(codegen, stmt);
+        arena_reset(statements);
+    }
+    ast_use_arena(arena);
+    if (lexer && lexer->read_error) {
         fprintf(stderr, "Error: Failed to read file\n");
-        free(source);
-        fclose(file);
-        return 1;
+        ok = false;
+    } else if (lexer && lexer->too_large) {
+        fprintf(stderr, "Error: %s is larger than 4 GiB\n", compilation->path);
+        ok = false;
+    }
+    if (ok && !codegen_finish(codegen)) {
+        fprintf(stderr, "Error: Failed to write output\n");
+        ok = false;
     }
-    source[file_size] = '\0';
-    fclose(file);
+    node_buffer_destroy(&compilation->functions);
 
-    Lexer *lexer = lexer_create(source);
-    Parser *parser = parser_create(lexer);
+    arena_destroy(statements);
+    typer_destroy(typer);
+    resolver_destroy(resolver);
+    codegen_destroy(codegen);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    return ok ? PASS_DONE : PASS_FAILED;
+}
 
-    ASTNode *ast = parser_parse(parser);
+/* With --cache, a source parsed before is mapped from the cache instead of parsed again */
+static PassStatus hash_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->cache_dir) {
+        return PASS_SKIPPED;
+    }
+    compilation->keyed = ast_cache_key(compilation->fd, &compilation->key);
+    return PASS_DONE;
+}
 
-    CodeGen *codegen = codegen_create(stdout);
-    codegen_generate(codegen, ast);
+/* The tree from a cache hit is rebuilt in the current arena */
+static PassStatus load_cache_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->keyed) {
+        return PASS_SKIPPED;
+    }
+    MappedAst *mapped = ast_cache_load(compilation->cache_dir, &compilation->key);
+    compilation->ast = mapped ? compact_ast_expand(&mapped->ast) : NULL;
+    compilation->cached = compilation->ast != NULL;
+    ast_cache_unmap(mapped);
+    return PASS_DONE;
+}
 
-    codegen_destroy(codegen);
+/* A parse error, reported by the parser, leaves no tree and fails the compile before any C is written */
+static PassStatus parse_pass(void *state) {
+    Compilation *compilation = state;
+    if (compilation->cached) {
+        return PASS_SKIPPED;
+    }
+    /* The source is streamed in chunks rather than read into memory whole */
+    Lexer *lexer = lexer_create_fd(compilation->fd, LEXER_DEFAULT_CHUNK_SIZE);
+    Parser *parser = lexer ? parser_create(lexer) : NULL;
+    if (!parser) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        lexer_destroy(lexer);
+        return PASS_FAILED;
+    }
+    compilation->ast = parser_parse(parser);
+    bool ok = compilation->ast && !lexer->read_error && !lexer->too_large;
+    if (lexer->read_error) {
+        fprintf(stderr, "Error: Failed to read file\n");
+    } else if (lexer->too_large) {
+        fprintf(stderr, "Error: %s is larger than 4 GiB\n", compilation->path);
+    }
     parser_destroy(parser);
     lexer_destroy(lexer);
-    free(source);
+    return ok ? PASS_DONE : PASS_FAILED;
+}
+
+static PassStatus store_cache_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->keyed || compilation->cached || !compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    CompactAst *compact = compact_ast_build(compilation->ast);
+    if (!compact || !ast_cache_store(compilation->cache_dir, &compilation->key, compact)) {
+        fprintf(stderr, "Warning: Cannot write AST cache in %s\n", compilation->cache_dir);
+    }
+    compact_ast_destroy(compact);
+    return PASS_DONE;
+}
+
+/* Name errors fail the compile before any C is written */
+static PassStatus resolve_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    return resolve_program(compilation->ast, compilation->lines) ? PASS_DONE : PASS_FAILED;
+}
+
+/* The cache holds the tree as parsed; optimizations run on every compile */
+static PassStatus cse_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->optimize || !compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    CseStats stats;
+    if (!cse_program(compilation->ast, &stats)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return PASS_FAILED;
+    }
+    if (compilation->report) {
+        fprintf(stderr, "cse: %zu temporaries, %zu repeated computations eliminated\n", stats.temporaries,
+                stats.eliminated);
+    }
+    /* Give the temporaries their slots; the program resolved before, so only memory can fail */
+    if (stats.temporaries > 0 && !resolve_program(compilation->ast, NULL)) {
+        return PASS_FAILED;
+    }
+    return PASS_DONE;
+}
+
+/* Type errors fail the compile too; optimizations have run, so what is typed is what is emitted */
+static PassStatus types_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    return types_infer(compilation->ast, compilation->lines, &compilation->types) ? PASS_DONE : PASS_FAILED;
+}
+
+/* Before folding, which then specializes the copies to the arguments they were given */
+static PassStatus inline_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->optimize || !compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    InlineOptions options;
+    inline_options_default(&options);
+    options.threshold = compilation->inline_threshold;
+    options.decisions = compilation->report ? stderr : NULL;
+    InlineStats stats;
+    if (!inline_program(compilation->ast, &compilation->types, &options, &stats)) {
+        return PASS_FAILED;
+    }
+    if (compilation->report) {
+        fprintf(stderr, "inline: %zu calls inlined, %zu left to recursive functions, %zu over the cost limit, "
+                "%zu left for the order of their arguments' effects\n", stats.inlined, stats.recursive,
+                stats.too_large, stats.effects);
+    }
+    return PASS_DONE;
+}
+
+/* After typing, so an optimized program has the same type errors as any other */
+static PassStatus fold_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->optimize || !compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    FoldStats stats;
+    if (!fold_program(compilation->ast, &stats)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return PASS_FAILED;
+    }
+    if (compilation->report) {
+        fprintf(stderr, "fold: %zu nodes eliminated, %zu operators folded, %zu constant reads propagated, "
+                "%zu branches decided\n", stats.eliminated, stats.folded, stats.propagated, stats.branches);
+    }
+    return PASS_DONE;
+}
+
+/* After folding, which decides the branches whose code this removes */
+static PassStatus dce_pass(void *state) {
+    Compilation *compilation = state;
+    if (!compilation->optimize || !compilation->ast) {
+        return PASS_SKIPPED;
+    }
+    DceStats stats;
+    if (!dce_program(compilation->ast, &compilation->types, &stats)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return PASS_FAILED;
+    }
+    if (compilation->report) {
+        fprintf(stderr, "dce: %zu unreachable functions, %zu statements after a return, "
+                "%zu dead stores and statements without effect removed\n", stats.functions, stats.unreachable,
+                stats.stores);
+    }
+    return PASS_DONE;
+}
+
+static PassStatus codegen_pass(void *state) {
+    Compilation *compilation = state;
+    CodeGen *codegen = codegen_create(stdout);
+    codegen_set_types(codegen, &compilation->types);
+    codegen_generate(codegen, compilation->ast);
+    codegen_destroy(codegen);
+    return PASS_DONE;
+}
+
+static const Pass default_passes[] = {
+    { "hash-source", hash_pass },
+    { "load-cache", load_cache_pass },
+    { "parse", parse_pass },
+    { "store-cache", store_cache_pass },
+    { "resolve", resolve_pass },
+    { "cse", cse_pass },
+    { "types", types_pass },
+    { "inline", inline_pass },
+    { "fold", fold_pass },
+    { "dce", dce_pass },
+    { "codegen", codegen_pass },
+};
 
-    if (ast) {
-        ast_destroy(ast);
+static const Pass stream_passes[] = {
+    { "scan-functions", scan_pass },
+    { "parse+codegen", stream_pass },
+};
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    const char *cache_dir = NULL;
+    const char *trace_path = NULL;
+    bool stream = false;
+    bool time_passes = false;
+    bool optimize = false;
+    bool report = false;
+    size_t inline_threshold = INLINE_DEFAULT_THRESHOLD;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "-O") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "--opt-report") == 0) {
+            report = true;
+        } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0 && argv[i][19] != '\0') {
+            char *end;
+            inline_threshold = strtoul(argv[i] + 19, &end, 10);
+            if (*end != '\0') {
+                fprintf(stderr, "Error: Invalid inline threshold %s\n", argv[i] + 19);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            time_passes = true;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') {
+            trace_path = argv[i] + 8;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "Usage: %s [-O] [--opt-report] [--inline-threshold=<nodes>] [--stream] [--cache <dir>] [--time-passes] [--trace=<file.json>] <source_file>\n",
+                argv[0]);
+        return 1;
     }
 
-    return 0;
+    Compilation compilation = {0};
+    compilation.path = path;
+    compilation.cache_dir = cache_dir;
+    compilation.optimize = optimize;
+    compilation.report = report;
+    compilation.inline_threshold = inline_threshold;
+    compilation.fd = open(path, O_RDONLY);
+    if (compilation.fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return 1;
+    }
+    Arena *arena = arena_create(0);
+    if (!arena) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        close(compilation.fd);
+        return 1;
+    }
+
+    /* Nothing of the mapping is read unless an error needs its line */
+    struct stat info;
+    void *source = MAP_FAILED;
+    LineIndex lines;
+    if (fstat(compilation.fd, &info) == 0 && info.st_size > 0) {
+        source = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, compilation.fd, 0);
+    }
+    if (source != MAP_FAILED) {
+        line_index_init(&lines, source, 0, (size_t)info.st_size, 1);
+        compilation.lines = &lines;
+    }
+
+    /* The whole tree lives in the arena and goes with it at the end */
+    ast_use_arena(arena);
+    PassManager manager;
+    pass_manager_init(&manager, time_passes || trace_path);
+    bool ok = stream ? pass_manager_run(&manager, stream_passes, sizeof(stream_passes) / sizeof(stream_passes[0]),
+                                        &compilation)
+                     : pass_manager_run(&manager, default_passes, sizeof(default_passes) / sizeof(default_passes[0]),
+                                        &compilation);
+    ast_use_arena(NULL);
+    arena_destroy(arena);
+    node_buffer_destroy(&compilation.functions);
+    program_types_free(&compilation.types);
+    if (compilation.lines) {
+        line_index_free(&lines);
+        munmap(source, (size_t)info.st_size);
+    }
+    close(compilation.fd);
+    atom_table_clear();
+
+    if (time_passes) {
+        pass_manager_print(&manager, stderr);
+    }
+    if (trace_path && !pass_manager_write_trace(&manager, trace_path)) {
+        fprintf(stderr, "Error: Cannot write trace %s\n", trace_path);
+        ok = false;
+    }
+    pass_manager_free(&manager);
+    return ok ? 0 : 1;
 }
@@ -3,28 +3,9 @@
 #include <stdio.h>
 #include <string.h>
 
-/* Helper to duplicate a string with length (strndup is not standard C) */
-static char *string_dup_len(const char *s, size_t len) {
-    char *result = (char *)malloc(len + 1);
-    if (result) {
-        memcpy(result, s, len);
-        result[len] = '\0';
-    }
-    return result;
-}
-
 /* Forward declarations */
 static ASTNode *parse_statement(Parser *parser);
 static ASTNode *parse_expression(Parser *parser);
-static ASTNode *parse_assignment(Parser *parser);
-static ASTNode *parse_logical_or(Parser *parser);
-static ASTNode *parse_logical_and(Parser *parser);
-static ASTNode *parse_equality(Parser *parser);
-static ASTNode *parse_comparison(Parser *parser);
-static ASTNode *parse_term(Parser *parser);
-static ASTNode *parse_factor(Parser *parser);
-static ASTNode *parse_unary(Parser *parser);
-static ASTNode *parse_call(Parser *parser);
 static ASTNode *parse_primary(Parser *parser);
 static ASTNode *parse_var_decl(Parser *parser);
 static ASTNode *parse_func_decl(Parser *parser);
@@ -33,20 +14,81 @@ static ASTNode *parse_while_stmt(Parser *parser);
 static ASTNode *parse_return_stmt(Parser *parser);
 static ASTNode *parse_expr_stmt(Parser *parser);
 
-/* Helper functions */
-static Token advance(Parser *parser) {
-    Token current = parser->current_token;
-    parser->current_token = parser->peek_token;
-    parser->peek_token = lexer_next_token(parser->lexer);
-    return current;
+/* Index returned by expect() when the expected token is missing */
+#define NO_TOKEN ((size_t)-1)
+
+/* Tokens lexed per refill; keeps freshly written tokens in cache for the parser */
+#define PARSER_FILL_BATCH 4096
+
+/* Lex the next batch of tokens into the buffer */
+static int fill(Parser *parser) {
+    return lexer_tokenize_into(parser->lexer, parser->tokens, PARSER_FILL_BATCH) > 0;
 }
 
-static Token peek(Parser *parser) {
-    return parser->current_token;
+/* Helper functions - tokens are addressed by index into the token buffer */
+static size_t advance(Parser *parser) {
+    size_t current = parser->pos;
+    if (parser->current == TOKEN_EOF) {
+        return current;
+    }
+    if (current + 1 >= parser->tokens->count && !fill(parser)) {
+        /* Out of memory while lexing ahead: stop as if at end of input */
+        parser->current = TOKEN_EOF;
+        return current;
+    }
+    parser->pos++;
+    parser->current = (TokenKind)parser->tokens->kinds[parser->pos];
+    return current;
 }
 
 static int check(Parser *parser, TokenKind kind) {
-    return parser->current_token.kind == kind;
+    return parser->current == kind;
+}
+
+/* Input offset of the current token; positions are resolved only for diagnostics */
+static uint32_t token_offset(Parser *parser) {
+    return (uint32_t)(parser->tokens->base + parser->tokens->offsets[parser->pos]);
+}
+
+/* Offset of the current token as stored in nodes: relative to the top-level statement */
+static uint32_t current_offset(Parser *parser) {
+    return token_offset(parser) - parser->statement_offset;
+}
+
+static int current_line(Parser *parser) {
+    return lexer_position(parser->lexer, token_offset(parser)).line;
+}
+
+/* Side-array value of a literal token; the parser only moves forward, so a cursor suffices */
+static const TokenLiteral *literal_at(Parser *parser, size_t index) {
+    const TokenBuffer *tokens = parser->tokens;
+    while (parser->literal_cursor < tokens->literal_count &&
+           tokens->literals[parser->literal_cursor].token < index) {
+        parser->literal_cursor++;
+    }
+    if (parser->literal_cursor < tokens->literal_count &&
+        tokens->literals[parser->literal_cursor].token == index) {
+        return &tokens->literals[parser->literal_cursor];
+    }
+    return token_buffer_literal(tokens, index);
+}
+
+/* Intern the source text of a name token, without copying it first */
+static Atom token_atom(Parser *parser, size_t index) {
+    return atom_intern(parser->tokens->source + parser->tokens->offsets[index],
+                       parser->tokens->lengths[index]);
+}
+
+/* An error token's own message says more than what was expected in its place */
+static void report_error(Parser *parser, const char *message) {
+    if (check(parser, TOKEN_ERROR)) {
+        const TokenLiteral *literal = literal_at(parser, parser->pos);
+        message = literal ? literal->value.message : message;
+    }
+    if (!parser->quiet) {
+        fprintf(stderr, "Parse error at line %d: %s\n",
+                current_line(parser), message);
+    }
 }
 
 static int match(Parser *parser, TokenKind kind) {
@@ -57,22 +99,28 @@ static int match(Parser *parser, TokenKind kind) {
     return 0;
 }
 
-static Token expect(Parser *parser, TokenKind kind, const char *message) {
+static size_t expect(Parser *parser, TokenKind kind, const char *message) {
     if (check(parser, kind)) {
         return advance(parser);
     }
 
-    fprintf(stderr, "Parse error at line %d: %s\n",
-            parser->current_token.line, message);
-
-    Token error_token = {0};
-    error_token.kind = TOKEN_ERROR;
-    return error_token;
+    report_error(parser, message);
+    return NO_TOKEN;
 }
 
-static void report_error(Parser *parser, const char *message) {
-    fprintf(stderr, "Parse error at line %d: %s\n",
-            parser->current_token.line, message);
+/*
+ * Between top-level statements no token before the current one is needed
+ * again. With a streaming lexer, drop them once a batch has piled up so
+ * their text can leave the window; in-memory sources and buffers the
+ * parser does not own keep every token.
+ */
+static void release_consumed(Parser *parser) {
+    if (parser->owns_tokens && parser->lexer && parser->lexer->fd >= 0 &&
+        parser->pos >= PARSER_FILL_BATCH) {
+        token_buffer_discard(parser->tokens, parser->pos);
+        parser->pos = 0;
+        parser->literal_cursor = 0;
+    }
 }
 
 /* Parser creation and destruction */
@@ -82,13 +130,70 @@ Parser *parser_create(Lexer *lexer) {
         return NULL;
     }
     parser->lexer = lexer;
-    parser->current_token = lexer_next_token(lexer);
-    parser->peek_token = lexer_next_token(lexer);
+    parser->tokens = lexer ? token_buffer_create(lexer->source, PARSER_FILL_BATCH) : NULL;
+    parser->owns_tokens = true;
+    parser->pos = 0;
+    parser->literal_cursor = 0;
+    parser->statement_offset = 0;
+    parser->quiet = false;
+    parser->frames = NULL;
+    parser->frame_count = 0;
+    parser->frame_capacity = 0;
+    if (!parser->tokens || !fill(parser)) {
+        token_buffer_destroy(parser->tokens);
+        free(parser);
+        return NULL;
+    }
+    parser->current = (TokenKind)parser->tokens->kinds[0];
+    return parser;
+}
+
+/*
+ * Create a parser over tokens that are already lexed, starting at token
+ * `pos`. The caller keeps ownership of the buffer; `lexer` is only used
+ * to lex more tokens if the buffer does not end with EOF yet, and to
+ * resolve positions for error messages.
+ */
+Parser *parser_create_from_tokens(Lexer *lexer, TokenBuffer *tokens, size_t pos) {
+    if (!lexer || !tokens || pos >= tokens->count) {
+        return NULL;
+    }
+    Parser *parser = malloc(sizeof(Parser));
+    if (!parser) {
+        return NULL;
+    }
+    parser->lexer = lexer;
+    parser->tokens = tokens;
+    parser->owns_tokens = false;
+    parser->pos = pos;
+    parser->current = (TokenKind)tokens->kinds[pos];
+    parser->statement_offset = 0;
+    parser->quiet = false;
+    parser->frames = NULL;
+    parser->frame_count = 0;
+    parser->frame_capacity = 0;
+
+    /* Start the literal cursor at the first literal at or after pos */
+    size_t lo = 0;
+    size_t hi = tokens->literal_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tokens->literals[mid].token < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    parser->literal_cursor = lo;
     return parser;
 }
 
 void parser_destroy(Parser *parser) {
     if (parser) {
+        if (parser->owns_tokens) {
+            token_buffer_destroy(parser->tokens);
+        }
+        free(parser->frames);
         free(parser);
     }
 }
@@ -104,32 +209,108 @@ ASTNode *parser_parse(Parser *parser) {
         return NULL;
     }
 
-    program->line = 1;
+    program->offset = 0;
 
     while (!check(parser, TOKEN_EOF)) {
-        ASTNode *stmt = parse_statement(parser);
+        ASTNode *stmt = parser_parse_statement(parser);
         if (!stmt) {
             ast_destroy(program);
             return NULL;
         }
-        ast_program_add_statement(program, stmt);
+        if (!ast_program_add_statement(program, stmt)) {
+            ast_destroy(stmt);
+            ast_destroy(program);
+            return NULL;
+        }
     }
 
     return program;
 }
 
-/* Statement parsing */
-static ASTNode *parse_statement(Parser *parser) {
-    if (match(parser, TOKEN_LET) || match(parser, TOKEN_CONST)) {
-        /* Backtrack - we need to know if it was let or const */
-        parser->peek_token = parser->current_token;
-        parser->current_token = peek(parser);
-        if (parser->current_token.kind == TOKEN_LET ||
-            parser->current_token.kind == TOKEN_CONST) {
-            return parse_var_decl(parser);
+/*
+ * Parse one top-level statement. Its offset is absolute and the offsets
+ * of the nodes inside it are relative to it, so moving the statement only
+ * touches the statement node. Returns NULL at EOF or on a parse error.
+ */
+ASTNode *parser_parse_statement(Parser *parser) {
+    if (!parser || check(parser, TOKEN_EOF)) {
+        return NULL;
+    }
+
+    parser->statement_offset = token_offset(parser);
+    ASTNode *stmt = parse_statement(parser);
+    if (stmt) {
+        stmt->offset = parser->statement_offset;
+        release_consumed(parser);
+    }
+    parser->statement_offset = 0;
+    return stmt;
+}
+
+/*
+ * Declaration pre-scan: collect the signature of every top-level
+ * `func NAME(params)` without parsing anything else. Only braces are
+ * tracked, so this is far cheaper than a parse; the nodes it appends to
+ * `functions` have empty bodies. Text the parser would reject is skipped
+ * rather than reported, as the real parse reports it. Returns false only
+ * when memory runs out.
+ */
+bool parser_scan_functions(Parser *parser, NodeBuffer *functions) {
+    if (!parser) {
+        return false;
+    }
+
+    size_t depth = 0;
+    while (!check(parser, TOKEN_EOF)) {
+        if (check(parser, TOKEN_LBRACE)) {
+            depth++;
+        } else if (check(parser, TOKEN_RBRACE)) {
+            depth -= depth > 0;
+        } else if (depth == 0 && check(parser, TOKEN_FUNC)) {
+            uint32_t offset = token_offset(parser);
+            advance(parser);
+            if (!check(parser, TOKEN_IDENTIFIER)) {
+                continue;
+            }
+            Atom name = token_atom(parser, advance(parser));
+            if (!match(parser, TOKEN_LPAREN)) {
+                continue;
+            }
+
+            AtomBuffer parameters = {0};
+            bool ok = true;
+            if (!check(parser, TOKEN_RPAREN)) {
+                do {
+                    if (!check(parser, TOKEN_IDENTIFIER)) {
+                        ok = false;
+                        break;
+                    }
+                    if (!atom_buffer_push(&parameters, token_atom(parser, advance(parser)))) {
+                        atom_buffer_free(&parameters);
+                        return false;
+                    }
+                } while (match(parser, TOKEN_COMMA));
+            }
+            if (!ok || !check(parser, TOKEN_RPAREN)) {
+                atom_buffer_free(&parameters);
+                continue;
+            }
+
+            ASTNode *node = ast_create_function_def(name, &parameters, NULL);
+            if (!node || !node_buffer_push(functions, node)) {
+                ast_destroy(node);
+                return false;
+            }
+            node->offset = offset;
         }
+        advance(parser);
+        release_consumed(parser);
     }
+    return true;
+}
 
+/* Statement parsing */
+static ASTNode *parse_statement(Parser *parser) {
     if (check(parser, TOKEN_LET) || check(parser, TOKEN_CONST)) {
         return parse_var_decl(parser);
     }
@@ -156,7 +337,7 @@ static ASTNode *parse_statement(Parser *parser) {
 /* Variable declaration: ("let" | "const") IDENTIFIER "=" expression ";" */
 static ASTNode *parse_var_decl(Parser *parser) {
     int is_const = 0;
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     if (match(parser, TOKEN_CONST)) {
         is_const = 1;
@@ -165,173 +346,117 @@ static ASTNode *parse_var_decl(Parser *parser) {
         return NULL;
     }
 
-    Token name_token = expect(parser, TOKEN_IDENTIFIER, "Expected identifier");
-    if (name_token.kind == TOKEN_ERROR) {
+    size_t name_token = expect(parser, TOKEN_IDENTIFIER, "Expected identifier");
+    if (name_token == NO_TOKEN) {
         return NULL;
     }
 
-    char *name = string_dup_len(name_token.lexeme, name_token.length);
+    Atom name = token_atom(parser, name_token);
 
     if (!match(parser, TOKEN_ASSIGN)) {
         report_error(parser, "Expected '=' in variable declaration");
-        free(name);
         return NULL;
     }
 
     ASTNode *initializer = parse_expression(parser);
     if (!initializer) {
-        free(name);
         return NULL;
     }
 
     if (!match(parser, TOKEN_SEMICOLON)) {
         report_error(parser, "Expected ';' after variable declaration");
-        free(name);
         ast_destroy(initializer);
         return NULL;
     }
 
     ASTNode *node = ast_create_var_decl(name, initializer, is_const);
-    node->line = line;
-    free(name);
+    node->offset = offset;
     return node;
 }
 
+/*
+ * Statements up to a '}' or the end of input, appended to `list`; the
+ * caller checks for the brace. On failure the list is destroyed.
+ */
+static bool parse_statement_list(Parser *parser, NodeBuffer *list) {
+    while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF)) {
+        ASTNode *stmt = parse_statement(parser);
+        if (!stmt || !node_buffer_push(list, stmt)) {
+            ast_destroy(stmt);
+            node_buffer_destroy(list);
+            return false;
+        }
+    }
+    return true;
+}
+
 /* Function declaration: "func" IDENTIFIER "(" parameters? ")" "{" statement* "}" */
 static ASTNode *parse_func_decl(Parser *parser) {
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     if (!match(parser, TOKEN_FUNC)) {
         report_error(parser, "Expected 'func'");
         return NULL;
     }
 
-    Token name_token = expect(parser, TOKEN_IDENTIFIER, "Expected function name");
-    if (name_token.kind == TOKEN_ERROR) {
+    size_t name_token = expect(parser, TOKEN_IDENTIFIER, "Expected function name");
+    if (name_token == NO_TOKEN) {
         return NULL;
     }
 
-    char *name = string_dup_len(name_token.lexeme, name_token.length);
+    Atom name = token_atom(parser, name_token);
 
     if (!match(parser, TOKEN_LPAREN)) {
         report_error(parser, "Expected '(' after function name");
-        free(name);
         return NULL;
     }
 
     /* Parse parameters */
-    char **parameters = NULL;
-    size_t param_count = 0;
+    AtomBuffer parameters = {0};
 
     if (!check(parser, TOKEN_RPAREN)) {
         do {
-            Token param_token = expect(parser, TOKEN_IDENTIFIER, "Expected parameter name");
-            if (param_token.kind == TOKEN_ERROR) {
-                for (size_t i = 0; i < param_count; i++) {
-                    free(parameters[i]);
-                }
-                free(parameters);
-                free(name);
+            size_t param_token = expect(parser, TOKEN_IDENTIFIER, "Expected parameter name");
+            if (param_token == NO_TOKEN || !atom_buffer_push(&parameters, token_atom(parser, param_token))) {
+                atom_buffer_free(&parameters);
                 return NULL;
             }
-
-            char **new_params = realloc(parameters, sizeof(char *) * (param_count + 1));
-            if (!new_params) {
-                for (size_t i = 0; i < param_count; i++) {
-                    free(parameters[i]);
-                }
-                free(parameters);
-                free(name);
-                return NULL;
-            }
-            parameters = new_params;
-            parameters[param_count] = string_dup_len(param_token.lexeme, param_token.length);
-            param_count++;
-
         } while (match(parser, TOKEN_COMMA));
     }
 
     if (!match(parser, TOKEN_RPAREN)) {
         report_error(parser, "Expected ')' after parameters");
-        for (size_t i = 0; i < param_count; i++) {
-            free(parameters[i]);
-        }
-        free(parameters);
-        free(name);
+        atom_buffer_free(&parameters);
         return NULL;
     }
 
     if (!match(parser, TOKEN_LBRACE)) {
         report_error(parser, "Expected '{' before function body");
-        for (size_t i = 0; i < param_count; i++) {
-            free(parameters[i]);
-        }
-        free(parameters);
-        free(name);
+        atom_buffer_free(&parameters);
         return NULL;
     }
 
-    /* Parse body */
-    ASTNode **body = NULL;
-    size_t body_count = 0;
-
-    while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF)) {
-        ASTNode *stmt = parse_statement(parser);
-        if (!stmt) {
-            for (size_t i = 0; i < param_count; i++) {
-                free(parameters[i]);
-            }
-            free(parameters);
-            for (size_t i = 0; i < body_count; i++) {
-                ast_destroy(body[i]);
-            }
-            free(body);
-            free(name);
-            return NULL;
-        }
-
-        ASTNode **new_body = realloc(body, sizeof(ASTNode *) * (body_count + 1));
-        if (!new_body) {
-            ast_destroy(stmt);
-            for (size_t i = 0; i < param_count; i++) {
-                free(parameters[i]);
-            }
-            free(parameters);
-            for (size_t i = 0; i < body_count; i++) {
-                ast_destroy(body[i]);
-            }
-            free(body);
-            free(name);
-            return NULL;
-        }
-        body = new_body;
-        body[body_count] = stmt;
-        body_count++;
+    NodeBuffer body = {0};
+    if (!parse_statement_list(parser, &body)) {
+        atom_buffer_free(&parameters);
+        return NULL;
     }
 
     if (!match(parser, TOKEN_RBRACE)) {
         report_error(parser, "Expected '}' after function body");
-        for (size_t i = 0; i < param_count; i++) {
-            free(parameters[i]);
-        }
-        free(parameters);
-        for (size_t i = 0; i < body_count; i++) {
-            ast_destroy(body[i]);
-        }
-        free(body);
-        free(name);
+        atom_buffer_free(&parameters);
+        node_buffer_destroy(&body);
         return NULL;
     }
 
-    ASTNode *node = ast_create_function_def(name, parameters, param_count, body, body_count);
-    node->line = line;
-    free(name);
+    ASTNode *node = ast_create_function_def(name, &parameters, &body);
+    node->offset = offset;
     return node;
 }
 
 /* If statement: "if" "(" expression ")" "{" statement* "}" ("else" "{" statement* "}")? */
 static ASTNode *parse_if_stmt(Parser *parser) {
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     if (!match(parser, TOKEN_IF)) {
         report_error(parser, "Expected 'if'");
@@ -360,118 +485,53 @@ static ASTNode *parse_if_stmt(Parser *parser) {
         return NULL;
     }
 
-    /* Parse then branch */
-    ASTNode **then_branch = NULL;
-    size_t then_count = 0;
-
-    while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF)) {
-        ASTNode *stmt = parse_statement(parser);
-        if (!stmt) {
-            ast_destroy(condition);
-            for (size_t i = 0; i < then_count; i++) {
-                ast_destroy(then_branch[i]);
-            }
-            free(then_branch);
-            return NULL;
-        }
-
-        ASTNode **new_then = realloc(then_branch, sizeof(ASTNode *) * (then_count + 1));
-        if (!new_then) {
-            ast_destroy(stmt);
-            ast_destroy(condition);
-            for (size_t i = 0; i < then_count; i++) {
-                ast_destroy(then_branch[i]);
-            }
-            free(then_branch);
-            return NULL;
-        }
-        then_branch = new_then;
-        then_branch[then_count] = stmt;
-        then_count++;
+    NodeBuffer then_branch = {0};
+    if (!parse_statement_list(parser, &then_branch)) {
+        ast_destroy(condition);
+        return NULL;
     }
 
     if (!match(parser, TOKEN_RBRACE)) {
         report_error(parser, "Expected '}' after then branch");
         ast_destroy(condition);
-        for (size_t i = 0; i < then_count; i++) {
-            ast_destroy(then_branch[i]);
-        }
-        free(then_branch);
+        node_buffer_destroy(&then_branch);
         return NULL;
     }
 
     /* Parse optional else branch */
-    ASTNode **else_branch = NULL;
-    size_t else_count = 0;
+    NodeBuffer else_branch = {0};
 
     if (match(parser, TOKEN_ELSE)) {
         if (!match(parser, TOKEN_LBRACE)) {
             report_error(parser, "Expected '{' after 'else'");
             ast_destroy(condition);
-            for (size_t i = 0; i < then_count; i++) {
-                ast_destroy(then_branch[i]);
-            }
-            free(then_branch);
+            node_buffer_destroy(&then_branch);
             return NULL;
         }
 
-        while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF)) {
-            ASTNode *stmt = parse_statement(parser);
-            if (!stmt) {
-                ast_destroy(condition);
-                for (size_t i = 0; i < then_count; i++) {
-                    ast_destroy(then_branch[i]);
-                }
-                free(then_branch);
-                for (size_t i = 0; i < else_count; i++) {
-                    ast_destroy(else_branch[i]);
-                }
-                free(else_branch);
-                return NULL;
-            }
-
-            ASTNode **new_else = realloc(else_branch, sizeof(ASTNode *) * (else_count + 1));
-            if (!new_else) {
-                ast_destroy(stmt);
-                ast_destroy(condition);
-                for (size_t i = 0; i < then_count; i++) {
-                    ast_destroy(then_branch[i]);
-                }
-                free(then_branch);
-                for (size_t i = 0; i < else_count; i++) {
-                    ast_destroy(else_branch[i]);
-                }
-                free(else_branch);
-                return NULL;
-            }
-            else_branch = new_else;
-            else_branch[else_count] = stmt;
-            else_count++;
+        if (!parse_statement_list(parser, &else_branch)) {
+            ast_destroy(condition);
+            node_buffer_destroy(&then_branch);
+            return NULL;
         }
 
         if (!match(parser, TOKEN_RBRACE)) {
             report_error(parser, "Expected '}' after else branch");
             ast_destroy(condition);
-            for (size_t i = 0; i < then_count; i++) {
-                ast_destroy(then_branch[i]);
-            }
-            free(then_branch);
-            for (size_t i = 0; i < else_count; i++) {
-                ast_destroy(else_branch[i]);
-            }
-            free(else_branch);
+            node_buffer_destroy(&then_branch);
+            node_buffer_destroy(&else_branch);
             return NULL;
         }
     }
 
-    ASTNode *node = ast_create_if(condition, then_branch, then_count, else_branch, else_count);
-    node->line = line;
+    ASTNode *node = ast_create_if(condition, &then_branch, &else_branch);
+    node->offset = offset;
     return node;
 }
 
 /* While statement: "while" "(" expression ")" "{" statement* "}" */
 static ASTNode *parse_while_stmt(Parser *parser) {
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     if (!match(parser, TOKEN_WHILE)) {
         report_error(parser, "Expected 'while'");
@@ -500,54 +560,27 @@ static ASTNode *parse_while_stmt(Parser *parser) {
         return NULL;
     }
 
-    /* Parse body */
-    ASTNode **body = NULL;
-    size_t body_count = 0;
-
-    while (!check(parser, TOKEN_RBRACE) && !check(parser, TOKEN_EOF)) {
-        ASTNode *stmt = parse_statement(parser);
-        if (!stmt) {
-            ast_destroy(condition);
-            for (size_t i = 0; i < body_count; i++) {
-                ast_destroy(body[i]);
-            }
-            free(body);
-            return NULL;
-        }
-
-        ASTNode **new_body = realloc(body, sizeof(ASTNode *) * (body_count + 1));
-        if (!new_body) {
-            ast_destroy(stmt);
-            ast_destroy(condition);
-            for (size_t i = 0; i < body_count; i++) {
-                ast_destroy(body[i]);
-            }
-            free(body);
-            return NULL;
-        }
-        body = new_body;
-        body[body_count] = stmt;
-        body_count++;
+    NodeBuffer body = {0};
+    if (!parse_statement_list(parser, &body)) {
+        ast_destroy(condition);
+        return NULL;
     }
 
     if (!match(parser, TOKEN_RBRACE)) {
         report_error(parser, "Expected '}' after while body");
         ast_destroy(condition);
-        for (size_t i = 0; i < body_count; i++) {
-            ast_destroy(body[i]);
-        }
-        free(body);
+        node_buffer_destroy(&body);
         return NULL;
     }
 
-    ASTNode *node = ast_create_while(condition, body, body_count);
-    node->line = line;
+    ASTNode *node = ast_create_while(condition, &body);
+    node->offset = offset;
     return node;
 }
 
 /* Return statement: "return" expression? ";" */
 static ASTNode *parse_return_stmt(Parser *parser) {
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     if (!match(parser, TOKEN_RETURN)) {
         report_error(parser, "Expected 'return'");
@@ -570,13 +603,13 @@ static ASTNode *parse_return_stmt(Parser *parser) {
     }
 
     ASTNode *node = ast_create_return(value);
-    node->line = line;
+    node->offset = offset;
     return node;
 }
 
 /* Expression statement: expression ";" */
 static ASTNode *parse_expr_stmt(Parser *parser) {
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     ASTNode *expr = parse_expression(parser);
     if (!expr) {
@@ -590,382 +623,355 @@ static ASTNode *parse_expr_stmt(Parser *parser) {
     }
 
     ASTNode *node = ast_create_expr_stmt(expr);
-    node->line = line;
+    node->offset = offset;
     return node;
 }
 
-/* Expression parsing */
-static ASTNode *parse_expression(Parser *parser) {
-    return parse_assignment(parser);
-}
-
-/* Assignment: IDENTIFIER "=" assignment | logical_or */
-static ASTNode *parse_assignment(Parser *parser) {
-    ASTNode *expr = parse_logical_or(parser);
-
-    if (match(parser, TOKEN_ASSIGN)) {
-        if (!expr || expr->type != NODE_IDENTIFIER) {
-            report_error(parser, "Invalid assignment target");
-            ast_destroy(expr);
-            return NULL;
-        }
-
-        int line = parser->current_token.line;
-        ASTNode *value = parse_assignment(parser);
-        if (!value) {
-            ast_destroy(expr);
+/*
+ * Expression parsing: a Pratt parser driven by operator_rules. Binding
+ * power, associativity and the node each operator builds live in the
+ * table, lowest precedence first:
+ *
+ *   assignment  =                  right-associative
+ *   logical_or  ||
+ *   logical_and &&
+ *   equality    == !=
+ *   comparison  < <= > >=
+ *   term        + -
+ *   factor      * / %
+ *   unary       ! -                prefix
+ *   call        ( arguments? )     postfix
+ */
+typedef enum {
+    PREC_NONE,
+    PREC_ASSIGNMENT,
+    PREC_OR,
+    PREC_AND,
+    PREC_EQUALITY,
+    PREC_COMPARISON,
+    PREC_TERM,
+    PREC_FACTOR,
+    PREC_UNARY,
+    PREC_CALL,
+} Precedence;
+
+/*
+ * How a token acts as an operator. `infix` is PREC_NONE for tokens that
+ * cannot follow an operand. Binary nodes sit at their operator, except
+ * that the logical and assignment operators sit at their right operand
+ * (`offset_after`), as they always have.
+ */
+typedef struct {
+    Precedence infix;
+    OperatorType infix_op;
+    bool right_assoc;
+    bool offset_after;
+    bool prefix;
+    OperatorType prefix_op;
+} OperatorRule;
+
+static const OperatorRule operator_rules[TOKEN_ERROR + 1] = {
+    [TOKEN_ASSIGN]  = { PREC_ASSIGNMENT, OP_ASSIGN, true,  true,  false, OP_ADD },
+    [TOKEN_OR]      = { PREC_OR,         OP_OR,     false, true,  false, OP_ADD },
+    [TOKEN_AND]     = { PREC_AND,        OP_AND,    false, true,  false, OP_ADD },
+    [TOKEN_EQ]      = { PREC_EQUALITY,   OP_EQ,     false, false, false, OP_ADD },
+    [TOKEN_NE]      = { PREC_EQUALITY,   OP_NE,     false, false, false, OP_ADD },
+    [TOKEN_LT]      = { PREC_COMPARISON, OP_LT,     false, false, false, OP_ADD },
+    [TOKEN_LE]      = { PREC_COMPARISON, OP_LE,     false, false, false, OP_ADD },
+    [TOKEN_GT]      = { PREC_COMPARISON, OP_GT,     false, false, false, OP_ADD },
+    [TOKEN_GE]      = { PREC_COMPARISON, OP_GE,     false, false, false, OP_ADD },
+    [TOKEN_PLUS]    = { PREC_TERM,       OP_ADD,    false, false, false, OP_ADD },
+    /* Unary minus uses the SUB operator */
+    [TOKEN_MINUS]   = { PREC_TERM,       OP_SUB,    false, false, true,  OP_SUB },
+    [TOKEN_STAR]    = { PREC_FACTOR,     OP_MUL,    false, false, false, OP_ADD },
+    [TOKEN_SLASH]   = { PREC_FACTOR,     OP_DIV,    false, false, false, OP_ADD },
+    [TOKEN_PERCENT] = { PREC_FACTOR,     OP_MOD,    false, false, false, OP_ADD },
+    [TOKEN_NOT]     = { PREC_NONE,       OP_ADD,    false, false, true,  OP_NOT },
+    [TOKEN_LPAREN]  = { PREC_CALL,       OP_ADD,    false, false, false, OP_ADD },
+};
+
+/*
+ * The parser works through nested expressions with a stack of frames
+ * instead of recursion. A FRAME_PRECEDENCE frame is one operand plus the
+ * operators after it that bind at least as tightly as min_precedence;
+ * while the right operand of one of them is parsed, `rule` holds it and
+ * `left` the operand before it. FRAME_PREFIX and FRAME_GROUP frames wait
+ * for the operand of a prefix operator or the expression inside '(',
+ * then carry on as the FRAME_PRECEDENCE frame of what they built.
+ * FRAME_CALL waits for the next argument of a call to `left`.
+ */
+typedef enum {
+    FRAME_PRECEDENCE,
+    FRAME_PREFIX,
+    FRAME_GROUP,
+    FRAME_CALL,
+} FrameKind;
+
+struct ExprFrame {
+    FrameKind kind;
+    int min_precedence;
+    const OperatorRule *rule;
+    uint32_t offset;
+    ASTNode *left;
+    NodeBuffer arguments;
+};
+
+typedef struct ExprFrame ExprFrame;
+
+/* Push a frame; the array may move, so earlier frame pointers are stale afterwards */
+static ExprFrame *push_frame(Parser *parser, FrameKind kind, int min_precedence) {
+    if (parser->frame_count == parser->frame_capacity) {
+        size_t capacity = parser->frame_capacity ? parser->frame_capacity * 2 : 32;
+        ExprFrame *frames = realloc(parser->frames, capacity * sizeof(ExprFrame));
+        if (!frames) {
             return NULL;
         }
-
-        /* Create assignment as binary op with OP_ASSIGN operator */
-        ASTNode *node = ast_create_binary_op(expr, value, OP_ASSIGN);
-        node->line = line;
-        return node;
+        parser->frames = frames;
+        parser->frame_capacity = capacity;
     }
-
-    return expr;
+    ExprFrame *frame = &parser->frames[parser->frame_count++];
+    frame->kind = kind;
+    frame->min_precedence = min_precedence;
+    frame->rule = NULL;
+    frame->left = NULL;
+    return frame;
 }
 
-/* Logical OR: logical_and ("||" logical_and)* */
-static ASTNode *parse_logical_or(Parser *parser) {
-    ASTNode *left = parse_logical_and(parser);
-    if (!left) {
-        return NULL;
-    }
-
-    while (match(parser, TOKEN_OR)) {
-        int line = parser->current_token.line;
-        ASTNode *right = parse_logical_and(parser);
-        if (!right) {
-            ast_destroy(left);
-            return NULL;
-        }
-
-        ASTNode *node = ast_create_binary_op(left, right, OP_OR);
-        node->line = line;
-        left = node;
-    }
-
-    return left;
+static void discard_call(ExprFrame *frame) {
+    node_buffer_destroy(&frame->arguments);
+    ast_destroy(frame->left);
 }
 
-/* Logical AND: equality ("&&" equality)* */
-static ASTNode *parse_logical_and(Parser *parser) {
-    ASTNode *left = parse_equality(parser);
-    if (!left) {
-        return NULL;
-    }
-
-    while (match(parser, TOKEN_AND)) {
-        int line = parser->current_token.line;
-        ASTNode *right = parse_equality(parser);
-        if (!right) {
-            ast_destroy(left);
-            return NULL;
-        }
-
-        ASTNode *node = ast_create_binary_op(left, right, OP_AND);
-        node->line = line;
-        left = node;
-    }
-
-    return left;
-}
-
-/* Equality: comparison (("==" | "!=") comparison)* */
-static ASTNode *parse_equality(Parser *parser) {
-    ASTNode *left = parse_comparison(parser);
-    if (!left) {
-        return NULL;
-    }
-
-    while (1) {
-        OperatorType op;
-        int line = parser->current_token.line;
-
-        if (match(parser, TOKEN_EQ)) {
-            op = OP_EQ;
-        } else if (match(parser, TOKEN_NE)) {
-            op = OP_NE;
-        } else {
-            break;
-        }
+/*
+ * Parse an expression. Going down, prefix operators and '(' push frames
+ * until a primary is reached; going up, each finished operand is handed
+ * to the frame on top, which either completes (and hands its node to the
+ * frame below) or starts another operand. A failed operand is handed up
+ * as NULL, and every frame frees what it holds on the way.
+ */
+static ASTNode *parse_expression(Parser *parser) {
+    size_t base = parser->frame_count;
+    int min_precedence = PREC_ASSIGNMENT;
+    bool descend = true;
+    ASTNode *value = NULL;
 
-        ASTNode *right = parse_comparison(parser);
-        if (!right) {
-            ast_destroy(left);
-            return NULL;
+    for (;;) {
+        if (descend) {
+            descend = false;
+            value = NULL;
+            for (;;) {
+                const OperatorRule *rule = &operator_rules[parser->current];
+                if (rule->prefix) {
+                    ExprFrame *frame = push_frame(parser, FRAME_PREFIX, min_precedence);
+                    if (!frame) {
+                        break;
+                    }
+                    frame->rule = rule;
+                    frame->offset = current_offset(parser);
+                    advance(parser);
+                    min_precedence = PREC_UNARY;
+                } else if (check(parser, TOKEN_LPAREN)) {
+                    if (!push_frame(parser, FRAME_GROUP, min_precedence)) {
+                        break;
+                    }
+                    advance(parser);
+                    min_precedence = PREC_ASSIGNMENT;
+                } else {
+                    /* An operand that no operator after it binds to needs no frame */
+                    value = parse_primary(parser);
+                    rule = &operator_rules[parser->current];
+                    if (!value || (rule->infix != PREC_NONE && (int)rule->infix >= min_precedence)) {
+                        if (!push_frame(parser, FRAME_PRECEDENCE, min_precedence)) {
+                            ast_destroy(value);
+                            value = NULL;
+                        }
+                    }
+                    break;
+                }
+            }
         }
 
-        ASTNode *node = ast_create_binary_op(left, right, op);
-        node->line = line;
-        left = node;
-    }
-
-    return left;
-}
-
-/* Comparison: term (("<" | "<=" | ">" | ">=") term)* */
-static ASTNode *parse_comparison(Parser *parser) {
-    ASTNode *left = parse_term(parser);
-    if (!left) {
-        return NULL;
-    }
-
-    while (1) {
-        OperatorType op;
-        int line = parser->current_token.line;
-
-        if (match(parser, TOKEN_LT)) {
-            op = OP_LT;
-        } else if (match(parser, TOKEN_LE)) {
-            op = OP_LE;
-        } else if (match(parser, TOKEN_GT)) {
-            op = OP_GT;
-        } else if (match(parser, TOKEN_GE)) {
-            op = OP_GE;
-        } else {
-            break;
+        if (parser->frame_count == base) {
+            return value;
         }
 
-        ASTNode *right = parse_term(parser);
-        if (!right) {
-            ast_destroy(left);
-            return NULL;
+        ExprFrame *frame = &parser->frames[parser->frame_count - 1];
+        if (frame->kind == FRAME_PREFIX) {
+            if (value) {
+                ASTNode *node = ast_create_unary_op(value, frame->rule->prefix_op);
+                node->offset = frame->offset;
+                value = node;
+            }
+            frame->kind = FRAME_PRECEDENCE;
+            frame->rule = NULL;
+        } else if (frame->kind == FRAME_GROUP) {
+            if (value && !match(parser, TOKEN_RPAREN)) {
+                report_error(parser, "Expected ')' after expression");
+                ast_destroy(value);
+                value = NULL;
+            }
+            frame->kind = FRAME_PRECEDENCE;
         }
 
-        ASTNode *node = ast_create_binary_op(left, right, op);
-        node->line = line;
-        left = node;
-    }
-
-    return left;
-}
-
-/* Term: factor (("+" | "-") factor)* */
-static ASTNode *parse_term(Parser *parser) {
-    ASTNode *left = parse_factor(parser);
-    if (!left) {
-        return NULL;
-    }
-
-    while (1) {
-        OperatorType op;
-        int line = parser->current_token.line;
-
-        if (match(parser, TOKEN_PLUS)) {
-            op = OP_ADD;
-        } else if (match(parser, TOKEN_MINUS)) {
-            op = OP_SUB;
-        } else {
-            break;
-        }
+        if (frame->kind == FRAME_CALL) {
+            if (!value || !node_buffer_push(&frame->arguments, value)) {
+                ast_destroy(value);
+                discard_call(frame);
+                parser->frame_count--;
+                value = NULL;
+                continue;
+            }
 
-        ASTNode *right = parse_factor(parser);
-        if (!right) {
-            ast_destroy(left);
-            return NULL;
+            if (match(parser, TOKEN_COMMA)) {
+                min_precedence = PREC_ASSIGNMENT;
+                descend = true;
+                continue;
+            }
+            parser->frame_count--;
+            if (!match(parser, TOKEN_RPAREN)) {
+                report_error(parser, "Expected ')' after arguments");
+                discard_call(frame);
+                value = NULL;
+                continue;
+            }
+            value = ast_create_call(frame->left, &frame->arguments);
+            value->offset = frame->offset;
+            continue;
+        }
+
+        ASTNode *left = value;
+        /* A failed assignment value has already been checked for a stray '=' */
+        bool check_assign = true;
+        if (frame->rule) {
+            /* `value` is the right operand of the pending operator */
+            if (value) {
+                left = ast_create_binary_op(frame->left, value, frame->rule->infix_op);
+                left->offset = frame->offset;
+            } else {
+                ast_destroy(frame->left);
+                check_assign = !frame->rule->right_assoc;
+            }
+            frame->rule = NULL;
+            frame->left = NULL;
         }
 
-        ASTNode *node = ast_create_binary_op(left, right, op);
-        node->line = line;
-        left = node;
-    }
+        while (left) {
+            const OperatorRule *rule = &operator_rules[parser->current];
+            if (rule->infix == PREC_NONE || (int)rule->infix < frame->min_precedence) {
+                break;
+            }
 
-    return left;
-}
+            if (rule->infix == PREC_CALL) {
+                advance(parser); /* Consume '(' */
+                uint32_t offset = current_offset(parser);
+                if (match(parser, TOKEN_RPAREN)) {
+                    left = ast_create_call(left, NULL);
+                    left->offset = offset;
+                    continue;
+                }
+                ExprFrame *call = push_frame(parser, FRAME_CALL, PREC_NONE);
+                if (!call) {
+                    ast_destroy(left);
+                    left = NULL;
+                    break;
+                }
+                call->left = left;
+                call->offset = offset;
+                memset(&call->arguments, 0, sizeof(NodeBuffer));
+                min_precedence = PREC_ASSIGNMENT;
+                descend = true;
+                break;
+            }
 
-/* Factor: unary (("*" | "/" | "%") unary)* */
-static ASTNode *parse_factor(Parser *parser) {
-    ASTNode *left = parse_unary(parser);
-    if (!left) {
-        return NULL;
-    }
+            uint32_t offset = current_offset(parser);
+            advance(parser);
+            if (rule->offset_after) {
+                offset = current_offset(parser);
+            }
 
-    while (1) {
-        OperatorType op;
-        int line = parser->current_token.line;
+            if (rule->infix_op == OP_ASSIGN && left->type != NODE_IDENTIFIER) {
+                report_error(parser, "Invalid assignment target");
+                ast_destroy(left);
+                left = NULL;
+                check_assign = false;
+                break;
+            }
 
-        if (match(parser, TOKEN_STAR)) {
-            op = OP_MUL;
-        } else if (match(parser, TOKEN_SLASH)) {
-            op = OP_DIV;
-        } else if (match(parser, TOKEN_PERCENT)) {
-            op = OP_MOD;
-        } else {
+            frame->rule = rule;
+            frame->offset = offset;
+            frame->left = left;
+            min_precedence = rule->right_assoc ? (int)rule->infix : (int)rule->infix + 1;
+            descend = true;
             break;
         }
-
-        ASTNode *right = parse_unary(parser);
-        if (!right) {
-            ast_destroy(left);
-            return NULL;
-        }
-
-        ASTNode *node = ast_create_binary_op(left, right, op);
-        node->line = line;
-        left = node;
-    }
-
-    return left;
-}
-
-/* Unary: ("!" | "-") unary | call */
-static ASTNode *parse_unary(Parser *parser) {
-    OperatorType op;
-    int line = parser->current_token.line;
-
-    if (match(parser, TOKEN_NOT)) {
-        op = OP_NOT;
-    } else if (match(parser, TOKEN_MINUS)) {
-        op = OP_SUB; /* Unary minus uses SUB operator */
-    } else {
-        return parse_call(parser);
-    }
-
-    ASTNode *operand = parse_unary(parser);
-    if (!operand) {
-        return NULL;
-    }
-
-    ASTNode *node = ast_create_unary_op(operand, op);
-    node->line = line;
-    return node;
-}
-
-/* Call: primary ("(" arguments? ")")* */
-static ASTNode *parse_call(Parser *parser) {
-    ASTNode *expr = parse_primary(parser);
-    if (!expr) {
-        return NULL;
-    }
-
-    while (match(parser, TOKEN_LPAREN)) {
-        int line = parser->current_token.line;
-
-        /* Parse arguments */
-        ASTNode **arguments = NULL;
-        size_t arg_count = 0;
-
-        if (!check(parser, TOKEN_RPAREN)) {
-            do {
-                ASTNode *arg = parse_expression(parser);
-                if (!arg) {
-                    for (size_t i = 0; i < arg_count; i++) {
-                        ast_destroy(arguments[i]);
-                    }
-                    free(arguments);
-                    ast_destroy(expr);
-                    return NULL;
-                }
-
-                ASTNode **new_args = realloc(arguments, sizeof(ASTNode *) * (arg_count + 1));
-                if (!new_args) {
-                    ast_destroy(arg);
-                    for (size_t i = 0; i < arg_count; i++) {
-                        ast_destroy(arguments[i]);
-                    }
-                    free(arguments);
-                    ast_destroy(expr);
-                    return NULL;
-                }
-                arguments = new_args;
-                arguments[arg_count] = arg;
-                arg_count++;
-
-            } while (match(parser, TOKEN_COMMA));
+        if (descend) {
+            continue;
         }
 
-        if (!match(parser, TOKEN_RPAREN)) {
-            report_error(parser, "Expected ')' after arguments");
-            for (size_t i = 0; i < arg_count; i++) {
-                ast_destroy(arguments[i]);
-            }
-            free(arguments);
-            ast_destroy(expr);
-            return NULL;
+        /* An '=' after an operand that failed to parse is reported as well */
+        if (!left && check_assign && frame->min_precedence <= PREC_ASSIGNMENT && match(parser, TOKEN_ASSIGN)) {
+            report_error(parser, "Invalid assignment target");
         }
-
-        ASTNode *node = ast_create_call(expr, arguments, arg_count);
-        node->line = line;
-        expr = node;
+        parser->frame_count--;
+        value = left;
     }
-
-    return expr;
 }
 
-/* Primary: NUMBER | STRING | "true" | "false" | "null" | IDENTIFIER | "(" expression ")" */
+/* Primary: NUMBER | STRING | "true" | "false" | "null" | IDENTIFIER | "print"; '(' is handled by parse_expression */
 static ASTNode *parse_primary(Parser *parser) {
-    int line = parser->current_token.line;
+    uint32_t offset = current_offset(parser);
 
     if (check(parser, TOKEN_INT)) {
-        Token token = advance(parser);
-        long value = token.value.int_value;
+        size_t token = advance(parser);
+        long value = literal_at(parser, token)->value.int_value;
         ASTNode *node = ast_create_int_literal(value);
-        node->line = line;
+        node->offset = offset;
         return node;
     }
 
     if (check(parser, TOKEN_FLOAT)) {
-        Token token = advance(parser);
-        double value = token.value.float_value;
+        size_t token = advance(parser);
+        double value = literal_at(parser, token)->value.float_value;
         ASTNode *node = ast_create_float_literal(value);
-        node->line = line;
+        node->offset = offset;
         return node;
     }
 
     if (check(parser, TOKEN_STRING)) {
-        Token token = advance(parser);
-        char *value = string_dup_len(token.lexeme, token.length);
-        ASTNode *node = ast_create_string_literal(value);
-        node->line = line;
-        free(value);
+        size_t token = advance(parser);
+        ASTNode *node = ast_create_string_literal_len(parser->tokens->source + parser->tokens->offsets[token],
+                                                      parser->tokens->lengths[token]);
+        node->offset = offset;
         return node;
     }
 
     if (match(parser, TOKEN_TRUE)) {
         ASTNode *node = ast_create_bool_literal(1);
-        node->line = line;
+        node->offset = offset;
         return node;
     }
 
     if (match(parser, TOKEN_FALSE)) {
         ASTNode *node = ast_create_bool_literal(0);
-        node->line = line;
+        node->offset = offset;
         return node;
     }
 
     if (match(parser, TOKEN_NULL)) {
         /* Represent null as integer 0 for now */
         ASTNode *node = ast_create_int_literal(0);
-        node->line = line;
+        node->offset = offset;
         return node;
     }
 
-    if (check(parser, TOKEN_IDENTIFIER)) {
-        Token token = advance(parser);
-        char *name = string_dup_len(token.lexeme, token.length);
-        ASTNode *node = ast_create_identifier(name);
-        node->line = line;
-        free(name);
+    /* The built-in print is a keyword but is called like any function */
+    if (check(parser, TOKEN_IDENTIFIER) || check(parser, TOKEN_PRINT)) {
+        size_t token = advance(parser);
+        ASTNode *node = ast_create_identifier(token_atom(parser, token));
+        node->offset = offset;
         return node;
     }
 
-    if (match(parser, TOKEN_LPAREN)) {
-        ASTNode *expr = parse_expression(parser);
-        if (!expr) {
-            return NULL;
-        }
-
-        if (!match(parser, TOKEN_RPAREN)) {
-            report_error(parser, "Expected ')' after expression");
-            ast_destroy(expr);
-            return NULL;
-        }
-
-        return expr;
-    }
-
     report_error(parser, "Unexpected token in expression");
     return NULL;
 }
@@ -4,14 +4,38 @@
 #include "lexer.h"
 #include "ast.h"
 
+/* A pending step of an expression being parsed; see parse_expression() */
+struct ExprFrame;
+
+/*
+ * The parser addresses tokens by index into a struct-of-arrays token
+ * buffer, which the lexer fills ahead of the parser in batches. Lookahead
+ * and backtracking are index arithmetic; no Token is ever copied.
+ *
+ * Expressions are parsed on `frames`, a work stack that lives as long as
+ * the parser, rather than on the C stack, so nesting depth is bounded
+ * only by memory.
+ */
 typedef struct {
     Lexer *lexer;
-    Token current_token;
-    Token peek_token;
+    TokenBuffer *tokens;
+    bool owns_tokens;
+    size_t pos;
+    TokenKind current;
+    size_t literal_cursor;
+    uint32_t statement_offset;
+    /* Parse errors are not printed; set by the parallel parser's workers */
+    bool quiet;
+    struct ExprFrame *frames;
+    size_t frame_count;
+    size_t frame_capacity;
 } Parser;
 
 Parser *parser_create(Lexer *lexer);
+Parser *parser_create_from_tokens(Lexer *lexer, TokenBuffer *tokens, size_t pos);
 void parser_destroy(Parser *parser);
 ASTNode *parser_parse(Parser *parser);
+ASTNode *parser_parse_statement(Parser *parser);
+bool parser_scan_functions(Parser *parser, NodeBuffer *functions);
 
 #endif
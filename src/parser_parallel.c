@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "parser_parallel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* A run of whole top-level statements and what its worker made of it */
+typedef struct {
+    Lexer *lexer;
+    TokenBuffer *tokens;
+    size_t start;
+    size_t end;
+    NodeBuffer statements;
+    /* Where the worker allocates nodes when the caller uses an arena */
+    Arena *arena;
+    bool ok;
+} Range;
+
+/* Parse the statements of a range; it is only good if the last one ends exactly at its end */
+static void *parse_range(void *arg) {
+    Range *range = arg;
+    Parser *parser = parser_create_from_tokens(range->lexer, range->tokens, range->start);
+    if (!parser) {
+        return NULL;
+    }
+    parser->quiet = true;
+    Arena *previous = ast_arena();
+    ast_use_arena(range->arena);
+
+    bool failed = false;
+    while (parser->pos < range->end) {
+        ASTNode *stmt = parser_parse_statement(parser);
+        if (!stmt || !node_buffer_push(&range->statements, stmt)) {
+            ast_destroy(stmt);
+            failed = true;
+            break;
+        }
+    }
+
+    range->ok = !failed && parser->pos == range->end;
+    ast_use_arena(previous);
+    parser_destroy(parser);
+    return NULL;
+}
+
+/* Parse every range, one thread each; the calling thread takes the last one */
+static void parse_ranges(Range *ranges, size_t count) {
+    pthread_t *threads = malloc(count * sizeof(pthread_t));
+    bool *started = calloc(count, sizeof(bool));
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (threads && started && pthread_create(&threads[i], NULL, parse_range, &ranges[i]) == 0) {
+            started[i] = true;
+        } else {
+            parse_range(&ranges[i]);
+        }
+    }
+    parse_range(&ranges[count - 1]);
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+/*
+ * Where the ranges start: token 0, then the first `func` at brace depth
+ * zero past each further 1/count of the stream. Returns how many ranges
+ * there are, which is fewer when the functions run out.
+ */
+static size_t find_cuts(const TokenBuffer *tokens, size_t *cuts, size_t count) {
+    size_t last = tokens->count - 1;
+    size_t used = 1;
+    long depth = 0;
+    cuts[0] = 0;
+    for (size_t i = 0; i < last && used < count; i++) {
+        uint8_t kind = tokens->kinds[i];
+        if (kind == TOKEN_LBRACE) {
+            depth++;
+        } else if (kind == TOKEN_RBRACE) {
+            depth--;
+        } else if (kind == TOKEN_FUNC && depth == 0 && i > 0 && i >= last / count * used) {
+            cuts[used++] = i;
+        }
+    }
+    return used;
+}
+
+/*
+ * Append statements to the program, or destroy them if `keep` is false
+ * or memory runs out. Returns whether every statement was kept.
+ */
+static bool move_statements(ASTNode *program, ASTNode **statements, size_t count, bool keep) {
+    for (size_t i = 0; i < count; i++) {
+        keep = keep && ast_program_add_statement(program, statements[i]);
+        if (!keep) {
+            ast_destroy(statements[i]);
+        }
+    }
+    return keep;
+}
+
+ASTNode *parser_parse_parallel(Lexer *lexer, TokenBuffer *tokens, unsigned threads) {
+    if (!lexer || !tokens || tokens->count == 0 || tokens->kinds[tokens->count - 1] != TOKEN_EOF) {
+        return NULL;
+    }
+
+    size_t range_count = threads > 0 ? threads : 1;
+    size_t *cuts = malloc(range_count * sizeof(size_t));
+    Range *ranges = calloc(range_count, sizeof(Range));
+    if (!cuts || !ranges) {
+        free(cuts);
+        free(ranges);
+        return NULL;
+    }
+    range_count = find_cuts(tokens, cuts, range_count);
+    for (size_t i = 0; i < range_count; i++) {
+        ranges[i].lexer = lexer;
+        ranges[i].tokens = tokens;
+        ranges[i].start = cuts[i];
+        ranges[i].end = i + 1 < range_count ? cuts[i + 1] : tokens->count - 1;
+    }
+    free(cuts);
+
+    /* Nothing to split: a plain serial parse */
+    if (range_count == 1) {
+        free(ranges);
+        Parser *parser = parser_create_from_tokens(lexer, tokens, 0);
+        ASTNode *program = parser_parse(parser);
+        parser_destroy(parser);
+        return program;
+    }
+
+    /* Workers fill arenas of their own, which the caller's arena then takes over */
+    Arena *arena = ast_arena();
+    bool arenas_ok = true;
+    for (size_t i = 0; arena && i < range_count; i++) {
+        ranges[i].arena = arena_create(arena->chunk_size);
+        arenas_ok = arenas_ok && ranges[i].arena;
+    }
+    if (!arenas_ok) {
+        for (size_t i = 0; i < range_count; i++) {
+            arena_destroy(ranges[i].arena);
+        }
+        free(ranges);
+        return NULL;
+    }
+
+    atom_table_set_shared(true);
+    parse_ranges(ranges, range_count);
+    atom_table_set_shared(false);
+
+    for (size_t i = 0; arena && i < range_count; i++) {
+        arena_adopt(arena, ranges[i].arena);
+        arena_destroy(ranges[i].arena);
+    }
+
+    size_t good = 0;
+    while (good < range_count && ranges[good].ok) {
+        good++;
+    }
+
+    /* The rest of the stream after the last good range, parsed serially */
+    ASTNode *rest = NULL;
+    if (good < range_count) {
+        Parser *parser = parser_create_from_tokens(lexer, tokens, ranges[good].start);
+        rest = parser_parse(parser);
+        parser_destroy(parser);
+    }
+
+    ASTNode *program = good == range_count || rest ? ast_create_program() : NULL;
+    bool ok = program != NULL;
+
+    /* Move the good ranges' statements and then the rest into the program in order */
+    for (size_t i = 0; i < range_count; i++) {
+        NodeBuffer *statements = &ranges[i].statements;
+        if (i < good) {
+            ok = move_statements(program, node_buffer_items(statements), statements->count, ok);
+        } else {
+            move_statements(program, node_buffer_items(statements), statements->count, false);
+        }
+        node_buffer_free(statements);
+    }
+    free(ranges);
+    if (rest) {
+        NodeList *statements = &rest->data.program.statements;
+        ok = move_statements(program, statements->items, statements->count, ok);
+        statements->count = 0;
+        ast_destroy(rest);
+    }
+
+    if (!ok) {
+        /* A parse error or out of memory; statements already moved go with the program */
+        ast_destroy(program);
+        return NULL;
+    }
+    program->offset = 0;
+    return program;
+}
@@ -0,0 +1,29 @@
+#ifndef PARSER_PARALLEL_H
+#define PARSER_PARALLEL_H
+
+#include "parser.h"
+
+/*
+ * Parse a complete token buffer (one that ends with TOKEN_EOF) on up to
+ * `threads` threads, with the same program and diagnostics as
+ * parser_parse() over it.
+ *
+ * A pre-scan over the token kinds matches braces to find the `func`
+ * tokens that start top-level function definitions, and the stream is
+ * cut before one of them into one range per thread. Each range is parsed
+ * on its own thread without printing errors. Its statements stand if it
+ * parsed without an error and stopped exactly where the next range
+ * starts, since a serial parse would then have stood there too. From the
+ * first range that did not, the rest of the stream is parsed serially on
+ * the calling thread, which reports errors exactly as parser_parse()
+ * does. The ranges' statements are stitched into the program in order.
+ *
+ * `lexer` is only used on the calling thread, to resolve positions for
+ * diagnostics. Atoms are interned from several threads at once, so their
+ * numbering can differ from a serial parse. If the calling thread
+ * allocates nodes from an arena (see ast_use_arena()), so does the whole
+ * program. Returns NULL on a parse error or allocation failure.
+ */
+ASTNode *parser_parse_parallel(Lexer *lexer, TokenBuffer *tokens, unsigned threads);
+
+#endif
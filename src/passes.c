@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "passes.h"
+#include "ast.h"
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+/* What the counters read at one moment; a record is the difference of two */
+typedef struct {
+    double wall;
+    double cpu;
+    size_t allocations;
+    size_t bytes;
+    long long heap;
+} Snapshot;
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void take_snapshot(Snapshot *snapshot, const Arena *arena) {
+    snapshot->wall = clock_seconds(CLOCK_MONOTONIC);
+    snapshot->cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    snapshot->allocations = arena ? arena->allocations : 0;
+    snapshot->bytes = arena ? arena->bytes_used : 0;
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 info = mallinfo2();
+    snapshot->heap = (long long)(info.uordblks + info.hblkhd);
+#else
+    snapshot->heap = 0;
+#endif
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+/* With `telemetry` off the passes only run; nothing is measured */
+void pass_manager_init(PassManager *manager, bool telemetry) {
+    manager->telemetry = telemetry;
+    manager->origin = clock_seconds(CLOCK_MONOTONIC);
+    manager->records = NULL;
+    manager->count = 0;
+    manager->capacity = 0;
+}
+
+void pass_manager_free(PassManager *manager) {
+    free(manager->records);
+    manager->records = NULL;
+    manager->count = 0;
+    manager->capacity = 0;
+}
+
+static void record(PassManager *manager, const char *name, const Snapshot *before, const Snapshot *after) {
+    if (manager->count == manager->capacity) {
+        size_t capacity = manager->capacity ? manager->capacity * 2 : 16;
+        PassRecord *records = realloc(manager->records, capacity * sizeof(PassRecord));
+        if (!records) {
+            return;
+        }
+        manager->records = records;
+        manager->capacity = capacity;
+    }
+    PassRecord *entry = &manager->records[manager->count++];
+    entry->name = name;
+    entry->start = before->wall - manager->origin;
+    entry->wall = after->wall - before->wall;
+    entry->cpu = after->cpu - before->cpu;
+    entry->allocations = after->allocations - before->allocations;
+    entry->bytes = after->bytes - before->bytes;
+    entry->heap_growth = after->heap - before->heap;
+    entry->peak_rss_kb = peak_rss_kb();
+}
+
+/*
+ * Run `passes` in order over `state`; returns false as soon as one fails.
+ * The AST arena in use when a pass starts is the one its allocations
+ * are counted in.
+ */
+bool pass_manager_run(PassManager *manager, const Pass *passes, size_t count, void *state) {
+    for (size_t i = 0; i < count; i++) {
+        Snapshot before, after;
+        const Arena *arena = ast_arena();
+        if (manager->telemetry) {
+            take_snapshot(&before, arena);
+        }
+        PassStatus status = passes[i].run(state);
+        if (manager->telemetry && status != PASS_SKIPPED) {
+            take_snapshot(&after, arena);
+            record(manager, passes[i].name, &before, &after);
+        }
+        if (status == PASS_FAILED) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The --time-passes table */
+void pass_manager_print(const PassManager *manager, FILE *output) {
+    double wall = 0.0, cpu = 0.0;
+    size_t allocations = 0, bytes = 0;
+    long long heap = 0;
+    long peak = 0;
+
+    fprintf(output, "===== Pass execution times =====\n");
+    fprintf(output, "%-16s %10s %10s %11s %11s %11s %9s\n",
+            "Pass", "Wall ms", "CPU ms", "Allocs", "Alloc KB", "Heap +KB", "RSS MB");
+    for (size_t i = 0; i < manager->count; i++) {
+        const PassRecord *entry = &manager->records[i];
+        fprintf(output, "%-16s %10.3f %10.3f %11zu %11zu %11lld %9.1f\n",
+                entry->name, entry->wall * 1e3, entry->cpu * 1e3, entry->allocations,
+                entry->bytes / 1024, entry->heap_growth / 1024, entry->peak_rss_kb / 1024.0);
+        wall += entry->wall;
+        cpu += entry->cpu;
+        allocations += entry->allocations;
+        bytes += entry->bytes;
+        heap += entry->heap_growth;
+        peak = entry->peak_rss_kb > peak ? entry->peak_rss_kb : peak;
+    }
+    fprintf(output, "%-16s %10.3f %10.3f %11zu %11zu %11lld %9.1f\n",
+            "Total", wall * 1e3, cpu * 1e3, allocations, bytes / 1024, heap / 1024, peak / 1024.0);
+}
+
+/*
+ * Write the records as Chrome trace-event JSON (chrome://tracing,
+ * Perfetto): a complete event per pass with its costs as arguments, and
+ * a counter event tracking peak RSS. Pass names are plain identifiers,
+ * so nothing needs escaping.
+ */
+bool pass_manager_write_trace(const PassManager *manager, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < manager->count; i++) {
+        const PassRecord *entry = &manager->records[i];
+        double start = entry->start * 1e6;
+        double end = (entry->start + entry->wall) * 1e6;
+        fprintf(file,
+                "{\"name\":\"%s\",\"cat\":\"pass\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cpu_ms\":%.3f,\"allocations\":%zu,"
+                "\"bytes\":%zu,\"heap_growth\":%lld,\"peak_rss_kb\":%ld}},\n",
+                entry->name, start, end - start, entry->cpu * 1e3, entry->allocations,
+                entry->bytes, entry->heap_growth, entry->peak_rss_kb);
+        fprintf(file, "{\"name\":\"peak_rss\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%.3f,"
+                "\"args\":{\"kb\":%ld}}%s\n",
+                end, entry->peak_rss_kb, i + 1 < manager->count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+}
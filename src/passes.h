@@ -0,0 +1,56 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Runs the phases of a compilation in order and, when telemetry is on,
+ * records what each one cost. A pass is a named function over the
+ * compilation state; it can fail, which stops the run, or find it has
+ * nothing to do, which leaves it out of the records.
+ */
+typedef enum {
+    PASS_DONE,
+    PASS_SKIPPED,
+    PASS_FAILED,
+} PassStatus;
+
+typedef struct {
+    const char *name;
+    PassStatus (*run)(void *state);
+} Pass;
+
+/*
+ * The cost of one pass. Allocations and bytes are the blocks the AST
+ * arena handed out during the pass, which is where the tree goes; heap
+ * growth is the change in bytes malloc has in use (glibc only, 0
+ * elsewhere). Peak RSS is the process high-water mark when it ended.
+ */
+typedef struct {
+    const char *name;
+    double start;           /* seconds since the manager was created */
+    double wall;
+    double cpu;
+    size_t allocations;
+    size_t bytes;
+    long long heap_growth;
+    long peak_rss_kb;
+} PassRecord;
+
+typedef struct {
+    bool telemetry;
+    double origin;
+    PassRecord *records;
+    size_t count;
+    size_t capacity;
+} PassManager;
+
+void pass_manager_init(PassManager *manager, bool telemetry);
+void pass_manager_free(PassManager *manager);
+bool pass_manager_run(PassManager *manager, const Pass *passes, size_t count, void *state);
+void pass_manager_print(const PassManager *manager, FILE *output);
+bool pass_manager_write_trace(const PassManager *manager, const char *path);
+
+#endif
@@ -0,0 +1,489 @@
+#include "resolve.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NO_BINDING UINT32_MAX
+
+/* Frames: 0 holds the globals, 1 is main, and each function gets the next */
+#define GLOBAL_FRAME 0
+#define MAIN_FRAME 1
+
+typedef enum {
+    BINDING_VARIABLE,
+    BINDING_CONSTANT,
+    BINDING_FUNCTION,
+    BINDING_BUILTIN,
+} BindingKind;
+
+typedef struct {
+    Atom name;
+    BindingKind kind;
+    uint32_t depth;
+    uint32_t slot;
+    uint32_t frame;
+    uint32_t parameters;    /* functions and builtins: the arguments they take */
+    uint32_t shadowed;      /* binding of the same name this one hides, or NO_BINDING */
+} Binding;
+
+/* Where an open scope starts: its first binding and first free slot */
+typedef struct {
+    uint32_t bindings;
+    uint32_t slots;
+    uint32_t depth;
+} Scope;
+
+/* Identifiers are either read or assigned */
+typedef enum {
+    ROLE_VALUE,
+    ROLE_TARGET,
+} Role;
+
+typedef struct {
+    ASTNode *node;
+    Role role;
+} ExpressionItem;
+
+/*
+ * Bindings form a stack that scopes push onto and pop back to. Atoms are
+ * already interned, so the innermost binding of each name is found by
+ * indexing `innermost` with the atom, and the bindings it hides are
+ * chained through `shadowed`. Locals of other frames stay in the chains
+ * (main's, while a function is resolved) and are skipped by lookup.
+ */
+struct Resolver {
+    LineIndex *lines;
+    Binding *bindings;
+    uint32_t count;
+    size_t capacity;
+    uint32_t *innermost;
+    size_t innermost_size;
+    Scope *scopes;
+    size_t scope_count;
+    size_t scope_capacity;
+    uint32_t globals;           /* slots taken at depth 0 */
+    uint32_t frame;
+    uint32_t next_frame;
+    uint32_t next_slot;         /* of the current frame */
+    uint32_t frame_slots;       /* most slots the current frame has needed */
+    const ASTNode *statement;   /* top-level statement being resolved, for offsets */
+    Atom declaring;             /* variable whose initializer is being resolved */
+    ExpressionItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    size_t errors;
+    bool failed;
+};
+
+static void report(Resolver *resolver, const ASTNode *node, const char *format, ...) {
+    size_t offset = node == resolver->statement ? node->offset : resolver->statement->offset + node->offset;
+    int line = resolver->lines ? line_index_lookup(resolver->lines, offset).line : 0;
+    va_list args;
+    va_start(args, format);
+    if (line > 0) {
+        fprintf(stderr, "Error at line %d: ", line);
+    } else {
+        fprintf(stderr, "Error: ");
+    }
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    resolver->errors++;
+}
+
+static void out_of_memory(Resolver *resolver) {
+    if (!resolver->failed) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+    }
+    resolver->failed = true;
+}
+
+static bool grow(void **array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 16;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+/* The binding a name refers to from the current frame, or NO_BINDING */
+static uint32_t lookup(const Resolver *resolver, Atom name) {
+    uint32_t index = name < resolver->innermost_size ? resolver->innermost[name] : NO_BINDING;
+    while (index != NO_BINDING && resolver->bindings[index].frame != GLOBAL_FRAME &&
+           resolver->bindings[index].frame != resolver->frame) {
+        index = resolver->bindings[index].shadowed;
+    }
+    return index;
+}
+
+/* Atoms interned after the resolver was created (while streaming) need room too */
+static bool reserve_atom(Resolver *resolver, Atom name) {
+    if (name < resolver->innermost_size) {
+        return true;
+    }
+    size_t size = resolver->innermost_size ? resolver->innermost_size : 64;
+    while (size <= name) {
+        size *= 2;
+    }
+    uint32_t *innermost = realloc(resolver->innermost, size * sizeof(uint32_t));
+    if (!innermost) {
+        return false;
+    }
+    for (size_t i = resolver->innermost_size; i < size; i++) {
+        innermost[i] = NO_BINDING;
+    }
+    resolver->innermost = innermost;
+    resolver->innermost_size = size;
+    return true;
+}
+
+static uint32_t current_depth(const Resolver *resolver) {
+    return resolver->scopes[resolver->scope_count - 1].depth;
+}
+
+/*
+ * Bind a name at `depth`, which is the innermost scope's or 0; `node` is
+ * where a clash is reported. Returns the binding, or NO_BINDING if the
+ * name was already declared there (the first declaration stays in force)
+ * or memory ran out.
+ */
+static uint32_t declare(Resolver *resolver, const ASTNode *node, Atom name, BindingKind kind, uint32_t depth,
+                        uint32_t parameters) {
+    uint32_t existing = lookup(resolver, name);
+    if (existing != NO_BINDING && resolver->bindings[existing].depth == depth) {
+        if (kind == BINDING_FUNCTION) {
+            report(resolver, node, "Function '%s' is already defined", atom_name(name));
+        } else {
+            report(resolver, node, "'%s' is already declared in this scope", atom_name(name));
+        }
+        return NO_BINDING;
+    }
+    if (!reserve_atom(resolver, name) ||
+        (resolver->count == resolver->capacity &&
+         !grow((void **)&resolver->bindings, &resolver->capacity, sizeof(Binding)))) {
+        out_of_memory(resolver);
+        return NO_BINDING;
+    }
+
+    uint32_t index = resolver->count++;
+    Binding *binding = &resolver->bindings[index];
+    binding->name = name;
+    binding->kind = kind;
+    binding->depth = depth;
+    binding->parameters = parameters;
+    binding->shadowed = resolver->innermost[name];
+    if (depth == 0) {
+        binding->frame = GLOBAL_FRAME;
+        binding->slot = resolver->globals++;
+    } else {
+        binding->frame = resolver->frame;
+        binding->slot = resolver->next_slot++;
+        if (resolver->next_slot > resolver->frame_slots) {
+            resolver->frame_slots = resolver->next_slot;
+        }
+    }
+    resolver->innermost[name] = index;
+    return index;
+}
+
+static bool open_scope(Resolver *resolver, uint32_t depth) {
+    if (resolver->scope_count == resolver->scope_capacity &&
+        !grow((void **)&resolver->scopes, &resolver->scope_capacity, sizeof(Scope))) {
+        out_of_memory(resolver);
+        return false;
+    }
+    Scope *scope = &resolver->scopes[resolver->scope_count++];
+    scope->bindings = resolver->count;
+    scope->slots = resolver->next_slot;
+    scope->depth = depth;
+    return true;
+}
+
+/* Unbind the scope's names and free its slots for the next scope */
+static void close_scope(Resolver *resolver) {
+    Scope *scope = &resolver->scopes[--resolver->scope_count];
+    while (resolver->count > scope->bindings) {
+        const Binding *binding = &resolver->bindings[--resolver->count];
+        resolver->innermost[binding->name] = binding->shadowed;
+    }
+    resolver->next_slot = scope->slots;
+}
+
+static void bind(ASTNode *identifier, const Binding *binding) {
+    identifier->data.identifier.depth = binding->depth;
+    identifier->data.identifier.slot = binding->slot;
+}
+
+static void resolve_name(Resolver *resolver, ASTNode *node, Role role) {
+    Atom name = node->data.identifier.name;
+    if (name == resolver->declaring) {
+        report(resolver, node, "'%s' is used in its own initializer", atom_name(name));
+        return;
+    }
+    uint32_t index = lookup(resolver, name);
+    if (index == NO_BINDING) {
+        report(resolver, node, "Undefined name '%s'", atom_name(name));
+        return;
+    }
+    const Binding *binding = &resolver->bindings[index];
+    if (binding->kind == BINDING_FUNCTION || binding->kind == BINDING_BUILTIN) {
+        report(resolver, node, role == ROLE_TARGET ? "Cannot assign to function '%s'" : "Function '%s' is used as a value",
+               atom_name(name));
+        return;
+    }
+    if (role == ROLE_TARGET && binding->kind == BINDING_CONSTANT) {
+        report(resolver, node, "Cannot assign to constant '%s'", atom_name(name));
+        return;
+    }
+    bind(node, binding);
+}
+
+/* A call names its function directly; codegen turns print into the runtime's printers whatever is in scope */
+static void resolve_callee(Resolver *resolver, ASTNode *call) {
+    ASTNode *callee = call->data.call.function;
+    Atom name = callee->data.identifier.name;
+    uint32_t index = name == ATOM_PRINT ? 0 : lookup(resolver, name);
+    if (index == NO_BINDING) {
+        report(resolver, callee, "Undefined function '%s'", atom_name(name));
+        return;
+    }
+    const Binding *binding = &resolver->bindings[index];
+    if (binding->kind != BINDING_FUNCTION && binding->kind != BINDING_BUILTIN) {
+        report(resolver, callee, "'%s' is not a function", atom_name(name));
+        return;
+    }
+    uint32_t arguments = call->data.call.arguments.count;
+    if (arguments != binding->parameters) {
+        report(resolver, call, "Function '%s' takes %u argument%s, not %u", atom_name(name),
+               (unsigned)binding->parameters, binding->parameters == 1 ? "" : "s", (unsigned)arguments);
+        return;
+    }
+    bind(callee, binding);
+}
+
+static void push_item(Resolver *resolver, ASTNode *node, Role role) {
+    if (!node) {
+        return;
+    }
+    if (resolver->item_count == resolver->item_capacity &&
+        !grow((void **)&resolver->items, &resolver->item_capacity, sizeof(ExpressionItem))) {
+        out_of_memory(resolver);
+        return;
+    }
+    resolver->items[resolver->item_count].node = node;
+    resolver->items[resolver->item_count].role = role;
+    resolver->item_count++;
+}
+
+/* Resolve an expression of any depth, left to right so errors come out in source order */
+static void resolve_expression(Resolver *resolver, ASTNode *expression) {
+    size_t base = resolver->item_count;
+    push_item(resolver, expression, ROLE_VALUE);
+
+    while (resolver->item_count > base && !resolver->failed) {
+        ExpressionItem item = resolver->items[--resolver->item_count];
+        ASTNode *node = item.node;
+        switch (node->type) {
+            case NODE_IDENTIFIER:
+                resolve_name(resolver, node, item.role);
+                break;
+            case NODE_BINARY_OP:
+                push_item(resolver, node->data.binary_op.right, ROLE_VALUE);
+                push_item(resolver, node->data.binary_op.left,
+                          node->data.binary_op.op == OP_ASSIGN ? ROLE_TARGET : ROLE_VALUE);
+                break;
+            case NODE_UNARY_OP:
+                push_item(resolver, node->data.unary_op.operand, ROLE_VALUE);
+                break;
+            case NODE_CALL:
+                for (size_t i = node->data.call.arguments.count; i > 0; i--) {
+                    push_item(resolver, node->data.call.arguments.items[i - 1], ROLE_VALUE);
+                }
+                if (node->data.call.function->type == NODE_IDENTIFIER) {
+                    resolve_callee(resolver, node);
+                } else {
+                    report(resolver, node, "Only a named function can be called");
+                    push_item(resolver, node->data.call.function, ROLE_VALUE);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    resolver->item_count = base;
+}
+
+static void resolve_statement(Resolver *resolver, ASTNode *statement);
+
+static void resolve_list(Resolver *resolver, NodeList *statements) {
+    for (size_t i = 0; i < statements->count && !resolver->failed; i++) {
+        resolve_statement(resolver, statements->items[i]);
+    }
+}
+
+static void resolve_scope(Resolver *resolver, NodeList *statements) {
+    if (open_scope(resolver, current_depth(resolver) + 1)) {
+        resolve_list(resolver, statements);
+        close_scope(resolver);
+    }
+}
+
+static void resolve_statement(Resolver *resolver, ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT:
+            resolve_expression(resolver, statement->data.expr_stmt.expression);
+            break;
+
+        case NODE_VAR_DECL: {
+            /* The name is in scope only after its initializer, as in the C emitted for it */
+            resolver->declaring = statement->data.var_decl.name;
+            resolve_expression(resolver, statement->data.var_decl.initializer);
+            resolver->declaring = ATOM_NONE;
+            uint32_t index = declare(resolver, statement, statement->data.var_decl.name,
+                                     statement->data.var_decl.is_const ? BINDING_CONSTANT : BINDING_VARIABLE,
+                                     current_depth(resolver), 0);
+            if (index != NO_BINDING) {
+                statement->data.var_decl.slot = resolver->bindings[index].slot;
+            }
+            break;
+        }
+
+        case NODE_IF:
+            resolve_expression(resolver, statement->data.if_stmt.condition);
+            resolve_scope(resolver, &statement->data.if_stmt.then_branch);
+            resolve_scope(resolver, &statement->data.if_stmt.else_branch);
+            break;
+
+        case NODE_WHILE:
+            resolve_expression(resolver, statement->data.while_stmt.condition);
+            resolve_scope(resolver, &statement->data.while_stmt.body);
+            break;
+
+        case NODE_RETURN:
+            resolve_expression(resolver, statement->data.return_stmt.value);
+            break;
+
+        case NODE_BLOCK:
+            resolve_scope(resolver, &statement->data.block.statements);
+            break;
+
+        case NODE_FUNCTION_DEF:
+            /* codegen only emits top-level functions */
+            report(resolver, statement, "Function '%s' must be defined at the top level",
+                   atom_name(statement->data.function_def.name));
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* A function body gets a frame of its own; main's locals are out of sight meanwhile */
+static void resolve_function(Resolver *resolver, ASTNode *function) {
+    uint32_t frame = resolver->frame;
+    uint32_t next_slot = resolver->next_slot;
+    uint32_t frame_slots = resolver->frame_slots;
+    resolver->frame = resolver->next_frame++;
+    resolver->next_slot = 0;
+    resolver->frame_slots = 0;
+
+    if (open_scope(resolver, 1)) {
+        const AtomList *parameters = &function->data.function_def.parameters;
+        for (uint32_t i = 0; i < parameters->count; i++) {
+            declare(resolver, function, parameters->items[i], BINDING_VARIABLE, 1, 0);
+        }
+        resolve_list(resolver, &function->data.function_def.body);
+        close_scope(resolver);
+    }
+    function->data.function_def.locals = resolver->frame_slots;
+
+    resolver->frame = frame;
+    resolver->next_slot = next_slot;
+    resolver->frame_slots = frame_slots;
+}
+
+/* A resolver with the builtins declared and main's scope open */
+Resolver *resolver_create(LineIndex *lines) {
+    Resolver *resolver = calloc(1, sizeof(Resolver));
+    if (!resolver) {
+        return NULL;
+    }
+    resolver->lines = lines;
+    resolver->frame = MAIN_FRAME;
+    resolver->next_frame = MAIN_FRAME + 1;
+    resolver->declaring = ATOM_NONE;
+    if (!open_scope(resolver, 0) ||
+        declare(resolver, NULL, ATOM_PRINT, BINDING_BUILTIN, 0, 1) != 0 ||
+        !open_scope(resolver, 1)) {
+        resolver_destroy(resolver);
+        return NULL;
+    }
+    return resolver;
+}
+
+void resolver_destroy(Resolver *resolver) {
+    if (resolver) {
+        free(resolver->bindings);
+        free(resolver->innermost);
+        free(resolver->scopes);
+        free(resolver->items);
+        free(resolver);
+    }
+}
+
+/*
+ * Make top-level functions visible to every statement, before any of
+ * them is resolved. The definitions need only their names and
+ * parameters (a declaration pre-scan will do).
+ */
+bool resolver_declare_functions(Resolver *resolver, ASTNode **functions, size_t count) {
+    size_t errors = resolver->errors;
+    for (size_t i = 0; i < count && !resolver->failed; i++) {
+        resolver->statement = functions[i];
+        declare(resolver, functions[i], functions[i]->data.function_def.name, BINDING_FUNCTION, 0,
+                functions[i]->data.function_def.parameters.count);
+    }
+    return !resolver->failed && resolver->errors == errors;
+}
+
+/* Resolve one top-level statement; false if it had errors */
+bool resolver_resolve_statement(Resolver *resolver, ASTNode *statement) {
+    size_t errors = resolver->errors;
+    resolver->statement = statement;
+    if (statement->type == NODE_FUNCTION_DEF) {
+        resolve_function(resolver, statement);
+    } else {
+        resolve_statement(resolver, statement);
+    }
+    return !resolver->failed && resolver->errors == errors;
+}
+
+bool resolve_program(ASTNode *program, LineIndex *lines) {
+    if (!program || program->type != NODE_PROGRAM) {
+        return false;
+    }
+    Resolver *resolver = resolver_create(lines);
+    if (!resolver) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return false;
+    }
+
+    NodeList *statements = &program->data.program.statements;
+    bool ok = true;
+    for (size_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_FUNCTION_DEF) {
+            ok = resolver_declare_functions(resolver, &statements->items[i], 1) && ok;
+        }
+    }
+    for (size_t i = 0; i < statements->count && !resolver->failed; i++) {
+        ok = resolver_resolve_statement(resolver, statements->items[i]) && ok;
+    }
+    program->data.program.locals = resolver->frame_slots;
+
+    ok = ok && !resolver->failed;
+    resolver_destroy(resolver);
+    return ok;
+}
@@ -0,0 +1,41 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include "ast.h"
+#include "line_index.h"
+
+/*
+ * Name resolution. Every identifier is bound to the declaration it
+ * refers to and annotated with that declaration's scope depth and slot
+ * (see ASTNode.data.identifier); each function, and main, gets the
+ * number of frame slots it needs. Scopes follow the C that codegen
+ * emits:
+ *
+ *   depth 0   builtins (print is slot 0), then the top-level functions
+ *             in order; visible everywhere, before or after definition
+ *   depth 1   a function's parameters and body, or main's statements
+ *   depth 2+  the branches of if, while bodies and blocks
+ *
+ * A name is visible from the end of its declaration to the end of its
+ * scope and hides the same name further out. Slots of a scope that has
+ * closed are reused by the next one, so a frame is as large as its
+ * deepest nesting needs, not its declaration count.
+ *
+ * Errors are printed to stderr with their line: undefined names, a name
+ * declared twice in one scope, a name read in its own initializer,
+ * assignment to a constant or a function, a function used as a value or
+ * called with the wrong number of arguments, and calls of anything but
+ * a named function. Resolution goes on past an error, so all of them are
+ * reported; names in error stay at SCOPE_UNRESOLVED.
+ *
+ * `lines` maps offsets to lines for the messages and may be NULL.
+ */
+typedef struct Resolver Resolver;
+
+Resolver *resolver_create(LineIndex *lines);
+void resolver_destroy(Resolver *resolver);
+bool resolver_declare_functions(Resolver *resolver, ASTNode **functions, size_t count);
+bool resolver_resolve_statement(Resolver *resolver, ASTNode *statement);
+bool resolve_program(ASTNode *program, LineIndex *lines);
+
+#endif
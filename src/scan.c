@@ -0,0 +1,406 @@
+#include "scan.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_VECTOR 1
+#define SCAN_WIDTH 32
+typedef __m256i vec_t;
+#define vec_load(p) _mm256_loadu_si256((const __m256i *)(const void *)(p))
+#define vec_set1(c) _mm256_set1_epi8((char)(c))
+#define vec_eq(a, b) _mm256_cmpeq_epi8((a), (b))
+#define vec_gt(a, b) _mm256_cmpgt_epi8((a), (b))
+#define vec_or(a, b) _mm256_or_si256((a), (b))
+#define vec_and(a, b) _mm256_and_si256((a), (b))
+#define vec_mask(v) ((unsigned)_mm256_movemask_epi8(v))
+#define VEC_FULL_MASK 0xFFFFFFFFu
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_VECTOR 1
+#define SCAN_WIDTH 16
+typedef __m128i vec_t;
+#define vec_load(p) _mm_loadu_si128((const __m128i *)(const void *)(p))
+#define vec_set1(c) _mm_set1_epi8((char)(c))
+#define vec_eq(a, b) _mm_cmpeq_epi8((a), (b))
+#define vec_gt(a, b) _mm_cmpgt_epi8((a), (b))
+#define vec_or(a, b) _mm_or_si128((a), (b))
+#define vec_and(a, b) _mm_and_si128((a), (b))
+#define vec_mask(v) ((unsigned)_mm_movemask_epi8(v))
+#define VEC_FULL_MASK 0xFFFFu
+#endif
+
+#ifdef SCAN_VECTOR
+/* Number of set bits */
+static unsigned popcount(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcount(mask);
+#else
+    unsigned count = 0;
+    for (; mask; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+/* Index of the lowest set bit; mask must be non-zero */
+static unsigned lowest_bit(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned index = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+/* Byte lanes in the inclusive range [lo, hi]; only valid for ASCII bounds */
+static vec_t vec_in_range(vec_t v, char lo, char hi) {
+    return vec_and(vec_gt(v, vec_set1(lo - 1)), vec_gt(vec_set1(hi + 1), v));
+}
+
+static vec_t vec_space(vec_t v) {
+    return vec_or(vec_or(vec_eq(v, vec_set1(' ')), vec_eq(v, vec_set1('\t'))),
+                  vec_or(vec_eq(v, vec_set1('\r')), vec_eq(v, vec_set1('\n'))));
+}
+
+static vec_t vec_ident(vec_t v) {
+    vec_t lower = vec_or(v, vec_set1(0x20));
+    return vec_or(vec_or(vec_in_range(lower, 'a', 'z'), vec_in_range(v, '0', '9')),
+                  vec_eq(v, vec_set1('_')));
+}
+#endif
+
+/*
+ * Most runs in real sources (a single space, short names) end within a few
+ * bytes, so every kernel checks a short scalar prefix before paying for
+ * vector loads and mask extraction.
+ */
+#define SCAN_SCALAR_PREFIX 8
+
+static size_t prefix_end(size_t pos, size_t length) {
+    return pos + SCAN_SCALAR_PREFIX < length ? pos + SCAN_SCALAR_PREFIX : length;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+size_t scan_space(const char *s, size_t pos, size_t length) {
+    for (size_t end = prefix_end(pos, length); pos < end; pos++) {
+        if (!is_space(s[pos])) {
+            return pos;
+        }
+    }
+#ifdef SCAN_VECTOR
+    while (pos + SCAN_WIDTH <= length) {
+        unsigned stop = ~vec_mask(vec_space(vec_load(s + pos))) & VEC_FULL_MASK;
+        if (stop) {
+            return pos + lowest_bit(stop);
+        }
+        pos += SCAN_WIDTH;
+    }
+#endif
+    while (pos < length && is_space(s[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+size_t scan_newline(const char *s, size_t pos, size_t length) {
+    for (size_t end = prefix_end(pos, length); pos < end; pos++) {
+        if (s[pos] == '\n') {
+            return pos;
+        }
+    }
+#ifdef SCAN_VECTOR
+    vec_t newline = vec_set1('\n');
+    while (pos + SCAN_WIDTH <= length) {
+        unsigned found = vec_mask(vec_eq(vec_load(s + pos), newline));
+        if (found) {
+            return pos + lowest_bit(found);
+        }
+        pos += SCAN_WIDTH;
+    }
+#endif
+    while (pos < length && s[pos] != '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+size_t scan_ident(const char *s, size_t pos, size_t length) {
+    for (size_t end = prefix_end(pos, length); pos < end; pos++) {
+        if (!is_ident(s[pos])) {
+            return pos;
+        }
+    }
+#ifdef SCAN_VECTOR
+    while (pos + SCAN_WIDTH <= length) {
+        unsigned stop = ~vec_mask(vec_ident(vec_load(s + pos))) & VEC_FULL_MASK;
+        if (stop) {
+            return pos + lowest_bit(stop);
+        }
+        pos += SCAN_WIDTH;
+    }
+#endif
+    while (pos < length && is_ident(s[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+size_t scan_digits(const char *s, size_t pos, size_t length) {
+    for (size_t end = prefix_end(pos, length); pos < end; pos++) {
+        if (s[pos] < '0' || s[pos] > '9') {
+            return pos;
+        }
+    }
+#ifdef SCAN_VECTOR
+    while (pos + SCAN_WIDTH <= length) {
+        unsigned stop = ~vec_mask(vec_in_range(vec_load(s + pos), '0', '9')) & VEC_FULL_MASK;
+        if (stop) {
+            return pos + lowest_bit(stop);
+        }
+        pos += SCAN_WIDTH;
+    }
+#endif
+    while (pos < length && s[pos] >= '0' && s[pos] <= '9') {
+        pos++;
+    }
+    return pos;
+}
+
+size_t scan_string(const char *s, size_t pos, size_t length) {
+    for (size_t end = prefix_end(pos, length); pos < end; pos++) {
+        if (s[pos] == '"' || s[pos] == '\0') {
+            return pos;
+        }
+    }
+#ifdef SCAN_VECTOR
+    vec_t quote = vec_set1('"');
+    vec_t nul = vec_set1('\0');
+    while (pos + SCAN_WIDTH <= length) {
+        vec_t v = vec_load(s + pos);
+        unsigned found = vec_mask(vec_or(vec_eq(v, quote), vec_eq(v, nul)));
+        if (found) {
+            return pos + lowest_bit(found);
+        }
+        pos += SCAN_WIDTH;
+    }
+#endif
+    while (pos < length && s[pos] != '"' && s[pos] != '\0') {
+        pos++;
+    }
+    return pos;
+}
+
+size_t scan_count_newlines(const char *s, size_t pos, size_t length) {
+    size_t count = 0;
+#ifdef SCAN_VECTOR
+    vec_t newline = vec_set1('\n');
+    while (pos + SCAN_WIDTH <= length) {
+        count += popcount(vec_mask(vec_eq(vec_load(s + pos), newline)));
+        pos += SCAN_WIDTH;
+    }
+#endif
+    for (; pos < length; pos++) {
+        count += s[pos] == '\n';
+    }
+    return count;
+}
+
+/*
+ * Length of the well-formed UTF-8 sequence at s[pos], or 0 if it is
+ * malformed, overlong, a surrogate, above U+10FFFF or cut off by length.
+ */
+static size_t utf8_sequence(const char *s, size_t pos, size_t length) {
+    const unsigned char *p = (const unsigned char *)s + pos;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xBF;
+    size_t n;
+    if (p[0] < 0x80) {
+        return 1;
+    } else if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+        n = 2;
+    } else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+        n = 3;
+        lo = p[0] == 0xE0 ? 0xA0 : 0x80;
+        hi = p[0] == 0xED ? 0x9F : 0xBF;
+    } else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+        n = 4;
+        lo = p[0] == 0xF0 ? 0x90 : 0x80;
+        hi = p[0] == 0xF4 ? 0x8F : 0xBF;
+    } else {
+        return 0;
+    }
+    if (length - pos < n || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+#if defined(__AVX2__)
+/*
+ * Block check after Keiser and Lemire, "Validating UTF-8 in less than one
+ * instruction per byte": every byte is classified together with the byte
+ * before it through three 16-entry nibble tables, and the AND of the three
+ * lookups is non-zero exactly for an invalid pair. Bytes that must be the
+ * second or third continuation of a 3- or 4-byte lead are checked against
+ * the leads two and three bytes back.
+ */
+#define UTF8_TOO_SHORT 0x01
+#define UTF8_TOO_LONG 0x02
+#define UTF8_OVERLONG_3 0x04
+#define UTF8_TOO_LARGE 0x08
+#define UTF8_SURROGATE 0x10
+#define UTF8_OVERLONG_2 0x20
+#define UTF8_TOO_LARGE_1000 0x40
+#define UTF8_OVERLONG_4 0x40
+#define UTF8_TWO_CONTS 0x80
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    _mm256_setr_epi8((char)(a), (char)(b), (char)(c), (char)(d), (char)(e), (char)(f), (char)(g), (char)(h), \
+                     (char)(i), (char)(j), (char)(k), (char)(l), (char)(m), (char)(n), (char)(o), (char)(p), \
+                     (char)(a), (char)(b), (char)(c), (char)(d), (char)(e), (char)(f), (char)(g), (char)(h), \
+                     (char)(i), (char)(j), (char)(k), (char)(l), (char)(m), (char)(n), (char)(o), (char)(p))
+
+/* The input shifted right by n bytes, with the end of the previous block shifted in */
+#define UTF8_PREV(input, prev, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (n))
+
+static __m256i utf8_block_errors(__m256i input, __m256i prev) {
+    const __m256i byte_1_high_table = UTF8_TABLE(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m256i byte_1_low_table = UTF8_TABLE(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte_2_high_table = UTF8_TABLE(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i prev1 = UTF8_PREV(input, prev, 1);
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    /* Only 111_____ two back and 1111____ three back leave a non-zero (at most 32) */
+    __m256i third = _mm256_subs_epu8(UTF8_PREV(input, prev, 2), _mm256_set1_epi8((char)(0xE0 - 1)));
+    __m256i fourth = _mm256_subs_epu8(UTF8_PREV(input, prev, 3), _mm256_set1_epi8((char)(0xF0 - 1)));
+    __m256i must23 = _mm256_cmpgt_epi8(_mm256_or_si256(third, fourth), _mm256_setzero_si256());
+    return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), special);
+}
+
+/* Non-zero if the block ends inside a multi-byte sequence */
+static __m256i utf8_block_incomplete(__m256i input) {
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm256_subs_epu8(input, max);
+}
+#endif
+
+size_t scan_utf8(const char *s, size_t pos, size_t length) {
+#if defined(__AVX2__)
+    size_t start = pos;
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    while (pos + SCAN_WIDTH <= length) {
+        __m256i input = vec_load(s + pos);
+        __m256i error;
+        if (vec_mask(input) == 0) {
+            /* ASCII block: only a sequence left open by the last block can be wrong */
+            error = incomplete;
+            incomplete = _mm256_setzero_si256();
+        } else {
+            error = utf8_block_errors(input, prev);
+            incomplete = utf8_block_incomplete(input);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+        prev = input;
+        pos += SCAN_WIDTH;
+    }
+
+    /* Finish sequence by sequence, from the start of a sequence the last block left open */
+    for (size_t back = 1; back <= 3 && pos - start >= back; back++) {
+        unsigned char c = (unsigned char)s[pos - back];
+        if (c >= 0xC0) {
+            pos -= back;
+            break;
+        }
+        if (c < 0x80) {
+            break;
+        }
+    }
+#elif defined(SCAN_VECTOR)
+    /* Without byte shuffles only the ASCII blocks are skipped in bulk */
+    while (pos + SCAN_WIDTH <= length) {
+        if (vec_mask(vec_load(s + pos)) == 0) {
+            pos += SCAN_WIDTH;
+            continue;
+        }
+        for (size_t end = pos + SCAN_WIDTH; pos < end;) {
+            size_t n = utf8_sequence(s, pos, length);
+            if (n == 0) {
+                return pos;
+            }
+            pos += n;
+        }
+    }
+#endif
+    while (pos < length) {
+        if ((unsigned char)s[pos] < 0x80) {
+            pos++;
+            continue;
+        }
+        size_t n = utf8_sequence(s, pos, length);
+        if (n == 0) {
+            return pos;
+        }
+        pos += n;
+    }
+    return pos;
+}
@@ -0,0 +1,41 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Byte-run scanning kernels used by the lexer.
+ *
+ * Each function starts at `pos` and returns the index of the first byte
+ * in [pos, length) that ends the run, or `length` if the run reaches the
+ * end of the buffer. Kernels never read at or past `length`.
+ *
+ * AVX2 (32 bytes) or SSE2 (16 bytes) versions are selected at compile
+ * time from the target flags; other targets use the scalar fallback.
+ */
+
+/* Skip whitespace: ' ', '\t', '\r' and '\n'. */
+size_t scan_space(const char *s, size_t pos, size_t length);
+
+/* Find the next '\n'. */
+size_t scan_newline(const char *s, size_t pos, size_t length);
+
+/* Skip identifier characters: [A-Za-z0-9_]. */
+size_t scan_ident(const char *s, size_t pos, size_t length);
+
+/* Skip decimal digits: [0-9]. */
+size_t scan_digits(const char *s, size_t pos, size_t length);
+
+/* Find the end of a string literal body: the next '"' or NUL. */
+size_t scan_string(const char *s, size_t pos, size_t length);
+
+/* Count the '\n' bytes in [pos, length); unlike the others, returns a count. */
+size_t scan_count_newlines(const char *s, size_t pos, size_t length);
+
+/*
+ * Skip well-formed UTF-8: returns the start of the first sequence that is
+ * invalid or cut off by length. pos must be at the start of a sequence.
+ */
+size_t scan_utf8(const char *s, size_t pos, size_t length);
+
+#endif
@@ -0,0 +1,1397 @@
+#include "types.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resolve.h"
+
+#define NO_FUNCTION UINT32_MAX
+#define NO_INSTANCE UINT32_MAX
+#define NO_SIGNATURE UINT32_MAX
+#define NO_DECLARATION UINT32_MAX
+
+/*
+ * Argument type lists a function is typed for separately before the
+ * calls with other lists share one generic instance
+ */
+#define MAX_SPECIALIZATIONS 8
+
+/* A variable, parameter or function result, and the first two types that clashed in it */
+typedef struct {
+    ValueType type;
+    ValueType clash[2];
+    uint32_t read;              /* walk that last read the type */
+} Declaration;
+
+/* A top-level function, or main (the last entry, which has no node), and its instances */
+typedef struct {
+    ASTNode *node;
+    Atom name;
+    uint32_t first_instance;    /* chained through Instance.next in order of creation */
+    uint32_t last_instance;
+    uint32_t specializations;
+    uint32_t generic;           /* instance for calls past the limit, or NO_INSTANCE */
+    uint32_t reachable;         /* instances the program can call */
+} Function;
+
+/*
+ * A function typed for one list of argument types, its signature. Its
+ * parameters are a run of the typer's declarations; its locals are listed
+ * in the order a walk meets their declarations, which is the same on
+ * every walk. The callers are every instance that has called
+ * this one on any walk; the callees are what the latest walk called,
+ * which is final once the types have settled.
+ */
+typedef struct {
+    uint32_t function;
+    uint32_t next;
+    uint32_t signature;         /* first argument type in the typer's signatures, or NO_SIGNATURE if generic */
+    ASTNode *node;              /* the definition, or a copy of it for a clone */
+    Atom name;                  /* what calls of this instance are renamed to */
+    uint32_t result;            /* declaration of what it returns */
+    uint32_t first_parameter;
+    uint32_t *locals;           /* declarations, made on the first walk */
+    uint32_t local_count;
+    uint32_t local_capacity;
+    uint32_t next_local;        /* of the walk in progress */
+    uint32_t *callers;
+    uint32_t caller_count;
+    uint32_t caller_capacity;
+    uint32_t last_walk;         /* latest walk that recorded a caller */
+    uint32_t *callees;
+    uint32_t callee_count;
+    uint32_t callee_capacity;
+    bool walked;
+    bool queued;
+    bool root;                  /* emitted whether called or not */
+    bool reachable;
+} Instance;
+
+/* An expression node, before or after its operands have been evaluated */
+typedef struct {
+    ASTNode *node;
+    bool operands_done;
+} EvaluationItem;
+
+struct Typer {
+    LineIndex *lines;
+    Function *functions;
+    uint32_t function_count;    /* main included */
+    Instance *instances;
+    uint32_t instance_count;
+    size_t instance_capacity;
+    ValueType *signatures;
+    size_t signature_count;
+    size_t signature_capacity;
+    Declaration *declarations;
+    uint32_t declaration_count;
+    size_t declaration_capacity;
+    /* The declaration in each frame slot, for main and for the function being walked */
+    uint32_t *main_slots;
+    uint32_t *function_slots;
+    uint32_t *slots;
+    uint32_t current;           /* instance being walked */
+    uint32_t walk;              /* number of the walk in progress */
+    bool changed;               /* something the current walk read has widened since */
+    /* Instances waiting to be walked again, first in first out */
+    uint32_t *queue;
+    size_t queue_head;
+    size_t queue_count;
+    size_t queue_capacity;
+    EvaluationItem *items;
+    size_t item_count;
+    size_t item_capacity;
+    ValueType *values;
+    size_t value_count;
+    size_t value_capacity;
+    Atom first_new_atom;        /* names of clones must not be in use */
+    bool adopted;               /* the program's statements hold the copies */
+    const ASTNode *statement;   /* top-level statement being walked, for offsets */
+    bool reporting;             /* the last walk, once the types have settled */
+    /* Streaming: statements typed as they come, each slot keeping the declaration it was first given */
+    bool streaming;
+    size_t main_slot_capacity;
+    size_t function_slot_capacity;
+    uint32_t result;            /* declaration of what the function being walked returns */
+    ProgramTypes streamed;      /* signatures of the functions typed so far, in order */
+    size_t streamed_capacity;
+    bool *called_early;         /* by function: called before its definition, and taken for a long */
+    size_t called_early_capacity;
+    size_t errors;
+    bool failed;
+};
+
+const char *type_name(ValueType type) {
+    switch (type) {
+        case TYPE_BOOL:
+            return "bool";
+        case TYPE_INT:
+            return "long";
+        case TYPE_FLOAT:
+            return "double";
+        case TYPE_STRING:
+            return "string";
+        case TYPE_VOID:
+            return "no";
+        case TYPE_ERROR:
+            return "conflicting";
+        default:
+            return "unknown";
+    }
+}
+
+/* The C type a value of `type` is declared with, ready for the name to follow */
+const char *type_declarator(ValueType type) {
+    switch (type) {
+        case TYPE_BOOL:
+            return "bool ";
+        case TYPE_FLOAT:
+            return "double ";
+        case TYPE_STRING:
+            return "const char *";
+        default:
+            return "long ";
+    }
+}
+
+/* The type of an expression of a tree types_infer has annotated */
+ValueType types_of(const ASTNode *expression) {
+    if (!expression) {
+        return TYPE_UNKNOWN;
+    }
+    switch (expression->type) {
+        case NODE_INT_LITERAL:
+            return TYPE_INT;
+        case NODE_FLOAT_LITERAL:
+            return TYPE_FLOAT;
+        case NODE_STRING_LITERAL:
+            return TYPE_STRING;
+        case NODE_BOOL_LITERAL:
+            return TYPE_BOOL;
+        case NODE_IDENTIFIER:
+            return expression->data.identifier.type;
+        case NODE_BINARY_OP:
+            return expression->data.binary_op.type;
+        case NODE_UNARY_OP:
+            return expression->data.unary_op.type;
+        case NODE_CALL:
+            return expression->data.call.function->type == NODE_IDENTIFIER
+                       ? expression->data.call.function->data.identifier.type
+                       : TYPE_UNKNOWN;
+        default:
+            return TYPE_UNKNOWN;
+    }
+}
+
+static void report(Typer *typer, const ASTNode *node, const char *format, ...) {
+    size_t offset = node == typer->statement ? node->offset : typer->statement->offset + node->offset;
+    int line = typer->lines ? line_index_lookup(typer->lines, offset).line : 0;
+    va_list args;
+    va_start(args, format);
+    if (line > 0) {
+        fprintf(stderr, "Error at line %d: ", line);
+    } else {
+        fprintf(stderr, "Error: ");
+    }
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    typer->errors++;
+}
+
+static void out_of_memory(Typer *typer) {
+    if (!typer->failed) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+    }
+    typer->failed = true;
+}
+
+static bool grow(void **array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 16;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+/* Least type holding values of both types; unknown holds nothing yet */
+static ValueType join(ValueType a, ValueType b) {
+    if (a == TYPE_UNKNOWN || a == b) {
+        return b;
+    }
+    if (b == TYPE_UNKNOWN) {
+        return a;
+    }
+    if (a <= TYPE_FLOAT && b <= TYPE_FLOAT) {
+        return a > b ? a : b;
+    }
+    return TYPE_ERROR;
+}
+
+/* Arithmetic on bools is done in longs, as in C */
+static ValueType promote(ValueType type) {
+    return type == TYPE_BOOL ? TYPE_INT : type;
+}
+
+static bool is_number(ValueType type) {
+    return type <= TYPE_FLOAT;
+}
+
+/*
+ * Let a declaration hold values of `type` too; true if it widened. The
+ * walk has to go again only if it read the narrower type already. A
+ * clash of two real types is kept for the report; one with an erroneous
+ * value has been reported where that value came from.
+ */
+static bool widen(Typer *typer, uint32_t declaration, ValueType type) {
+    Declaration *target = &typer->declarations[declaration];
+    ValueType joined = join(target->type, type);
+    if (joined == target->type) {
+        return false;
+    }
+    if (joined == TYPE_ERROR && type != TYPE_ERROR) {
+        target->clash[0] = target->type;
+        target->clash[1] = type;
+    }
+    target->type = joined;
+    if (target->read == typer->walk) {
+        typer->changed = true;
+    }
+    return true;
+}
+
+static void enqueue(Typer *typer, uint32_t instance) {
+    if (typer->instances[instance].queued) {
+        return;
+    }
+    if (typer->queue_count == typer->queue_capacity &&
+        !grow((void **)&typer->queue, &typer->queue_capacity, sizeof(uint32_t))) {
+        out_of_memory(typer);
+        return;
+    }
+    typer->instances[instance].queued = true;
+    typer->queue[typer->queue_count++] = instance;
+}
+
+static uint32_t dequeue(Typer *typer) {
+    uint32_t instance = typer->queue[typer->queue_head++];
+    if (typer->queue_head == typer->queue_count) {
+        typer->queue_head = typer->queue_count = 0;
+    }
+    typer->instances[instance].queued = false;
+    return instance;
+}
+
+/* Something another instance reads has widened: walk it again (widen looks after the current one) */
+static void touch(Typer *typer, uint32_t instance) {
+    if (instance != typer->current) {
+        enqueue(typer, instance);
+    }
+}
+
+/* The function a callee names, or NO_FUNCTION for print */
+static uint32_t callee_function(const Typer *typer, const ASTNode *callee) {
+    if (callee->type != NODE_IDENTIFIER || callee->data.identifier.depth != 0 ||
+        callee->data.identifier.slot == 0 || callee->data.identifier.slot >= typer->function_count) {
+        return NO_FUNCTION;
+    }
+    return callee->data.identifier.slot - 1;
+}
+
+static bool push_index(Typer *typer, uint32_t **array, uint32_t *count, uint32_t *capacity, uint32_t index) {
+    if (*count == *capacity) {
+        size_t grown = *capacity;
+        if (!grow((void **)array, &grown, sizeof(uint32_t))) {
+            out_of_memory(typer);
+            return false;
+        }
+        *capacity = (uint32_t)grown;
+    }
+    (*array)[(*count)++] = index;
+    return true;
+}
+
+static uint32_t new_declarations(Typer *typer, uint32_t count) {
+    while (typer->declaration_count + (size_t)count > typer->declaration_capacity) {
+        if (!grow((void **)&typer->declarations, &typer->declaration_capacity, sizeof(Declaration))) {
+            out_of_memory(typer);
+            return 0;
+        }
+    }
+    uint32_t first = typer->declaration_count;
+    for (uint32_t i = 0; i < count; i++) {
+        Declaration *declaration = &typer->declarations[first + i];
+        declaration->type = TYPE_UNKNOWN;
+        declaration->clash[0] = declaration->clash[1] = TYPE_UNKNOWN;
+        declaration->read = 0;
+    }
+    typer->declaration_count += count;
+    return first;
+}
+
+/*
+ * A new instance of a function, queued for its first walk: for the
+ * argument types `signature`, which its parameters start from, or
+ * generic when that is NULL.
+ */
+static uint32_t new_instance(Typer *typer, uint32_t function, const ValueType *signature) {
+    ASTNode *node = typer->functions[function].node;
+    uint32_t parameters = node ? node->data.function_def.parameters.count : 0;
+    if ((typer->instance_count == typer->instance_capacity &&
+         !grow((void **)&typer->instances, &typer->instance_capacity, sizeof(Instance))) ||
+        (signature && typer->signature_count + parameters > typer->signature_capacity &&
+         !grow((void **)&typer->signatures, &typer->signature_capacity, sizeof(ValueType)))) {
+        out_of_memory(typer);
+        return NO_INSTANCE;
+    }
+    uint32_t index = typer->instance_count++;
+    Instance *instance = &typer->instances[index];
+    memset(instance, 0, sizeof(Instance));
+    instance->function = function;
+    instance->next = NO_INSTANCE;
+    instance->node = node;
+    instance->name = node ? node->data.function_def.name : ATOM_NONE;
+    instance->signature = NO_SIGNATURE;
+    instance->result = new_declarations(typer, 1);
+    instance->first_parameter = new_declarations(typer, parameters);
+    if (signature) {
+        instance->signature = (uint32_t)typer->signature_count;
+        for (uint32_t i = 0; i < parameters; i++) {
+            typer->signatures[typer->signature_count++] = signature[i];
+            typer->declarations[instance->first_parameter + i].type = signature[i];
+        }
+    }
+
+    Function *owner = &typer->functions[function];
+    if (owner->first_instance == NO_INSTANCE) {
+        owner->first_instance = index;
+    } else {
+        typer->instances[owner->last_instance].next = index;
+    }
+    owner->last_instance = index;
+    enqueue(typer, index);
+    return index;
+}
+
+/*
+ * The instance of a function that a call with these argument types
+ * runs: the one for exactly these types, made if there is room for one
+ * more, or else the generic instance, widened to take them.
+ */
+static uint32_t instance_for(Typer *typer, uint32_t function, const ValueType *arguments, uint32_t count) {
+    Function *owner = &typer->functions[function];
+    /* A call that knows no more than the generic instance shares it */
+    bool unknown = owner->generic != NO_INSTANCE;
+    for (uint32_t i = 0; unknown && i < count; i++) {
+        unknown = arguments[i] == TYPE_UNKNOWN;
+    }
+    if (unknown) {
+        return owner->generic;
+    }
+    for (uint32_t i = owner->first_instance; i != NO_INSTANCE; i = typer->instances[i].next) {
+        uint32_t signature = typer->instances[i].signature;
+        if (signature != NO_SIGNATURE &&
+            (count == 0 || memcmp(&typer->signatures[signature], arguments, count * sizeof(ValueType)) == 0)) {
+            return i;
+        }
+    }
+    /* Types not yet known are on their way to others, so they do not count against the limit */
+    bool known = true;
+    for (uint32_t i = 0; i < count; i++) {
+        known &= arguments[i] != TYPE_UNKNOWN;
+    }
+    if (!known || owner->specializations < MAX_SPECIALIZATIONS) {
+        owner->specializations += known;
+        return new_instance(typer, function, arguments);
+    }
+    if (owner->generic == NO_INSTANCE) {
+        uint32_t generic = new_instance(typer, function, NULL);
+        typer->functions[function].generic = generic;
+        if (generic == NO_INSTANCE) {
+            return NO_INSTANCE;
+        }
+    }
+    uint32_t generic = typer->functions[function].generic;
+    for (uint32_t i = 0; i < count; i++) {
+        if (widen(typer, typer->instances[generic].first_parameter + i, arguments[i])) {
+            touch(typer, generic);
+        }
+    }
+    return generic;
+}
+
+/* What print returns cannot be used */
+static ValueType use(Typer *typer, const ASTNode *node, ValueType type) {
+    if (type != TYPE_VOID) {
+        return type;
+    }
+    if (typer->reporting) {
+        report(typer, node, "print does not return a value");
+    }
+    return TYPE_ERROR;
+}
+
+static ValueType binary_type(Typer *typer, ASTNode *node, ValueType left, ValueType right) {
+    OperatorType op = node->data.binary_op.op;
+    if (left == TYPE_ERROR || right == TYPE_ERROR) {
+        return TYPE_ERROR;
+    }
+    if (left == TYPE_STRING && right == TYPE_STRING && (op == OP_EQ || op == OP_NE)) {
+        return TYPE_BOOL;
+    }
+    if (!is_number(left) || !is_number(right) || (op == OP_MOD && (left == TYPE_FLOAT || right == TYPE_FLOAT))) {
+        if (typer->reporting) {
+            report(typer, node, "Operator '%s' cannot be applied to %s and %s", ast_operator_text(op),
+                   type_name(left), type_name(right));
+        }
+        return TYPE_ERROR;
+    }
+    switch (op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            return promote(left > right ? left : right);
+        case OP_MOD:
+            return TYPE_INT;
+        default:
+            return TYPE_BOOL;
+    }
+}
+
+static ValueType unary_type(Typer *typer, ASTNode *node, ValueType operand) {
+    OperatorType op = node->data.unary_op.op;
+    if (operand == TYPE_ERROR) {
+        return TYPE_ERROR;
+    }
+    if (!is_number(operand)) {
+        if (typer->reporting) {
+            report(typer, node, "Operator '%s' cannot be applied to %s", ast_operator_text(op), type_name(operand));
+        }
+        return TYPE_ERROR;
+    }
+    return op == OP_NOT ? TYPE_BOOL : promote(operand);
+}
+
+/* The declaration a resolved variable refers to */
+static uint32_t variable(const Typer *typer, const ASTNode *identifier) {
+    return typer->slots[identifier->data.identifier.slot];
+}
+
+static ValueType read_type(Typer *typer, uint32_t declaration) {
+    typer->declarations[declaration].read = typer->walk;
+    return typer->declarations[declaration].type;
+}
+
+static ValueType assign(Typer *typer, ASTNode *node, ValueType value) {
+    ASTNode *target = node->data.binary_op.left;
+    value = use(typer, node->data.binary_op.right, value);
+    if (target->type != NODE_IDENTIFIER || target->data.identifier.depth == SCOPE_UNRESOLVED) {
+        return TYPE_ERROR;
+    }
+    uint32_t declaration = variable(typer, target);
+    /* A streamed variable keeps its initializer's type, which unknown declares as a long */
+    ValueType declared = typer->declarations[declaration].type;
+    declared = declared == TYPE_UNKNOWN ? TYPE_INT : declared;
+    if (!typer->streaming) {
+        widen(typer, declaration, value);
+    } else if (typer->reporting && declared != TYPE_ERROR && value != TYPE_ERROR && join(declared, value) != declared) {
+        report(typer, node, "'%s' is a %s from its initializer and cannot be given %s values when streamed",
+               atom_name(target->data.identifier.name), type_name(declared), type_name(value));
+    }
+    ValueType type = read_type(typer, declaration);
+    if (typer->reporting) {
+        target->data.identifier.type = type;
+    }
+    return type;
+}
+
+/*
+ * Streaming: functions take longs, or bools, which C converts to longs
+ * without loss; an argument of another type is an error, since there are
+ * no call sites to type a parameter by. A call returns what its function
+ * was found to, or, if the function has not been defined yet, a long,
+ * which its definition then has to bear out. print is the builtin in
+ * slot 0.
+ */
+static ValueType streamed_call(Typer *typer, ASTNode *node, const ValueType *arguments) {
+    ASTNode *callee = node->data.call.function;
+    if (callee->type != NODE_IDENTIFIER || callee->data.identifier.depth != 0) {
+        return TYPE_ERROR;
+    }
+    uint32_t slot = callee->data.identifier.slot;
+    size_t typed = typer->streamed.function_count;
+    ValueType result = TYPE_VOID;
+    if (slot > 0 && slot - 1 < typed) {
+        result = typer->streamed.functions[slot - 1].result;
+    } else if (slot > 0 && slot - 1 == typed && typer->statement->type == NODE_FUNCTION_DEF) {
+        result = read_type(typer, typer->result);
+    } else if (slot > 0) {
+        while (slot - 1 >= typer->called_early_capacity) {
+            size_t old = typer->called_early_capacity;
+            if (!grow((void **)&typer->called_early, &typer->called_early_capacity, sizeof(bool))) {
+                out_of_memory(typer);
+                return TYPE_ERROR;
+            }
+            memset(typer->called_early + old, 0, (typer->called_early_capacity - old) * sizeof(bool));
+        }
+        typer->called_early[slot - 1] = true;
+        result = TYPE_INT;
+    }
+    for (uint32_t i = 0; slot > 0 && typer->reporting && i < node->data.call.arguments.count; i++) {
+        ValueType argument = arguments[i];
+        if (argument != TYPE_UNKNOWN && argument != TYPE_BOOL && argument != TYPE_INT && argument != TYPE_ERROR) {
+            report(typer, node->data.call.arguments.items[i],
+                   "Argument %u of '%s' is a %s, but streamed functions take longs", i + 1,
+                   atom_name(callee->data.identifier.name), type_name(argument));
+        }
+    }
+    if (typer->reporting) {
+        callee->data.identifier.type = result;
+    }
+    return result;
+}
+
+/*
+ * A call runs the callee's instance for its argument types, and its
+ * value is what that instance returns. On the last walk the call is
+ * renamed to the instance.
+ */
+static ValueType call(Typer *typer, ASTNode *node, ValueType *arguments) {
+    ASTNode *callee = node->data.call.function;
+    uint32_t function = callee_function(typer, callee);
+    uint32_t count = node->data.call.arguments.count;
+    ValueType result = TYPE_VOID;
+    for (uint32_t i = 0; i < count; i++) {
+        arguments[i] = use(typer, node->data.call.arguments.items[i], arguments[i]);
+    }
+    if (typer->streaming) {
+        return streamed_call(typer, node, arguments);
+    }
+    if (function != NO_FUNCTION) {
+        uint32_t index = instance_for(typer, function, arguments, count);
+        if (index == NO_INSTANCE) {
+            return TYPE_ERROR;
+        }
+        Instance *current = &typer->instances[typer->current];
+        if (!push_index(typer, &current->callees, &current->callee_count, &current->callee_capacity, index)) {
+            return TYPE_ERROR;
+        }
+        Instance *instance = &typer->instances[index];
+        if (instance->last_walk != typer->walk) {
+            instance->last_walk = typer->walk;
+            if (!push_index(typer, &instance->callers, &instance->caller_count, &instance->caller_capacity,
+                            typer->current)) {
+                return TYPE_ERROR;
+            }
+        }
+        result = read_type(typer, instance->result);
+        if (typer->reporting) {
+            callee->data.identifier.name = instance->name;
+        }
+    }
+    if (typer->reporting) {
+        callee->data.identifier.type = result;
+    }
+    return result;
+}
+
+static uint32_t operand_count(const ASTNode *node) {
+    switch (node->type) {
+        case NODE_BINARY_OP:
+            return node->data.binary_op.op == OP_ASSIGN ? 1 : 2;
+        case NODE_UNARY_OP:
+            return 1;
+        case NODE_CALL:
+            return node->data.call.arguments.count;
+        default:
+            return 0;
+    }
+}
+
+/* The type of a node whose operands' types are `operands`, annotating it on the last walk */
+static ValueType node_type(Typer *typer, ASTNode *node, ValueType *operands) {
+    ValueType type = TYPE_UNKNOWN;
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            if (node->data.identifier.depth != SCOPE_UNRESOLVED && node->data.identifier.depth != 0) {
+                type = read_type(typer, variable(typer, node));
+            }
+            if (typer->reporting) {
+                node->data.identifier.type = type;
+            }
+            return type;
+
+        case NODE_BINARY_OP:
+            if (node->data.binary_op.op == OP_ASSIGN) {
+                type = assign(typer, node, operands[0]);
+            } else {
+                type = binary_type(typer, node, use(typer, node->data.binary_op.left, operands[0]),
+                                   use(typer, node->data.binary_op.right, operands[1]));
+            }
+            if (typer->reporting) {
+                node->data.binary_op.type = type;
+            }
+            return type;
+
+        case NODE_UNARY_OP:
+            type = unary_type(typer, node, use(typer, node->data.unary_op.operand, operands[0]));
+            if (typer->reporting) {
+                node->data.unary_op.type = type;
+            }
+            return type;
+
+        case NODE_CALL:
+            return call(typer, node, operands);
+
+        default:
+            return types_of(node);
+    }
+}
+
+static void push_item(Typer *typer, ASTNode *node, bool operands_done) {
+    if (typer->item_count == typer->item_capacity &&
+        !grow((void **)&typer->items, &typer->item_capacity, sizeof(EvaluationItem))) {
+        out_of_memory(typer);
+        return;
+    }
+    typer->items[typer->item_count].node = node;
+    typer->items[typer->item_count].operands_done = operands_done;
+    typer->item_count++;
+}
+
+static void push_value(Typer *typer, ValueType type) {
+    if (typer->value_count == typer->value_capacity &&
+        !grow((void **)&typer->values, &typer->value_capacity, sizeof(ValueType))) {
+        out_of_memory(typer);
+        return;
+    }
+    typer->values[typer->value_count++] = type;
+}
+
+/*
+ * Type an expression of any depth: operands first, left to right so
+ * errors come out in source order, their types on a value stack that
+ * each node then pops.
+ */
+static ValueType evaluate(Typer *typer, ASTNode *expression) {
+    if (!expression) {
+        return TYPE_UNKNOWN;
+    }
+    size_t base = typer->item_count;
+    size_t values = typer->value_count;
+    push_item(typer, expression, false);
+
+    while (typer->item_count > base && !typer->failed) {
+        EvaluationItem item = typer->items[--typer->item_count];
+        ASTNode *node = item.node;
+        uint32_t operands = operand_count(node);
+        if (!item.operands_done && operands > 0) {
+            push_item(typer, node, true);
+            if (node->type == NODE_CALL) {
+                for (uint32_t i = operands; i > 0; i--) {
+                    push_item(typer, node->data.call.arguments.items[i - 1], false);
+                }
+            } else if (node->type == NODE_UNARY_OP) {
+                push_item(typer, node->data.unary_op.operand, false);
+            } else {
+                push_item(typer, node->data.binary_op.right, false);
+                if (operands == 2) {
+                    push_item(typer, node->data.binary_op.left, false);
+                }
+            }
+            continue;
+        }
+        typer->value_count -= operands;
+        push_value(typer, node_type(typer, node, &typer->values[typer->value_count]));
+    }
+
+    ValueType type = typer->failed ? TYPE_ERROR : typer->values[values];
+    typer->item_count = base;
+    typer->value_count = values;
+    return type;
+}
+
+static void condition(Typer *typer, ASTNode *expression) {
+    ValueType type = use(typer, expression, evaluate(typer, expression));
+    if (type == TYPE_STRING && typer->reporting) {
+        report(typer, expression, "A condition cannot be a string");
+    }
+}
+
+/* The two types that clashed in a declaration, if they have not been reported elsewhere */
+static bool clashed(const Declaration *declaration) {
+    return declaration->type == TYPE_ERROR && declaration->clash[1] != TYPE_UNKNOWN;
+}
+
+/* The next local of the instance being walked, made on its first walk */
+static uint32_t next_local(Typer *typer) {
+    Instance *instance = &typer->instances[typer->current];
+    if (!instance->walked) {
+        uint32_t declaration = new_declarations(typer, 1);
+        if (typer->failed ||
+            !push_index(typer, &instance->locals, &instance->local_count, &instance->local_capacity, declaration)) {
+            return 0;
+        }
+    }
+    return instance->locals[instance->next_local++];
+}
+
+/*
+ * Streaming: the declaration of a slot of the frame being walked, made
+ * the first time the slot is used and taken over by each later variable
+ * in it, so there are no more declarations than slots
+ */
+static uint32_t bind(Typer *typer, uint32_t slot) {
+    bool main = typer->statement->type != NODE_FUNCTION_DEF;
+    uint32_t **slots = main ? &typer->main_slots : &typer->function_slots;
+    size_t *capacity = main ? &typer->main_slot_capacity : &typer->function_slot_capacity;
+    while (slot >= *capacity) {
+        size_t old = *capacity;
+        if (!grow((void **)slots, capacity, sizeof(uint32_t))) {
+            out_of_memory(typer);
+            return 0;
+        }
+        for (size_t i = old; i < *capacity; i++) {
+            (*slots)[i] = NO_DECLARATION;
+        }
+    }
+    typer->slots = *slots;
+    if (typer->slots[slot] == NO_DECLARATION) {
+        uint32_t declaration = new_declarations(typer, 1);
+        if (typer->failed) {
+            return 0;
+        }
+        typer->slots[slot] = declaration;
+    }
+    Declaration *declaration = &typer->declarations[typer->slots[slot]];
+    declaration->type = TYPE_UNKNOWN;
+    declaration->clash[0] = declaration->clash[1] = TYPE_UNKNOWN;
+    return typer->slots[slot];
+}
+
+static void walk_statement(Typer *typer, ASTNode *statement);
+
+static void walk_list(Typer *typer, NodeList *statements) {
+    for (size_t i = 0; i < statements->count && !typer->failed; i++) {
+        walk_statement(typer, statements->items[i]);
+    }
+}
+
+static void walk_statement(Typer *typer, ASTNode *statement) {
+    switch (statement->type) {
+        case NODE_EXPRESSION_STMT:
+            evaluate(typer, statement->data.expr_stmt.expression);
+            break;
+
+        case NODE_VAR_DECL: {
+            ASTNode *initializer = statement->data.var_decl.initializer;
+            ValueType value = use(typer, initializer, evaluate(typer, initializer));
+            uint32_t declaration = typer->streaming ? bind(typer, statement->data.var_decl.slot) : next_local(typer);
+            if (typer->failed) {
+                break;
+            }
+            widen(typer, declaration, value);
+            typer->slots[statement->data.var_decl.slot] = declaration;
+            if (typer->reporting) {
+                const Declaration *variable = &typer->declarations[declaration];
+                statement->data.var_decl.type = variable->type;
+                if (clashed(variable)) {
+                    report(typer, statement, "'%s' is given both %s and %s values",
+                           atom_name(statement->data.var_decl.name), type_name(variable->clash[0]),
+                           type_name(variable->clash[1]));
+                }
+            }
+            break;
+        }
+
+        case NODE_IF:
+            condition(typer, statement->data.if_stmt.condition);
+            walk_list(typer, &statement->data.if_stmt.then_branch);
+            walk_list(typer, &statement->data.if_stmt.else_branch);
+            break;
+
+        case NODE_WHILE:
+            condition(typer, statement->data.while_stmt.condition);
+            walk_list(typer, &statement->data.while_stmt.body);
+            break;
+
+        case NODE_RETURN: {
+            ASTNode *value = statement->data.return_stmt.value;
+            ValueType type = use(typer, value, evaluate(typer, value));
+            if (typer->streaming) {
+                /* main's value is its exit status */
+                if (value && typer->statement->type == NODE_FUNCTION_DEF) {
+                    widen(typer, typer->result, type);
+                }
+                break;
+            }
+            const Instance *instance = &typer->instances[typer->current];
+            /* main's value is its exit status */
+            if (value && instance->node && widen(typer, instance->result, type)) {
+                instance = &typer->instances[typer->current];
+                for (uint32_t i = 0; i < instance->caller_count; i++) {
+                    touch(typer, instance->callers[i]);
+                }
+            }
+            break;
+        }
+
+        case NODE_BLOCK:
+            walk_list(typer, &statement->data.block.statements);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Make `instance` the one being walked, with its frame's slots */
+static void enter(Typer *typer, uint32_t instance) {
+    typer->current = instance;
+    typer->slots = typer->instances[instance].node ? typer->function_slots : typer->main_slots;
+}
+
+static void start_walk(Typer *typer, uint32_t index) {
+    Instance *instance = &typer->instances[index];
+    enter(typer, index);
+    typer->walk++;
+    instance->next_local = 0;
+    instance->callee_count = 0;
+}
+
+static void walk_function(Typer *typer, uint32_t index) {
+    start_walk(typer, index);
+    const Instance *instance = &typer->instances[index];
+    ASTNode *node = instance->node;
+    typer->statement = node;
+    const AtomList *parameters = &node->data.function_def.parameters;
+    for (uint32_t i = 0; i < parameters->count; i++) {
+        typer->slots[i] = instance->first_parameter + i;
+    }
+
+    if (typer->reporting) {
+        const char *name = atom_name(typer->functions[instance->function].name);
+        for (uint32_t i = 0; i < parameters->count; i++) {
+            const Declaration *parameter = &typer->declarations[instance->first_parameter + i];
+            if (clashed(parameter)) {
+                report(typer, node, "Parameter '%s' of '%s' is given both %s and %s values",
+                       atom_name(parameters->items[i]), name, type_name(parameter->clash[0]),
+                       type_name(parameter->clash[1]));
+            }
+        }
+        const Declaration *result = &typer->declarations[instance->result];
+        if (clashed(result)) {
+            report(typer, node, "'%s' returns both %s and %s values", name, type_name(result->clash[0]),
+                   type_name(result->clash[1]));
+        }
+    }
+
+    walk_list(typer, &node->data.function_def.body);
+    typer->instances[index].walked = true;
+}
+
+/* Walk one of main's statements; main's walk must have been started */
+static void walk_main_statement(Typer *typer, ASTNode *statement) {
+    enter(typer, 0);
+    typer->statement = statement;
+    walk_statement(typer, statement);
+}
+
+/* Walk an instance, or main, again and again until its own types stop widening */
+static void settle(Typer *typer, ASTNode *program, uint32_t index) {
+    do {
+        typer->changed = false;
+        if (typer->instances[index].node) {
+            walk_function(typer, index);
+        } else {
+            start_walk(typer, index);
+            NodeList *statements = &program->data.program.statements;
+            for (size_t i = 0; i < statements->count && !typer->failed; i++) {
+                if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+                    walk_main_statement(typer, statements->items[i]);
+                }
+            }
+            typer->instances[index].walked = true;
+        }
+    } while (typer->changed && !typer->failed);
+}
+
+/* One entry per function in order of definition, then main, which is instance 0 */
+static bool create_functions(Typer *typer, ASTNode *program) {
+    NodeList *statements = &program->data.program.statements;
+    uint32_t count = 1;
+    uint32_t function_slots = 1;
+    for (size_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_FUNCTION_DEF) {
+            count++;
+            if (statements->items[i]->data.function_def.locals > function_slots) {
+                function_slots = statements->items[i]->data.function_def.locals;
+            }
+        }
+    }
+    typer->functions = calloc(count, sizeof(Function));
+    typer->function_slots = malloc(function_slots * sizeof(uint32_t));
+    typer->main_slots = malloc((program->data.program.locals + 1) * sizeof(uint32_t));
+    if (!typer->functions || !typer->function_slots || !typer->main_slots) {
+        out_of_memory(typer);
+        return false;
+    }
+    typer->function_count = count;
+
+    uint32_t index = 0;
+    for (size_t i = 0; i <= statements->count; i++) {
+        ASTNode *node = i < statements->count ? statements->items[i] : NULL;
+        if (node && node->type != NODE_FUNCTION_DEF) {
+            continue;
+        }
+        Function *function = &typer->functions[index++];
+        function->node = node;
+        function->name = node ? node->data.function_def.name : ATOM_NONE;
+        function->first_instance = function->last_instance = NO_INSTANCE;
+        function->generic = NO_INSTANCE;
+    }
+    if (new_instance(typer, count - 1, NULL) == NO_INSTANCE) {
+        return false;
+    }
+    typer->instances[0].root = true;
+    return !typer->failed;
+}
+
+/* Mark every instance main, or a rooted generic, can call; returns false if out of memory */
+static bool mark_reachable(Typer *typer) {
+    uint32_t *stack = malloc(typer->instance_count * sizeof(uint32_t));
+    if (!stack) {
+        out_of_memory(typer);
+        return false;
+    }
+    size_t count = 0;
+    for (uint32_t i = 0; i < typer->function_count; i++) {
+        typer->functions[i].reachable = 0;
+    }
+    for (uint32_t i = 0; i < typer->instance_count; i++) {
+        Instance *instance = &typer->instances[i];
+        instance->reachable = instance->root;
+        if (instance->root) {
+            stack[count++] = i;
+        }
+    }
+    while (count > 0) {
+        const Instance *instance = &typer->instances[stack[--count]];
+        typer->functions[instance->function].reachable++;
+        for (uint32_t i = 0; i < instance->callee_count; i++) {
+            Instance *callee = &typer->instances[instance->callees[i]];
+            if (!callee->reachable) {
+                callee->reachable = true;
+                stack[count++] = instance->callees[i];
+            }
+        }
+    }
+    free(stack);
+    return true;
+}
+
+/*
+ * Settle every queued instance, then find what the program can call.
+ * Instances made along the way for argument types that have since
+ * widened are dropped; a function nothing calls is still emitted, as its
+ * generic instance.
+ */
+static void settle_program(Typer *typer, ASTNode *program) {
+    for (;;) {
+        while (typer->queue_count > 0 && !typer->failed) {
+            settle(typer, program, dequeue(typer));
+        }
+        if (typer->failed || !mark_reachable(typer)) {
+            return;
+        }
+        bool rooted = false;
+        for (uint32_t i = 0; i + 1 < typer->function_count; i++) {
+            if (typer->functions[i].reachable > 0) {
+                continue;
+            }
+            if (typer->functions[i].generic == NO_INSTANCE) {
+                uint32_t generic = new_instance(typer, i, NULL);
+                if (generic == NO_INSTANCE) {
+                    return;
+                }
+                typer->functions[i].generic = generic;
+            }
+            typer->instances[typer->functions[i].generic].root = true;
+            rooted = true;
+        }
+        if (!rooted) {
+            return;
+        }
+    }
+}
+
+/* One letter per argument type, for the names of specialized copies */
+static char type_code(ValueType type) {
+    switch (type) {
+        case TYPE_BOOL:
+            return 'b';
+        case TYPE_INT:
+            return 'l';
+        case TYPE_FLOAT:
+            return 'd';
+        case TYPE_STRING:
+            return 's';
+        case TYPE_UNKNOWN:
+            return 'u';
+        default:
+            return 'e';
+    }
+}
+
+/* `name__` and a letter per argument type, with '_' added until no source name is the same */
+static Atom specialized_name(Typer *typer, const Instance *instance, uint32_t parameters) {
+    const char *name = atom_name(typer->functions[instance->function].name);
+    size_t length = strlen(name);
+    size_t size = length + parameters + 2;
+    char *text = malloc(size + 1);
+    if (!text) {
+        out_of_memory(typer);
+        return ATOM_NONE;
+    }
+    memcpy(text, name, length);
+    text[length++] = '_';
+    text[length++] = '_';
+    for (uint32_t i = 0; i < parameters; i++) {
+        text[length++] = type_code(typer->signatures[instance->signature + i]);
+    }
+    Atom atom = atom_intern(text, length);
+    while (atom != ATOM_NONE && atom < typer->first_new_atom) {
+        char *longer = realloc(text, ++size + 1);
+        if (!longer) {
+            atom = ATOM_NONE;
+            break;
+        }
+        text = longer;
+        text[length++] = '_';
+        atom = atom_intern(text, length);
+    }
+    free(text);
+    if (atom == ATOM_NONE) {
+        out_of_memory(typer);
+    }
+    return atom;
+}
+
+/*
+ * Give every reachable instance of a function that has more than one a
+ * definition of its own: the first keeps the source's, the rest get
+ * copies. The generic instance keeps the source name, and the others are
+ * named for their argument types, so max(1, 2) and max(1.5, 2.5) call
+ * max__ll and max__dd.
+ */
+static bool specialize(Typer *typer) {
+    for (uint32_t i = 0; i + 1 < typer->function_count && !typer->failed; i++) {
+        Function *function = &typer->functions[i];
+        if (function->reachable < 2) {
+            continue;
+        }
+        uint32_t parameters = function->node->data.function_def.parameters.count;
+        bool first = true;
+        for (uint32_t j = function->first_instance; j != NO_INSTANCE; j = typer->instances[j].next) {
+            Instance *instance = &typer->instances[j];
+            if (!instance->reachable) {
+                continue;
+            }
+            if (instance->signature != NO_SIGNATURE) {
+                instance->name = specialized_name(typer, instance, parameters);
+            }
+            if (!first) {
+                instance->node = ast_clone(function->node);
+                if (!instance->node) {
+                    out_of_memory(typer);
+                    return false;
+                }
+            }
+            first = false;
+        }
+        for (uint32_t j = function->first_instance; j != NO_INSTANCE; j = typer->instances[j].next) {
+            Instance *instance = &typer->instances[j];
+            if (instance->reachable) {
+                instance->node->data.function_def.name = instance->name;
+            }
+        }
+    }
+    return !typer->failed;
+}
+
+/*
+ * The last walk, in source order: each definition becomes its reachable
+ * instances. Once one instance of a function has errors, the rest are
+ * not reported, since they would mostly say the same again.
+ */
+static void report_program(Typer *typer, ASTNode *program) {
+    NodeList *statements = &program->data.program.statements;
+    uint32_t function = 0;
+    typer->reporting = true;
+    start_walk(typer, 0);
+    for (size_t i = 0; i < statements->count && !typer->failed; i++) {
+        if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+            walk_main_statement(typer, statements->items[i]);
+            continue;
+        }
+        size_t errors = typer->errors;
+        for (uint32_t j = typer->functions[function].first_instance; j != NO_INSTANCE && errors == typer->errors;
+             j = typer->instances[j].next) {
+            if (typer->instances[j].reachable) {
+                walk_function(typer, j);
+            }
+        }
+        function++;
+    }
+}
+
+/* The reachable instances' signatures and definitions, in source order */
+static bool export_types(Typer *typer, ASTNode *program, ProgramTypes *types) {
+    size_t count = 0;
+    bool cloned = false;
+    for (uint32_t i = 0; i + 1 < typer->function_count; i++) {
+        count += typer->functions[i].reachable;
+        cloned |= typer->functions[i].reachable > 1;
+    }
+    types->function_count = count;
+    types->functions = calloc(count ? count : 1, sizeof(FunctionType));
+    if (!types->functions) {
+        out_of_memory(typer);
+        return false;
+    }
+    size_t index = 0;
+    for (uint32_t i = 0; i + 1 < typer->function_count; i++) {
+        for (uint32_t j = typer->functions[i].first_instance; j != NO_INSTANCE; j = typer->instances[j].next) {
+            const Instance *instance = &typer->instances[j];
+            if (!instance->reachable) {
+                continue;
+            }
+            FunctionType *type = &types->functions[index++];
+            type->result = typer->declarations[instance->result].type;
+            type->parameter_count = instance->node->data.function_def.parameters.count;
+            if (type->parameter_count > 0) {
+                type->parameters = malloc(type->parameter_count * sizeof(ValueType));
+                if (!type->parameters) {
+                    out_of_memory(typer);
+                    return false;
+                }
+                for (uint32_t k = 0; k < type->parameter_count; k++) {
+                    type->parameters[k] = typer->declarations[instance->first_parameter + k].type;
+                }
+            }
+        }
+    }
+    if (!cloned) {
+        return true;
+    }
+
+    /* The copies go right after their source, and calls are bound to them by name */
+    NodeList *statements = &program->data.program.statements;
+    NodeBuffer buffer = {0};
+    uint32_t function = 0;
+    bool ok = true;
+    for (size_t i = 0; i < statements->count && ok; i++) {
+        if (statements->items[i]->type != NODE_FUNCTION_DEF) {
+            ok = node_buffer_push(&buffer, statements->items[i]);
+            continue;
+        }
+        for (uint32_t j = typer->functions[function].first_instance; j != NO_INSTANCE && ok;
+             j = typer->instances[j].next) {
+            if (typer->instances[j].reachable) {
+                ok = node_buffer_push(&buffer, typer->instances[j].node);
+            }
+        }
+        function++;
+    }
+    if (!ok || !ast_list_assign(statements, &buffer)) {
+        node_buffer_free(&buffer);
+        out_of_memory(typer);
+        return false;
+    }
+    node_buffer_free(&buffer);
+    typer->adopted = true;
+    return resolve_program(program, NULL);
+}
+
+/* Copies made for a program whose types failed, which never made it into the tree */
+static void destroy_clones(Typer *typer) {
+    for (uint32_t i = 0; i < typer->instance_count; i++) {
+        const Instance *instance = &typer->instances[i];
+        if (instance->node && instance->node != typer->functions[instance->function].node) {
+            ast_destroy(instance->node);
+        }
+    }
+}
+
+static void release(Typer *typer) {
+    for (uint32_t i = 0; i < typer->instance_count; i++) {
+        free(typer->instances[i].callers);
+        free(typer->instances[i].callees);
+        free(typer->instances[i].locals);
+    }
+    free(typer->functions);
+    free(typer->instances);
+    free(typer->signatures);
+    free(typer->declarations);
+    free(typer->main_slots);
+    free(typer->function_slots);
+    free(typer->queue);
+    free(typer->items);
+    free(typer->values);
+}
+
+/*
+ * Widen until nothing changes, then walk everything once more in source
+ * order to annotate the tree and report errors.
+ */
+bool types_infer(ASTNode *program, LineIndex *lines, ProgramTypes *types) {
+    types->functions = NULL;
+    types->function_count = 0;
+    if (!program || program->type != NODE_PROGRAM) {
+        return false;
+    }
+    Typer typer = {0};
+    typer.lines = lines;
+    typer.first_new_atom = (Atom)atom_count();
+
+    bool specialized = false;
+    if (create_functions(&typer, program)) {
+        settle_program(&typer, program);
+        specialized = !typer.failed && specialize(&typer);
+        if (specialized) {
+            report_program(&typer, program);
+        }
+    }
+
+    bool ok = specialized && !typer.failed && typer.errors == 0 && export_types(&typer, program, types);
+    if (!ok) {
+        program_types_free(types);
+        if (specialized && !typer.adopted) {
+            destroy_clones(&typer);
+        }
+    }
+    release(&typer);
+    return ok;
+}
+
+/*
+ * --stream: statements are typed as they come and can be freed once
+ * emitted; only the frames' declarations and the signatures are kept
+ */
+Typer *typer_create(LineIndex *lines) {
+    Typer *typer = calloc(1, sizeof(Typer));
+    if (typer) {
+        typer->lines = lines;
+        typer->streaming = true;
+        typer->reporting = true;
+        typer->result = new_declarations(typer, 1);
+        if (typer->failed) {
+            typer_destroy(typer);
+            return NULL;
+        }
+    }
+    return typer;
+}
+
+void typer_destroy(Typer *typer) {
+    if (typer) {
+        release(typer);
+        program_types_free(&typer->streamed);
+        free(typer->called_early);
+        free(typer);
+    }
+}
+
+/* The signatures of the functions typed so far, in order of definition; they grow with each one */
+const ProgramTypes *typer_types(const Typer *typer) {
+    return &typer->streamed;
+}
+
+static void walk_streamed_function(Typer *typer, ASTNode *function) {
+    typer->walk++;
+    for (uint32_t i = 0; i < function->data.function_def.parameters.count && !typer->failed; i++) {
+        uint32_t parameter = bind(typer, i);
+        if (!typer->failed) {
+            typer->declarations[parameter].type = TYPE_INT;
+        }
+    }
+    typer->slots = typer->function_slots;
+    walk_list(typer, &function->data.function_def.body);
+}
+
+/*
+ * A function's result is typed from its own body, walked again while a
+ * recursive call has read a result that has since widened, then once
+ * more to annotate it and report errors
+ */
+static void type_streamed_function(Typer *typer, ASTNode *function) {
+    const char *name = atom_name(function->data.function_def.name);
+    size_t index = typer->streamed.function_count;
+    uint32_t parameters = function->data.function_def.parameters.count;
+    if (index == typer->streamed_capacity &&
+        !grow((void **)&typer->streamed.functions, &typer->streamed_capacity, sizeof(FunctionType))) {
+        out_of_memory(typer);
+        return;
+    }
+    FunctionType *type = &typer->streamed.functions[index];
+    type->parameters = parameters > 0 ? malloc(parameters * sizeof(ValueType)) : NULL;
+    if (parameters > 0 && !type->parameters) {
+        out_of_memory(typer);
+        return;
+    }
+    for (uint32_t i = 0; i < parameters; i++) {
+        type->parameters[i] = TYPE_INT;
+    }
+    type->parameter_count = parameters;
+
+    Declaration *result = &typer->declarations[typer->result];
+    result->type = TYPE_UNKNOWN;
+    result->clash[0] = result->clash[1] = TYPE_UNKNOWN;
+    typer->reporting = false;
+    do {
+        typer->changed = false;
+        walk_streamed_function(typer, function);
+    } while (typer->changed && !typer->failed);
+    typer->reporting = true;
+    walk_streamed_function(typer, function);
+
+    result = &typer->declarations[typer->result];
+    if (clashed(result)) {
+        report(typer, function, "'%s' returns both %s and %s values", name, type_name(result->clash[0]),
+               type_name(result->clash[1]));
+    } else if (index < typer->called_early_capacity && typer->called_early[index] && result->type != TYPE_ERROR &&
+               join(TYPE_INT, result->type) != TYPE_INT) {
+        report(typer, function, "'%s' returns %s values, but is called before its definition when streamed", name,
+               type_name(result->type));
+    }
+    type->result = result->type;
+    typer->streamed.function_count++;
+}
+
+bool typer_type_statement(Typer *typer, ASTNode *statement) {
+    size_t errors = typer->errors;
+    typer->statement = statement;
+    if (statement->type == NODE_FUNCTION_DEF) {
+        type_streamed_function(typer, statement);
+    } else {
+        typer->walk++;
+        typer->slots = typer->main_slots;
+        walk_statement(typer, statement);
+    }
+    return !typer->failed && typer->errors == errors;
+}
+
+void program_types_free(ProgramTypes *types) {
+    if (types && types->functions) {
+        for (size_t i = 0; i < types->function_count; i++) {
+            free(types->functions[i].parameters);
+        }
+        free(types->functions);
+        types->functions = NULL;
+        types->function_count = 0;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include "ast.h"
+#include "line_index.h"
+
+/*
+ * Type inference. Every variable, parameter and function result gets the
+ * least type that holds every value it is given, over the ordering
+ *
+ *   bool < long < double        string
+ *
+ * so `let x = 1; x = x / 2.0;` makes x a double. Arithmetic follows C:
+ * bools promote to long, and long meets double in a double. Comparisons
+ * and the logical operators give bools. Strings can only be compared for
+ * equality with each other; a string mixed with a number, or given to any
+ * other operator or to a condition, is a type error, as is using what
+ * print returns.
+ *
+ * Functions are typed per call: each list of argument types a function
+ * is called with gets its own instance, typed for exactly those, so
+ * max(1, 2) and max(1.5, 2.5) run on longs and on doubles. A function
+ * called with more than MAX_SPECIALIZATIONS (in types.c) lists shares one
+ * generic instance among the rest, as wide as all their arguments, as
+ * does a function nothing calls. When a function has more than one
+ * instance the program can reach, the definition is copied (ast_clone)
+ * into one per instance, named for its argument types: max__ll and
+ * max__dd, or just max for the generic one. The copies follow their
+ * source in the program, the calls are renamed to them, and the program
+ * is resolved again.
+ *
+ * Types are found by walking each instance until nothing it assigns
+ * changes, and walking again any instance whose parameters or callees'
+ * results changed; the ordering is only three high, so this settles in
+ * a few passes, and recursive calls end up calling the instance itself
+ * or one other. The program must have been resolved (resolve.h) first;
+ * slots are what tie each use of a name to its declaration.
+ *
+ * Errors are printed to stderr with their line, and all of them are
+ * reported before types_infer fails. Identifiers, operators and variable
+ * declarations are annotated with their types in the tree, which is what
+ * types_of reads; the signatures of the top-level functions, copies
+ * included, in program order, are in `types`, to be freed with
+ * program_types_free.
+ */
+typedef struct {
+    ValueType result;
+    ValueType *parameters;
+    uint32_t parameter_count;
+} FunctionType;
+
+typedef struct {
+    FunctionType *functions;
+    size_t function_count;
+} ProgramTypes;
+
+/*
+ * --stream types one resolved top-level statement at a time instead
+ * (typer_type_statement). With no call sites to go on, parameters are
+ * longs, which a bool argument converts to, and a function returns what
+ * its own body does, found before its definition is emitted; typer_types
+ * holds the signatures so far. A variable has its initializer's type. A
+ * value that does not fit those is an error rather than a wider type, as
+ * is a function that returns a double or string but was called before
+ * its definition, when a long was all it could be taken for.
+ */
+typedef struct Typer Typer;
+
+bool types_infer(ASTNode *program, LineIndex *lines, ProgramTypes *types);
+void program_types_free(ProgramTypes *types);
+Typer *typer_create(LineIndex *lines);
+void typer_destroy(Typer *typer);
+bool typer_type_statement(Typer *typer, ASTNode *statement);
+const ProgramTypes *typer_types(const Typer *typer);
+ValueType types_of(const ASTNode *expression);
+const char *type_name(ValueType type);
+const char *type_declarator(ValueType type);
+
+#endif
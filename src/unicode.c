@@ -0,0 +1,67 @@
+#include "unicode.h"
+#include "unicode_tables.h"
+
+/* Decode the well-formed sequence at s[pos]; returns its length in bytes */
+size_t utf8_decode(const char *s, size_t pos, uint32_t *code_point) {
+    const unsigned char *p = (const unsigned char *)s + pos;
+    if (p[0] < 0x80) {
+        *code_point = p[0];
+        return 1;
+    }
+    if (p[0] < 0xE0) {
+        *code_point = ((uint32_t)(p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+        return 2;
+    }
+    if (p[0] < 0xF0) {
+        *code_point = ((uint32_t)(p[0] & 0x0F) << 12) | ((uint32_t)(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+        return 3;
+    }
+    *code_point = ((uint32_t)(p[0] & 0x07) << 18) | ((uint32_t)(p[1] & 0x3F) << 12) |
+                  ((uint32_t)(p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+    return 4;
+}
+
+/*
+ * Whether s[pos, length) is the start of a well-formed sequence that
+ * more bytes could complete, as when a read stops inside a character.
+ */
+bool utf8_is_partial(const char *s, size_t pos, size_t length) {
+    const unsigned char *p = (const unsigned char *)s + pos;
+    size_t available = length - pos;
+    size_t needed = p[0] >= 0xF0 ? 4 : p[0] >= 0xE0 ? 3 : 2;
+    if (available == 0 || p[0] < 0xC2 || p[0] > 0xF4 || available >= needed) {
+        return false;
+    }
+    if (available >= 2) {
+        unsigned char lo = p[0] == 0xE0 ? 0xA0 : p[0] == 0xF0 ? 0x90 : 0x80;
+        unsigned char hi = p[0] == 0xED ? 0x9F : p[0] == 0xF4 ? 0x8F : 0xBF;
+        if (p[1] < lo || p[1] > hi) {
+            return false;
+        }
+    }
+    return available < 3 || (p[2] & 0xC0) == 0x80;
+}
+
+/* Binary search over sorted inclusive ranges */
+static bool in_ranges(const uint32_t ranges[][2], size_t count, uint32_t code_point) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ranges[mid][1] < code_point) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < count && ranges[lo][0] <= code_point;
+}
+
+/* Non-ASCII code points only; the lexer's character classes handle ASCII */
+bool unicode_is_xid_start(uint32_t code_point) {
+    return in_ranges(xid_start_ranges, XID_START_RANGES, code_point);
+}
+
+bool unicode_is_xid_continue(uint32_t code_point) {
+    return in_ranges(xid_continue_ranges, XID_CONTINUE_RANGES, code_point);
+}
@@ -0,0 +1,18 @@
+#ifndef UNICODE_H
+#define UNICODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Code point helpers for the lexer's non-ASCII slow path. Input is
+ * validated with scan_utf8() before it is lexed, so decoding trusts the
+ * lead byte and does no checking of its own.
+ */
+size_t utf8_decode(const char *s, size_t pos, uint32_t *code_point);
+bool utf8_is_partial(const char *s, size_t pos, size_t length);
+bool unicode_is_xid_start(uint32_t code_point);
+bool unicode_is_xid_continue(uint32_t code_point);
+
+#endif
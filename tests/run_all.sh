@@ -4,8 +4,9 @@ BUILD_DIR="build"
 mkdir -p "$BUILD_DIR"
 
 echo "Compiling tests..."
-gcc -I.. -o "$BUILD_DIR/test_lexer" test_lexer.c ../src/lexer.c
-gcc -I.. -o "$BUILD_DIR/test_parser" test_parser.c ../src/lexer.c ../src/parser.c ../src/ast.c
+gcc -I.. -o "$BUILD_DIR/test_lexer" test_lexer.c ../src/scan.c ../src/unicode.c ../src/line_index.c ../src/lexer.c ../src/lexer_parallel.c -pthread
+gcc -I.. -o "$BUILD_DIR/test_parser" test_parser.c ../src/scan.c ../src/unicode.c ../src/line_index.c ../src/lexer.c ../src/parser.c ../src/ast.c ../src/ast_compact.c ../src/ast_cache.c ../src/passes.c ../src/ast_hash.c ../src/cse.c ../src/resolve.c ../src/types.c ../src/inline.c ../src/fold.c ../src/dce.c ../src/arena.c ../src/atom.c ../src/incremental.c ../src/parser_parallel.c -pthread
+gcc -I.. -o "$BUILD_DIR/test_codegen" test_codegen.c ../src/scan.c ../src/unicode.c ../src/line_index.c ../src/ast.c ../src/codegen.c ../src/types.c ../src/resolve.c ../src/fold.c ../src/arena.c ../src/atom.c -pthread
 
 echo ""
 echo "Running Lexer Tests..."
@@ -18,7 +19,12 @@ echo "Running Parser Tests..."
 parser_result=$?
 
 echo ""
-if [ $lexer_result -eq 0 ] && [ $parser_result -eq 0 ]; then
+echo "Running Code Generator Tests..."
+"$BUILD_DIR/test_codegen"
+codegen_result=$?
+
+echo ""
+if [ $lexer_result -eq 0 ] && [ $parser_result -eq 0 ] && [ $codegen_result -eq 0 ]; then
     echo "All tests passed!"
     exit 0
 else
@@ -9,12 +9,27 @@
 #include <assert.h>
 #include "../src/ast.h"
 #include "../src/codegen.h"
+#include "../src/fold.h"
+#include "../src/resolve.h"
+
+/* Read back and close a stream written by the code generator */
+static char *read_stream(FILE *stream) {
+    fseek(stream, 0, SEEK_END);
+    size_t size = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+
+    char *output = malloc(size + 1);
+    if (output) {
+        fread(output, 1, size, stream);
+        output[size] = '\0';
+    }
+
+    fclose(stream);
+    return output;
+}
 
 /* Test helper to capture output to string */
 static char *capture_codegen_output(ASTNode *ast) {
-    char *output = NULL;
-    size_t size = 0;
-
     /* Open memory stream (POSIX) or use tmpfile */
     FILE *stream = tmpfile();
     if (!stream) {
@@ -27,18 +42,34 @@ static char *capture_codegen_output(ASTNode *ast) {
     codegen_destroy(gen);
 
     /* Read back the output */
-    fseek(stream, 0, SEEK_END);
-    size = ftell(stream);
-    fseek(stream, 0, SEEK_SET);
+    return read_stream(stream);
+}
 
-    output = malloc(size + 1);
-    if (output) {
-        fread(output, 1, size, stream);
-        output[size] = '\0';
+/* Test helper: output of the streaming API, one top-level statement at a time */
+static char *capture_streamed_output(ASTNode *ast) {
+    FILE *stream = tmpfile();
+    if (!stream) {
+        return NULL;
     }
 
-    fclose(stream);
-    return output;
+    CodeGen *gen = codegen_create(stream);
+    NodeBuffer functions = {0};
+    for (size_t i = 0; i < ast->data.program.statements.count; i++) {
+        if (ast->data.program.statements.items[i]->type == NODE_FUNCTION_DEF) {
+            node_buffer_push(&functions, ast->data.program.statements.items[i]);
+        }
+    }
+    bool begun = codegen_begin(gen, node_buffer_items(&functions), functions.count);
+    assert(begun);
+    node_buffer_free(&functions);
+    for (size_t i = 0; i < ast->data.program.statements.count; i++) {
+        codegen_add_statement(gen, ast->data.program.statements.items[i]);
+    }
+    bool finished = codegen_finish(gen);
+    assert(finished);
+    codegen_destroy(gen);
+
+    return read_stream(stream);
 }
 
 /* Test 1: Simple integer literal */
@@ -73,30 +104,30 @@ void test_function_def() {
     ASTNode *program = ast_create_program();
 
     /* Create parameters */
-    char **params = malloc(2 * sizeof(char *));
-    params[0] = strdup("a");
-    params[1] = strdup("b");
+    AtomBuffer params = {0};
+    atom_buffer_push(&params, atom_intern("a", 1));
+    atom_buffer_push(&params, atom_intern("b", 1));
 
     /* Create function body: return a + b */
-    ASTNode *a = ast_create_identifier("a");
-    ASTNode *b = ast_create_identifier("b");
+    ASTNode *a = ast_create_identifier(atom_intern("a", 1));
+    ASTNode *b = ast_create_identifier(atom_intern("b", 1));
     ASTNode *add_expr = ast_create_binary_op(a, b, OP_ADD);
     ASTNode *return_stmt = ast_create_return(add_expr);
 
-    ASTNode **body = malloc(sizeof(ASTNode *));
-    body[0] = return_stmt;
+    NodeBuffer body = {0};
+    node_buffer_push(&body, return_stmt);
 
     /* Create function */
-    ASTNode *func = ast_create_function_def("add", params, 2, body, 1);
+    ASTNode *func = ast_create_function_def(atom_intern("add", 3), &params, &body);
     ast_program_add_statement(program, func);
 
     char *output = capture_codegen_output(program);
 
     /* Verify output */
     assert(output != NULL);
-    assert(strstr(output, "int add") != NULL);
-    assert(strstr(output, "int a") != NULL);
-    assert(strstr(output, "int b") != NULL);
+    assert(strstr(output, "long add") != NULL);
+    assert(strstr(output, "long a") != NULL);
+    assert(strstr(output, "long b") != NULL);
     assert(strstr(output, "return") != NULL);
 
     free(output);
@@ -116,12 +147,11 @@ void test_if_statement() {
     ASTNode *cond = ast_create_int_literal(1);
     ASTNode *ret = ast_create_return(ast_create_int_literal(42));
 
-    ASTNode **then_branch = malloc(sizeof(ASTNode *));
-    then_branch[0] = ret;
+    NodeBuffer then_branch = {0};
+    node_buffer_push(&then_branch, ret);
 
-    ASTNode *if_stmt = ast_create_if(cond, then_branch, 1, NULL, 0);
-    ASTNode *expr_stmt = ast_create_expr_stmt(if_stmt);
-    ast_program_add_statement(program, expr_stmt);
+    ASTNode *if_stmt = ast_create_if(cond, &then_branch, NULL);
+    ast_program_add_statement(program, if_stmt);
 
     char *output = capture_codegen_output(program);
 
@@ -143,11 +173,11 @@ void test_function_call() {
     /* Create AST: print(42) */
     ASTNode *program = ast_create_program();
 
-    ASTNode *func = ast_create_identifier("print");
-    ASTNode **args = malloc(sizeof(ASTNode *));
-    args[0] = ast_create_int_literal(42);
+    ASTNode *func = ast_create_identifier(ATOM_PRINT);
+    NodeBuffer args = {0};
+    node_buffer_push(&args, ast_create_int_literal(42));
 
-    ASTNode *call = ast_create_call(func, args, 1);
+    ASTNode *call = ast_create_call(func, &args);
     ASTNode *expr_stmt = ast_create_expr_stmt(call);
     ast_program_add_statement(program, expr_stmt);
 
@@ -197,6 +227,107 @@ void test_binary_operations() {
     printf("PASSED\n");
 }
 
+/* Test 6: Streaming output matches whole-program output */
+void test_streaming() {
+    printf("Test 6: Streaming... ");
+
+    /* Create AST: let x = 1; func id(a) { return a; } print(id(x)); */
+    ASTNode *program = ast_create_program();
+    ast_program_add_statement(program, ast_create_var_decl(atom_intern("x", 1), ast_create_int_literal(1), 0));
+
+    AtomBuffer params = {0};
+    atom_buffer_push(&params, atom_intern("a", 1));
+    NodeBuffer body = {0};
+    node_buffer_push(&body, ast_create_return(ast_create_identifier(atom_intern("a", 1))));
+    ast_program_add_statement(program, ast_create_function_def(atom_intern("id", 2), &params, &body));
+
+    NodeBuffer inner = {0};
+    node_buffer_push(&inner, ast_create_identifier(atom_intern("x", 1)));
+    NodeBuffer args = {0};
+    node_buffer_push(&args, ast_create_call(ast_create_identifier(atom_intern("id", 2)), &inner));
+    ASTNode *call = ast_create_call(ast_create_identifier(ATOM_PRINT), &args);
+    ast_program_add_statement(program, ast_create_expr_stmt(call));
+
+    char *whole = capture_codegen_output(program);
+    char *streamed = capture_streamed_output(program);
+
+    /* Verify output */
+    assert(whole != NULL && streamed != NULL);
+    assert(strcmp(whole, streamed) == 0);
+    assert(strstr(streamed, "long id(long a);") != NULL);
+
+    free(whole);
+    free(streamed);
+    ast_destroy(program);
+
+    printf("PASSED\n");
+}
+
+/* Test 7: Integer literals are longs, so their arithmetic does not overflow at 2^31 */
+void test_long_literals() {
+    printf("Test 7: Long literals... ");
+
+    /* Create AST: print(100000 * 100000); */
+    ASTNode *program = ast_create_program();
+    NodeBuffer args = {0};
+    node_buffer_push(&args, ast_create_binary_op(ast_create_int_literal(100000), ast_create_int_literal(100000),
+                                                 OP_MUL));
+    ASTNode *call = ast_create_call(ast_create_identifier(ATOM_PRINT), &args);
+    ast_program_add_statement(program, ast_create_expr_stmt(call));
+
+    char *output = capture_codegen_output(program);
+
+    /* Verify output */
+    assert(output != NULL);
+    assert(strstr(output, "(100000L * 100000L)") != NULL);
+
+    free(output);
+    ast_destroy(program);
+
+    printf("PASSED\n");
+}
+
+/* print(2147483647 * 2); */
+static ASTNode *overflowing_program(void) {
+    ASTNode *program = ast_create_program();
+    NodeBuffer args = {0};
+    node_buffer_push(&args, ast_create_binary_op(ast_create_int_literal(2147483647), ast_create_int_literal(2),
+                                                 OP_MUL));
+    ASTNode *call = ast_create_call(ast_create_identifier(ATOM_PRINT), &args);
+    ast_program_add_statement(program, ast_create_expr_stmt(call));
+    return program;
+}
+
+/* Test 8: -O folds a product past int range to the value the unfolded C computes */
+void test_folded_overflow() {
+    printf("Test 8: Folded overflow... ");
+
+    ASTNode *plain = overflowing_program();
+    ASTNode *folded = overflowing_program();
+    ProgramTypes types;
+    FoldStats stats;
+    bool ok = resolve_program(folded, NULL) && types_infer(folded, NULL, &types);
+    assert(ok);
+    ok = fold_program(folded, &stats);
+    assert(ok);
+
+    char *plain_output = capture_codegen_output(plain);
+    char *folded_output = capture_codegen_output(folded);
+
+    /* Verify output: both print 4294967294, with -O or without */
+    assert(plain_output != NULL && folded_output != NULL);
+    assert(strstr(plain_output, "miru_print_int((2147483647L * 2L));") != NULL);
+    assert(strstr(folded_output, "miru_print_int(4294967294L);") != NULL);
+
+    free(plain_output);
+    free(folded_output);
+    program_types_free(&types);
+    ast_destroy(plain);
+    ast_destroy(folded);
+
+    printf("PASSED\n");
+}
+
 int main(void) {
     printf("\n=== Code Generator Tests ===\n\n");
 
@@ -205,6 +336,9 @@ int main(void) {
     test_if_statement();
     test_function_call();
     test_binary_operations();
+    test_streaming();
+    test_long_literals();
+    test_folded_overflow();
 
     printf("\nAll tests passed!\n\n");
 
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../src/lexer.h"
+#include "../src/lexer_parallel.h"
+#include "../src/scan.h"
 
 int tests_run = 0;
 int tests_passed = 0;
@@ -31,11 +33,252 @@ void test_lexer_token_creation(void) {
     lexer_destroy(lexer);
 }
 
+void test_lexer_long_runs(void) {
+    /* Runs longer than one vector width must keep positions exact */
+    const char *source =
+        "identifier_name_longer_than_thirty_two_bytes_x1 = 12345678901234567890;\n"
+        "                                        y // a comment that is well over thirty-two bytes long\n"
+        "\t\tz";
+    Lexer *lexer = lexer_create(source);
+
+    Token token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_IDENTIFIER, "test_lexer_long_runs identifier kind");
+    assert_equal_int((int)token.length, 47, "test_lexer_long_runs identifier length");
+
+    lexer_next_token(lexer);
+    token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_INT, "test_lexer_long_runs number kind");
+    assert_equal_int(lexer_position(lexer, token.offset).column, 51, "test_lexer_long_runs number column");
+
+    lexer_next_token(lexer);
+    token = lexer_next_token(lexer);
+    SourcePosition position = lexer_position(lexer, token.offset);
+    assert_equal_int(position.line, 2, "test_lexer_long_runs blank run line");
+    assert_equal_int(position.column, 41, "test_lexer_long_runs blank run column");
+
+    token = lexer_next_token(lexer);
+    position = lexer_position(lexer, token.offset);
+    assert_equal_int(position.line, 3, "test_lexer_long_runs after comment line");
+    assert_equal_int(position.column, 3, "test_lexer_long_runs after comment column");
+    lexer_destroy(lexer);
+}
+
+void test_lexer_keywords(void) {
+    /* Every keyword hits its perfect-hash slot; near misses stay identifiers */
+    const char *source = "if else while for func return let const true false null print "
+                         "iff els whilex fo funcs returned lets constant tru falsey nul printf";
+    TokenKind expected[] = {
+        TOKEN_IF, TOKEN_ELSE, TOKEN_WHILE, TOKEN_FOR, TOKEN_FUNC, TOKEN_RETURN,
+        TOKEN_LET, TOKEN_CONST, TOKEN_TRUE, TOKEN_FALSE, TOKEN_NULL, TOKEN_PRINT,
+    };
+    size_t keyword_count = sizeof(expected) / sizeof(expected[0]);
+    Lexer *lexer = lexer_create(source);
+
+    int keywords_ok = 1;
+    for (size_t i = 0; i < keyword_count; i++) {
+        if (lexer_next_token(lexer).kind != expected[i]) {
+            keywords_ok = 0;
+        }
+    }
+    assert_equal_int(keywords_ok, 1, "test_lexer_keywords keywords");
+
+    int identifiers_ok = 1;
+    for (size_t i = 0; i < keyword_count; i++) {
+        if (lexer_next_token(lexer).kind != TOKEN_IDENTIFIER) {
+            identifiers_ok = 0;
+        }
+    }
+    assert_equal_int(identifiers_ok, 1, "test_lexer_keywords near misses");
+    lexer_destroy(lexer);
+}
+
+void test_lexer_stream(void) {
+    /* Four-byte chunks split identifiers, strings, floats, comments and "==" */
+    const char *source = "let long_identifier = \"a string\nspanning chunks\";\n"
+                         "// comment across chunks\n"
+                         "x == 3.25 + -17 / y_2;";
+    FILE *file = tmpfile();
+    fputs(source, file);
+    rewind(file);
+
+    Lexer *expected = lexer_create(source);
+    Lexer *lexer = lexer_create_fd(fileno(file), 4);
+    int same = 1;
+    int count = 0;
+    for (;;) {
+        Token a = lexer_next_token(expected);
+        Token b = lexer_next_token(lexer);
+        if (a.kind != b.kind || a.length != b.length || a.offset != b.offset ||
+            memcmp(a.lexeme, b.lexeme, a.length) != 0 || a.value.int_value != b.value.int_value) {
+            same = 0;
+            break;
+        }
+        count++;
+        if (a.kind == TOKEN_EOF) {
+            break;
+        }
+    }
+    assert_equal_int(same, 1, "test_lexer_stream same tokens");
+    assert_equal_int(count, 14, "test_lexer_stream token count");
+    lexer_destroy(expected);
+    lexer_destroy(lexer);
+    fclose(file);
+}
+
+void test_lexer_parallel(void) {
+    /* Cuts land inside multi-line strings and after quotes in comments */
+    const char *source = "let a = \"one\ntwo\nthree\";\n"
+                         "// a \"quote\" in a comment\n"
+                         "let b = \"\n\n\n\";\n"
+                         "print(a, b, 42, 1.5);\n"
+                         "let c = \"unterminated\n\n";
+    size_t length = strlen(source);
+    Lexer *lexer = lexer_create(source);
+    TokenBuffer *expected = lexer_tokenize_all(lexer);
+
+    int same = 1;
+    for (unsigned threads = 1; threads <= 16; threads++) {
+        TokenBuffer *tokens = lexer_tokenize_parallel(source, length, threads);
+        if (!tokens || tokens->count != expected->count ||
+            tokens->literal_count != expected->literal_count) {
+            same = 0;
+        }
+        for (size_t i = 0; same && i < expected->count; i++) {
+            if (tokens->kinds[i] != expected->kinds[i] || tokens->offsets[i] != expected->offsets[i] ||
+                tokens->lengths[i] != expected->lengths[i]) {
+                same = 0;
+            }
+        }
+        for (size_t i = 0; same && i < expected->literal_count; i++) {
+            if (tokens->literals[i].token != expected->literals[i].token) {
+                same = 0;
+            }
+        }
+        token_buffer_destroy(tokens);
+    }
+    assert_equal_int(same, 1, "test_lexer_parallel same as sequential");
+    assert_equal_int(lexer_position(lexer, expected->offsets[expected->count - 1]).line, 12,
+                     "test_lexer_parallel eof line");
+    token_buffer_destroy(expected);
+    lexer_destroy(lexer);
+}
+
+void test_line_index(void) {
+    /* Offsets resolve to 1-based lines and columns, relative to a window base */
+    const char *text = "ab\n\ncd\nef";
+    LineIndex index;
+    line_index_init(&index, text, 100, strlen(text), 7);
+
+    SourcePosition position = line_index_lookup(&index, 100);
+    assert_equal_int(position.line * 100 + position.column, 701, "test_line_index first byte");
+    position = line_index_lookup(&index, 102);
+    assert_equal_int(position.line * 100 + position.column, 703, "test_line_index newline");
+    position = line_index_lookup(&index, 103);
+    assert_equal_int(position.line * 100 + position.column, 801, "test_line_index empty line");
+    position = line_index_lookup(&index, 109);
+    assert_equal_int(position.line * 100 + position.column, 1003, "test_line_index end");
+    assert_equal_int(line_index_lookup(&index, 99).line, 0, "test_line_index before window");
+    line_index_free(&index);
+}
+
+void test_lexer_utf8(void) {
+    /* Non-ASCII identifiers and strings; other characters are errors */
+    const char *source = "let caf\xc3\xa9 = \"h\xc3\xa9llo \xe2\x9c\x93\";\n"
+                         "\xe5\xa4\x89\xe6\x95\xb0_2 \xf0\x9f\x98\x80 x";
+    Lexer *lexer = lexer_create(source);
+    lexer_next_token(lexer);
+    Token token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_IDENTIFIER, "test_lexer_utf8 identifier kind");
+    assert_equal_int((int)token.length, 5, "test_lexer_utf8 identifier length");
+    lexer_next_token(lexer);
+    token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_STRING, "test_lexer_utf8 string kind");
+    assert_equal_int((int)token.length, 12, "test_lexer_utf8 string length");
+    lexer_next_token(lexer);
+    token = lexer_next_token(lexer);
+    assert_equal_int((int)token.length, 8, "test_lexer_utf8 CJK identifier length");
+    token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_ERROR, "test_lexer_utf8 emoji is an error");
+    token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_IDENTIFIER, "test_lexer_utf8 lexing resumes after emoji");
+    assert_equal_int(lexer_position(lexer, token.offset).column, 15, "test_lexer_utf8 column counts bytes");
+    lexer_destroy(lexer);
+
+    /* Input stops at the first invalid sequence */
+    lexer = lexer_create("a b\xc3(c");
+    lexer_next_token(lexer);
+    lexer_next_token(lexer);
+    token = lexer_next_token(lexer);
+    assert_equal_int(token.kind, TOKEN_ERROR, "test_lexer_utf8 invalid input error");
+    assert_equal_int((int)token.offset, 3, "test_lexer_utf8 invalid input offset");
+    assert_equal_int(lexer_next_token(lexer).kind, TOKEN_EOF, "test_lexer_utf8 invalid input ends");
+    lexer_destroy(lexer);
+
+    /* One-byte chunks split every sequence; parallel cuts drop slices past an error */
+    FILE *file = tmpfile();
+    fputs(source, file);
+    rewind(file);
+    Lexer *expected = lexer_create(source);
+    lexer = lexer_create_fd(fileno(file), 1);
+    int same = 1;
+    for (;;) {
+        Token a = lexer_next_token(expected);
+        Token b = lexer_next_token(lexer);
+        if (a.kind != b.kind || a.length != b.length || a.offset != b.offset) {
+            same = 0;
+            break;
+        }
+        if (a.kind == TOKEN_EOF) {
+            break;
+        }
+    }
+    assert_equal_int(same, 1, "test_lexer_utf8 stream same tokens");
+    lexer_destroy(expected);
+    lexer_destroy(lexer);
+    fclose(file);
+
+    const char *broken = "let a = 1;\nlet b\xe2\x9c = 2;\nlet c = 3;\n";
+    TokenBuffer *tokens = lexer_tokenize_parallel(broken, strlen(broken), 3);
+    assert_equal_int(tokens ? (int)tokens->count : -1, 9, "test_lexer_utf8 parallel stops at error");
+    token_buffer_destroy(tokens);
+}
+
+void test_scan_utf8(void) {
+    /* Errors are found at their sequence start, also across vector blocks */
+    char buffer[80];
+    const char *cases[] = {
+        "\xc3\xa9", "\xc0\xaf", "\xe0\x9f\x80", "\xed\xa0\x80", "\xf4\x90\x80\x80",
+        "\xf0\x9f\x98", "\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80",
+    };
+    const int valid[] = { 1, 0, 0, 0, 0, 0, 0, 1, 1 };
+    int correct = 0;
+    int total = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        size_t size = strlen(cases[c]);
+        for (size_t at = 0; at + size <= 40; at++) {
+            memset(buffer, 'a', 40);
+            memcpy(buffer + at, cases[c], size);
+            size_t end = scan_utf8(buffer, 0, 40);
+            correct += valid[c] ? end == 40 : end == at;
+            total++;
+        }
+    }
+    assert_equal_int(correct, total, "test_scan_utf8 sequences at every alignment");
+    assert_equal_int((int)scan_utf8("ab\xc3\xa9", 0, 3), 2, "test_scan_utf8 cut off by length");
+}
+
 int main(void) {
     printf("Running Lexer Tests...\n\n");
 
     test_lexer_creation();
     test_lexer_token_creation();
+    test_lexer_long_runs();
+    test_lexer_keywords();
+    test_lexer_stream();
+    test_lexer_parallel();
+    test_line_index();
+    test_lexer_utf8();
+    test_scan_utf8();
 
     printf("\n%d/%d tests passed\n", tests_passed, tests_run);
     return tests_passed == tests_run ? 0 : 1;
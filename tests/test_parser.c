@@ -1,7 +1,21 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "../src/parser.h"
+#include "../src/incremental.h"
+#include "../src/parser_parallel.h"
+#include "../src/ast_cache.h"
+#include "../src/passes.h"
+#include "../src/ast_hash.h"
+#include "../src/cse.h"
+#include "../src/resolve.h"
+#include "../src/types.h"
+#include "../src/fold.h"
+#include "../src/dce.h"
+#include "../src/inline.h"
 
 int tests_run = 0;
 int tests_passed = 0;
@@ -38,11 +52,1182 @@ void test_parser_parse(void) {
     }
 }
 
+void test_parser_var_decl(void) {
+    const char *source = "let x = 1; const y = x;";
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_var_decl parses");
+    if (ast) {
+        assert_equal_int((int)ast->data.program.statements.count, 2, "test_parser_var_decl count");
+        assert_equal_int(ast->data.program.statements.items[0]->data.var_decl.is_const, 0, "test_parser_var_decl let");
+        assert_equal_int(ast->data.program.statements.items[1]->data.var_decl.is_const, 1, "test_parser_var_decl const");
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+void test_parser_print_call(void) {
+    const char *source = "print(-7);";
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_print_call parses");
+    if (ast) {
+        ASTNode *call = ast->data.program.statements.items[0]->data.expr_stmt.expression;
+        assert_equal_int(call->type, NODE_CALL, "test_parser_print_call call");
+        assert_equal_int((int)call->data.call.arguments.items[0]->data.int_literal.value, -7,
+                         "test_parser_print_call literal value");
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+/* Child lists on both sides of the inline limit keep their order */
+void test_parser_lists(void) {
+    char source[4096];
+    char *p = source;
+    p += sprintf(p, "func f(a, b, c, d, e, g) {\n");
+    for (int i = 0; i < 100; i++) {
+        p += sprintf(p, "    a = a + %d;\n", i);
+    }
+    p += sprintf(p, "}\nf(1, 2, 3, 4);\nf(1, 2, 3, 4, 5, 6, 7, 8, 9, 10);\nif (1) { } else { f(); f(); }\n");
+
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_lists parses");
+    if (ast) {
+        ASTNode **statements = ast->data.program.statements.items;
+        ASTNode *func = statements[0];
+        assert_equal_int((int)func->data.function_def.parameters.count, 6, "test_parser_lists parameters");
+        assert_equal_int((int)func->data.function_def.parameters.items[5], (int)atom_intern("g", 1),
+                         "test_parser_lists last parameter");
+        assert_equal_int((int)func->data.function_def.body.count, 100, "test_parser_lists body");
+        ASTNode *last = func->data.function_def.body.items[99]->data.expr_stmt.expression;
+        assert_equal_int((int)last->data.binary_op.right->data.binary_op.right->data.int_literal.value, 99,
+                         "test_parser_lists body order");
+
+        for (int i = 1; i <= 2; i++) {
+            NodeList *arguments = &statements[i]->data.expr_stmt.expression->data.call.arguments;
+            int in_order = 1;
+            for (uint32_t j = 0; j < arguments->count; j++) {
+                in_order = in_order && arguments->items[j]->data.int_literal.value == (long)j + 1;
+            }
+            assert_equal_int((int)arguments->count, i == 1 ? 4 : 10, "test_parser_lists argument count");
+            assert_equal_int(in_order, 1, "test_parser_lists argument order");
+        }
+
+        assert_equal_int((int)statements[3]->data.if_stmt.then_branch.count, 0, "test_parser_lists empty branch");
+        assert_equal_int((int)statements[3]->data.if_stmt.else_branch.count, 2, "test_parser_lists else branch");
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+void test_parser_scan_functions(void) {
+    const char *source =
+        "let x = 1;\n"
+        "func f(a, b) { if (a) { func inner(c) { } } return b; }\n"
+        "func g() { }\n"
+        "print(f(1, 2));\n"
+        "func (a) { }\n"
+        "func h(a, 2) { }\n"
+        "func last(z) { }\n";
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    NodeBuffer functions = {0};
+    assert_equal_int(parser_scan_functions(parser, &functions), 1, "test_parser_scan_functions scans");
+    assert_equal_int((int)functions.count, 3, "test_parser_scan_functions top level only");
+    if (functions.count == 3) {
+        ASTNode **items = node_buffer_items(&functions);
+        assert_equal_int(items[0]->data.function_def.name == atom_intern("f", 1) &&
+                         items[0]->data.function_def.parameters.count == 2, 1,
+                         "test_parser_scan_functions signature");
+        assert_equal_int((int)items[1]->data.function_def.parameters.count, 0,
+                         "test_parser_scan_functions no parameters");
+        assert_equal_int(items[2]->data.function_def.name == atom_intern("last", 4), 1,
+                         "test_parser_scan_functions skips malformed");
+        assert_equal_int((int)items[0]->data.function_def.body.count, 0, "test_parser_scan_functions no body");
+    }
+    node_buffer_destroy(&functions);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+void test_parser_compact(void) {
+    const char *source =
+        "func f(a, b) {\n"
+        "    if (a < b) { return -a; } else { print(\"no\", 3000000000); }\n"
+        "}\n"
+        "const x = f(1, 2.5);\n";
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    CompactAst *compact = ast ? compact_ast_build(ast) : NULL;
+    assert_equal_int(compact != NULL, 1, "test_parser_compact builds");
+    if (compact) {
+        /* Pre-order: the program, then the function and everything in it, then the declaration */
+        CompactList statements = compact_ast_list(compact, compact->data[compact->root].a);
+        NodeRef func = statements.items[0];
+        NodeRef decl = statements.items[1];
+        assert_equal_int((int)statements.count == 2 && compact->root == 1 && func == 2, 1,
+                         "test_parser_compact pre-order");
+        assert_equal_int(compact->kinds[func], NODE_FUNCTION_DEF, "test_parser_compact function");
+        CompactList parameters = compact_ast_list(compact, compact->data[func].b);
+        assert_equal_int((int)parameters.count == 2 && parameters.items[1] == atom_intern("b", 1), 1,
+                         "test_parser_compact parameters");
+        CompactList body = compact_ast_list(compact, parameters.end);
+        NodeRef branch = body.items[0];
+        CompactList then_branch = compact_ast_list(compact, compact->data[branch].b);
+        CompactList else_branch = compact_ast_list(compact, then_branch.end);
+        assert_equal_int(compact->kinds[branch] == NODE_IF && then_branch.count == 1 && else_branch.count == 1, 1,
+                         "test_parser_compact branches");
+        assert_equal_int(compact->ops[compact->data[branch].a], OP_LT, "test_parser_compact operator");
+        assert_equal_int((int)compact->offsets[branch], (int)(strstr(source, "if") - source),
+                         "test_parser_compact absolute offset");
+
+        NodeRef call = compact->data[else_branch.items[0]].a;
+        CompactList arguments = compact_ast_list(compact, compact->data[call].b);
+        assert_equal_int(strcmp(compact->strings + compact->data[arguments.items[0]].a, "\"no\""), 0,
+                         "test_parser_compact string");
+        assert_equal_int(compact_ast_int(compact, arguments.items[1]) == 3000000000L, 1,
+                         "test_parser_compact 64-bit integer");
+
+        assert_equal_int(compact->ops[decl], 1, "test_parser_compact const");
+        NodeRef init = compact->data[decl].b;
+        arguments = compact_ast_list(compact, compact->data[init].b);
+        assert_equal_int(compact_ast_float(compact, arguments.items[1]) == 2.5, 1, "test_parser_compact float");
+        assert_equal_int((int)compact->count - 1, (int)arguments.items[1], "test_parser_compact last node");
+    }
+    compact_ast_destroy(compact);
+    ast_destroy(ast);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+/* File offset of the first copy of `bytes` in a file, or -1 */
+static long find_in_file(const char *path, const void *bytes, size_t length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *contents = size > 0 ? malloc((size_t)size) : NULL;
+    long found = -1;
+    if (contents && fread(contents, 1, (size_t)size, file) == (size_t)size) {
+        for (long i = 0; found < 0 && i + (long)length <= size; i++) {
+            found = memcmp(contents + i, bytes, length) == 0 ? i : -1;
+        }
+    }
+    free(contents);
+    fclose(file);
+    return found;
+}
+
+/* Overwrite the 32-bit word at `offset` in a file; returns the word it held */
+static uint32_t swap_file_word(const char *path, long offset, uint32_t value) {
+    uint32_t previous = 0;
+    FILE *file = fopen(path, "r+b");
+    if (file) {
+        fseek(file, offset, SEEK_SET);
+        if (fread(&previous, sizeof(previous), 1, file) == 1) {
+            fseek(file, offset, SEEK_SET);
+            fwrite(&value, sizeof(value), 1, file);
+        }
+        fclose(file);
+    }
+    return previous;
+}
+
+void test_parser_ast_cache(void) {
+    const char *source =
+        "func add(a, b) { return a + b; }\n"
+        "let s = \"cached\";\n"
+        "print(add(1, 2.5), s);\n";
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    CompactAst *compact = ast ? compact_ast_build(ast) : NULL;
+    char dir[] = "/tmp/miru_cache_XXXXXX";
+    bool have_dir = mkdtemp(dir) != NULL;
+    AstCacheKey key = { ast_cache_hash(source, strlen(source)), strlen(source) };
+    assert_equal_int(compact && have_dir && ast_cache_store(dir, &key, compact), 1, "test_parser_ast_cache store");
+
+    /* A hit maps the same arrays back */
+    MappedAst *mapped = ast_cache_load(dir, &key);
+    assert_equal_int(mapped != NULL, 1, "test_parser_ast_cache hit");
+    if (mapped && compact) {
+        const CompactAst *loaded = &mapped->ast;
+        assert_equal_int(loaded->count == compact->count && loaded->root == compact->root &&
+                         memcmp(loaded->kinds, compact->kinds, compact->count) == 0 &&
+                         memcmp(loaded->data, compact->data, compact->count * sizeof(CompactData)) == 0 &&
+                         memcmp(loaded->extra, compact->extra, compact->extra_count * sizeof(uint32_t)) == 0,
+                         1, "test_parser_ast_cache same arrays");
+
+        /* Rebuilt into a pointer tree and lowered again, it gives the same nodes and offsets */
+        ASTNode *expanded = compact_ast_expand(loaded);
+        CompactAst *again = expanded ? compact_ast_build(expanded) : NULL;
+        assert_equal_int(again && again->count == compact->count &&
+                         memcmp(again->offsets, compact->offsets, compact->count * sizeof(uint32_t)) == 0 &&
+                         memcmp(again->data, compact->data, compact->count * sizeof(CompactData)) == 0,
+                         1, "test_parser_ast_cache expand");
+        assert_equal_int(expanded && expanded->data.program.statements.items[1]->offset ==
+                         (uint32_t)(strstr(source, "let") - source), 1, "test_parser_ast_cache statement offset");
+        compact_ast_destroy(again);
+        ast_destroy(expanded);
+    }
+    ast_cache_unmap(mapped);
+
+    /* Another source, or another format version, is a miss */
+    AstCacheKey other = { key.hash, key.length + 1 };
+    assert_equal_int(ast_cache_load(dir, &other) == NULL, 1, "test_parser_ast_cache other source");
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%016llx.ast", dir, (unsigned long long)key.hash);
+
+    /* A corrupted list count or child ref is a miss, not a crash */
+    long extra = compact ? find_in_file(path, compact->extra, compact->extra_count * sizeof(uint32_t)) : -1;
+    long data = compact ? find_in_file(path, compact->data, compact->count * sizeof(CompactData)) : -1;
+    assert_equal_int(extra >= 0 && data >= 0, 1, "test_parser_ast_cache sections found");
+    if (extra >= 0 && data >= 0) {
+        long count = extra + (long)(compact->data[compact->root].a * sizeof(uint32_t));
+        uint32_t previous = swap_file_word(path, count, 0x7fffffff);
+        assert_equal_int(ast_cache_load(dir, &key) == NULL, 1, "test_parser_ast_cache bad list count");
+        swap_file_word(path, count, previous);
+
+        NodeRef binary = NODE_REF_NONE;
+        for (NodeRef ref = 1; ref < compact->count && binary == NODE_REF_NONE; ref++) {
+            binary = compact->kinds[ref] == NODE_BINARY_OP ? ref : NODE_REF_NONE;
+        }
+        long child = data + (long)(binary * sizeof(CompactData) + offsetof(CompactData, a));
+        previous = swap_file_word(path, child, 0x40000000);
+        assert_equal_int(ast_cache_load(dir, &key) == NULL, 1, "test_parser_ast_cache bad child");
+        swap_file_word(path, child, previous);
+
+        /* So is a changed value the tree checks cannot see */
+        long text = find_in_file(path, "ched", 4);
+        uint32_t changed;
+        memcpy(&changed, "chex", sizeof(changed));
+        previous = text >= 0 ? swap_file_word(path, text, changed) : 0;
+        assert_equal_int(text >= 0 && ast_cache_load(dir, &key) == NULL, 1, "test_parser_ast_cache changed string");
+        if (text >= 0) {
+            swap_file_word(path, text, previous);
+        }
+
+        MappedAst *restored = ast_cache_load(dir, &key);
+        assert_equal_int(restored != NULL, 1, "test_parser_ast_cache restored");
+        ast_cache_unmap(restored);
+    }
+
+    FILE *file = fopen(path, "r+b");
+    uint32_t version = AST_CACHE_VERSION + 1;
+    if (file) {
+        fseek(file, 8, SEEK_SET);
+        fwrite(&version, sizeof(version), 1, file);
+        fclose(file);
+    }
+    assert_equal_int(ast_cache_load(dir, &key) == NULL, 1, "test_parser_ast_cache version");
+
+    /* Stores leave no temporary files behind */
+    remove(path);
+    assert_equal_int(have_dir && rmdir(dir) == 0, 1, "test_parser_ast_cache no temporaries");
+    compact_ast_destroy(compact);
+    ast_destroy(ast);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+/* Passes for test_pass_manager: the state counts the passes that ran */
+static PassStatus parse_test_pass(void *state) {
+    int *ran = state;
+    Lexer *lexer = lexer_create("let x = 1 + 2; print(x);");
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    (*ran)++;
+    return ast ? PASS_DONE : PASS_FAILED;
+}
+
+static PassStatus skipped_test_pass(void *state) {
+    (void)state;
+    return PASS_SKIPPED;
+}
+
+static PassStatus failing_test_pass(void *state) {
+    int *ran = state;
+    (*ran)++;
+    return PASS_FAILED;
+}
+
+void test_pass_manager(void) {
+    const Pass passes[] = {
+        { "parse", parse_test_pass },
+        { "skipped", skipped_test_pass },
+        { "fail", failing_test_pass },
+        { "after", parse_test_pass },
+    };
+    Arena *arena = arena_create(0);
+    ast_use_arena(arena);
+    PassManager manager;
+    pass_manager_init(&manager, true);
+    int ran = 0;
+    bool ok = pass_manager_run(&manager, passes, 4, &ran);
+    ast_use_arena(NULL);
+    assert_equal_int(ok, 0, "test_pass_manager failure stops the run");
+    assert_equal_int(ran, 2, "test_pass_manager passes run");
+    assert_equal_int((int)manager.count, 2, "test_pass_manager skipped pass not recorded");
+    if (manager.count == 2) {
+        assert_equal_int(strcmp(manager.records[1].name, "fail"), 0, "test_pass_manager names");
+        /* program, declaration, binary op, two literals, expression statement, call, identifier x twice, print */
+        assert_equal_int((int)manager.records[0].allocations, 10, "test_pass_manager arena allocations");
+        assert_equal_int(manager.records[0].bytes == arena->bytes_used && manager.records[0].peak_rss_kb > 0, 1,
+                         "test_pass_manager bytes and rss");
+    }
+
+    char path[] = "/tmp/miru_trace_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+    }
+    assert_equal_int(fd >= 0 && pass_manager_write_trace(&manager, path), 1, "test_pass_manager trace");
+    FILE *file = fopen(path, "r");
+    char trace[1024] = "";
+    if (file) {
+        size_t length = fread(trace, 1, sizeof(trace) - 1, file);
+        trace[length] = '\0';
+        fclose(file);
+    }
+    assert_equal_int(strstr(trace, "\"name\":\"parse\",\"cat\":\"pass\",\"ph\":\"X\"") != NULL &&
+                     strstr(trace, "\"traceEvents\":[") != NULL && strstr(trace, "]}") != NULL,
+                     1, "test_pass_manager trace events");
+    remove(path);
+    pass_manager_free(&manager);
+    arena_destroy(arena);
+}
+
+/* Parse a source whose program then outlives the parser */
+static ASTNode *parse_source(const char *source) {
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    return ast;
+}
+
+/* The expression of a top-level statement: a declaration's initializer or an expression statement */
+static ASTNode *statement_expression(ASTNode *program, size_t index) {
+    ASTNode *statement = program->data.program.statements.items[index];
+    return statement->type == NODE_VAR_DECL ? statement->data.var_decl.initializer
+                                            : statement->data.expr_stmt.expression;
+}
+
+void test_ast_hash(void) {
+    ASTNode *ast = parse_source("let a = (x + 1) * f(y);\n  let b = (x + 1) * f(y);\nlet c = (x + 1) * f(z);\n"
+                                "let d = (1 + x) * f(y);");
+    ASTNode *a = statement_expression(ast, 0), *b = statement_expression(ast, 1);
+    ASTNode *c = statement_expression(ast, 2), *d = statement_expression(ast, 3);
+    assert_equal_int(ast_hash(a) == ast_hash(b) && ast_equal(a, b), 1, "test_ast_hash equal at other offsets");
+    assert_equal_int(ast_hash(a) != ast_hash(c) && !ast_equal(a, c), 1, "test_ast_hash other name");
+    assert_equal_int(ast_hash(a) != ast_hash(d) && !ast_equal(a, d), 1, "test_ast_hash operand order");
+    assert_equal_int(ast_hash(ast->data.program.statements.items[0]) !=
+                     ast_hash(ast->data.program.statements.items[1]), 1, "test_ast_hash declared name");
+    ast_destroy(ast);
+
+    /* Subtrees far deeper than the C stack would allow */
+    int depth = 100000;
+    char *source = malloc(2 * (size_t)depth + 16);
+    if (source) {
+        memset(source, '-', (size_t)depth);
+        strcpy(source + depth, "x; ");
+        memset(source + depth + 3, '-', (size_t)depth);
+        strcpy(source + 2 * depth + 3, "x;");
+        ast = parse_source(source);
+        assert_equal_int(ast && ast_equal(statement_expression(ast, 0), statement_expression(ast, 1)) &&
+                         ast_hash(statement_expression(ast, 0)) == ast_hash(statement_expression(ast, 1)),
+                         1, "test_ast_hash deep");
+        ast_destroy(ast);
+        free(source);
+    }
+}
+
+void test_cse(void) {
+    CseStats stats;
+    ASTNode *ast = parse_source("let a = x * y + x * y;\nlet b = x * y;\nprint(a + b);");
+    bool ok = cse_program(ast, &stats);
+    NodeList *statements = &ast->data.program.statements;
+    assert_equal_int(ok && stats.temporaries == 1 && stats.eliminated == 2, 1, "test_cse stats");
+    ASTNode *temporary = statements->items[0];
+    assert_equal_int(statements->count == 4 && temporary->type == NODE_VAR_DECL &&
+                     temporary->data.var_decl.is_const &&
+                     temporary->data.var_decl.initializer->type == NODE_BINARY_OP &&
+                     temporary->data.var_decl.initializer->data.binary_op.op == OP_MUL, 1,
+                     "test_cse temporary declared first");
+    ASTNode *sum = statement_expression(ast, 1);
+    ASTNode *b = statement_expression(ast, 2);
+    Atom name = temporary->data.var_decl.name;
+    assert_equal_int(sum->data.binary_op.left->type == NODE_IDENTIFIER &&
+                     sum->data.binary_op.left->data.identifier.name == name &&
+                     sum->data.binary_op.right->data.identifier.name == name &&
+                     b->type == NODE_IDENTIFIER && b->data.identifier.name == name,
+                     1, "test_cse occurrences read the temporary");
+    ast_destroy(ast);
+
+    /* An assignment in between, even inside a call argument or a branch, ends the reuse */
+    ast = parse_source("let a = x * y;\nf(x = 2);\nlet b = x * y;\nif (a) { y = 1; }\nlet c = x * y;");
+    ok = cse_program(ast, &stats);
+    assert_equal_int(ok && stats.temporaries == 0 && ast->data.program.statements.count == 5, 1,
+                     "test_cse assignment kills");
+    ast_destroy(ast);
+
+    /* The right operand of && may not run, so it reuses a temporary but never starts one */
+    ast = parse_source("let a = c && x * y;\nlet b = x * y;\nlet d = c || x * y;");
+    ok = cse_program(ast, &stats);
+    ASTNode *skipped = ok ? statement_expression(ast, 0)->data.binary_op.right : NULL;
+    assert_equal_int(ok && stats.temporaries == 1 && stats.eliminated == 1 &&
+                     ast->data.program.statements.count == 4 &&
+                     ast->data.program.statements.items[1]->type == NODE_VAR_DECL &&
+                     skipped->type == NODE_BINARY_OP && skipped->data.binary_op.op == OP_MUL,
+                     1, "test_cse conditional operand");
+    ast_destroy(ast);
+
+    /* A temporary does not take a name the program already has */
+    ast = parse_source("let x = 3;\nlet miru_cse_0 = 10;\nlet a = (x + 1) * (x + 1);");
+    ok = cse_program(ast, &stats);
+    ASTNode *named = ok ? ast->data.program.statements.items[2] : NULL;
+    assert_equal_int(ok && stats.temporaries == 1 && named->type == NODE_VAR_DECL &&
+                     strcmp(atom_name(named->data.var_decl.name), "miru_cse_0") != 0 &&
+                     resolve_program(ast, NULL), 1, "test_cse names unused");
+    ast_destroy(ast);
+}
+
+void test_resolve(void) {
+    ASTNode *ast = parse_source("func f(a, b) {\n"
+                                "    let c = a;\n"
+                                "    if (c) { let d = b; } else { let e = c; }\n"
+                                "    return c;\n"
+                                "}\n"
+                                "let x = 1;\n"
+                                "if (x) { let x = 2; print(x); }\n"
+                                "let z = f(x, 2);\n");
+    bool ok = resolve_program(ast, NULL);
+    assert_equal_int(ok, 1, "test_resolve resolves");
+    NodeList *statements = &ast->data.program.statements;
+    ASTNode *f = statements->items[0];
+    NodeList *body = &f->data.function_def.body;
+    ASTNode *returned = body->items[2]->data.return_stmt.value;
+    ASTNode *d = body->items[1]->data.if_stmt.then_branch.items[0];
+    ASTNode *e = body->items[1]->data.if_stmt.else_branch.items[0];
+    assert_equal_int(f->data.function_def.locals == 4 && d->data.var_decl.slot == 3 && e->data.var_decl.slot == 3 &&
+                     returned->data.identifier.depth == 1 && returned->data.identifier.slot == 2, 1,
+                     "test_resolve function frame reuses slots");
+
+    /* The inner x hides the outer one in its branch only */
+    ASTNode *branch = statements->items[2];
+    ASTNode *inner = branch->data.if_stmt.then_branch.items[1]->data.expr_stmt.expression->data.call.arguments.items[0];
+    ASTNode *outer = statements->items[3]->data.var_decl.initializer->data.call.arguments.items[0];
+    ASTNode *callee = statements->items[3]->data.var_decl.initializer->data.call.function;
+    assert_equal_int(inner->data.identifier.depth == 2 && inner->data.identifier.slot == 1 &&
+                     outer->data.identifier.depth == 1 && outer->data.identifier.slot == 0, 1,
+                     "test_resolve shadowing");
+    assert_equal_int(callee->data.identifier.depth == 0 && callee->data.identifier.slot == 1 &&
+                     statements->items[3]->data.var_decl.slot == 1 && ast->data.program.locals == 2, 1,
+                     "test_resolve globals and main");
+    ast_destroy(ast);
+
+    /* Every error is found, not only the first; names in error stay unresolved */
+    const char *errors[] = {
+        "print(y);",
+        "const k = 1; k = 2;",
+        "let q = q + 1;",
+        "let x = 1; let x = 2;",
+        "func f(a) { return a; } print(f(1, 2));",
+        "func f(a) { return x; } let x = 1;",
+        "let w = 1; w(2);",
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        ast = parse_source(errors[i]);
+        failed += ast && !resolve_program(ast, NULL);
+        ast_destroy(ast);
+    }
+    assert_equal_int(failed, (int)(sizeof(errors) / sizeof(errors[0])), "test_resolve errors");
+}
+
+/* Resolve and type a source; the program outlives the types */
+static bool infer_source(const char *source, ASTNode **ast, ProgramTypes *types) {
+    *ast = parse_source(source);
+    return *ast && resolve_program(*ast, NULL) && types_infer(*ast, NULL, types);
+}
+
+void test_types(void) {
+    ASTNode *ast;
+    ProgramTypes types;
+    bool ok = infer_source("func half(x) { return x / 2; }\n"
+                           "func less(a, b) { return a < b; }\n"
+                           "let n = half(7);\n"
+                           "let r = half(7.5);\n"
+                           "let w = 1;\n"
+                           "while (w < 10) { w = w * 1.5; }\n"
+                           "let s = \"text\";\n"
+                           "print(less(n, 2));\n",
+                           &ast, &types);
+    assert_equal_int(ok && types.function_count == 3, 1, "test_types infers");
+    NodeList *statements = &ast->data.program.statements;
+    assert_equal_int(types.functions[0].parameters[0] == TYPE_INT && types.functions[1].result == TYPE_FLOAT &&
+                     statements->items[3]->data.var_decl.type == TYPE_INT &&
+                     statements->items[4]->data.var_decl.type == TYPE_FLOAT, 1,
+                     "test_types each call typed for its arguments");
+    assert_equal_int(types.functions[2].result == TYPE_BOOL && types.functions[2].parameters[1] == TYPE_INT &&
+                     types_of(statement_expression(ast, 8)->data.call.arguments.items[0]) == TYPE_BOOL, 1,
+                     "test_types comparisons give bools");
+    ASTNode *loop = statements->items[6];
+    assert_equal_int(statements->items[5]->data.var_decl.type == TYPE_FLOAT &&
+                     loop->data.while_stmt.condition->data.binary_op.left->data.identifier.type == TYPE_FLOAT &&
+                     statements->items[7]->data.var_decl.type == TYPE_STRING, 1,
+                     "test_types assignment widens the declaration");
+    program_types_free(&types);
+    ast_destroy(ast);
+
+    /* Every type error is reported */
+    const char *errors[] = {
+        "let x = 1; x = \"s\";",
+        "let y = \"a\" + 1;",
+        "let z = print(1);",
+        "if (\"s\") { print(1); }",
+        "func g(p) { if (p) { return 1; } return \"x\"; } g(true);",
+        "let m = 2.5 % 2;",
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        failed += !infer_source(errors[i], &ast, &types);
+        ast_destroy(ast);
+    }
+    assert_equal_int(failed, (int)(sizeof(errors) / sizeof(errors[0])), "test_types errors");
+}
+
+/* Resolve and type a source one statement at a time, as --stream does */
+static bool stream_source(const char *source, ASTNode **ast) {
+    *ast = parse_source(source);
+    Resolver *resolver = resolver_create(NULL);
+    Typer *typer = typer_create(NULL);
+    NodeList *statements = &(*ast)->data.program.statements;
+    bool ok = true;
+    for (size_t i = 0; i < statements->count; i++) {
+        if (statements->items[i]->type == NODE_FUNCTION_DEF) {
+            ok = resolver_declare_functions(resolver, &statements->items[i], 1) && ok;
+        }
+    }
+    for (size_t i = 0; i < statements->count && ok; i++) {
+        ok = resolver_resolve_statement(resolver, statements->items[i]) &&
+             typer_type_statement(typer, statements->items[i]);
+    }
+    typer_destroy(typer);
+    resolver_destroy(resolver);
+    return ok;
+}
+
+void test_types_stream(void) {
+    ASTNode *ast;
+    bool ok = stream_source("let x = \"inner\";\n"
+                            "let q = 10.0 / 4;\n"
+                            "func id(a) { let s = 1.5; s = s + a; return a; }\n"
+                            "print(id(2));\n"
+                            "print(x == \"inner\");\n"
+                            "func even(n) { return n % 2 == 0; }\n"
+                            "func half(n) { if (n < 1) { return half(n + 2); } return n / 2.0; }\n"
+                            "let h = half(3);\n"
+                            "print(even(id(true)));\n",
+                            &ast);
+    assert_equal_int(ok, 1, "test_types_stream types");
+    NodeList *statements = &ast->data.program.statements;
+    ASTNode *local = statements->items[2]->data.function_def.body.items[0];
+    assert_equal_int(statements->items[0]->data.var_decl.type == TYPE_STRING &&
+                     statements->items[1]->data.var_decl.type == TYPE_FLOAT &&
+                     local->data.var_decl.type == TYPE_FLOAT, 1,
+                     "test_types_stream variables take their initializers' types");
+    assert_equal_int(types_of(statement_expression(ast, 3)->data.call.arguments.items[0]) == TYPE_INT &&
+                     types_of(statement_expression(ast, 4)->data.call.arguments.items[0]) == TYPE_BOOL, 1,
+                     "test_types_stream print arguments");
+    assert_equal_int(statements->items[7]->data.var_decl.type == TYPE_FLOAT &&
+                     types_of(statement_expression(ast, 8)->data.call.arguments.items[0]) == TYPE_BOOL, 1,
+                     "test_types_stream results typed from the bodies");
+    ast_destroy(ast);
+
+    /* What types_infer would widen, or could only type by the calls, cannot be streamed */
+    const char *errors[] = {
+        "let x = 1; x = x / 2.0;",
+        "let b = true; b = 5;",
+        "func g(a) { return a; } g(1.5);",
+        "func s(a) { return a; } s(\"x\");",
+        "print(later()); func later() { return 0.5; }",
+        "let y = \"a\" + 1;",
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        failed += !stream_source(errors[i], &ast);
+        ast_destroy(ast);
+    }
+    assert_equal_int(failed, (int)(sizeof(errors) / sizeof(errors[0])), "test_types_stream errors");
+}
+
+/* The name a call statement's callee has been bound to */
+static const char *callee_name(ASTNode *program, size_t index) {
+    return atom_name(statement_expression(program, index)->data.call.function->data.identifier.name);
+}
+
+void test_specialize(void) {
+    ASTNode *ast;
+    ProgramTypes types;
+    bool ok = infer_source("func max(a, b) { if (a > b) { return a; } return b; }\n"
+                           "let i = max(1, 2);\n"
+                           "let d = max(1.5, 2.5);\n"
+                           "let j = max(3, 4);\n",
+                           &ast, &types);
+    NodeList *statements = &ast->data.program.statements;
+    assert_equal_int(ok && types.function_count == 2 && statements->count == 5, 1, "test_specialize copies");
+    ASTNode *longs = statements->items[0], *doubles = statements->items[1];
+    assert_equal_int(strcmp(atom_name(longs->data.function_def.name), "max__ll") == 0 &&
+                     strcmp(atom_name(doubles->data.function_def.name), "max__dd") == 0 &&
+                     longs->data.function_def.body.items[1] != doubles->data.function_def.body.items[1], 1,
+                     "test_specialize names");
+    assert_equal_int(strcmp(callee_name(ast, 2), "max__ll") == 0 && strcmp(callee_name(ast, 3), "max__dd") == 0 &&
+                     strcmp(callee_name(ast, 4), "max__ll") == 0 && types.functions[1].result == TYPE_FLOAT &&
+                     types_of(statement_expression(ast, 2)) == TYPE_INT, 1, "test_specialize calls");
+    program_types_free(&types);
+    ast_destroy(ast);
+
+    /* Recursion with other argument types settles on one more copy */
+    ok = infer_source("func f(x, n) { if (n > 0) { return f(x + 0.5, n - 1); } return x; }\n"
+                      "print(f(1, 3));\n",
+                      &ast, &types);
+    ASTNode *call = statement_expression(ast, 2)->data.call.arguments.items[0];
+    assert_equal_int(ok && types.function_count == 2 &&
+                     strcmp(atom_name(call->data.call.function->data.identifier.name), "f__ll") == 0 &&
+                     types.functions[0].result == TYPE_FLOAT && types.functions[1].parameters[0] == TYPE_FLOAT, 1,
+                     "test_specialize recursion");
+    program_types_free(&types);
+    ast_destroy(ast);
+
+    /* Past the limit, calls share the generic function, as wide as all their arguments */
+    ok = infer_source("func p(a, b) { return a; }\n"
+                      "p(true, true); p(true, 1); p(true, 1.5); p(1, true); p(1, 1);\n"
+                      "p(1, 1.5); p(1.5, true); p(1.5, 1); p(2, true); p(\"s\", 1);\n",
+                      &ast, &types);
+    assert_equal_int(ok && types.function_count == 9 && strcmp(callee_name(ast, 17), "p__lb") == 0 &&
+                     strcmp(callee_name(ast, 18), "p") == 0 && types.functions[8].parameters[0] == TYPE_STRING,
+                     1, "test_specialize limit");
+    program_types_free(&types);
+    ast_destroy(ast);
+}
+
+void test_fold(void) {
+    ASTNode *ast;
+    ProgramTypes types;
+    FoldStats stats;
+    bool ok = infer_source("const h = 2 * 60 * 60;\n"
+                           "let d = 7 / -2;\n"
+                           "let m = -7 % 3;\n"
+                           "let z = 1 / 0;\n"
+                           "let o = 4611686018427387904 * 2;\n"
+                           "let f = 1.5 * 2 > 2 && \"a\" != \"b\";\n"
+                           "if (h > 3600) { print(h); } else { print(0); }\n"
+                           "while (false) { print(1); }\n"
+                           "let v = 1;\n"
+                           "v = v + h;\n",
+                           &ast, &types);
+    ok = ok && fold_program(ast, &stats);
+    NodeList *statements = &ast->data.program.statements;
+    assert_equal_int(ok && statements->count == 9 && stats.branches == 2 && stats.propagated == 3, 1,
+                     "test_fold stats");
+    assert_equal_int(statement_expression(ast, 0)->data.int_literal.value == 7200 &&
+                     statement_expression(ast, 1)->data.int_literal.value == -3 &&
+                     statement_expression(ast, 2)->data.int_literal.value == -1 &&
+                     statement_expression(ast, 5)->type == NODE_BOOL_LITERAL &&
+                     statement_expression(ast, 5)->data.bool_literal.value == 1, 1,
+                     "test_fold computes as C does");
+    assert_equal_int(statement_expression(ast, 3)->type == NODE_BINARY_OP &&
+                     statement_expression(ast, 4)->type == NODE_BINARY_OP, 1,
+                     "test_fold leaves division by zero and overflow to run time");
+    ASTNode *print = statement_expression(ast, 6);
+    ASTNode *sum = statement_expression(ast, 8)->data.binary_op.right;
+    assert_equal_int(print->type == NODE_CALL && print->data.call.arguments.items[0]->data.int_literal.value == 7200 &&
+                     sum->data.binary_op.left->type == NODE_IDENTIFIER &&
+                     sum->data.binary_op.right->data.int_literal.value == 7200, 1,
+                     "test_fold propagates constants and takes the branch");
+    program_types_free(&types);
+    ast_destroy(ast);
+}
+
+void test_dce(void) {
+    ASTNode *ast;
+    ProgramTypes types;
+    DceStats stats;
+    bool ok = infer_source("func dead(x) { return x; }\n"
+                           "func side(x) { print(x); return x; }\n"
+                           "func f(n) { return n; print(n); }\n"
+                           "let a = side(1);\n"
+                           "let b = 2;\n"
+                           "let k = 5;\n"
+                           "let y = (k = 6);\n"
+                           "let c = 3;\n"
+                           "print(f(c));\n",
+                           &ast, &types);
+    ok = ok && dce_program(ast, &types, &stats);
+    NodeList *statements = &ast->data.program.statements;
+    assert_equal_int(ok && stats.functions == 1 && stats.unreachable == 1 && statements->count == 5, 1,
+                     "test_dce stats");
+    assert_equal_int(strcmp(atom_name(statements->items[0]->data.function_def.name), "side") == 0 &&
+                     statements->items[1]->data.function_def.body.count == 1 && types.function_count == 2 &&
+                     types.functions[1].parameter_count == 1, 1,
+                     "test_dce removes the function nothing calls, with its signature");
+    assert_equal_int(statements->items[2]->type == NODE_EXPRESSION_STMT &&
+                     statement_expression(ast, 2)->type == NODE_CALL &&
+                     statements->items[3]->type == NODE_VAR_DECL, 1,
+                     "test_dce keeps the effects of what it removes");
+    program_types_free(&types);
+    ast_destroy(ast);
+
+    /* A library has no main, so any of its functions may be called */
+    ok = infer_source("func g(x) { return x; }\nfunc h(x) { return g(x); }\n", &ast, &types);
+    ok = ok && dce_program(ast, &types, &stats);
+    assert_equal_int(ok && stats.functions == 0 && ast->data.program.statements.count == 2, 1,
+                     "test_dce keeps a library's functions");
+    program_types_free(&types);
+    ast_destroy(ast);
+}
+
+void test_inline(void) {
+    ASTNode *ast;
+    ProgramTypes types;
+    InlineStats stats;
+    bool ok = infer_source("func max(a, b) { if (a > b) { return a; } return b; }\n"
+                           "func root(n) { let i = 0; while (i < n) { if (i * i == n) { return i; } i = i + 1; } return 0; }\n"
+                           "func f(n) { if (n < 1) { return 1; } return n * f(n - 1); }\n"
+                           "let m = max(3, 4);\n"
+                           "print(root(9));\n"
+                           "print(f(3));\n",
+                           &ast, &types);
+    ok = ok && inline_program(ast, &types, NULL, &stats);
+    NodeList *statements = &ast->data.program.statements;
+    assert_equal_int(ok && stats.inlined == 2 && stats.recursive == 1 && statements->count == 10, 1,
+                     "test_inline stats");
+    ASTNode *result = statements->items[3], *body = statements->items[4];
+    assert_equal_int(result->type == NODE_VAR_DECL && result->data.var_decl.type == TYPE_INT &&
+                     body->type == NODE_BLOCK && body->data.block.statements.count == 3 &&
+                     body->data.block.statements.items[2]->type == NODE_IF &&
+                     body->data.block.statements.items[2]->data.if_stmt.else_branch.count == 1 &&
+                     statement_expression(ast, 5)->type == NODE_IDENTIFIER &&
+                     statement_expression(ast, 5)->data.identifier.depth != SCOPE_UNRESOLVED, 1,
+                     "test_inline lowers returns into the branches");
+    /* The return in the loop sets a flag the loop and the code after it test */
+    ASTNode *loop_body = statements->items[7];
+    ASTNode *flag = loop_body->data.block.statements.items[1];
+    assert_equal_int(loop_body->type == NODE_BLOCK && flag->type == NODE_VAR_DECL && flag->data.var_decl.type == TYPE_BOOL &&
+                     statements->items[9]->data.expr_stmt.expression->data.call.arguments.items[0]->type == NODE_CALL,
+                     1, "test_inline leaves returns in loops to a flag and recursion alone");
+    program_types_free(&types);
+    ast_destroy(ast);
+
+    /* A threshold of 0 inlines nothing */
+    InlineOptions options;
+    inline_options_default(&options);
+    options.threshold = 0;
+    ok = infer_source("func g(x) { return x; }\nprint(g(1));\n", &ast, &types);
+    ok = ok && inline_program(ast, &types, &options, &stats);
+    assert_equal_int(ok && stats.inlined == 0 && ast->data.program.statements.count == 2, 1,
+                     "test_inline threshold");
+    program_types_free(&types);
+    ast_destroy(ast);
+
+    /* The copies' names stay clear of the program's own */
+    ok = infer_source("let miru_inline_0 = 50;\nfunc g(v) { return v + 1; }\nlet r = g(miru_inline_0);\n", &ast, &types);
+    ok = ok && inline_program(ast, &types, NULL, &stats);
+    assert_equal_int(ok && stats.inlined == 1 &&
+                     strcmp(atom_name(ast->data.program.statements.items[2]->data.var_decl.name), "miru_inline_0_") == 0,
+                     1, "test_inline names unused");
+    program_types_free(&types);
+    ast_destroy(ast);
+}
+
+void test_parser_precedence(void) {
+    /* x = (y = ((1 - 2) - 3 * -f(4)(5)) || (b && c)) */
+    const char *source = "x = y = 1 - 2 - 3 * -f(4)(5) || b && c;";
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_precedence parses");
+    if (ast) {
+        ASTNode *assign = ast->data.program.statements.items[0]->data.expr_stmt.expression;
+        assert_equal_int(assign->data.binary_op.op, OP_ASSIGN, "test_parser_precedence assignment");
+        ASTNode *inner = assign->data.binary_op.right;
+        assert_equal_int(inner->data.binary_op.op, OP_ASSIGN, "test_parser_precedence assignment is right-associative");
+        ASTNode *or = inner->data.binary_op.right;
+        assert_equal_int(or->data.binary_op.op, OP_OR, "test_parser_precedence || binds loosest");
+        assert_equal_int(or->data.binary_op.right->data.binary_op.op, OP_AND, "test_parser_precedence && over ||");
+        ASTNode *sub = or->data.binary_op.left;
+        assert_equal_int(sub->data.binary_op.left->data.binary_op.op, OP_SUB, "test_parser_precedence - is left-associative");
+        ASTNode *mul = sub->data.binary_op.right;
+        assert_equal_int(mul->data.binary_op.op, OP_MUL, "test_parser_precedence * over -");
+        ASTNode *neg = mul->data.binary_op.right;
+        assert_equal_int(neg->type, NODE_UNARY_OP, "test_parser_precedence unary minus");
+        assert_equal_int(neg->data.unary_op.operand->data.call.function->type, NODE_CALL,
+                         "test_parser_precedence calls bind tightest");
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+
+    lexer = lexer_create("1 + x = 2;");
+    parser = parser_create(lexer);
+    ast = parser_parse(parser);
+    assert_equal_int(ast == NULL, 1, "test_parser_precedence invalid assignment target");
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+}
+
+/* Parse a source with stderr sent to a file; `errors` gets what was printed */
+static void parse_errors(const char *source, char *errors, size_t size) {
+    FILE *file = tmpfile();
+    int saved = dup(fileno(stderr));
+    errors[0] = '\0';
+    if (!file || saved < 0) {
+        if (file) {
+            fclose(file);
+        }
+        return;
+    }
+    fflush(stderr);
+    dup2(fileno(file), fileno(stderr));
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ast_destroy(parser_parse(parser));
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    fflush(stderr);
+    dup2(saved, fileno(stderr));
+    close(saved);
+    rewind(file);
+    size_t length = fread(errors, 1, size - 1, file);
+    errors[length] = '\0';
+    fclose(file);
+}
+
+void test_parser_error_token(void) {
+    /* A token the lexer rejected is reported with the lexer's message */
+    char errors[256];
+    parse_errors("let \xC3( = 2;", errors, sizeof(errors));
+    assert_equal_int(strstr(errors, "Invalid UTF-8") != NULL, 1, "test_parser_error_token in place of a name");
+    parse_errors("let x = 1 + \xC3(;", errors, sizeof(errors));
+    assert_equal_int(strstr(errors, "Invalid UTF-8") != NULL, 1, "test_parser_error_token in an expression");
+    parse_errors("let x = 1 & 2;", errors, sizeof(errors));
+    assert_equal_int(strstr(errors, "Unexpected character '&'") != NULL, 1, "test_parser_error_token in place of an operator");
+    parse_errors("let = 2;", errors, sizeof(errors));
+    assert_equal_int(strstr(errors, "Expected identifier") != NULL, 1, "test_parser_error_token other tokens unchanged");
+}
+
+void test_parser_deep_nesting(void) {
+    /* Far deeper than the C stack could hold one frame per level */
+    const int depth = 100000;
+    char *source = malloc((size_t)depth * 3 + 16);
+    char *p = source;
+    p += sprintf(p, "x = ");
+    for (int i = 0; i < depth; i++) {
+        *p++ = '-';
+        *p++ = '(';
+    }
+    *p++ = '1';
+    memset(p, ')', (size_t)depth);
+    strcpy(p + depth, ";");
+
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_deep_nesting parses");
+    if (ast) {
+        ASTNode *node = ast->data.program.statements.items[0]->data.expr_stmt.expression->data.binary_op.right;
+        int levels = 0;
+        while (node->type == NODE_UNARY_OP) {
+            node = node->data.unary_op.operand;
+            levels++;
+        }
+        assert_equal_int(levels, depth, "test_parser_deep_nesting depth");
+
+        CompactAst *compact = compact_ast_build(ast);
+        assert_equal_int(compact && compact->count == (size_t)depth + 6, 1, "test_parser_deep_nesting compact");
+        compact_ast_destroy(compact);
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+
+    /* A missing ')' at the bottom unwinds every level */
+    p[depth - 1] = ';';
+    p[depth] = '\0';
+    lexer = lexer_create(source);
+    parser = parser_create(lexer);
+    ast = parser_parse(parser);
+    assert_equal_int(ast == NULL, 1, "test_parser_deep_nesting unbalanced");
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    free(source);
+}
+
+void test_token_buffer(void) {
+    const char *source = "x = 3.5 + 2;";
+    Lexer *lexer = lexer_create(source);
+    TokenBuffer *tokens = lexer_tokenize_all(lexer);
+    assert_equal_int((int)tokens->count, 7, "test_token_buffer count");
+    assert_equal_int(tokens->kinds[tokens->count - 1], TOKEN_EOF, "test_token_buffer eof");
+    assert_equal_int((int)tokens->offsets[2], 4, "test_token_buffer offset");
+    assert_equal_int((int)tokens->lengths[2], 3, "test_token_buffer length");
+    assert_equal_int((int)token_buffer_literal(tokens, 4)->value.int_value, 2, "test_token_buffer int value");
+    assert_equal_int(token_buffer_literal(tokens, 1) == NULL, 1, "test_token_buffer no value");
+    token_buffer_destroy(tokens);
+    lexer_destroy(lexer);
+}
+
+void test_parser_stream(void) {
+    /* Enough statements that consumed tokens are discarded mid-parse */
+    FILE *file = tmpfile();
+    for (int i = 0; i < 2000; i++) {
+        fprintf(file, "let value_%d = %d;\n", i, i);
+    }
+    rewind(file);
+
+    Lexer *lexer = lexer_create_fd(fileno(file), 16);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_stream parses");
+    if (ast) {
+        ASTNode *last = ast->data.program.statements.items[ast->data.program.statements.count - 1];
+        assert_equal_int((int)ast->data.program.statements.count, 2000, "test_parser_stream count");
+        assert_equal_int(strcmp(atom_name(last->data.var_decl.name), "value_1999"), 0, "test_parser_stream name");
+        assert_equal_int((int)last->data.var_decl.initializer->data.int_literal.value, 1999,
+                         "test_parser_stream value");
+        /* The last statement is still inside the lexer's window */
+        assert_equal_int(lexer_position(lexer, last->offset).line, 2000, "test_parser_stream line");
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    fclose(file);
+}
+
+void test_atoms(void) {
+    const char *source = "count counter count";
+    Atom count = atom_intern(source, 5);
+    const char *text = atom_name(count);
+    assert_equal_int(atom_intern(source + 14, 5) == count, 1, "test_atoms same slice same atom");
+    assert_equal_int(atom_intern(source + 6, 7) != count, 1, "test_atoms different name");
+    assert_equal_int(atom_intern("print", 5) == ATOM_PRINT, 1, "test_atoms builtin print");
+
+    /* Growing the table keeps atoms and canonical pointers stable */
+    char name[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(name, sizeof(name), "name_%d", i);
+        atom_intern(name, strlen(name));
+    }
+    assert_equal_int(atom_intern("count", 5) == count && atom_name(count) == text, 1,
+                     "test_atoms stable after growth");
+    assert_equal_int(strcmp(atom_name(count), "count"), 0, "test_atoms canonical text");
+}
+
+/* Parse `source` serially and on four threads and compare the top-level statements */
+static int parallel_matches_serial(const char *source, int *statements) {
+    Lexer *lexer = lexer_create(source);
+    TokenBuffer *tokens = lexer_tokenize_all(lexer);
+    Parser *parser = parser_create_from_tokens(lexer, tokens, 0);
+    ASTNode *serial = parser_parse(parser);
+    ASTNode *parallel = parser_parse_parallel(lexer, tokens, 4);
+
+    int same = (serial == NULL) == (parallel == NULL);
+    if (serial && parallel) {
+        same = serial->data.program.statements.count == parallel->data.program.statements.count;
+        for (size_t i = 0; same && i < serial->data.program.statements.count; i++) {
+            ASTNode *a = serial->data.program.statements.items[i];
+            ASTNode *b = parallel->data.program.statements.items[i];
+            same = a->type == b->type && a->offset == b->offset &&
+                   (a->type != NODE_FUNCTION_DEF || a->data.function_def.body.count == b->data.function_def.body.count);
+        }
+    }
+    *statements = serial ? (int)serial->data.program.statements.count : -1;
+
+    ast_destroy(serial);
+    ast_destroy(parallel);
+    parser_destroy(parser);
+    token_buffer_destroy(tokens);
+    lexer_destroy(lexer);
+    return same;
+}
+
+void test_parser_parallel(void) {
+    char *source = malloc(64 * 1024);
+    char *p = source;
+    for (int i = 0; i < 400; i++) {
+        p += sprintf(p, "func f%d(a) {\n    if (a) { return a * %d; }\n    return 0;\n}\n", i, i);
+        if (i % 50 == 0) {
+            p += sprintf(p, "let v%d = f%d(%d);\n", i, i, i);
+        }
+    }
+
+    int statements = 0;
+    assert_equal_int(parallel_matches_serial(source, &statements), 1, "test_parser_parallel same program");
+    assert_equal_int(statements, 408, "test_parser_parallel statement count");
+
+    /* An error in a late function fails the whole parse, as it does serially */
+    strstr(source + (p - source) / 2, "return 0;")[7] = '+';
+    assert_equal_int(parallel_matches_serial(source, &statements), 1, "test_parser_parallel error");
+    assert_equal_int(statements, -1, "test_parser_parallel error fails");
+
+    /* No functions to cut at */
+    assert_equal_int(parallel_matches_serial("let x = 1; print(x);", &statements), 1,
+                     "test_parser_parallel no functions");
+    free(source);
+}
+
+void test_parser_arena(void) {
+    Arena *arena = arena_create(4096);
+    char *odd = arena_alloc(arena, 3);
+    double *real = arena_alloc(arena, sizeof(double));
+    char *big = arena_alloc(arena, 100000);
+    assert_equal_int(odd && real && big && (size_t)real % sizeof(double) == 0, 1, "test_parser_arena aligned blocks");
+    big[99999] = 1;
+    assert_equal_int((int)arena->chunk_count, 2, "test_parser_arena big block gets its own chunk");
+    arena_reset(arena);
+
+    /* Long lists, which would otherwise be heap arrays, and strings all come from the arena */
+    const char *source = "func f(a, b, c, d, e) { a; b; c; d; e; }\nprint(\"text\", 1, 2, 3, 4, 5);";
+    ast_use_arena(arena);
+    Lexer *lexer = lexer_create(source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse(parser);
+    assert_equal_int(ast != NULL, 1, "test_parser_arena parses");
+    if (ast) {
+        ASTNode *func = ast->data.program.statements.items[0];
+        ASTNode *call = ast->data.program.statements.items[1]->data.expr_stmt.expression;
+        assert_equal_int((int)func->data.function_def.body.count, 5, "test_parser_arena body");
+        assert_equal_int(func->data.function_def.body.capacity == 0 &&
+                         func->data.function_def.parameters.capacity == 0 &&
+                         call->data.call.arguments.capacity == 0, 1, "test_parser_arena lists in the arena");
+        assert_equal_int(strcmp(call->data.call.arguments.items[0]->data.string_literal.value, "\"text\""), 0,
+                         "test_parser_arena string");
+        assert_equal_int(arena->chunk_count <= 2 && arena->allocations >= 16, 1, "test_parser_arena few chunks");
+        /* Does nothing: the arena owns the tree */
+        ast_destroy(ast);
+    }
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    arena_reset(arena);
+
+    /* The parallel parser gathers its workers' arenas into this one */
+    char program[8192];
+    char *p = program;
+    for (int i = 0; i < 100; i++) {
+        p += sprintf(p, "func f%d(a) { return a + %d; }\n", i, i);
+    }
+    int statements = 0;
+    assert_equal_int(parallel_matches_serial(program, &statements), 1, "test_parser_arena parallel");
+    assert_equal_int(statements, 100, "test_parser_arena parallel statement count");
+    ast_use_arena(NULL);
+    arena_destroy(arena);
+}
+
+/* Offset of the first occurrence of `needle` in the source text */
+static size_t find(const ParsedSource *source, const char *needle) {
+    return (size_t)(strstr(source->text, needle) - source->text);
+}
+
+void test_parser_incremental(void) {
+    const char *text = "func f() {\n    return 1;\n}\n"
+                       "let b = 2;\n"
+                       "if (b) { print(b); }\n"
+                       "print(0);\n"
+                       "let c = 3.5;\n";
+    ParsedSource *source = parsed_source_create(text, strlen(text));
+    assert_equal_int(source && source->program, 1, "test_parser_incremental parses");
+    if (!source || !source->program) {
+        parsed_source_destroy(source);
+        return;
+    }
+
+    /* A literal edit re-lexes a couple of tokens and re-parses one statement */
+    ASTNode *program = parsed_source_edit(source, find(source, "2;"), 0, "4", 1);
+    ASTNode **statements = program ? program->data.program.statements.items : NULL;
+    assert_equal_int(program != NULL && source->reparsed_statements == 1 && source->relexed_tokens <= 3, 1,
+                     "test_parser_incremental one statement");
+    assert_equal_int(statements ? (int)statements[1]->data.var_decl.initializer->data.int_literal.value : 0, 42,
+                     "test_parser_incremental new value");
+    assert_equal_int(statements ? (int)statements[4]->offset : 0, (int)find(source, "let c"),
+                     "test_parser_incremental later offsets move");
+
+    /* Turning the next statement into an else re-parses the if that looks ahead for it */
+    program = parsed_source_edit(source, find(source, "print(0)"), 0, "else { ", 7);
+    program = parsed_source_edit(source, find(source, "print(0);") + 9, 0, " }", 2);
+    statements = program ? program->data.program.statements.items : NULL;
+    assert_equal_int(program ? (int)program->data.program.statements.count : 0, 4,
+                     "test_parser_incremental else joins if");
+    assert_equal_int(statements ? (int)statements[2]->data.if_stmt.else_branch.count : 0, 1,
+                     "test_parser_incremental else branch");
+
+    /* A broken edit leaves no program; undoing it parses again */
+    size_t brace = find(source, "}");
+    assert_equal_int(parsed_source_edit(source, brace, 1, NULL, 0) == NULL, 1,
+                     "test_parser_incremental broken edit");
+    program = parsed_source_edit(source, brace, 0, "}", 1);
+    assert_equal_int(program ? (int)program->data.program.statements.count : 0, 4,
+                     "test_parser_incremental recovers");
+
+    /* The tokens match a fresh lex of the edited text */
+    ParsedSource *fresh = parsed_source_create(source->text, source->length);
+    int same = fresh && fresh->tokens->count == source->tokens->count &&
+               fresh->tokens->literal_count == source->tokens->literal_count;
+    for (size_t i = 0; same && i < fresh->tokens->count; i++) {
+        same = fresh->tokens->kinds[i] == source->tokens->kinds[i] &&
+               fresh->tokens->offsets[i] == source->tokens->offsets[i] &&
+               fresh->tokens->lengths[i] == source->tokens->lengths[i];
+    }
+    assert_equal_int(same, 1, "test_parser_incremental same tokens");
+    parsed_source_destroy(fresh);
+    parsed_source_destroy(source);
+}
+
 int main(void) {
     printf("Running Parser Tests...\n\n");
 
     test_parser_creation();
     test_parser_parse();
+    test_parser_var_decl();
+    test_parser_print_call();
+    test_parser_lists();
+    test_parser_scan_functions();
+    test_parser_compact();
+    test_parser_ast_cache();
+    test_pass_manager();
+    test_ast_hash();
+    test_cse();
+    test_resolve();
+    test_types();
+    test_types_stream();
+    test_specialize();
+    test_fold();
+    test_dce();
+    test_inline();
+    test_parser_precedence();
+    test_parser_error_token();
+    test_parser_deep_nesting();
+    test_token_buffer();
+    test_parser_stream();
+    test_atoms();
+    test_parser_parallel();
+    test_parser_arena();
+    test_parser_incremental();
 
     printf("\n%d/%d tests passed\n", tests_passed, tests_run);
     return tests_passed == tests_run ? 0 : 1;
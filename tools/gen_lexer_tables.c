@@ -0,0 +1,183 @@
+/*
+ * Build-time generator for the lexer tables.
+ *
+ * Reads the keyword list in src/keywords.def and emits either:
+ *   header   - src/lexer_tables.gen.h: the 256-entry character-class
+ *              table and a collision-free keyword hash table
+ *   markdown - the keyword reference section of KEYWORDS.md
+ *
+ * Usage: gen_lexer_tables header|markdown
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *text;
+    const char *token;
+    const char *category;
+    const char *description;
+} Keyword;
+
+static const Keyword keywords[] = {
+#define KEYWORD(text, token, category, description) { text, #token, category, description },
+#include "../src/keywords.def"
+#undef KEYWORD
+};
+
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(keywords[0]))
+#define MAX_TABLE_SIZE 256
+#define MAX_MULTIPLIER 64
+
+/* Character classes, in the order they are emitted as an enum */
+static const char *class_names[] = {
+    "CC_OTHER",
+    "CC_BLANK",
+    "CC_ALPHA",
+    "CC_DIGIT",
+    "CC_QUOTE",
+    "CC_SLASH",
+    "CC_MINUS",
+    "CC_OPERATOR",
+    "CC_UTF8",
+};
+
+enum {
+    CC_OTHER,
+    CC_BLANK,
+    CC_ALPHA,
+    CC_DIGIT,
+    CC_QUOTE,
+    CC_SLASH,
+    CC_MINUS,
+    CC_OPERATOR,
+    CC_UTF8,
+    CC_COUNT
+};
+
+/* Punctuation and operators resolved through the operator transition table */
+static const char *operator_chars = "(){}[],;:.+*%=!<>&|";
+
+static int classify(int c) {
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') return CC_BLANK;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') return CC_ALPHA;
+    if (c >= '0' && c <= '9') return CC_DIGIT;
+    if (c == '"') return CC_QUOTE;
+    if (c == '/') return CC_SLASH;
+    if (c == '-') return CC_MINUS;
+    if (c != '\0' && strchr(operator_chars, c)) return CC_OPERATOR;
+    if (c >= 0x80) return CC_UTF8;
+    return CC_OTHER;
+}
+
+/* Must match KEYWORD_HASH in the emitted header */
+static unsigned keyword_hash(const char *text, size_t length, unsigned a, unsigned b, unsigned size) {
+    return ((unsigned char)text[0] * a + (unsigned char)text[length - 1] * b + (unsigned)length) & (size - 1);
+}
+
+/* Search for the smallest table and multipliers with no collisions */
+static int find_perfect_hash(unsigned *out_a, unsigned *out_b, unsigned *out_size) {
+    for (unsigned size = 8; size <= MAX_TABLE_SIZE; size *= 2) {
+        if (size < KEYWORD_COUNT) {
+            continue;
+        }
+        for (unsigned a = 1; a < MAX_MULTIPLIER; a++) {
+            for (unsigned b = 0; b < MAX_MULTIPLIER; b++) {
+                unsigned char used[MAX_TABLE_SIZE] = {0};
+                size_t i;
+                for (i = 0; i < KEYWORD_COUNT; i++) {
+                    unsigned h = keyword_hash(keywords[i].text, strlen(keywords[i].text), a, b, size);
+                    if (used[h]) {
+                        break;
+                    }
+                    used[h] = 1;
+                }
+                if (i == KEYWORD_COUNT) {
+                    *out_a = a;
+                    *out_b = b;
+                    *out_size = size;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int emit_header(void) {
+    unsigned a, b, size;
+    if (!find_perfect_hash(&a, &b, &size)) {
+        fprintf(stderr, "Error: No collision-free keyword hash found\n");
+        return 1;
+    }
+
+    const Keyword *slots[MAX_TABLE_SIZE] = {0};
+    for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+        slots[keyword_hash(keywords[i].text, strlen(keywords[i].text), a, b, size)] = &keywords[i];
+    }
+
+    printf("/* Generated by tools/gen_lexer_tables.c from src/keywords.def - do not edit. */\n\n");
+    printf("#ifndef LEXER_TABLES_GEN_H\n#define LEXER_TABLES_GEN_H\n\n");
+
+    printf("typedef enum {\n");
+    for (int c = 0; c < CC_COUNT; c++) {
+        printf("    %s,\n", class_names[c]);
+    }
+    printf("} CharClass;\n\n");
+
+    printf("static const unsigned char char_class[256] = {\n");
+    for (int c = 0; c < 256; c++) {
+        if (c % 8 == 0) {
+            printf("    ");
+        }
+        printf("%s,%s", class_names[classify(c)], c % 8 == 7 ? "\n" : " ");
+    }
+    printf("};\n\n");
+
+    printf("typedef struct {\n");
+    printf("    const char *text;\n");
+    printf("    size_t length;\n");
+    printf("    TokenKind kind;\n");
+    printf("} KeywordEntry;\n\n");
+
+    printf("#define KEYWORD_TABLE_SIZE %u\n", size);
+    printf("#define KEYWORD_HASH(text, length) \\\n");
+    printf("    (((unsigned char)(text)[0] * %uu + (unsigned char)(text)[(length) - 1] * %uu + \\\n", a, b);
+    printf("      (unsigned)(length)) & (KEYWORD_TABLE_SIZE - 1))\n\n");
+
+    printf("static const KeywordEntry keyword_table[KEYWORD_TABLE_SIZE] = {\n");
+    for (unsigned i = 0; i < size; i++) {
+        if (slots[i]) {
+            printf("    { \"%s\", %zu, %s },\n", slots[i]->text, strlen(slots[i]->text), slots[i]->token);
+        } else {
+            printf("    { NULL, 0, TOKEN_IDENTIFIER },\n");
+        }
+    }
+    printf("};\n\n");
+
+    printf("#endif\n");
+    return 0;
+}
+
+static int emit_markdown(void) {
+    printf("<!-- Generated by tools/gen_lexer_tables.c from src/keywords.def (make keywords-doc) - do not edit. -->\n\n");
+    printf("Miru has **%zu reserved keywords**:\n\n", KEYWORD_COUNT);
+    printf("| Keyword | Category | Description |\n");
+    printf("| ------- | -------- | ----------- |\n");
+    for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+        printf("| `%s` | %s | %s |\n", keywords[i].text, keywords[i].category, keywords[i].description);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "header") == 0) {
+        return emit_header();
+    }
+    if (argc == 2 && strcmp(argv[1], "markdown") == 0) {
+        return emit_markdown();
+    }
+    fprintf(stderr, "Usage: %s header|markdown\n", argv[0]);
+    return 1;
+}
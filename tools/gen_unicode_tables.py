@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Generator for the Unicode identifier tables (src/unicode_tables.h).
+
+Emits the non-ASCII code point ranges of XID_Start and XID_Continue
+(Unicode Standard Annex #31) as sorted [first, last] pairs for binary
+search. The properties come from Python's own Unicode database: Python
+identifiers are defined by the same two properties, so a code point is
+XID_Start when it is a valid identifier on its own and XID_Continue when
+it is valid after a letter.
+
+The output is committed so building the compiler does not need Python;
+run `make unicode-tables` to regenerate it for a newer Unicode version.
+
+Usage: gen_unicode_tables.py > src/unicode_tables.h
+"""
+
+import sys
+import unicodedata
+
+MAX_CODE_POINT = 0x10FFFF
+
+
+def is_xid_start(ch):
+    return ch.isidentifier()
+
+
+def is_xid_continue(ch):
+    return ("a" + ch).isidentifier()
+
+
+def ranges(predicate):
+    """Maximal runs of non-ASCII code points that satisfy the predicate."""
+    result = []
+    start = None
+    for cp in range(0x80, MAX_CODE_POINT + 2):
+        inside = cp <= MAX_CODE_POINT and not 0xD800 <= cp <= 0xDFFF and predicate(chr(cp))
+        if inside and start is None:
+            start = cp
+        elif not inside and start is not None:
+            result.append((start, cp - 1))
+            start = None
+    return result
+
+
+def emit_table(out, name, table):
+    out.write("static const uint32_t %s[][2] = {\n" % name)
+    for i in range(0, len(table), 4):
+        row = ", ".join("{ 0x%05X, 0x%05X }" % pair for pair in table[i:i + 4])
+        out.write("    %s,\n" % row)
+    out.write("};\n\n")
+
+
+def main():
+    out = sys.stdout
+    start = ranges(is_xid_start)
+    cont = ranges(is_xid_continue)
+
+    out.write("/* Generated by tools/gen_unicode_tables.py (make unicode-tables) "
+              "from Unicode %s - do not edit. */\n\n" % unicodedata.unidata_version)
+    out.write("#ifndef UNICODE_TABLES_H\n#define UNICODE_TABLES_H\n\n")
+    out.write("#include <stdint.h>\n\n")
+    out.write("/* Non-ASCII XID_Start and XID_Continue code points as sorted inclusive ranges */\n")
+    out.write("#define XID_START_RANGES %d\n" % len(start))
+    out.write("#define XID_CONTINUE_RANGES %d\n\n" % len(cont))
+    emit_table(out, "xid_start_ranges", start)
+    emit_table(out, "xid_continue_ranges", cont)
+    out.write("#endif\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())